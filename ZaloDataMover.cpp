@@ -3,11 +3,22 @@
 #include <shlobj.h>
 #include <string>
 #include <filesystem>
-#include <fstream>
 #include <commctrl.h>
 #include <thread>
 #include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <memory>
 #include "resource.h"
+#include "ColdArchive.h"
+#include "DeferredDelete.h"
+#include "EventLog.h"
+#include "Migration.h"
+#include "Preflight.h"
+#include "ProcessControl.h"
+#include "Progress.h"
 
 // Link with the Common Controls library
 #pragma comment(lib, "comctl32.lib")
@@ -20,8 +31,52 @@ HWND g_hwndProgressBar = NULL;
 HWND g_hwndStatus = NULL;
 HWND g_hwndEditPath = NULL;
 HWND g_hwndCheckStartZalo = NULL;
+HWND g_hwndCheckLiveCopy = NULL;
+HWND g_hwndCheckVerify = NULL;
+HWND g_hwndCheckPlacement = NULL;
+HWND g_hwndCheckDedup = NULL;
+HWND g_hwndCheckArchive = NULL;
+HWND g_hwndCheckLowPriority = NULL;
 std::atomic<bool> g_isRunning = false;
+std::atomic<bool> g_cancelRequested = false;
+bool g_closeAfterCancel = false;
 HINSTANCE g_hInstance = NULL;
+unsigned g_copyThreads = 0; // 0 = auto, override with --threads N
+bool g_writeTrace = false;  // --trace: also export each run's phase spans as a Chrome trace
+
+// Structured log of the running migration (JSON lines, written in the background),
+// used by the migration thread only and closed when the run ends
+std::unique_ptr<zdm::EventLog> g_eventLog;
+
+// Copy progress, written by the copy workers and sampled by a UI timer
+const UINT kProgressIntervalMs = 100;
+zdm::CopyProgress g_copyProgress;
+zdm::ProgressRate g_progressRate; // UI thread only
+std::atomic<bool> g_copyActive = false; // the timer shows copy progress only while set
+std::atomic<bool> g_deltaPass = false;
+
+// Deletes old data folders renamed aside by a migration, after the junction exists.
+// Stopped when the window closes, the next launch picks up what is left.
+zdm::BackgroundDeleter g_trashDeleter;
+
+// Tier split of the last migration with the placement policy, for the completion message
+std::wstring g_placementSummary;
+
+// What the last migration packed into the cold archive, for the completion message
+std::wstring g_archiveSummary;
+
+// Options chosen in the window for one migration
+struct MoveOptions {
+    bool liveCopy = false; // bulk copy while Zalo runs, close it only for the delta
+    bool verify = false;   // checksum every copied file before the source is deleted
+    bool placement = false; // keep databases and recent small files here, move only media folders
+    bool dedup = false;     // write identical photos and files once, link the other copies
+    bool lowPriority = false; // copy at background I/O priority so the PC stays usable
+    bool archive = false;   // pack media not written for a year into the compressed archive
+};
+
+// Media untouched this long goes into the cold archive
+const int64_t kArchiveAgeDays = 365;
 
 // Process steps for progress tracking
 enum ProcessStep {
@@ -117,203 +172,230 @@ std::wstring SelectFolderDialog(HWND hwndOwner) {
     return std::wstring();
 }
 
-// Close Zalo process if running
+// Close Zalo process if running. Returns once every Zalo process has exited,
+// false when one is still running after the timeout.
 bool CloseZaloProcess() {
     UpdateProgress(STEP_CLOSE_ZALO, L"Closing Zalo process if running...");
     
-    // Use taskkill to terminate Zalo
-    int result = system("taskkill /f /im Zalo.exe >nul 2>&1");
-    
-    // Wait to ensure process has ended
-    Sleep(2000);
-    
-    return result == 0 || result == 128; // 128 usually means process not found
+    zdm::TerminateResult result = zdm::TerminateProcesses(L"Zalo.exe", std::chrono::seconds(10));
+    return result.Complete();
 }
 
-// Move Zalo data to the new location
-bool MoveZaloData(const std::wstring& targetDir) {
-    std::wstring zaloDataPath = GetZaloDataPath();
-    std::wstring newZaloDataPath = targetDir + L"\\ZaloPC";
-    
-    UpdateProgress(STEP_CHECK_DIRECTORIES, L"Checking directories...");
-    
-    try {
-        // Check if source directory exists
-        if (!fs::exists(zaloDataPath)) {
-            std::wstring errorMsg = L"Zalo data directory not found at: " + zaloDataPath;
-            UpdateProgress(STEP_CHECK_DIRECTORIES, errorMsg);
+// Close Zalo before anything is renamed, copied or synced. While a Zalo.exe survives
+// the user may close it by hand and retry; false when they give up.
+bool EnsureZaloClosed() {
+    while (!CloseZaloProcess()) {
+        int answer = MessageBoxW(g_hwndMain,
+                                 L"Zalo is still running and could not be closed.\n"
+                                 L"Close it manually, then press Retry, or Cancel to stop the migration.",
+                                 L"Zalo is running", MB_RETRYCANCEL | MB_ICONWARNING);
+        if (answer != IDRETRY) {
+            UpdateProgress(STEP_CLOSE_ZALO, L"Zalo is still running, migration stopped.");
             return false;
         }
-        
-        // Check if destination directory already exists
-        if (fs::exists(newZaloDataPath)) {
-            int result = MessageBoxW(g_hwndMain, 
-                L"Destination folder already exists. Do you want to delete it?", 
-                L"Confirm", 
-                MB_YESNO | MB_ICONQUESTION);
-                
-            if (result != IDYES) {
-                UpdateProgress(STEP_CHECK_DIRECTORIES, L"Operation canceled.");
-                return false;
-            }
-            
-            UpdateProgress(STEP_CHECK_DIRECTORIES, L"Deleting old destination folder...");
-            fs::remove_all(newZaloDataPath);
+    }
+    return true;
+}
+
+// Open the log of one migration next to the new data. Logging is best effort,
+// a log that cannot be opened leaves the run unlogged.
+void OpenEventLog(const std::wstring& logPath) {
+    try {
+        g_eventLog = std::make_unique<zdm::EventLog>(fs::path(logPath) / L"zalo_data_mover.log");
+        if (g_writeTrace) {
+            g_eventLog->EnableTrace(fs::path(logPath) / L"zalo_data_mover.trace.json");
         }
-        
-        // Check if source is a symbolic link
-        DWORD attributes = GetFileAttributesW(zaloDataPath.c_str());
-        if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
-            UpdateProgress(STEP_CHECK_DIRECTORIES, L"Detected existing symbolic link...");
-            
-            // Copy data from the symbolic link target
-            try {
-                fs::create_directories(newZaloDataPath);
-                
-                // Count files for progress tracking
-                size_t totalItems = 0;
-                size_t processedItems = 0;
-                for (const auto& entry : fs::recursive_directory_iterator(zaloDataPath)) {
-                    totalItems++;
-                }
-                
-                // Copy all files from source (symbolic link target) to destination
-                for (const auto& entry : fs::directory_iterator(zaloDataPath)) {
-                    const auto& path = entry.path();
-                    const auto& targetPath = fs::path(newZaloDataPath) / path.filename();
-                    
-                    std::wstring statusMsg = L"Copying: " + path.filename().wstring();
-                    ProcessStep currentStep = static_cast<ProcessStep>(STEP_COPY_FILES + static_cast<int>((processedItems * 50) / totalItems));
-                    UpdateProgress(currentStep, statusMsg);
-                    
-                    if (fs::is_directory(path)) {
-                        fs::copy(path, targetPath, fs::copy_options::recursive);
-                    } else {
-                        fs::copy_file(path, targetPath, fs::copy_options::overwrite_existing);
-                    }
-                    
-                    processedItems++;
-                }
-            } catch (const std::exception& e) {
-                std::wstring errorMsg = L"Error copying from symbolic link: ";
-                errorMsg += std::wstring(e.what(), e.what() + strlen(e.what()));
-                UpdateProgress(STEP_COPY_FILES, errorMsg);
-                return false;
-            }
-            
-            // Remove old symbolic link
-            UpdateProgress(STEP_REMOVE_OLD_DIR, L"Removing old symbolic link...");
-            if (!fs::remove(zaloDataPath)) {
-                UpdateProgress(STEP_REMOVE_OLD_DIR, L"Cannot remove old symbolic link!");
-                return false;
-            }
-        } else {
-            // Regular directory - copy contents
-            try {
-                fs::create_directories(fs::path(newZaloDataPath).parent_path());
-                
-                // Count files for progress tracking
-                size_t totalItems = 0;
-                size_t processedItems = 0;
-                for (const auto& entry : fs::recursive_directory_iterator(zaloDataPath)) {
-                    totalItems++;
-                }
-                
-                UpdateProgress(STEP_COPY_FILES, L"Copying Zalo data to new location...");
-                
-                // Copy files one by one with progress tracking
-                fs::create_directories(newZaloDataPath);
-                for (const auto& entry : fs::recursive_directory_iterator(zaloDataPath)) {
-                    const fs::path& sourcePath = entry.path();
-                    fs::path relativePath = fs::relative(sourcePath, zaloDataPath);
-                    fs::path targetPath = fs::path(newZaloDataPath) / relativePath;
-                    
-                    std::wstring statusMsg = L"Copying: " + relativePath.wstring();
-                    ProcessStep currentStep = static_cast<ProcessStep>(STEP_COPY_FILES + static_cast<int>((processedItems * 50) / totalItems));
-                    UpdateProgress(currentStep, statusMsg);
-                    
-                    if (fs::is_directory(sourcePath)) {
-                        fs::create_directories(targetPath);
-                    } else {
-                        fs::create_directories(targetPath.parent_path());
-                        fs::copy_file(sourcePath, targetPath, fs::copy_options::overwrite_existing);
-                    }
-                    
-                    processedItems++;
-                }
-                
-                UpdateProgress(STEP_REMOVE_OLD_DIR, L"Removing old data directory...");
-                fs::remove_all(zaloDataPath);
-            } catch (const std::exception& e) {
-                std::wstring errorMsg = L"Error moving data: " + std::wstring(e.what(), e.what() + strlen(e.what()));
-                UpdateProgress(STEP_COPY_FILES, errorMsg);
-                return false;
-            }
+    } catch (const fs::filesystem_error&) {
+        g_eventLog.reset();
+    }
+}
+
+// One free-text line in the migration log
+void WriteLog(const std::string& message) {
+    if (g_eventLog) {
+        g_eventLog->Message(message);
+    }
+}
+
+// Last line of a run: the outcome, the failed step if any and the copy totals, then flush the log
+void FinishEventLog(const char* failedStep, const zdm::MigrationResult& result) {
+    if (!g_eventLog) {
+        return;
+    }
+    g_eventLog->Write("done", std::string("\"ok\":") + (failedStep ? "false" : "true") +
+                              (failedStep ? ",\"failed_step\":" + zdm::JsonString(failedStep) : std::string()) +
+                              ",\"strategy\":" + zdm::JsonString(zdm::StrategyName(result.strategy)) +
+                              ",\"files_copied\":" + std::to_string(result.copy.filesCopied) +
+                              ",\"bytes_copied\":" + std::to_string(result.copy.bytesCopied) +
+                              ",\"files_verified\":" + std::to_string(result.copy.filesVerified) +
+                              ",\"files_archived\":" + std::to_string(result.archive.files));
+    g_eventLog.reset();
+}
+
+// Format a byte count for status messages
+std::wstring FormatBytes(uint64_t bytes) {
+    wchar_t buffer[32];
+    if (bytes >= 1024ull * 1024 * 1024) {
+        swprintf(buffer, 32, L"%.2f GB", bytes / (1024.0 * 1024 * 1024));
+    } else {
+        swprintf(buffer, 32, L"%.1f MB", bytes / (1024.0 * 1024));
+    }
+    return buffer;
+}
+
+// Timer handler: sample the copy counters and show throughput, bytes left and ETA.
+// Runs on the UI thread only.
+void ShowCopyProgress() {
+    zdm::ProgressSnapshot snapshot = g_copyProgress.Snapshot();
+    double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    g_progressRate.Update(snapshot, now);
+    
+    // The live delta pass runs in the short window before the old folder is removed
+    int position = STEP_REMOVE_OLD_DIR - 1;
+    std::wstring statusMsg = L"Syncing changes: ";
+    if (!g_deltaPass) {
+        double fraction = snapshot.bytesPlanned ? static_cast<double>(snapshot.bytesDone) / snapshot.bytesPlanned : 1.0;
+        position = STEP_COPY_FILES + static_cast<int>(std::min(fraction, 1.0) * 50);
+        statusMsg = L"Copying: ";
+    }
+    statusMsg += fs::path(snapshot.currentPath).wstring() + L"\n" +
+                 FormatBytes(snapshot.bytesDone) + L" / " + FormatBytes(snapshot.bytesPlanned);
+    
+    wchar_t rates[96];
+    swprintf(rates, 96, L"\n%.1f MB/s, %.0f files/s, %s left",
+             g_progressRate.BytesPerSecond() / (1024 * 1024), g_progressRate.FilesPerSecond(),
+             FormatBytes(g_progressRate.BytesRemaining()).c_str());
+    statusMsg += rates;
+    
+    double eta = g_progressRate.EtaSeconds();
+    if (eta >= 0) {
+        int remaining = static_cast<int>(eta);
+        wchar_t etaText[32];
+        swprintf(etaText, 32, L" - ETA %d:%02d", remaining / 60, remaining % 60);
+        statusMsg += etaText;
+    }
+    
+    SendMessage(g_hwndProgressBar, PBM_SETPOS, static_cast<WPARAM>(position), 0);
+    SetWindowTextW(g_hwndStatus, statusMsg.c_str());
+}
+
+// UTF-8 engine messages to UTF-16 for the window
+std::wstring Utf8ToWide(const std::string& text) {
+    int length = MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), NULL, 0);
+    std::wstring wide(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), &wide[0], length);
+    return wide;
+}
+
+// Progress bar position for each engine step
+ProcessStep StepPosition(zdm::MigrationStep step) {
+    switch (step) {
+        case zdm::MigrationStep::CheckDirectories: return STEP_CHECK_DIRECTORIES;
+        case zdm::MigrationStep::Rename:
+        case zdm::MigrationStep::Scan:
+        case zdm::MigrationStep::Archive:
+        case zdm::MigrationStep::Copy: return STEP_COPY_FILES;
+        case zdm::MigrationStep::Rescan:
+        case zdm::MigrationStep::SyncChanges: return static_cast<ProcessStep>(STEP_REMOVE_OLD_DIR - 1);
+        case zdm::MigrationStep::RemoveSource: return STEP_REMOVE_OLD_DIR;
+        case zdm::MigrationStep::CreateLink: return STEP_CREATE_LINK;
+    }
+    return STEP_INIT;
+}
+
+// Move Zalo data to the new location with the migration engine.
+// The workers only bump g_copyProgress, the window samples it on a timer
+// (ShowCopyProgress) so copying never waits for the UI thread.
+// The junctions are created afterwards by CreateJunctionLink: one for the data folder,
+// or with the placement policy one per moved subfolder (result.partial). The old data is
+// only renamed aside into trash, to be deleted in the background once Zalo can run again.
+bool MoveZaloData(const std::wstring& targetDir, const MoveOptions& moveOptions, zdm::MigrationResult& result) {
+    zdm::PlacementPolicy policy = zdm::DefaultPlacementPolicy();
+    zdm::ArchiveOptions archive;
+    archive.policy = zdm::DefaultArchivePolicy(kArchiveAgeDays);
+    archive.verify = moveOptions.verify;
+    
+    zdm::MigrationOptions options;
+    options.source = GetZaloDataPath();
+    options.destination = targetDir + L"\\ZaloPC";
+    options.threadCount = g_copyThreads;
+    options.verify = moveOptions.verify;
+    options.liveCopy = moveOptions.liveCopy;
+    options.dedup = moveOptions.dedup;
+    options.io.lowPriority = moveOptions.lowPriority;
+    options.createLink = false;
+    options.deferDelete = true;
+    options.placement = moveOptions.placement ? &policy : nullptr;
+    options.archive = moveOptions.archive ? &archive : nullptr;
+    options.progress = &g_copyProgress;
+    options.cancel = &g_cancelRequested;
+    options.eventLog = g_eventLog.get();
+    
+    zdm::MigrationCallbacks callbacks;
+    callbacks.onStatus = [](zdm::MigrationStep step, const std::string& message) {
+        // The timer shows copy progress only while a copy pass runs
+        g_copyActive = step == zdm::MigrationStep::Copy || step == zdm::MigrationStep::SyncChanges;
+        g_deltaPass = step == zdm::MigrationStep::SyncChanges;
+        UpdateProgress(StepPosition(step), Utf8ToWide(message));
+    };
+    callbacks.decide = [](zdm::MigrationQuestion, const std::string& prompt) {
+        return MessageBoxW(g_hwndMain, Utf8ToWide(prompt).c_str(), L"Confirm", MB_YESNO | MB_ICONQUESTION) == IDYES;
+    };
+    callbacks.closeApplication = [] {
+        g_copyActive = false;
+        if (!EnsureZaloClosed()) {
+            throw zdm::MigrationDeclined("Zalo is still running");
         }
-        
+    };
+    callbacks.log = [](const std::string& line) {
+        WriteLog(line);
+    };
+    
+    try {
+        result = zdm::RunMigration(options, callbacks);
+        g_copyActive = false;
         return true;
+    } catch (const zdm::MigrationDeclined&) {
+        g_copyActive = false;
+        UpdateProgress(STEP_CHECK_DIRECTORIES, L"Operation canceled.");
+        return false;
     } catch (const std::exception& e) {
-        std::wstring errorMsg = L"Error moving data: " + std::wstring(e.what(), e.what() + strlen(e.what()));
-        UpdateProgress(STEP_COPY_FILES, errorMsg);
+        g_copyActive = false;
+        UpdateProgress(STEP_COPY_FILES, L"Error moving data: " + Utf8ToWide(e.what()));
         return false;
     }
 }
 
-// Create junction link - simplified to use only the most reliable method
-bool CreateJunctionLink(const std::wstring& targetDir) {
-    std::wstring zaloDataPath = GetZaloDataPath();
-    std::wstring newZaloDataPath = targetDir + L"\\ZaloPC";
-    
+// Create junction link in process (no elevation needed), with manual instructions as fallback.
+// zaloDataPath is the old location (the data folder or one of its subfolders),
+// newZaloDataPath where that data lives now.
+bool CreateJunctionLink(const std::wstring& zaloDataPath, const std::wstring& newZaloDataPath) {
     UpdateProgress(STEP_CREATE_LINK, L"Creating junction link...");
     
-    // Use cmd to create junction link (most reliable method)
-    std::wstring command = L"cmd.exe /c mklink /j \"" + zaloDataPath + L"\" \"" + newZaloDataPath + L"\"";
-    
-    SHELLEXECUTEINFOW sei = {0};
-    sei.cbSize = sizeof(SHELLEXECUTEINFOW);
-    sei.fMask = SEE_MASK_NOCLOSEPROCESS;
-    sei.lpVerb = L"runas";  // Run as admin
-    sei.lpFile = L"cmd.exe";
-    sei.lpParameters = (L"/c mklink /j \"" + zaloDataPath + L"\" \"" + newZaloDataPath + L"\"").c_str();
-    sei.nShow = SW_HIDE;
-    
-    if (!ShellExecuteExW(&sei)) {
+    try {
+        zdm::CreateDirectoryLink(zaloDataPath, newZaloDataPath);
+        UpdateProgress(STEP_CREATE_LINK, L"Junction link created successfully.");
+        return true;
+    } catch (const fs::filesystem_error&) {
         UpdateProgress(STEP_CREATE_LINK, L"Failed to create junction link. Manual creation required.");
-        
-        // Show instructions for manual link creation with full path
-        std::wstring manualLinkCmd = L"mklink /j \"" + zaloDataPath + L"\" \"" + newZaloDataPath + L"\"";
-        std::wstring message = L"Failed to create junction link automatically.\n\n"
-                              L"Please follow these steps:\n"
-                              L"1. Open Command Prompt as Administrator\n"
-                              L"2. Run this command:\n"
-                              L"   " + manualLinkCmd + L"\n\n"
-                              L"Have you completed these steps?";
-        
-        int result = MessageBoxW(g_hwndMain, message.c_str(), L"Manual Junction Link Creation", MB_YESNO | MB_ICONQUESTION);
-        if (result == IDYES) {
-            // Verify if link was created
-            if (fs::exists(zaloDataPath)) {
-                UpdateProgress(STEP_CREATE_LINK, L"Junction link created successfully!");
-                return true;
-            }
-        }
-        
-        return false;
     }
     
-    // Wait for process to complete
-    WaitForSingleObject(sei.hProcess, INFINITE);
-    
-    // Get exit code
-    DWORD exitCode;
-    GetExitCodeProcess(sei.hProcess, &exitCode);
-    
-    // Close handle
-    CloseHandle(sei.hProcess);
-    
-    if (exitCode == 0 || fs::exists(zaloDataPath)) {
-        UpdateProgress(STEP_CREATE_LINK, L"Junction link created successfully.");
-        return true;
+    // Show instructions for manual link creation with full path
+    std::wstring manualLinkCmd = L"mklink /j \"" + zaloDataPath + L"\" \"" + newZaloDataPath + L"\"";
+    std::wstring message = L"Failed to create junction link automatically.\n\n"
+                          L"Please follow these steps:\n"
+                          L"1. Open Command Prompt as Administrator\n"
+                          L"2. Run this command:\n"
+                          L"   " + manualLinkCmd + L"\n\n"
+                          L"Have you completed these steps?";
+    
+    int result = MessageBoxW(g_hwndMain, message.c_str(), L"Manual Junction Link Creation", MB_YESNO | MB_ICONQUESTION);
+    if (result == IDYES) {
+        // Verify if link was created
+        if (fs::exists(zaloDataPath)) {
+            UpdateProgress(STEP_CREATE_LINK, L"Junction link created successfully!");
+            return true;
+        }
     }
     
     return false;
@@ -336,60 +418,152 @@ void StartZalo() {
     ShellExecuteW(NULL, L"open", programFilesPath.c_str(), NULL, NULL, SW_SHOWNORMAL);
 }
 
-// Write log to file
-void WriteLog(const std::string& message, const std::wstring& logPath) {
-    std::wstring logFile = logPath + L"\\zalo_data_mover.log";
-    std::ofstream log(logFile, std::ios_base::app);
-    if (log.is_open()) {
-        time_t now = time(0);
-        char timeBuffer[26];
-        ctime_s(timeBuffer, sizeof(timeBuffer), &now);
-        timeBuffer[strlen(timeBuffer) - 1] = '\0';
-        log << "[" << timeBuffer << "] " << message << std::endl;
-        log.close();
+// Scan the data, check the free space at the target and measure both disks before Zalo is
+// closed. Shows the result and asks to go on; false stops the migration with nothing changed.
+bool RunPreflightCheck(const std::wstring& targetDir, const MoveOptions& moveOptions) {
+    UpdateProgress(STEP_INIT, L"Checking data size, free space and disk speed...");
+    
+    zdm::PlacementPolicy policy = zdm::DefaultPlacementPolicy();
+    zdm::PreflightOptions options;
+    options.source = GetZaloDataPath();
+    options.destination = targetDir + L"\\ZaloPC";
+    options.threadCount = g_copyThreads;
+    options.verify = moveOptions.verify;
+    options.placement = moveOptions.placement ? &policy : nullptr;
+    zdm::ArchiveOptions archive;
+    archive.policy = zdm::DefaultArchivePolicy(kArchiveAgeDays);
+    options.archive = moveOptions.archive ? &archive : nullptr;
+    options.cancel = &g_cancelRequested;
+    options.eventLog = g_eventLog.get();
+    
+    zdm::PreflightReport report;
+    try {
+        report = zdm::RunPreflight(options);
+    } catch (const std::exception& e) {
+        UpdateProgress(STEP_INIT, L"Cannot read Zalo data: " + Utf8ToWide(e.what()));
+        return false;
+    }
+    
+    std::string description = zdm::DescribePreflight(report);
+    WriteLog(description);
+    std::wstring summary = Utf8ToWide(description);
+    UpdateProgress(STEP_INIT, summary);
+    if (!report.Ok()) {
+        std::wstring message = summary + L"\n\n" +
+                               (report.enoughSpace ? L"The destination folder cannot be written."
+                                                   : L"The destination does not have enough free space.") +
+                               L" Nothing was changed.";
+        MessageBoxW(g_hwndMain, message.c_str(), L"Cannot move Zalo data", MB_OK | MB_ICONERROR);
+        return false;
     }
+    std::wstring question = summary + L"\n\n" +
+                            (moveOptions.liveCopy ? L"Zalo will be closed briefly at the end of the copy."
+                                                  : L"Zalo will be closed while the data moves.") +
+                            L" Continue?";
+    return MessageBoxW(g_hwndMain, question.c_str(), L"Ready to move Zalo data", MB_YESNO | MB_ICONQUESTION) == IDYES;
 }
 
 // Run Zalo data moving process in a separate thread
 void RunZaloDataMoverProcess(const std::wstring& targetDir) {
     g_isRunning = true;
+    g_cancelRequested = false;
     
     std::wstring zaloDataPath = GetZaloDataPath();
     UpdateProgress(STEP_INIT, L"Starting Zalo data migration process from: " + zaloDataPath);
+    OpenEventLog(targetDir);
+    
+    // Live copy keeps Zalo open during the bulk copy and closes it for the final delta
+    MoveOptions moveOptions;
+    moveOptions.liveCopy = SendMessage(g_hwndCheckLiveCopy, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    moveOptions.verify = SendMessage(g_hwndCheckVerify, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    moveOptions.placement = SendMessage(g_hwndCheckPlacement, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    moveOptions.dedup = SendMessage(g_hwndCheckDedup, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    moveOptions.lowPriority = SendMessage(g_hwndCheckLowPriority, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    moveOptions.archive = SendMessage(g_hwndCheckArchive, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    
+    // 0. Make sure the data fits before anything is closed or copied
+    if (!RunPreflightCheck(targetDir, moveOptions)) {
+        UpdateProgress(STEP_INIT, L"Migration not started.");
+        FinishEventLog("preflight", zdm::MigrationResult());
+        g_isRunning = false;
+        SendMessage(g_hwndMain, WM_OPERATION_DONE, 0, 0);
+        return;
+    }
     
-    // 1. Close Zalo if running
-    if (!CloseZaloProcess()) {
-        UpdateProgress(STEP_CLOSE_ZALO, L"Warning: Could not close Zalo or it's not running.");
+    // 1. Close Zalo if running (a live copy closes it later, through the migration)
+    if (!moveOptions.liveCopy) {
+        zdm::PhaseSpan span(g_eventLog.get(), "close");
+        if (!EnsureZaloClosed()) {
+            span.End(zdm::SpanCounters(), "\"closed\":false");
+            FinishEventLog("close", zdm::MigrationResult());
+            g_isRunning = false;
+            SendMessage(g_hwndMain, WM_OPERATION_DONE, 0, 0);
+            return;
+        }
+        span.End();
     }
     
     // 2. Move data
-    if (!MoveZaloData(targetDir)) {
+    zdm::MigrationResult result;
+    if (!MoveZaloData(targetDir, moveOptions, result)) {
         UpdateProgress(STEP_COPY_FILES, L"Failed to move Zalo data!");
-        WriteLog("Data migration failed", targetDir);
+        FinishEventLog("migrate", result);
         g_isRunning = false;
         SendMessage(g_hwndMain, WM_OPERATION_DONE, 0, 0);
         return;
     }
     
-    // 3. Create junction link
-    if (!CreateJunctionLink(targetDir)) {
+    // 3. Create junction links: one for the whole folder, or one per subfolder the policy moved
+    std::wstring newZaloDataPath = targetDir + L"\\ZaloPC";
+    bool linked = true;
+    zdm::PhaseSpan linkSpan(g_eventLog.get(), "link");
+    if (!result.partial) {
+        linked = CreateJunctionLink(zaloDataPath, newZaloDataPath);
+    } else {
+        for (const zdm::PlacementSubtree& subtree : result.placement.subtrees) {
+            std::wstring relativePath = fs::path(subtree.relativePath).wstring();
+            linked = CreateJunctionLink(zaloDataPath + L"\\" + relativePath, newZaloDataPath + L"\\" + relativePath);
+            if (!linked) {
+                break;
+            }
+        }
+    }
+    if (!linked) {
         UpdateProgress(STEP_CREATE_LINK, L"Failed to create junction link!");
-        WriteLog("Junction link creation failed", targetDir);
+        linkSpan.End(zdm::SpanCounters(), "\"linked\":false");
+        FinishEventLog("link", result);
         g_isRunning = false;
         SendMessage(g_hwndMain, WM_OPERATION_DONE, 0, 0);
         return;
     }
     
+    linkSpan.End({ result.partial ? result.placement.subtrees.size() : 1, 0 });
+    
     // 4. Complete
-    UpdateProgress(STEP_COMPLETE, L"Data successfully moved from:\n" + zaloDataPath + L"\nto:\n" + targetDir + L"\\ZaloPC");
-    WriteLog("Data migration successful", targetDir);
+    UpdateProgress(STEP_COMPLETE, L"Data successfully moved from:\n" + zaloDataPath + L"\nto:\n" + newZaloDataPath);
+    g_placementSummary = moveOptions.placement ? Utf8ToWide(zdm::DescribePlacement(result.placement)) : L"";
+    g_archiveSummary.clear();
+    if (result.archive.files > 0) {
+        g_archiveSummary = std::to_wstring(result.archive.files) + L" old media files (" +
+                           FormatBytes(result.archive.bytes) + L") were archived into " +
+                           FormatBytes(result.archive.storedBytes) + L" at:\n" + result.archiveDirectory.wstring();
+    }
     
     // 5. Start Zalo if selected
     BOOL isChecked = (BOOL)SendMessage(g_hwndCheckStartZalo, BM_GETCHECK, 0, 0);
     if (isChecked == BST_CHECKED) {
+        zdm::PhaseSpan span(g_eventLog.get(), "restart");
         StartZalo();
+        span.End();
     }
     
+    // 6. Delete the old data now that Zalo no longer needs it
+    for (const fs::path& trash : result.trash) {
+        WriteLog("Deleting old data in the background: " + trash.u8string());
+    }
+    g_trashDeleter.Add(result.trash);
+    FinishEventLog(nullptr, result);
+    
     g_isRunning = false;
     SendMessage(g_hwndMain, WM_OPERATION_DONE, 1, 0);
 }
@@ -442,11 +616,60 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             SendMessage(g_hwndCheckStartZalo, WM_SETFONT, (WPARAM)hFont, TRUE);
             SendMessage(g_hwndCheckStartZalo, BM_SETCHECK, BST_CHECKED, 0);
             
+            // Create live copy checkbox
+            g_hwndCheckLiveCopy = CreateWindowW(
+                L"BUTTON", L"Copy while Zalo is running",
+                WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                380, 60, 240, 25,
+                hwnd, (HMENU)IDC_CHECKBOX_LIVE_COPY, g_hInstance, NULL);
+            SendMessage(g_hwndCheckLiveCopy, WM_SETFONT, (WPARAM)hFont, TRUE);
+            
+            // Create verify checkbox
+            g_hwndCheckVerify = CreateWindowW(
+                L"BUTTON", L"Verify copied files before deleting the originals",
+                WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                20, 90, 350, 25,
+                hwnd, (HMENU)IDC_CHECKBOX_VERIFY, g_hInstance, NULL);
+            SendMessage(g_hwndCheckVerify, WM_SETFONT, (WPARAM)hFont, TRUE);
+            SendMessage(g_hwndCheckVerify, BM_SETCHECK, BST_CHECKED, 0);
+            
+            // Create low priority checkbox
+            g_hwndCheckLowPriority = CreateWindowW(
+                L"BUTTON", L"Copy in the background (low disk priority)",
+                WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                380, 90, 240, 25,
+                hwnd, (HMENU)IDC_CHECKBOX_LOW_PRIORITY, g_hInstance, NULL);
+            SendMessage(g_hwndCheckLowPriority, WM_SETFONT, (WPARAM)hFont, TRUE);
+            
+            // Create placement checkbox
+            g_hwndCheckPlacement = CreateWindowW(
+                L"BUTTON", L"Keep databases on this drive, move only media folders",
+                WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                20, 120, 350, 25,
+                hwnd, (HMENU)IDC_CHECKBOX_PLACEMENT, g_hInstance, NULL);
+            SendMessage(g_hwndCheckPlacement, WM_SETFONT, (WPARAM)hFont, TRUE);
+            
+            // Create dedup checkbox
+            g_hwndCheckDedup = CreateWindowW(
+                L"BUTTON", L"Store duplicate files once",
+                WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                380, 120, 240, 25,
+                hwnd, (HMENU)IDC_CHECKBOX_DEDUP, g_hInstance, NULL);
+            SendMessage(g_hwndCheckDedup, WM_SETFONT, (WPARAM)hFont, TRUE);
+            
+            // Create archive checkbox
+            g_hwndCheckArchive = CreateWindowW(
+                L"BUTTON", L"Archive media older than one year (compressed)",
+                WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                20, 150, 350, 25,
+                hwnd, (HMENU)IDC_CHECKBOX_ARCHIVE, g_hInstance, NULL);
+            SendMessage(g_hwndCheckArchive, WM_SETFONT, (WPARAM)hFont, TRUE);
+            
             // Create Start button
             HWND hwndBtnStart = CreateWindowW(
                 L"BUTTON", L"Start Migration",
                 WS_VISIBLE | WS_CHILD | BS_PUSHBUTTON | WS_DISABLED,
-                20, 100, 600, 40,
+                20, 190, 600, 40,
                 hwnd, (HMENU)IDC_BTN_START, g_hInstance, NULL);
             SendMessage(hwndBtnStart, WM_SETFONT, (WPARAM)hFont, TRUE);
             
@@ -454,7 +677,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             g_hwndProgressBar = CreateWindowExW(
                 0, PROGRESS_CLASSW, NULL,
                 WS_VISIBLE | WS_CHILD,
-                20, 160, 600, 30,
+                20, 250, 600, 30,
                 hwnd, (HMENU)IDC_PROGRESS_BAR, g_hInstance, NULL);
             SendMessage(g_hwndProgressBar, PBM_SETRANGE, 0, MAKELPARAM(0, 100));
             SendMessage(g_hwndProgressBar, PBM_SETPOS, 0, 0);
@@ -463,7 +686,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             g_hwndStatus = CreateWindowW(
                 L"STATIC", L"Please select a destination folder to begin...",
                 WS_VISIBLE | WS_CHILD | SS_LEFT,
-                20, 200, 600, 60,
+                20, 290, 600, 60,
                 hwnd, (HMENU)IDC_STATUS_TEXT, g_hInstance, NULL);
             SendMessage(g_hwndStatus, WM_SETFONT, (WPARAM)hFont, TRUE);
             
@@ -487,6 +710,17 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                     break;
                 }
                 
+                // The archive packs files while Zalo could still change them, so it
+                // cannot run with a live copy: ticking one clears the other
+                case IDC_CHECKBOX_LIVE_COPY:
+                case IDC_CHECKBOX_ARCHIVE: {
+                    HWND other = ctrlId == IDC_CHECKBOX_ARCHIVE ? g_hwndCheckLiveCopy : g_hwndCheckArchive;
+                    if (SendMessage((HWND)lParam, BM_GETCHECK, 0, 0) == BST_CHECKED) {
+                        SendMessage(other, BM_SETCHECK, BST_UNCHECKED, 0);
+                    }
+                    break;
+                }
+                
                 case IDC_BTN_START: {
                     if (g_isRunning) break;
                     
@@ -503,6 +737,19 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                     EnableWindow(GetDlgItem(hwnd, IDC_BTN_BROWSE), FALSE);
                     EnableWindow(g_hwndEditPath, FALSE);
                     EnableWindow(g_hwndCheckStartZalo, FALSE);
+                    EnableWindow(g_hwndCheckLiveCopy, FALSE);
+                    EnableWindow(g_hwndCheckVerify, FALSE);
+                    EnableWindow(g_hwndCheckPlacement, FALSE);
+                    EnableWindow(g_hwndCheckDedup, FALSE);
+                    EnableWindow(g_hwndCheckLowPriority, FALSE);
+                    EnableWindow(g_hwndCheckArchive, FALSE);
+                    
+                    // Fresh counters for this run, sampled by the progress timer until it ends
+                    g_copyProgress.Reset();
+                    g_progressRate = zdm::ProgressRate();
+                    g_copyActive = false;
+                    g_deltaPass = false;
+                    SetTimer(hwnd, IDT_COPY_PROGRESS, kProgressIntervalMs, NULL);
                     
                     // Start worker thread
                     std::thread workerThread(RunZaloDataMoverProcess, std::wstring(targetDir));
@@ -519,12 +766,34 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             break;
         }
         
+        case WM_TIMER: {
+            // Once canceled the status keeps "Stopping, please wait..."
+            if (wParam == IDT_COPY_PROGRESS && g_copyActive && !g_cancelRequested) {
+                ShowCopyProgress();
+            }
+            break;
+        }
+        
         case WM_OPERATION_DONE: {
+            KillTimer(hwnd, IDT_COPY_PROGRESS);
+            
+            // The user asked to exit while copying, the journal is flushed now
+            if (g_closeAfterCancel) {
+                DestroyWindow(hwnd);
+                break;
+            }
+            
             // Re-enable controls when done
             EnableWindow(GetDlgItem(hwnd, IDC_BTN_START), TRUE);
             EnableWindow(GetDlgItem(hwnd, IDC_BTN_BROWSE), TRUE);
             EnableWindow(g_hwndEditPath, TRUE);
             EnableWindow(g_hwndCheckStartZalo, TRUE);
+            EnableWindow(g_hwndCheckLiveCopy, TRUE);
+            EnableWindow(g_hwndCheckVerify, TRUE);
+            EnableWindow(g_hwndCheckPlacement, TRUE);
+            EnableWindow(g_hwndCheckDedup, TRUE);
+            EnableWindow(g_hwndCheckLowPriority, TRUE);
+            EnableWindow(g_hwndCheckArchive, TRUE);
             
             // Show completion message if successful
             if (wParam == 1) {
@@ -534,6 +803,12 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                 std::wstring message = L"Zalo data has been successfully moved from:\n" + 
                                       sourcePath + L"\n\nto:\n" + 
                                       std::wstring(targetDir) + L"\\ZaloPC";
+                if (!g_placementSummary.empty()) {
+                    message += L"\n\n" + g_placementSummary;
+                }
+                if (!g_archiveSummary.empty()) {
+                    message += L"\n\n" + g_archiveSummary;
+                }
                 
                 MessageBoxW(hwnd, message.c_str(), L"Complete", MB_OK | MB_ICONINFORMATION);
             }
@@ -545,11 +820,19 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                 if (MessageBoxW(hwnd, L"Operation in progress. Are you sure you want to exit?", L"Confirm", MB_YESNO | MB_ICONQUESTION) != IDYES) {
                     break;
                 }
+                
+                // Let the copy stop cleanly so the next run can resume, the window
+                // closes when the worker reports WM_OPERATION_DONE
+                g_closeAfterCancel = true;
+                g_cancelRequested = true;
+                SetWindowTextW(g_hwndStatus, L"Stopping, please wait...");
+                break;
             }
             DestroyWindow(hwnd);
             break;
             
         case WM_DESTROY:
+            g_trashDeleter.Stop();
             PostQuitMessage(0);
             break;
             
@@ -564,6 +847,12 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     g_hInstance = hInstance;
     
+    // Optional copy thread count: --threads N
+    const char* threadsArg = strstr(lpCmdLine, "--threads");
+    if (threadsArg) {
+        g_copyThreads = static_cast<unsigned>(atoi(threadsArg + strlen("--threads")));
+    }
+    g_writeTrace = strstr(lpCmdLine, "--trace") != NULL;
     
     // Register window class
     const wchar_t CLASS_NAME[] = L"ZaloDataMoverWindowClass";
@@ -584,7 +873,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         CLASS_NAME,
         L"Zalo Data Migration Tool",
         WS_OVERLAPPEDWINDOW,
-        CW_USEDEFAULT, CW_USEDEFAULT, 650, 300,
+        CW_USEDEFAULT, CW_USEDEFAULT, 650, 400,
         NULL,
         NULL,
         hInstance,
@@ -600,6 +889,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     ShowWindow(g_hwndMain, nCmdShow);
     UpdateWindow(g_hwndMain);
     
+    // Finish deleting old data an earlier run could not complete
+    g_trashDeleter.Add(zdm::FindTrash(GetZaloDataPath()));
+    
     // Message loop
     MSG msg = {0};
     while (GetMessage(&msg, NULL, 0, 0)) {
@@ -0,0 +1,164 @@
+#include "TreeGenerator.h"
+
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace zdm {
+
+void TreeProfile::Scale(double factor) {
+    auto scale = [factor](uint64_t& count) {
+        count = static_cast<uint64_t>(std::llround(count * factor));
+    };
+    scale(thumbnails);
+    scale(images);
+    scale(forwardedImages);
+    scale(videos);
+    scale(databases);
+}
+
+namespace {
+
+const size_t kChunkSize = 1 << 20;
+
+// Writes files of pseudo-random bytes. Every file starts at a different offset
+// into one random block, so contents differ without generating each byte.
+class TreeWriter {
+public:
+    TreeWriter(const fs::path& root, uint64_t seed)
+        : m_root(root), m_random(seed), m_block(2 * kChunkSize) {
+        for (char& byte : m_block) {
+            byte = static_cast<char>(m_random());
+        }
+    }
+
+    // Log-uniform size, many small files and a few big ones like real chat media
+    uint64_t RandomSize(uint64_t minSize, uint64_t maxSize) {
+        if (maxSize <= minSize) {
+            return minSize;
+        }
+        std::uniform_real_distribution<double> exponent(std::log(static_cast<double>(minSize)),
+                                                        std::log(static_cast<double>(maxSize)));
+        return static_cast<uint64_t>(std::exp(exponent(m_random)));
+    }
+
+    unsigned RandomIndex(unsigned count) {
+        return std::uniform_int_distribution<unsigned>(0, count - 1)(m_random);
+    }
+
+    void WriteFile(const fs::path& relativePath, uint64_t size) {
+        fs::path path = m_root / relativePath;
+        fs::create_directories(path.parent_path());
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        size_t offset = RandomIndex(kChunkSize);
+        uint64_t remaining = size;
+        while (file && remaining > 0) {
+            size_t length = remaining < kChunkSize ? static_cast<size_t>(remaining) : kChunkSize;
+            file.write(m_block.data() + offset, static_cast<std::streamsize>(length));
+            remaining -= length;
+        }
+        file.close();
+        if (!file) {
+            throw fs::filesystem_error("cannot write file", path, std::make_error_code(std::errc::io_error));
+        }
+
+        m_tree.files++;
+        m_tree.bytes += size;
+    }
+
+    // Same content under another name
+    void CopyFile(const fs::path& from, const fs::path& relativePath) {
+        fs::path path = m_root / relativePath;
+        fs::create_directories(path.parent_path());
+        fs::copy_file(m_root / from, path, fs::copy_options::overwrite_existing);
+
+        m_tree.files++;
+        m_tree.bytes += fs::file_size(path);
+    }
+
+    GeneratedTree& Tree() { return m_tree; }
+
+private:
+    fs::path m_root;
+    std::mt19937_64 m_random;
+    std::vector<char> m_block;
+    GeneratedTree m_tree;
+};
+
+// Folder for item n of a kind, split so no folder holds more than perDirectory files
+fs::path Bucket(const fs::path& folder, uint64_t n, unsigned perDirectory) {
+    return folder / std::to_string(n / (perDirectory ? perDirectory : 1));
+}
+
+} // namespace
+
+GeneratedTree GenerateTree(const fs::path& root, const TreeProfile& profile) {
+    fs::create_directories(root);
+    TreeWriter writer(root, profile.seed);
+
+    unsigned accountCount = profile.accounts ? profile.accounts : 1;
+    std::vector<fs::path> accounts;
+    for (unsigned i = 0; i < accountCount; i++) {
+        accounts.push_back(std::to_string(100000000 + writer.RandomIndex(900000000)));
+    }
+    auto account = [&](uint64_t n) -> const fs::path& { return accounts[n % accountCount]; };
+
+    // Thumbnails: one in ten goes to the nested download folders instead
+    for (uint64_t n = 0; n < profile.thumbnails; n++) {
+        uint64_t size = writer.RandomSize(profile.thumbnailMin, profile.thumbnailMax);
+        std::string name = std::to_string(n) + ".jpg";
+        if (n % 10 == 9) {
+            fs::path folder = account(n) / "ZaloDownloads";
+            for (unsigned level = 0; level < profile.nestingDepth; level++) {
+                folder /= "group" + std::to_string(writer.RandomIndex(2));
+            }
+            writer.WriteFile(folder / name, size);
+        } else {
+            writer.WriteFile(Bucket(account(n) / "thumb", n / accountCount, profile.filesPerDirectory) / name, size);
+        }
+    }
+
+    std::vector<fs::path> images;
+    for (uint64_t n = 0; n < profile.images; n++) {
+        uint64_t size = writer.RandomSize(profile.imageMin, profile.imageMax);
+        images.push_back(Bucket(account(n) / "picture", n / accountCount, profile.filesPerDirectory) /
+                         ("IMG_" + std::to_string(n) + ".jpg"));
+        writer.WriteFile(images.back(), size);
+    }
+
+    // A forwarded photo is stored again, in full, for the chat it was forwarded to
+    for (uint64_t n = 0; n < profile.forwardedImages && !images.empty(); n++) {
+        const fs::path& original = images[writer.RandomIndex(static_cast<unsigned>(images.size()))];
+        writer.CopyFile(original, Bucket(account(n) / "file", n / accountCount, profile.filesPerDirectory) /
+                                  ("FWD_" + std::to_string(n) + ".jpg"));
+    }
+
+    for (uint64_t n = 0; n < profile.videos; n++) {
+        uint64_t size = writer.RandomSize(profile.videoMin, profile.videoMax);
+        writer.WriteFile(account(n) / "video" / ("VID_" + std::to_string(n) + ".mp4"), size);
+    }
+
+    // SQLite stores come with a write-ahead log of a fraction of their size
+    for (uint64_t n = 0; n < profile.databases; n++) {
+        uint64_t size = writer.RandomSize(profile.databaseMin, profile.databaseMax);
+        fs::path database = account(n) / "db" / ("Msg" + std::to_string(n) + ".db");
+        writer.WriteFile(database, size & ~uint64_t(4095));
+        fs::path wal = database;
+        wal += "-wal";
+        writer.WriteFile(wal, size / 16);
+    }
+
+    GeneratedTree& tree = writer.Tree();
+    for (auto it = fs::recursive_directory_iterator(root); it != fs::recursive_directory_iterator(); ++it) {
+        if (it->is_directory()) {
+            tree.directories++;
+        }
+    }
+    return tree;
+}
+
+} // namespace zdm
@@ -0,0 +1,54 @@
+#ifndef TREE_GENERATOR_H
+#define TREE_GENERATOR_H
+
+#include <cstdint>
+#include <filesystem>
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Shape of a synthetic ZaloPC tree. Counts are per run, sizes are drawn
+// log-uniformly between the bounds so small files dominate like in real data.
+struct TreeProfile {
+    uint64_t seed = 1;
+    unsigned accounts = 2;          // top-level account folders
+    unsigned filesPerDirectory = 400;
+    unsigned nestingDepth = 6;      // depth of the nested download folders
+
+    uint64_t thumbnails = 20000;    // chat thumbnails and avatars
+    uint64_t thumbnailMin = 1 << 10;
+    uint64_t thumbnailMax = 16 << 10;
+
+    uint64_t images = 300;          // received photos
+    uint64_t imageMin = 64 << 10;
+    uint64_t imageMax = 2 << 20;
+    uint64_t forwardedImages = 0;   // byte-identical copies of received photos, as forwarding leaves them
+
+    uint64_t videos = 2;
+    uint64_t videoMin = 16 << 20;
+    uint64_t videoMax = 64 << 20;
+
+    uint64_t databases = 8;         // SQLite message stores, each with a -wal file
+    uint64_t databaseMin = 1 << 20;
+    uint64_t databaseMax = 16 << 20;
+
+    // Multiply every file count, keeps the mix while growing or shrinking the tree
+    void Scale(double factor);
+};
+
+// What GenerateTree wrote
+struct GeneratedTree {
+    uint64_t files = 0;
+    uint64_t directories = 0;
+    uint64_t bytes = 0;
+};
+
+// Write a tree shaped like profile under root (created if needed). The same
+// profile and seed always give the same paths, sizes and contents.
+// Throws fs::filesystem_error.
+GeneratedTree GenerateTree(const fs::path& root, const TreeProfile& profile);
+
+} // namespace zdm
+
+#endif // TREE_GENERATOR_H
@@ -0,0 +1,375 @@
+// Benchmark for the migration engine. Generates a synthetic ZaloPC tree, runs
+// the same phases as the application (scan, copy, snapshot, trash, link, delete) and prints
+// a JSON report so runs can be compared over time, including heap allocations
+// per phase (counted by the operator new below).
+//
+//   zalo_bench --work DIR [--scale F] [--seed N] [--threads N] [--verify] [--journal] [--dedup] [--no-reflink]
+//              [--io auto|sync|threads|uring|iocp] [--queue-depth N] [--thumbnails N] [--images N] [--videos N] [--databases N]
+//              [--forwards N] [--depth N] [--max-streams N] [--bandwidth MB] [--low-priority] [--no-adaptive]
+//              [--output FILE] [--keep]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "AsyncIo.h"
+#include "CopyEngine.h"
+#include "DeferredDelete.h"
+#include "IoScheduler.h"
+#include "Manifest.h"
+#include "ManifestFile.h"
+#include "Migration.h"
+#include "TreeGenerator.h"
+#include "WorkStealingPool.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::atomic<uint64_t> g_allocations{0};
+
+} // namespace
+
+// Every allocation of the process goes through here, the engine's hot loops should add none per file
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+struct BenchOptions {
+    fs::path work;
+    zdm::TreeProfile profile;
+    double scale = 1.0;
+    unsigned threads = 0;
+    bool verify = false;
+    bool journal = false; // checkpoint journal in the target, as the application keeps one
+    bool dedup = false;
+    bool reflink = true;
+    bool keep = false;
+    zdm::IoBackend ioBackend = zdm::IoBackend::Auto;
+    unsigned queueDepth = 32;
+    zdm::IoLimits ioLimits;
+    std::string output;
+};
+
+// Wall time of each phase, in seconds
+struct PhaseTimes {
+    double generate = 0;
+    double scan = 0;
+    double copy = 0;
+    double trash = 0;  // the source renamed aside
+    double link = 0;
+    double remove = 0; // the trash deleted, after the link like the application's background delete
+};
+
+// Writing the manifest snapshot, mapping it back and diffing it against the scan
+struct SnapshotTimes {
+    double write = 0;
+    double open = 0;
+    double diff = 0;
+    uint64_t bytes = 0;
+    size_t changes = 0; // the scan and its own snapshot: should be 0
+};
+
+// Heap allocations made during each phase
+struct PhaseAllocations {
+    uint64_t scan = 0;
+    uint64_t copy = 0;
+    uint64_t remove = 0;
+};
+
+class Stopwatch {
+public:
+    Stopwatch()
+        : m_start(std::chrono::steady_clock::now()), m_allocations(g_allocations.load(std::memory_order_relaxed)) {}
+    double Seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+    uint64_t Allocations() const {
+        return g_allocations.load(std::memory_order_relaxed) - m_allocations;
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_allocations;
+};
+
+uint64_t PeakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+}
+
+void PrintUsage() {
+    std::cerr << "usage: zalo_bench --work DIR [--scale F] [--seed N] [--threads N] [--verify] [--journal] [--dedup] [--no-reflink]\n"
+                 "                  [--io auto|sync|threads|uring|iocp] [--queue-depth N] [--thumbnails N] [--images N] [--videos N] [--databases N]\n"
+                 "                  [--forwards N] [--depth N] [--max-streams N] [--bandwidth MB] [--low-priority] [--no-adaptive]\n"
+                 "                  [--output FILE] [--keep]\n";
+}
+
+bool ParseArguments(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        auto number = [&]() { i++; return std::strtoull(value, nullptr, 10); };
+
+        if (arg == "--verify") {
+            options.verify = true;
+        } else if (arg == "--journal") {
+            options.journal = true;
+        } else if (arg == "--dedup") {
+            options.dedup = true;
+        } else if (arg == "--no-reflink") {
+            options.reflink = false;
+        } else if (arg == "--low-priority") {
+            options.ioLimits.lowPriority = true;
+        } else if (arg == "--no-adaptive") {
+            options.ioLimits.adaptive = false;
+        } else if (arg == "--keep") {
+            options.keep = true;
+        } else if (!value) {
+            return false;
+        } else if (arg == "--work") {
+            options.work = argv[++i];
+        } else if (arg == "--output") {
+            options.output = argv[++i];
+        } else if (arg == "--scale") {
+            options.scale = std::atof(argv[++i]);
+        } else if (arg == "--seed") {
+            options.profile.seed = number();
+        } else if (arg == "--threads") {
+            options.threads = static_cast<unsigned>(number());
+        } else if (arg == "--io") {
+            if (!zdm::ParseIoBackend(argv[++i], options.ioBackend)) {
+                return false;
+            }
+        } else if (arg == "--queue-depth") {
+            options.queueDepth = static_cast<unsigned>(number());
+        } else if (arg == "--max-streams") {
+            options.ioLimits.maxStreams = static_cast<unsigned>(number());
+        } else if (arg == "--bandwidth") {
+            options.ioLimits.maxBytesPerSecond = std::atof(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--thumbnails") {
+            options.profile.thumbnails = number();
+        } else if (arg == "--images") {
+            options.profile.images = number();
+        } else if (arg == "--forwards") {
+            options.profile.forwardedImages = number();
+        } else if (arg == "--videos") {
+            options.profile.videos = number();
+        } else if (arg == "--databases") {
+            options.profile.databases = number();
+        } else if (arg == "--depth") {
+            options.profile.nestingDepth = static_cast<unsigned>(number());
+        } else {
+            return false;
+        }
+    }
+    return !options.work.empty() && options.scale > 0;
+}
+
+std::string Report(const BenchOptions& options, const zdm::GeneratedTree& tree,
+                   const zdm::CopyStats& stats, const PhaseTimes& times, const PhaseAllocations& allocations,
+                   const SnapshotTimes& snapshot, unsigned threads, const char* io) {
+    // The application deletes the trash in the background once Zalo runs again
+    double migration = times.scan + times.copy + times.trash + times.link;
+    auto rate = [](double amount, double seconds) { return seconds > 0 ? amount / seconds : 0.0; };
+    double entries = static_cast<double>(tree.files + tree.directories);
+
+    std::ostringstream json;
+    json.precision(6);
+    json << "{\n"
+         << "  \"seed\": " << options.profile.seed << ",\n"
+         << "  \"threads\": " << threads << ",\n"
+         << "  \"verify\": " << (options.verify ? "true" : "false") << ",\n"
+         << "  \"journal\": " << (options.journal ? "true" : "false") << ",\n"
+         << "  \"io\": \"" << io << "\", \"queue_depth\": " << options.queueDepth << ",\n"
+         << "  \"scheduler\": { \"source\": \"" << zdm::DeviceKindName(stats.sourceDevice)
+         << "\", \"destination\": \"" << zdm::DeviceKindName(stats.destinationDevice)
+         << "\", \"max_streams\": " << options.ioLimits.maxStreams << ", \"final_streams\": " << stats.streamLimit
+         << ", \"bandwidth_mb\": " << options.ioLimits.maxBytesPerSecond / (1024 * 1024)
+         << ", \"low_priority\": " << (options.ioLimits.lowPriority ? "true" : "false")
+         << ", \"adaptive\": " << (options.ioLimits.adaptive ? "true" : "false") << " },\n"
+         << "  \"tree\": { \"files\": " << tree.files << ", \"directories\": " << tree.directories
+         << ", \"bytes\": " << tree.bytes << " },\n"
+         << "  \"copied\": { \"files\": " << stats.filesCopied << ", \"bytes\": " << stats.bytesCopied
+         << ", \"verified\": " << stats.filesVerified << ", \"cloned\": " << stats.filesCloned
+         << ", \"bytes_cloned\": " << stats.bytesCloned << " },\n"
+         << "  \"dedup\": { \"enabled\": " << (options.dedup ? "true" : "false")
+         << ", \"candidates\": " << stats.dedupCandidates << ", \"files\": " << stats.filesDeduplicated
+         << ", \"bytes\": " << stats.bytesDeduplicated
+         << ", \"hit_rate\": " << rate(static_cast<double>(stats.filesDeduplicated),
+                                        static_cast<double>(stats.dedupCandidates))
+         << ", \"bytes_saved_ratio\": " << rate(static_cast<double>(stats.bytesDeduplicated),
+                                                 static_cast<double>(tree.bytes)) << " },\n"
+         << "  \"phases\": { \"generate\": " << times.generate << ", \"scan\": " << times.scan
+         << ", \"copy\": " << times.copy << ", \"trash\": " << times.trash << ", \"link\": " << times.link
+         << ", \"delete\": " << times.remove << " },\n"
+         << "  \"snapshot\": { \"bytes\": " << snapshot.bytes << ", \"write\": " << snapshot.write
+         << ", \"open\": " << snapshot.open << ", \"diff\": " << snapshot.diff << ", \"changes\": " << snapshot.changes
+         << ", \"diff_entries_per_second\": " << rate(entries, snapshot.diff) << " },\n"
+         << "  \"seconds\": " << migration << ",\n"
+         << "  \"files_per_second\": " << rate(static_cast<double>(tree.files), migration) << ",\n"
+         << "  \"mb_per_second\": " << rate(tree.bytes / (1024.0 * 1024.0), migration) << ",\n"
+         << "  \"copy_files_per_second\": " << rate(static_cast<double>(stats.filesCopied), times.copy) << ",\n"
+         << "  \"copy_mb_per_second\": " << rate(stats.bytesCopied / (1024.0 * 1024.0), times.copy) << ",\n"
+         << "  \"allocations\": { \"scan\": " << allocations.scan << ", \"copy\": " << allocations.copy
+         << ", \"delete\": " << allocations.remove << " },\n"
+         << "  \"scan_allocations_per_entry\": " << rate(static_cast<double>(allocations.scan), entries) << ",\n"
+         << "  \"copy_allocations_per_file\": " << rate(static_cast<double>(allocations.copy),
+                                                     static_cast<double>(stats.filesCopied)) << ",\n"
+         << "  \"peak_rss_bytes\": " << PeakResidentBytes() << "\n"
+         << "}\n";
+    return json.str();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!ParseArguments(argc, argv, options)) {
+        PrintUsage();
+        return 2;
+    }
+    options.profile.Scale(options.scale);
+
+    // Same layout as a migration: the data folder moves into a target folder
+    // and a link is left where it used to be
+    fs::path source;
+    fs::path target;
+
+    try {
+        // The link must not depend on the current directory
+        fs::path work = fs::absolute(options.work);
+        source = work / "ZaloPC";
+        target = work / "target" / "ZaloPC";
+
+        fs::remove_all(source);
+        fs::remove_all(target.parent_path());
+
+        PhaseTimes times;
+        PhaseAllocations allocations;
+        Stopwatch generateTimer;
+        zdm::GeneratedTree tree = zdm::GenerateTree(source, options.profile);
+        times.generate = generateTimer.Seconds();
+
+        zdm::CopyOptions copyOptions;
+        copyOptions.threadCount = options.threads;
+        copyOptions.verify = options.verify;
+        copyOptions.dedup = options.dedup;
+        copyOptions.tuning.ioBackend = options.ioBackend;
+        copyOptions.tuning.queueDepth = options.queueDepth;
+        copyOptions.tuning.reflink = options.reflink;
+        copyOptions.io = options.ioLimits;
+        unsigned threads = options.threads ? options.threads : zdm::WorkStealingPool::DefaultThreadCount();
+
+        // Report what the copy threads will actually get, Auto may fall back to blocking calls
+        std::unique_ptr<zdm::AsyncIo> probe = zdm::CreateAsyncIo(options.ioBackend, options.queueDepth);
+        const char* io = probe ? probe->Name() : zdm::IoBackendName(zdm::IoBackend::Synchronous);
+
+        Stopwatch scanTimer;
+        zdm::Manifest manifest = zdm::ScanTree(source, options.threads);
+        times.scan = scanTimer.Seconds();
+        allocations.scan = scanTimer.Allocations();
+
+        Stopwatch copyTimer;
+        std::unique_ptr<zdm::CopyJournal> journal;
+        if (options.journal) {
+            fs::create_directories(target);
+            journal = std::make_unique<zdm::CopyJournal>(target);
+            journal->Open();
+            copyOptions.journal = journal.get();
+        }
+        zdm::CopyStats stats = zdm::CopyEngine(copyOptions).CopyManifest(manifest, source, target);
+        if (journal) {
+            journal->Remove();
+        }
+        times.copy = copyTimer.Seconds();
+        allocations.copy = copyTimer.Allocations();
+
+        SnapshotTimes snapshot;
+        fs::path snapshotPath = zdm::SnapshotPath(target);
+        Stopwatch writeTimer;
+        zdm::WriteManifestFile(snapshotPath, manifest);
+        snapshot.write = writeTimer.Seconds();
+        snapshot.bytes = fs::file_size(snapshotPath);
+        {
+            Stopwatch openTimer;
+            zdm::ManifestFile mapped(snapshotPath);
+            snapshot.open = openTimer.Seconds();
+            Stopwatch diffTimer;
+            zdm::ManifestDiff diff = zdm::DiffManifests(mapped, manifest);
+            snapshot.diff = diffTimer.Seconds();
+            snapshot.changes = diff.changed.size() + diff.removed.size();
+        }
+
+        Stopwatch trashTimer;
+        fs::path trash = zdm::MoveToTrash(source);
+        times.trash = trashTimer.Seconds();
+
+        Stopwatch linkTimer;
+        zdm::CreateDirectoryLink(source, target);
+        times.link = linkTimer.Seconds();
+
+        zdm::DeleteOptions deleteOptions;
+        deleteOptions.threadCount = options.threads;
+        Stopwatch removeTimer;
+        zdm::DeleteTree(trash, deleteOptions);
+        times.remove = removeTimer.Seconds();
+        allocations.remove = removeTimer.Allocations();
+
+        std::string report = Report(options, tree, stats, times, allocations, snapshot, threads, io);
+        std::cout << report;
+        if (!options.output.empty()) {
+            std::ofstream(options.output) << report;
+        }
+
+        if (!options.keep) {
+            fs::remove(source);
+            fs::remove_all(target.parent_path());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "zalo_bench: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
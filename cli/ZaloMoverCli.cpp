@@ -0,0 +1,751 @@
+// Headless front end for scripted rollouts. Runs the same migration pipeline
+// as the window: questions are answered by --yes (declined otherwise) and
+// progress goes to stdout as text lines or, with --json-progress, as one JSON
+// object per line.
+//
+//   zalo_mover --source DIR --dest DIR [--threads N] [--yes] [--json-progress]
+//              [--no-verify] [--no-link] [--io auto|sync|threads|uring|iocp] [--queue-depth N]
+//              [--policy default|FILE] [--dry-run] [--dedup] [--no-reflink]
+//              [--max-streams N] [--bandwidth MB] [--low-priority] [--no-adaptive]
+//              [--log FILE] [--trace FILE] [--audit] [--close NAME] [--preflight] [--no-preflight]
+//              [--archive DAYS] [--archive-level N]
+//   zalo_mover --source DIR --dest DIR --extract PATH [--json-progress]
+//   zalo_mover --source DIR --mirror DIR [--reconcile MIN] [--threads N] [--json-progress] ...
+//
+// The data folder ends up at DIR/<name of source>, like the window's target folder.
+// With --policy only the bulk subfolders move, each with its own link (see
+// PlacementPolicy.h for the rule format); --dry-run scans and reports the split
+// between the tiers without changing anything. --dedup writes files with identical
+// content once and links the other copies to it (see CopyOptions::dedup). Files are
+// cloned instead of copied where the destination file system can share blocks with the
+// source (Btrfs, XFS, ReFS), --no-reflink always copies the data. --max-streams limits the
+// files copied at once (by default two when either side is a hard disk, see IoScheduler),
+// --bandwidth caps the copy at MB per second and --low-priority runs it at background I/O
+// priority, so the machine stays usable during working hours. The number of streams follows
+// the measured throughput unless --no-adaptive is given. --log appends a JSON-lines record
+// of the run to FILE: a timing span with file and byte counters for every phase and the
+// slowest files of the copy; --trace also writes the spans as a Chrome trace.
+// A copy leaves a manifest file of what it moved next to the data folder (DIR/<name>.zdm-manifest,
+// see ManifestFile.h); --audit scans DIR/<name> and lists what was added, changed or removed
+// since, without changing anything.
+// --mirror keeps a warm copy of the source at DIR/<name of source> until Ctrl+C: it follows
+// change notifications and copies changed files in batches once they are quiet, with a full
+// comparison of both trees every --reconcile minutes (15 by default, 0 = only at the start)
+// to catch anything the notifications missed (see Mirror.h). The copy flags above apply.
+// Before anything is closed or copied a preflight scans the source, checks the free space at
+// DIR with headroom, measures both disks for a second and estimates the copy time (see
+// Preflight.h); the run stops when the data cannot fit. --preflight only prints that report,
+// --no-preflight skips it.
+// --archive DAYS packs pictures, videos, files and downloads not written for DAYS days into
+// compressed containers at DIR/<name>.zdm-archive instead of copying them (see ColdArchive.h),
+// --archive-level sets the zstd level (3 by default). They are no longer in the data folder
+// afterwards: --extract PATH writes one of them back to DIR/<name>/PATH.
+// --close NAME ends the processes named NAME (Zalo.exe) before the data is moved, waits up to
+// 10 seconds for them to exit and fails the run when one is still there. Without it Zalo must
+// be closed before the tool runs. The old data is
+// renamed aside and deleted after the link exists, so Zalo can be restarted as soon
+// as the "link" step is reported; a delete cut short is finished by the next run.
+// Exit codes: 0 done, 1 failed, 2 bad arguments, 3 declined, 130 interrupted.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ColdArchive.h"
+#include "DeferredDelete.h"
+#include "EventLog.h"
+#include "ManifestFile.h"
+#include "Migration.h"
+#include "Mirror.h"
+#include "PlacementPolicy.h"
+#include "Preflight.h"
+#include "ProcessControl.h"
+#include "Progress.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct CliOptions {
+    fs::path source;
+    fs::path destination;
+    unsigned threads = 0;
+    bool yes = false;
+    bool jsonProgress = false;
+    bool verify = true;
+    bool createLink = true;
+    zdm::IoBackend ioBackend = zdm::IoBackend::Auto;
+    unsigned queueDepth = 32;
+    std::string policy; // "default", a rule file or empty for the whole folder
+    bool dryRun = false;
+    bool audit = false;
+    bool preflightOnly = false;
+    bool preflight = true;
+    bool dedup = false;
+    bool reflink = true;
+    zdm::IoLimits ioLimits;
+    fs::path logFile;
+    fs::path traceFile;
+    fs::path mirror;
+    unsigned reconcileMinutes = 15;
+    std::string closeProcess; // process to end before the data is moved, empty = none
+    int64_t archiveDays = -1; // media older than this goes into the cold archive, -1 = no archive
+    int archiveLevel = 3;
+    std::string extract;      // archived file to restore, relative to the data folder
+};
+
+std::atomic<bool> g_cancelRequested{false};
+
+void OnInterrupt(int) {
+    g_cancelRequested = true;
+}
+
+void PrintUsage() {
+    std::cerr << "usage: zalo_mover --source DIR --dest DIR [--threads N] [--yes] [--json-progress]\n"
+                 "                  [--no-verify] [--no-link] [--io auto|sync|threads|uring|iocp] [--queue-depth N]\n"
+                 "                  [--policy default|FILE] [--dry-run] [--dedup] [--no-reflink]\n"
+                 "                  [--max-streams N] [--bandwidth MB] [--low-priority] [--no-adaptive]\n"
+                 "                  [--log FILE] [--trace FILE] [--audit] [--close NAME] [--preflight] [--no-preflight]\n"
+                 "                  [--archive DAYS] [--archive-level N]\n"
+                 "       zalo_mover --source DIR --dest DIR --extract PATH [--json-progress]\n"
+                 "       zalo_mover --source DIR --mirror DIR [--reconcile MIN] [--threads N] [--json-progress] ...\n";
+}
+
+// Zalo keeps its data under %LOCALAPPDATA%\ZaloPC
+fs::path DefaultSource() {
+#ifdef _WIN32
+    const wchar_t* localAppData = _wgetenv(L"LOCALAPPDATA");
+    if (localAppData) {
+        return fs::path(localAppData) / L"ZaloPC";
+    }
+#endif
+    return fs::path();
+}
+
+bool ParseArguments(int argc, char** argv, CliOptions& options) {
+    options.source = DefaultSource();
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--yes") {
+            options.yes = true;
+        } else if (arg == "--json-progress") {
+            options.jsonProgress = true;
+        } else if (arg == "--no-verify") {
+            options.verify = false;
+        } else if (arg == "--no-link") {
+            options.createLink = false;
+        } else if (arg == "--dry-run") {
+            options.dryRun = true;
+        } else if (arg == "--audit") {
+            options.audit = true;
+        } else if (arg == "--preflight") {
+            options.preflightOnly = true;
+        } else if (arg == "--no-preflight") {
+            options.preflight = false;
+        } else if (arg == "--dedup") {
+            options.dedup = true;
+        } else if (arg == "--no-reflink") {
+            options.reflink = false;
+        } else if (arg == "--low-priority") {
+            options.ioLimits.lowPriority = true;
+        } else if (arg == "--no-adaptive") {
+            options.ioLimits.adaptive = false;
+        } else if (arg == "--max-streams" && hasValue) {
+            options.ioLimits.maxStreams = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--bandwidth" && hasValue) {
+            options.ioLimits.maxBytesPerSecond = std::strtod(argv[++i], nullptr) * 1024 * 1024;
+        } else if (arg == "--mirror" && hasValue) {
+            options.mirror = fs::u8path(argv[++i]);
+        } else if (arg == "--reconcile" && hasValue) {
+            options.reconcileMinutes = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--close" && hasValue) {
+            options.closeProcess = argv[++i];
+        } else if (arg == "--archive" && hasValue) {
+            options.archiveDays = std::strtoll(argv[++i], nullptr, 10);
+            if (options.archiveDays < 0) {
+                return false;
+            }
+        } else if (arg == "--archive-level" && hasValue) {
+            options.archiveLevel = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+        } else if (arg == "--extract" && hasValue) {
+            options.extract = argv[++i];
+        } else if (arg == "--log" && hasValue) {
+            options.logFile = fs::u8path(argv[++i]);
+        } else if (arg == "--trace" && hasValue) {
+            options.traceFile = fs::u8path(argv[++i]);
+        } else if (arg == "--policy" && hasValue) {
+            options.policy = argv[++i];
+        } else if (arg == "--source" && hasValue) {
+            options.source = fs::u8path(argv[++i]);
+        } else if (arg == "--dest" && hasValue) {
+            options.destination = fs::u8path(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--io" && hasValue) {
+            if (!zdm::ParseIoBackend(argv[++i], options.ioBackend)) {
+                return false;
+            }
+        } else if (arg == "--queue-depth" && hasValue) {
+            options.queueDepth = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            return false;
+        }
+    }
+    if (options.source.empty()) {
+        return false;
+    }
+    if (options.audit || options.preflightOnly || !options.extract.empty()) {
+        return !options.destination.empty();
+    }
+    return options.dryRun || !options.mirror.empty() || !options.destination.empty();
+}
+
+using zdm::JsonString;
+
+// Serializes output from the migration thread and the progress sampler
+class Console {
+public:
+    explicit Console(bool json) : m_json(json) {}
+
+    bool Json() const { return m_json; }
+
+    void Line(const std::string& line) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::cout << line << std::endl;
+    }
+
+    void Event(const std::string& type, const std::string& fields) {
+        Line("{\"event\":" + JsonString(type) + (fields.empty() ? "" : "," + fields) + "}");
+    }
+
+private:
+    bool m_json;
+    std::mutex m_mutex;
+};
+
+// Samples the copy counters on its own thread while a copy pass runs,
+// the copy workers never touch the console
+class ProgressSampler {
+public:
+    ProgressSampler(zdm::CopyProgress& progress, Console& console)
+        : m_progress(progress), m_console(console), m_thread(&ProgressSampler::Run, this) {}
+
+    ~ProgressSampler() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    void SetActive(bool active) { m_active = active; }
+
+private:
+    void Run() {
+        // JSON consumers get a finer stream, people reading a terminal one line a second
+        auto interval = std::chrono::milliseconds(m_console.Json() ? 250 : 1000);
+        zdm::ProgressRate rate;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_wake.wait_for(lock, interval, [this] { return m_stopping; })) {
+            if (!m_active) {
+                continue;
+            }
+            zdm::ProgressSnapshot snapshot = m_progress.Snapshot();
+            double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            rate.Update(snapshot, now);
+            Print(snapshot, rate);
+        }
+    }
+
+    void Print(const zdm::ProgressSnapshot& snapshot, const zdm::ProgressRate& rate) {
+        std::ostringstream line;
+        if (m_console.Json()) {
+            line << "\"files_done\":" << snapshot.filesDone << ",\"files_planned\":" << snapshot.filesPlanned
+                 << ",\"bytes_done\":" << snapshot.bytesDone << ",\"bytes_planned\":" << snapshot.bytesPlanned
+                 << ",\"bytes_per_second\":" << static_cast<uint64_t>(rate.BytesPerSecond())
+                 << ",\"files_per_second\":" << static_cast<uint64_t>(rate.FilesPerSecond())
+                 << ",\"eta_seconds\":" << static_cast<int64_t>(rate.EtaSeconds())
+                 << ",\"current\":" << JsonString(fs::path(snapshot.currentPath).u8string());
+            m_console.Event("progress", line.str());
+            return;
+        }
+
+        line.setf(std::ios::fixed);
+        line.precision(1);
+        line << snapshot.filesDone << "/" << snapshot.filesPlanned << " files, "
+             << snapshot.bytesDone / (1024.0 * 1024.0) << "/" << snapshot.bytesPlanned / (1024.0 * 1024.0) << " MB, "
+             << rate.BytesPerSecond() / (1024 * 1024) << " MB/s, "
+             << static_cast<uint64_t>(rate.FilesPerSecond()) << " files/s";
+        double eta = rate.EtaSeconds();
+        if (eta >= 0) {
+            int remaining = static_cast<int>(eta);
+            line << ", ETA " << remaining / 60 << ":" << (remaining % 60 < 10 ? "0" : "") << remaining % 60;
+        }
+        m_console.Line(line.str());
+    }
+
+    zdm::CopyProgress& m_progress;
+    Console& m_console;
+    std::atomic<bool> m_active{false};
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+zdm::PlacementPolicy LoadPolicy(const std::string& name) {
+    if (name.empty()) {
+        // Everything is bulk: the plan of a whole-folder move
+        zdm::PlacementPolicy policy;
+        policy.defaultTier = zdm::Tier::Bulk;
+        return policy;
+    }
+    if (name == "default") {
+        return zdm::DefaultPlacementPolicy();
+    }
+    return zdm::LoadPlacementPolicy(fs::u8path(name));
+}
+
+void PrintPlacement(Console& console, const zdm::PlacementPlan& plan) {
+    if (!console.Json()) {
+        console.Line(zdm::DescribePlacement(plan));
+        return;
+    }
+    std::ostringstream fields;
+    fields << "\"fast_files\":" << plan.fast.files << ",\"fast_bytes\":" << plan.fast.bytes
+           << ",\"moved_files\":" << plan.moved.files << ",\"moved_bytes\":" << plan.moved.bytes
+           << ",\"pinned_files\":" << plan.pinned.files << ",\"pinned_bytes\":" << plan.pinned.bytes
+           << ",\"whole_tree\":" << (plan.wholeTree ? "true" : "false") << ",\"subtrees\":[";
+    for (size_t i = 0; i < plan.subtrees.size(); i++) {
+        const zdm::PlacementSubtree& subtree = plan.subtrees[i];
+        fields << (i ? "," : "") << "{\"path\":" << JsonString(fs::path(subtree.relativePath).u8string())
+               << ",\"files\":" << subtree.totals.files << ",\"bytes\":" << subtree.totals.bytes << "}";
+    }
+    fields << "]";
+    console.Event("plan", fields.str());
+}
+
+// Scan, space check and disk probes for moving source to destination, printed as a summary
+// or as one "preflight" event
+zdm::PreflightReport Preflight(Console& console, const CliOptions& cli, const fs::path& source,
+                               const fs::path& destination, const zdm::PlacementPolicy* placement,
+                               zdm::EventLog* eventLog) {
+    zdm::PreflightOptions options;
+    options.source = source;
+    options.destination = destination;
+    options.threadCount = cli.threads;
+    options.verify = cli.verify;
+    options.placement = placement;
+    zdm::ArchiveOptions archive;
+    if (cli.archiveDays >= 0) {
+        archive.policy = zdm::DefaultArchivePolicy(cli.archiveDays);
+        options.archive = &archive;
+    }
+    options.io = cli.ioLimits;
+    options.cancel = &g_cancelRequested;
+    options.eventLog = eventLog;
+    zdm::PreflightReport report = zdm::RunPreflight(options);
+
+    if (!console.Json()) {
+        console.Line(zdm::DescribePreflight(report));
+        return report;
+    }
+    std::ostringstream fields;
+    fields << "\"strategy\":" << JsonString(zdm::StrategyName(report.plan.strategy))
+           << ",\"files\":" << report.files << ",\"directories\":" << report.directories
+           << ",\"bytes\":" << report.bytes
+           << ",\"files_to_move\":" << report.filesToMove << ",\"bytes_to_move\":" << report.bytesToMove
+           << ",\"bytes_resumed\":" << report.bytesResumed
+           << ",\"files_archived\":" << report.filesArchived << ",\"bytes_archived\":" << report.bytesArchived
+           << ",\"required_bytes\":" << report.requiredBytes << ",\"available_bytes\":" << report.availableBytes
+           << ",\"enough_space\":" << (report.enoughSpace ? "true" : "false")
+           << ",\"writable\":" << (report.writable ? "true" : "false")
+           << ",\"source_device\":" << JsonString(zdm::DeviceKindName(report.source.device))
+           << ",\"destination_device\":" << JsonString(zdm::DeviceKindName(report.destination.device))
+           << ",\"read_bytes_per_second\":" << static_cast<uint64_t>(report.source.bytesPerSecond)
+           << ",\"write_bytes_per_second\":" << static_cast<uint64_t>(report.destination.bytesPerSecond)
+           << ",\"read_seconds_per_file\":" << report.source.secondsPerFile
+           << ",\"write_seconds_per_file\":" << report.destination.secondsPerFile
+           << ",\"streams\":" << report.streams
+           << ",\"estimated_seconds\":" << report.estimatedSeconds
+           << ",\"seconds\":" << report.seconds << ",\"folders\":[";
+    for (size_t i = 0; i < report.folders.size(); i++) {
+        const zdm::PreflightFolder& folder = report.folders[i];
+        fields << (i ? "," : "") << "{\"name\":" << JsonString(fs::path(folder.name).u8string())
+               << ",\"files\":" << folder.files << ",\"bytes\":" << folder.bytes << "}";
+    }
+    fields << "]";
+    console.Event("preflight", fields.str());
+    return report;
+}
+
+// Why a preflight stops the migration
+std::string PreflightProblem(const zdm::PreflightReport& report) {
+    if (!report.enoughSpace) {
+        return "not enough space at the destination: " + std::to_string(report.requiredBytes / (1024 * 1024)) +
+               " MB needed, " + std::to_string(report.availableBytes / (1024 * 1024)) + " MB free";
+    }
+    return "cannot write at the destination";
+}
+
+// Compare a migrated data folder with the snapshot its migration left next to it
+void Audit(Console& console, const fs::path& dataFolder, unsigned threads) {
+    auto start = std::chrono::steady_clock::now();
+    zdm::ManifestFile snapshot(zdm::SnapshotPath(dataFolder));
+    zdm::Manifest current = zdm::ScanTree(dataFolder, threads);
+    zdm::ManifestDiff diff = zdm::DiffManifests(snapshot, current);
+
+    auto print = [&](const char* change, const char* mark, zdm::PathView relativePath) {
+        std::string path = fs::path(relativePath).u8string();
+        if (console.Json()) {
+            console.Event("audit_entry", "\"change\":" + JsonString(change) + ",\"path\":" + JsonString(path));
+        } else {
+            console.Line(std::string(mark) + " " + path);
+        }
+    };
+    for (size_t index : diff.removed) {
+        print("removed", "-", snapshot.RelativePath(snapshot[index]));
+    }
+    size_t added = 0;
+    for (size_t index : diff.changed) {
+        zdm::PathView relativePath = current.RelativePath(current[index]);
+        bool known = snapshot.Find(relativePath) != nullptr;
+        added += known ? 0 : 1;
+        print(known ? "changed" : "added", known ? "~" : "+", relativePath);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ostringstream fields;
+    fields << "\"snapshot_entries\":" << snapshot.Size() << ",\"entries\":" << current.Size()
+           << ",\"added\":" << added << ",\"changed\":" << diff.changed.size() - added
+           << ",\"removed\":" << diff.removed.size() << ",\"seconds\":" << seconds;
+    if (console.Json()) {
+        console.Event("audit", fields.str());
+    } else {
+        console.Line(std::to_string(current.Size()) + " entries, " + std::to_string(added) + " added, " +
+                     std::to_string(diff.changed.size() - added) + " changed, " +
+                     std::to_string(diff.removed.size()) + " removed since the snapshot");
+    }
+}
+
+// Restore one archived file into the migrated data folder
+void Extract(Console& console, const fs::path& dataFolder, const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+    fs::path relativePath = fs::u8path(path).make_preferred();
+    zdm::ArchiveReader archive(zdm::ArchivePath(dataFolder));
+    fs::path output = dataFolder / relativePath;
+    if (!archive.Extract(relativePath.native(), output)) {
+        throw std::runtime_error(path + " is not in the archive (" + std::to_string(archive.Size()) + " files)");
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (console.Json()) {
+        console.Event("extract", "\"path\":" + JsonString(output.u8string()) +
+                                 ",\"bytes\":" + std::to_string(fs::file_size(output)) +
+                                 ",\"seconds\":" + std::to_string(seconds));
+    } else {
+        console.Line("Extracted " + output.u8string());
+    }
+}
+
+// Follow the source into a warm copy until interrupted
+void Mirror(Console& console, const CliOptions& cli, const fs::path& source, zdm::EventLog* eventLog) {
+    zdm::MirrorOptions options;
+    options.source = source;
+    options.mirror = fs::absolute(cli.mirror) / source.filename();
+    options.threadCount = cli.threads;
+    options.reconcileInterval = std::chrono::minutes(cli.reconcileMinutes);
+    options.tuning.ioBackend = cli.ioBackend;
+    options.tuning.queueDepth = cli.queueDepth;
+    options.tuning.reflink = cli.reflink;
+    options.io = cli.ioLimits;
+    options.cancel = &g_cancelRequested;
+    options.eventLog = eventLog;
+
+    if (!console.Json()) {
+        console.Line("Mirroring " + source.u8string() + " to " + options.mirror.u8string() + ", Ctrl+C to stop");
+    }
+    zdm::MirrorStats stats = zdm::RunMirror(options, [&](const zdm::MirrorPass& pass) {
+        if (console.Json()) {
+            std::ostringstream fields;
+            fields << "\"reconcile\":" << (pass.reconcile ? "true" : "false") << ",\"paths\":" << pass.paths
+                   << ",\"files_copied\":" << pass.filesCopied << ",\"bytes_copied\":" << pass.bytesCopied
+                   << ",\"removed\":" << pass.entriesRemoved << ",\"failures\":" << pass.failures
+                   << ",\"seconds\":" << pass.seconds;
+            console.Event("mirror", fields.str());
+        } else if (pass.reconcile || pass.filesCopied || pass.entriesRemoved || pass.failures) {
+            console.Line(std::string(pass.reconcile ? "Reconciled: " : "Synced: ") + std::to_string(pass.filesCopied) +
+                         " files copied, " + std::to_string(pass.entriesRemoved) + " removed" +
+                         (pass.failures ? ", " + std::to_string(pass.failures) + " to retry" : ""));
+        }
+    });
+
+    std::ostringstream fields;
+    fields << "\"batches\":" << stats.batches << ",\"reconciles\":" << stats.reconciles
+           << ",\"files_copied\":" << stats.filesCopied << ",\"bytes_copied\":" << stats.bytesCopied
+           << ",\"removed\":" << stats.entriesRemoved << ",\"notifications_lost\":" << stats.notificationsLost;
+    if (eventLog) {
+        eventLog->Write("done", fields.str());
+    }
+    if (console.Json()) {
+        console.Event("done", fields.str());
+    } else {
+        console.Line("Mirror stopped after " + std::to_string(stats.batches) + " batches, " +
+                     std::to_string(stats.filesCopied) + " files copied");
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    CliOptions cli;
+    if (!ParseArguments(argc, argv, cli)) {
+        PrintUsage();
+        return 2;
+    }
+    std::signal(SIGINT, OnInterrupt);
+
+    Console console(cli.jsonProgress);
+    zdm::CopyProgress progress;
+    ProgressSampler sampler(progress, console);
+
+    // "ZaloPC/" has no filename, the link needs an absolute target
+    fs::path source = fs::absolute(cli.source);
+    if (!source.has_filename()) {
+        source = source.parent_path();
+    }
+
+    zdm::PlacementPolicy policy;
+    std::unique_ptr<zdm::EventLog> eventLog;
+    try {
+        if (!cli.logFile.empty()) {
+            eventLog = std::make_unique<zdm::EventLog>(cli.logFile);
+            if (!cli.traceFile.empty()) {
+                eventLog->EnableTrace(cli.traceFile);
+            }
+        }
+        policy = LoadPolicy(cli.policy);
+        if (cli.dryRun) {
+            PrintPlacement(console, zdm::PlanPlacement(zdm::ScanTree(source, cli.threads), policy));
+            return 0;
+        }
+        if (cli.preflightOnly) {
+            zdm::PreflightReport report = Preflight(console, cli, source, fs::absolute(cli.destination) / source.filename(),
+                                                    cli.policy.empty() ? nullptr : &policy, eventLog.get());
+            return report.Ok() ? 0 : 1;
+        }
+        if (cli.audit) {
+            Audit(console, fs::absolute(cli.destination) / source.filename(), cli.threads);
+            return 0;
+        }
+        if (!cli.extract.empty()) {
+            Extract(console, fs::absolute(cli.destination) / source.filename(), cli.extract);
+            return 0;
+        }
+        if (!cli.mirror.empty()) {
+            Mirror(console, cli, source, eventLog.get());
+            return 0;
+        }
+    } catch (const std::exception& e) {
+        if (console.Json()) {
+            console.Event("error", "\"message\":" + JsonString(e.what()) + ",\"exit_code\":1");
+        } else {
+            std::cerr << "zalo_mover: " << e.what() << "\n";
+        }
+        return 1;
+    }
+
+    zdm::MigrationOptions options;
+    options.source = source;
+    options.destination = fs::absolute(cli.destination) / source.filename();
+    options.threadCount = cli.threads;
+    options.verify = cli.verify;
+    options.createLink = cli.createLink;
+    options.dedup = cli.dedup;
+    options.deferDelete = true;
+    options.tuning.ioBackend = cli.ioBackend;
+    options.tuning.queueDepth = cli.queueDepth;
+    options.tuning.reflink = cli.reflink;
+    options.io = cli.ioLimits;
+    options.placement = cli.policy.empty() ? nullptr : &policy;
+    zdm::ArchiveOptions archive;
+    if (cli.archiveDays >= 0) {
+        archive.policy = zdm::DefaultArchivePolicy(cli.archiveDays);
+        archive.compressionLevel = cli.archiveLevel;
+        archive.verify = cli.verify;
+        options.archive = &archive;
+    }
+    options.progress = &progress;
+    options.cancel = &g_cancelRequested;
+    options.eventLog = eventLog.get();
+
+    zdm::MigrationCallbacks callbacks;
+    callbacks.onStatus = [&](zdm::MigrationStep step, const std::string& message) {
+        sampler.SetActive(step == zdm::MigrationStep::Copy || step == zdm::MigrationStep::SyncChanges);
+        if (console.Json()) {
+            console.Event("status", "\"step\":" + JsonString(zdm::StepName(step)) + ",\"message\":" + JsonString(message));
+        } else {
+            console.Line(message);
+        }
+    };
+    callbacks.decide = [&](zdm::MigrationQuestion, const std::string& prompt) {
+        if (console.Json()) {
+            console.Event("question", "\"prompt\":" + JsonString(prompt) + ",\"answer\":" + (cli.yes ? "true" : "false"));
+        } else {
+            console.Line(prompt + (cli.yes ? " yes (--yes)" : " no (run with --yes to allow)"));
+        }
+        return cli.yes;
+    };
+    if (!cli.closeProcess.empty()) {
+        callbacks.closeApplication = [&]() {
+            const std::chrono::seconds kCloseTimeout(10);
+            zdm::TerminateResult closed = zdm::TerminateProcesses(fs::u8path(cli.closeProcess).native(), kCloseTimeout);
+            if (console.Json()) {
+                console.Event("close", "\"process\":" + JsonString(cli.closeProcess) +
+                                       ",\"found\":" + std::to_string(closed.found) +
+                                       ",\"exited\":" + std::to_string(closed.exited));
+            } else if (closed.found > 0) {
+                console.Line("Closed " + std::to_string(closed.exited) + " of " + std::to_string(closed.found) +
+                             " " + cli.closeProcess + " processes");
+            }
+            if (!closed.Complete()) {
+                throw std::runtime_error(cli.closeProcess + " is still running after " +
+                                         std::to_string(kCloseTimeout.count()) + " seconds");
+            }
+        };
+    }
+    callbacks.log = [&](const std::string& line) {
+        if (eventLog) {
+            eventLog->Message(line);
+        }
+        if (console.Json()) {
+            console.Event("log", "\"message\":" + JsonString(line));
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    int exitCode = 0;
+    try {
+        if (cli.preflight) {
+            zdm::PreflightReport report = Preflight(console, cli, source, options.destination, options.placement,
+                                                    eventLog.get());
+            if (!report.Ok()) {
+                throw std::runtime_error(PreflightProblem(report));
+            }
+        }
+        if (callbacks.closeApplication && !options.liveCopy) {
+            zdm::PhaseSpan span(eventLog.get(), "close");
+            callbacks.closeApplication();
+            span.End();
+        }
+        zdm::MigrationResult result = zdm::RunMigration(options, callbacks);
+        sampler.SetActive(false);
+
+        // The data is in place and linked, now the old copy and anything an earlier run left behind
+        uint64_t trashFailures = 0;
+        std::vector<fs::path> trash = zdm::FindTrash(source);
+        if (!trash.empty()) {
+            callbacks.onStatus(zdm::MigrationStep::RemoveSource, "Deleting old data...");
+        }
+        for (const fs::path& directory : trash) {
+            zdm::DeleteOptions deleteOptions;
+            deleteOptions.threadCount = cli.threads;
+            deleteOptions.cancel = &g_cancelRequested;
+            zdm::PhaseSpan span(eventLog.get(), "delete_trash");
+            zdm::DeleteStats stats = zdm::DeleteTree(directory, deleteOptions);
+            span.End({ stats.entriesDeleted, 0 }, "\"failures\":" + std::to_string(stats.failures) +
+                                                 ",\"completed\":" + (stats.completed ? "true" : "false"));
+            if (!stats.completed) {
+                trashFailures += stats.failures;
+                std::string note = "Old data left at " + directory.u8string() + ", the next run deletes it";
+                if (console.Json()) {
+                    console.Event("log", "\"message\":" + JsonString(note));
+                } else {
+                    console.Line(note);
+                }
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::ostringstream fields;
+        fields << "\"strategy\":" << JsonString(zdm::StrategyName(result.strategy))
+               << ",\"resumed\":" << (result.resumed ? "true" : "false")
+               << ",\"files_copied\":" << result.copy.filesCopied
+               << ",\"bytes_copied\":" << result.copy.bytesCopied
+               << ",\"files_skipped\":" << result.copy.filesSkipped
+               << ",\"files_verified\":" << result.copy.filesVerified
+               << ",\"files_cloned\":" << result.copy.filesCloned
+               << ",\"bytes_cloned\":" << result.copy.bytesCloned
+               << ",\"dedup_candidates\":" << result.copy.dedupCandidates
+               << ",\"files_deduplicated\":" << result.copy.filesDeduplicated
+               << ",\"bytes_deduplicated\":" << result.copy.bytesDeduplicated
+               << ",\"source_device\":" << JsonString(zdm::DeviceKindName(result.copy.sourceDevice))
+               << ",\"destination_device\":" << JsonString(zdm::DeviceKindName(result.copy.destinationDevice))
+               << ",\"streams\":" << result.copy.streamLimit
+               << ",\"partial\":" << (result.partial ? "true" : "false")
+               << ",\"subtrees_moved\":" << result.placement.subtrees.size()
+               << ",\"trash_failures\":" << trashFailures
+               << ",\"snapshot\":" << JsonString(result.snapshot.u8string())
+               << ",\"files_archived\":" << result.archive.files
+               << ",\"bytes_archived\":" << result.archive.bytes
+               << ",\"archive_bytes\":" << result.archive.storedBytes
+               << ",\"seconds\":" << seconds;
+        if (options.placement) {
+            PrintPlacement(console, result.placement);
+        }
+        if (eventLog) {
+            eventLog->Write("done", fields.str());
+        }
+        if (console.Json()) {
+            console.Event("done", fields.str());
+        } else {
+            std::string moved = result.partial ? std::to_string(result.placement.subtrees.size()) + " folders" : "Data";
+            console.Line(moved + " moved to " + options.destination.u8string() + " (" +
+                         zdm::StrategyName(result.strategy) + ", " + std::to_string(result.copy.filesCopied) +
+                         " files copied)");
+            if (result.archive.files > 0) {
+                console.Line(std::to_string(result.archive.files) + " files (" +
+                             std::to_string(result.archive.bytes / (1024 * 1024)) + " MB) archived into " +
+                             std::to_string(result.archive.storedBytes / (1024 * 1024)) + " MB at " +
+                             result.archiveDirectory.u8string());
+            }
+            if (cli.dedup) {
+                console.Line(std::to_string(result.copy.filesDeduplicated) + " of " +
+                             std::to_string(result.copy.dedupCandidates) + " candidate files were duplicates, " +
+                             std::to_string(result.copy.bytesDeduplicated / (1024 * 1024)) + " MB not written");
+            }
+        }
+    } catch (const std::exception& e) {
+        sampler.SetActive(false);
+        if (dynamic_cast<const zdm::MigrationDeclined*>(&e)) {
+            exitCode = 3;
+        } else if (dynamic_cast<const zdm::CopyCanceled*>(&e)) {
+            exitCode = 130;
+        } else {
+            exitCode = 1;
+        }
+        std::string fields = "\"message\":" + JsonString(e.what()) + ",\"exit_code\":" + std::to_string(exitCode);
+        if (eventLog) {
+            eventLog->Write("error", fields);
+        }
+        if (console.Json()) {
+            console.Event("error", fields);
+        } else {
+            std::cerr << "zalo_mover: " << e.what() << "\n";
+        }
+    }
+    return exitCode;
+}
@@ -0,0 +1,575 @@
+#include "AsyncIo.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+const unsigned kDefaultQueueDepth = 32;
+
+[[noreturn]] void ThrowSystemError(int error, const char* what) {
+#ifdef _WIN32
+    throw std::system_error(error, std::system_category(), what);
+#else
+    throw std::system_error(error, std::generic_category(), what);
+#endif
+}
+
+// Fixed pool of request slots, indexes double as backend user data
+class SlotPool {
+public:
+    explicit SlotPool(unsigned count) {
+        m_free.reserve(count);
+        for (unsigned i = count; i > 0; i--) {
+            m_free.push_back(i - 1);
+        }
+    }
+
+    unsigned Take() {
+        if (m_free.empty()) {
+            throw std::logic_error("AsyncIo queue depth exceeded");
+        }
+        unsigned slot = m_free.back();
+        m_free.pop_back();
+        return slot;
+    }
+
+    void Give(unsigned slot) { m_free.push_back(slot); }
+
+private:
+    std::vector<unsigned> m_free;
+};
+
+// Blocking positional transfer, used by the thread pool backend
+int64_t TransferAt(bool write, IoHandle file, void* buffer, size_t length, uint64_t offset) {
+#ifdef _WIN32
+    // Works for handles opened with and without FILE_FLAG_OVERLAPPED
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!overlapped.hEvent) {
+        return -static_cast<int64_t>(GetLastError());
+    }
+
+    DWORD transferred = 0;
+    BOOL ok = write ? WriteFile(file, buffer, static_cast<DWORD>(length), NULL, &overlapped)
+                    : ReadFile(file, buffer, static_cast<DWORD>(length), NULL, &overlapped);
+    if (ok || GetLastError() == ERROR_IO_PENDING) {
+        ok = GetOverlappedResult(file, &overlapped, &transferred, TRUE);
+    }
+    DWORD error = ok ? ERROR_SUCCESS : GetLastError();
+    CloseHandle(overlapped.hEvent);
+
+    if (error == ERROR_HANDLE_EOF) {
+        return 0;
+    }
+    return error == ERROR_SUCCESS ? static_cast<int64_t>(transferred) : -static_cast<int64_t>(error);
+#else
+    for (;;) {
+        ssize_t count = write ? pwrite(file, buffer, length, static_cast<off_t>(offset))
+                              : pread(file, buffer, length, static_cast<off_t>(offset));
+        if (count >= 0) {
+            return count;
+        }
+        if (errno != EINTR) {
+            return -static_cast<int64_t>(errno);
+        }
+    }
+#endif
+}
+
+// Portable backend: requests run as blocking calls on a few helper threads
+class ThreadPoolIo : public AsyncIo {
+public:
+    explicit ThreadPoolIo(unsigned queueDepth) : AsyncIo(queueDepth) {
+        unsigned threadCount = queueDepth < 4 ? queueDepth : 4;
+        for (unsigned i = 0; i < threadCount; i++) {
+            m_threads.emplace_back(&ThreadPoolIo::WorkerLoop, this);
+        }
+    }
+
+    ~ThreadPoolIo() override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_requestReady.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void Read(IoHandle file, void* buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        Queue({ false, file, buffer, length, offset, tag });
+    }
+
+    void Write(IoHandle file, const void* buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        Queue({ true, file, const_cast<void*>(buffer), length, offset, tag });
+    }
+
+    size_t Wait(IoCompletion* completions, size_t capacity) override {
+        if (m_inFlight == 0) {
+            return 0;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_completionReady.wait(lock, [this] { return !m_completions.empty(); });
+
+        size_t count = 0;
+        while (count < capacity && !m_completions.empty()) {
+            completions[count++] = m_completions.front();
+            m_completions.pop_front();
+        }
+        m_inFlight -= static_cast<unsigned>(count);
+        return count;
+    }
+
+    const char* Name() const override { return "threads"; }
+
+private:
+    struct Request {
+        bool write;
+        IoHandle file;
+        void* buffer;
+        size_t length;
+        uint64_t offset;
+        uint64_t tag;
+    };
+
+    void Queue(const Request& request) {
+        if (m_inFlight >= m_queueDepth) {
+            throw std::logic_error("AsyncIo queue depth exceeded");
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_requests.push_back(request);
+        }
+        m_inFlight++;
+        m_requestReady.notify_one();
+    }
+
+    void WorkerLoop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_requestReady.wait(lock, [this] { return m_stopping || !m_requests.empty(); });
+            if (m_requests.empty()) {
+                return;
+            }
+            Request request = m_requests.front();
+            m_requests.pop_front();
+
+            lock.unlock();
+            IoCompletion completion;
+            completion.tag = request.tag;
+            completion.result = TransferAt(request.write, request.file, request.buffer, request.length, request.offset);
+            lock.lock();
+
+            m_completions.push_back(completion);
+            m_completionReady.notify_one();
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_requestReady;
+    std::condition_variable m_completionReady;
+    std::deque<Request> m_requests;
+    std::deque<IoCompletion> m_completions;
+    bool m_stopping = false;
+};
+
+#ifdef _WIN32
+
+// Overlapped ReadFile/WriteFile, completions collected from one completion port
+class IocpIo : public AsyncIo {
+public:
+    explicit IocpIo(unsigned queueDepth)
+        : AsyncIo(queueDepth), m_slots(queueDepth), m_requests(queueDepth) {
+        m_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+        if (!m_port) {
+            ThrowSystemError(static_cast<int>(GetLastError()), "CreateIoCompletionPort");
+        }
+        m_entries.resize(queueDepth);
+    }
+
+    ~IocpIo() override {
+        // Requests still running write into m_requests, let them finish first
+        while (m_inFlight > 0) {
+            IoCompletion completions[16];
+            Wait(completions, 16);
+        }
+        CloseHandle(m_port);
+    }
+
+    void Attach(IoHandle file) override {
+        if (!CreateIoCompletionPort(file, m_port, 0, 0)) {
+            ThrowSystemError(static_cast<int>(GetLastError()), "CreateIoCompletionPort");
+        }
+    }
+
+    void Read(IoHandle file, void* buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        Request& request = Start(file, offset, tag);
+        if (!ReadFile(file, buffer, static_cast<DWORD>(length), NULL, &request.overlapped)) {
+            Check(request);
+        }
+    }
+
+    void Write(IoHandle file, const void* buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        Request& request = Start(file, offset, tag);
+        if (!WriteFile(file, buffer, static_cast<DWORD>(length), NULL, &request.overlapped)) {
+            Check(request);
+        }
+    }
+
+    size_t Wait(IoCompletion* completions, size_t capacity) override {
+        if (m_inFlight == 0) {
+            return 0;
+        }
+        size_t count = 0;
+
+        // Requests the system refused outright never reach the port
+        while (count < capacity && !m_failed.empty()) {
+            completions[count++] = m_failed.front();
+            m_failed.pop_front();
+        }
+        if (count > 0) {
+            m_inFlight -= static_cast<unsigned>(count);
+            return count;
+        }
+
+        ULONG removed = 0;
+        ULONG wanted = static_cast<ULONG>(capacity < m_entries.size() ? capacity : m_entries.size());
+        if (!GetQueuedCompletionStatusEx(m_port, m_entries.data(), wanted, &removed, INFINITE, FALSE)) {
+            ThrowSystemError(static_cast<int>(GetLastError()), "GetQueuedCompletionStatusEx");
+        }
+
+        for (ULONG i = 0; i < removed; i++) {
+            Request* request = CONTAINING_RECORD(m_entries[i].lpOverlapped, Request, overlapped);
+            DWORD transferred = 0;
+            IoCompletion& completion = completions[count++];
+            completion.tag = request->tag;
+            if (GetOverlappedResult(request->file, &request->overlapped, &transferred, FALSE)) {
+                completion.result = transferred;
+            } else {
+                DWORD error = GetLastError();
+                completion.result = error == ERROR_HANDLE_EOF ? 0 : -static_cast<int64_t>(error);
+            }
+            m_slots.Give(static_cast<unsigned>(request - m_requests.data()));
+        }
+        m_inFlight -= static_cast<unsigned>(count);
+        return count;
+    }
+
+    const char* Name() const override { return "iocp"; }
+
+private:
+    struct Request {
+        OVERLAPPED overlapped;
+        HANDLE file;
+        uint64_t tag;
+    };
+
+    Request& Start(IoHandle file, uint64_t offset, uint64_t tag) {
+        Request& request = m_requests[m_slots.Take()];
+        ZeroMemory(&request.overlapped, sizeof(request.overlapped));
+        request.overlapped.Offset = static_cast<DWORD>(offset);
+        request.overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        request.file = file;
+        request.tag = tag;
+        m_inFlight++;
+        return request;
+    }
+
+    // A FALSE return is only a failure when the request is not pending
+    void Check(Request& request) {
+        DWORD error = GetLastError();
+        if (error == ERROR_IO_PENDING) {
+            return;
+        }
+        IoCompletion completion;
+        completion.tag = request.tag;
+        completion.result = error == ERROR_HANDLE_EOF ? 0 : -static_cast<int64_t>(error);
+        m_failed.push_back(completion);
+        m_slots.Give(static_cast<unsigned>(&request - m_requests.data()));
+    }
+
+    HANDLE m_port = NULL;
+    SlotPool m_slots;
+    std::vector<Request> m_requests;
+    std::vector<OVERLAPPED_ENTRY> m_entries;
+    std::deque<IoCompletion> m_failed;
+};
+
+#else
+
+// io_uring through the raw system calls, so no liburing is needed at build or run time
+class IoUringIo : public AsyncIo {
+public:
+    explicit IoUringIo(unsigned queueDepth)
+        : AsyncIo(queueDepth), m_slots(queueDepth), m_requests(queueDepth) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        m_ringFd = static_cast<int>(syscall(__NR_io_uring_setup, queueDepth, &params));
+        if (m_ringFd < 0) {
+            ThrowSystemError(errno, "io_uring_setup");
+        }
+
+        m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap && m_cqRingSize > m_sqRingSize) {
+            m_sqRingSize = m_cqRingSize;
+        }
+
+        m_sqRing = Map(m_sqRingSize, IORING_OFF_SQ_RING);
+        m_cqRing = singleMap ? m_sqRing : Map(m_cqRingSize, IORING_OFF_CQ_RING);
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe*>(Map(m_sqesSize, IORING_OFF_SQES));
+
+        char* sq = static_cast<char*>(m_sqRing);
+        m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        char* cq = static_cast<char*>(m_cqRing);
+        m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~IoUringIo() override {
+        // The kernel may still write into buffers of requests in flight
+        while (m_inFlight > 0) {
+            IoCompletion completions[16];
+            try {
+                Wait(completions, 16);
+            } catch (...) {
+                break;
+            }
+        }
+        Unmap();
+        close(m_ringFd);
+    }
+
+    void Read(IoHandle file, void* buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        Prepare(IORING_OP_READV, file, buffer, length, offset, tag);
+    }
+
+    void Write(IoHandle file, const void* buffer, size_t length, uint64_t offset, uint64_t tag) override {
+        Prepare(IORING_OP_WRITEV, file, const_cast<void*>(buffer), length, offset, tag);
+    }
+
+    size_t Wait(IoCompletion* completions, size_t capacity) override {
+        if (m_inFlight == 0) {
+            return 0;
+        }
+        for (;;) {
+            size_t count = Reap(completions, capacity);
+            if (count > 0) {
+                return count;
+            }
+
+            // One call submits everything prepared and waits for the first completion
+            int result = static_cast<int>(syscall(__NR_io_uring_enter, m_ringFd, m_unsubmitted, 1,
+                                                  IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (result < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                    continue;
+                }
+                ThrowSystemError(errno, "io_uring_enter");
+            }
+            m_unsubmitted -= static_cast<unsigned>(result);
+        }
+    }
+
+    const char* Name() const override { return "uring"; }
+
+private:
+    struct Request {
+        iovec vector;
+        uint64_t tag;
+    };
+
+    // Called from the constructor: on failure the rings mapped so far are released here,
+    // the destructor does not run for an object whose constructor threw
+    void* Map(size_t size, off_t offset) {
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, offset);
+        if (address == MAP_FAILED) {
+            int error = errno;
+            Unmap();
+            close(m_ringFd);
+            ThrowSystemError(error, "io_uring mmap");
+        }
+        return address;
+    }
+
+    void Unmap() {
+        if (m_sqes) {
+            munmap(m_sqes, m_sqesSize);
+        }
+        if (m_cqRing && m_cqRing != m_sqRing) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        if (m_sqRing) {
+            munmap(m_sqRing, m_sqRingSize);
+        }
+        m_sqes = nullptr;
+        m_cqRing = nullptr;
+        m_sqRing = nullptr;
+    }
+
+    void Prepare(uint8_t opcode, int file, void* buffer, size_t length, uint64_t offset, uint64_t tag) {
+        unsigned slot = m_slots.Take();
+        Request& request = m_requests[slot];
+        request.vector.iov_base = buffer;
+        request.vector.iov_len = length;
+        request.tag = tag;
+
+        // The ring holds queueDepth entries and never more than queueDepth requests are
+        // outstanding, so there is always a free submission entry
+        unsigned tail = *m_sqTail;
+        unsigned index = tail & m_sqMask;
+        io_uring_sqe& sqe = m_sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(&request.vector);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = slot;
+        m_sqArray[index] = index;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        m_unsubmitted++;
+        m_inFlight++;
+    }
+
+    size_t Reap(IoCompletion* completions, size_t capacity) {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        size_t count = 0;
+        while (head != tail && count < capacity) {
+            const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+            unsigned slot = static_cast<unsigned>(cqe.user_data);
+            completions[count].tag = m_requests[slot].tag;
+            completions[count].result = cqe.res;
+            m_slots.Give(slot);
+            count++;
+            head++;
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        m_inFlight -= static_cast<unsigned>(count);
+        return count;
+    }
+
+    int m_ringFd = -1;
+    void* m_sqRing = nullptr;
+    void* m_cqRing = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqRingSize = 0;
+    size_t m_cqRingSize = 0;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned* m_sqArray = nullptr;
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    unsigned m_unsubmitted = 0;
+    SlotPool m_slots;
+    std::vector<Request> m_requests;
+};
+
+#endif // _WIN32
+
+} // namespace
+
+std::unique_ptr<AsyncIo> CreateAsyncIo(IoBackend backend, unsigned queueDepth) {
+    if (queueDepth == 0) {
+        queueDepth = kDefaultQueueDepth;
+    }
+
+    switch (backend) {
+        case IoBackend::Synchronous:
+            return nullptr;
+        case IoBackend::ThreadPool:
+            return std::make_unique<ThreadPoolIo>(queueDepth);
+        case IoBackend::Auto:
+            // Kernels without io_uring, or sandboxes that block it, keep the blocking path
+            try {
+#ifdef _WIN32
+                return std::make_unique<IocpIo>(queueDepth);
+#else
+                return std::make_unique<IoUringIo>(queueDepth);
+#endif
+            } catch (const std::system_error&) {
+                return nullptr;
+            }
+        case IoBackend::IoUring:
+#ifdef _WIN32
+            ThrowSystemError(ERROR_NOT_SUPPORTED, "io_uring is not available on Windows");
+#else
+            return std::make_unique<IoUringIo>(queueDepth);
+#endif
+        case IoBackend::Iocp:
+#ifdef _WIN32
+            return std::make_unique<IocpIo>(queueDepth);
+#else
+            ThrowSystemError(ENOTSUP, "IOCP is only available on Windows");
+#endif
+    }
+    return nullptr;
+}
+
+const char* IoBackendName(IoBackend backend) {
+    switch (backend) {
+        case IoBackend::Auto:
+            return "auto";
+        case IoBackend::Synchronous:
+            return "sync";
+        case IoBackend::ThreadPool:
+            return "threads";
+        case IoBackend::IoUring:
+            return "uring";
+        case IoBackend::Iocp:
+            return "iocp";
+    }
+    return "unknown";
+}
+
+bool ParseIoBackend(const std::string& name, IoBackend& backend) {
+    const IoBackend all[] = { IoBackend::Auto, IoBackend::Synchronous, IoBackend::ThreadPool,
+                              IoBackend::IoUring, IoBackend::Iocp };
+    for (IoBackend candidate : all) {
+        if (name == IoBackendName(candidate)) {
+            backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace zdm
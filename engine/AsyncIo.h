@@ -0,0 +1,76 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace zdm {
+
+enum class IoBackend : uint8_t {
+    Auto,        // io_uring or IOCP when the system has it, otherwise Synchronous
+    Synchronous, // blocking calls on the copy threads, no async layer
+    ThreadPool,  // portable: blocking calls on helper threads
+    IoUring,     // Linux io_uring
+    Iocp         // Windows overlapped I/O on a completion port
+};
+
+#ifdef _WIN32
+using IoHandle = void*; // HANDLE
+#else
+using IoHandle = int;
+#endif
+
+struct IoCompletion {
+    uint64_t tag = 0;
+    int64_t result = 0; // bytes transferred, or minus the errno / Win32 error code
+};
+
+// Positional reads and writes with many requests in flight on one thread.
+// Not thread-safe: every copy thread owns its own instance.
+class AsyncIo {
+public:
+    explicit AsyncIo(unsigned queueDepth) : m_queueDepth(queueDepth) {}
+    virtual ~AsyncIo() = default;
+
+    AsyncIo(const AsyncIo&) = delete;
+    AsyncIo& operator=(const AsyncIo&) = delete;
+
+    unsigned QueueDepth() const { return m_queueDepth; }
+    unsigned InFlight() const { return m_inFlight; }
+
+    // Make a handle usable with this backend (IOCP association), before its first request.
+    // Windows handles must be opened with FILE_FLAG_OVERLAPPED. Throws std::system_error.
+    virtual void Attach(IoHandle) {}
+
+    // Queue a request. The buffer must stay valid until its completion has been returned,
+    // at most QueueDepth() requests may be in flight.
+    virtual void Read(IoHandle file, void* buffer, size_t length, uint64_t offset, uint64_t tag) = 0;
+    virtual void Write(IoHandle file, const void* buffer, size_t length, uint64_t offset, uint64_t tag) = 0;
+
+    // Start everything queued and block until at least one request has completed.
+    // Returns the number of completions stored, at most capacity, 0 when nothing is
+    // in flight. Throws std::system_error.
+    virtual size_t Wait(IoCompletion* completions, size_t capacity) = 0;
+
+    virtual const char* Name() const = 0;
+
+protected:
+    unsigned m_queueDepth;
+    unsigned m_inFlight = 0;
+};
+
+// Create a backend with room for queueDepth requests in flight (0 = 32).
+// Returns null for Synchronous, and for Auto when no native backend is available.
+// Throws std::system_error when an explicitly requested backend cannot be started.
+std::unique_ptr<AsyncIo> CreateAsyncIo(IoBackend backend, unsigned queueDepth);
+
+const char* IoBackendName(IoBackend backend);
+
+// Parse a name accepted on command lines (auto, sync, threads, uring, iocp)
+bool ParseIoBackend(const std::string& name, IoBackend& backend);
+
+} // namespace zdm
+
+#endif // ASYNC_IO_H
@@ -0,0 +1,243 @@
+#include "ChangeWatcher.h"
+#include "DirectoryEnumerator.h"
+
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+// Large enough to ride out a burst (a folder of thumbnails written at once) between two waits
+const size_t kNotifyBufferBytes = 64 * 1024;
+
+void AppendChange(std::vector<PathString>& changed, const PathString& directory, PathView name) {
+    if (name.empty()) {
+        // The root itself carries no data of its own
+        if (!directory.empty()) {
+            changed.push_back(directory);
+        }
+        return;
+    }
+    PathString path = directory;
+    if (!path.empty()) {
+        path += fs::path::preferred_separator;
+    }
+    path.append(name.data(), name.size());
+    changed.push_back(std::move(path));
+}
+
+} // namespace
+
+#ifdef _WIN32
+
+struct ChangeWatcher::Request {
+    OVERLAPPED overlapped = {};
+    DWORD buffer[kNotifyBufferBytes / sizeof(DWORD)]; // FILE_NOTIFY_INFORMATION needs DWORD alignment
+};
+
+ChangeWatcher::ChangeWatcher(const fs::path& root)
+    : m_root(root), m_request(std::make_unique<Request>()) {
+    HANDLE directory = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                                   FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (directory == INVALID_HANDLE_VALUE) {
+        throw fs::filesystem_error("cannot watch directory", root,
+                                   std::error_code(static_cast<int>(GetLastError()), std::system_category()));
+    }
+    m_directory = directory;
+    m_request->overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!m_request->overlapped.hEvent || !Issue()) {
+        std::error_code ec(static_cast<int>(GetLastError()), std::system_category());
+        if (m_request->overlapped.hEvent) {
+            CloseHandle(m_request->overlapped.hEvent);
+        }
+        CloseHandle(directory);
+        throw fs::filesystem_error("cannot watch directory", root, ec);
+    }
+}
+
+ChangeWatcher::~ChangeWatcher() {
+    if (m_pending) {
+        DWORD bytes = 0;
+        CancelIoEx(m_directory, &m_request->overlapped);
+        GetOverlappedResult(m_directory, &m_request->overlapped, &bytes, TRUE);
+    }
+    CloseHandle(m_request->overlapped.hEvent);
+    CloseHandle(m_directory);
+}
+
+bool ChangeWatcher::Issue() {
+    const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                         FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_ATTRIBUTES;
+    ResetEvent(m_request->overlapped.hEvent);
+    m_pending = ReadDirectoryChangesW(m_directory, m_request->buffer, sizeof(m_request->buffer), TRUE, filter,
+                                      NULL, &m_request->overlapped, NULL) != 0;
+    return m_pending;
+}
+
+bool ChangeWatcher::Wait(std::chrono::milliseconds timeout, std::vector<PathString>& changed) {
+    if (!m_pending && !Issue()) {
+        // The handle went bad (the root was removed), nothing more will be reported
+        Sleep(static_cast<DWORD>(timeout.count()));
+        return false;
+    }
+    if (WaitForSingleObject(m_request->overlapped.hEvent, static_cast<DWORD>(timeout.count())) != WAIT_OBJECT_0) {
+        bool lost = m_lost;
+        m_lost = false;
+        return !lost;
+    }
+
+    DWORD bytes = 0;
+    BOOL completed = GetOverlappedResult(m_directory, &m_request->overlapped, &bytes, FALSE);
+    m_pending = false;
+
+    // Zero bytes: more changes than the buffer holds, the system dropped them
+    bool lost = m_lost || !completed || bytes == 0;
+    m_lost = false;
+    if (completed && bytes > 0) {
+        const unsigned char* next = reinterpret_cast<const unsigned char*>(m_request->buffer);
+        for (;;) {
+            const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(next);
+            AppendChange(changed, PathString(), PathView(info->FileName, info->FileNameLength / sizeof(WCHAR)));
+            if (info->NextEntryOffset == 0) {
+                break;
+            }
+            next += info->NextEntryOffset;
+        }
+    }
+
+    // Ask again right away, changes made from here on queue up in the system
+    if (!Issue()) {
+        m_lost = true;
+    }
+    return !lost;
+}
+
+#else
+
+namespace {
+
+const uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |
+                            IN_ATTRIB | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+} // namespace
+
+ChangeWatcher::ChangeWatcher(const fs::path& root)
+    : m_root(root), m_buffer(kNotifyBufferBytes) {
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        throw fs::filesystem_error("cannot watch directory", root, std::error_code(errno, std::generic_category()));
+    }
+    int wd = inotify_add_watch(m_fd, root.c_str(), kWatchMask);
+    if (wd < 0) {
+        std::error_code ec(errno, std::generic_category());
+        close(m_fd);
+        throw fs::filesystem_error("cannot watch directory", root, ec);
+    }
+    m_watches[wd] = PathString();
+
+    try {
+        m_enumerator = std::make_unique<DirectoryEnumerator>(root);
+        AddWatches(PathString());
+    } catch (...) {
+        close(m_fd);
+        throw;
+    }
+}
+
+ChangeWatcher::~ChangeWatcher() {
+    close(m_fd);
+}
+
+void ChangeWatcher::AddWatches(const PathString& relativePath) {
+    std::vector<PathString> directories{ relativePath };
+    while (!directories.empty()) {
+        PathString directory = std::move(directories.back());
+        directories.pop_back();
+
+        if (!directory.empty()) {
+            // A directory moved within the tree keeps its watch, this only updates its path
+            int wd = inotify_add_watch(m_fd, (m_root / directory).c_str(), kWatchMask);
+            if (wd < 0) {
+                // Gone again, or out of watches (fs.inotify.max_user_watches): only a rescan sees it now
+                if (errno != ENOENT && errno != ENOTDIR) {
+                    m_lost = true;
+                }
+                continue;
+            }
+            m_watches[wd] = directory;
+        }
+
+        try {
+            for (const DirectoryEntryInfo& entry : m_enumerator->Read(directory)) {
+                if (entry.type == EntryType::Directory) {
+                    PathString child = directory;
+                    if (!child.empty()) {
+                        child += fs::path::preferred_separator;
+                    }
+                    child.append(entry.name.data(), entry.name.size());
+                    directories.push_back(std::move(child));
+                }
+            }
+        } catch (const fs::filesystem_error&) {
+            // Removed while it was being read, its own notification follows
+        }
+    }
+}
+
+bool ChangeWatcher::Wait(std::chrono::milliseconds timeout, std::vector<PathString>& changed) {
+    pollfd ready = { m_fd, POLLIN, 0 };
+    if (poll(&ready, 1, static_cast<int>(timeout.count())) > 0) {
+        std::vector<PathString> newDirectories;
+        for (;;) {
+            ssize_t length = read(m_fd, m_buffer.data(), m_buffer.size());
+            if (length <= 0) {
+                break;
+            }
+            for (char* next = m_buffer.data(); next < m_buffer.data() + length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(next);
+                next += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    m_lost = true;
+                    continue;
+                }
+                auto watch = m_watches.find(event->wd);
+                if (watch == m_watches.end()) {
+                    continue;
+                }
+                if (event->mask & IN_IGNORED) {
+                    m_watches.erase(watch);
+                    continue;
+                }
+
+                // The name is padded with NULs up to len
+                PathView name = event->len ? PathView(event->name) : PathView();
+                AppendChange(changed, watch->second, name);
+                if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                    newDirectories.push_back(changed.back());
+                }
+            }
+        }
+        for (const PathString& directory : newDirectories) {
+            AddWatches(directory);
+        }
+    }
+
+    bool lost = m_lost;
+    m_lost = false;
+    return !lost;
+}
+
+#endif
+
+} // namespace zdm
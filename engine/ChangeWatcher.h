@@ -0,0 +1,63 @@
+#ifndef CHANGE_WATCHER_H
+#define CHANGE_WATCHER_H
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Manifest.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+class DirectoryEnumerator;
+
+// Change notifications for a whole tree, read without polling the disk.
+// Linux: inotify with one watch per directory, directories that appear later are
+// watched as they are reported. (fanotify would watch a whole mount with one mark,
+// but needs CAP_SYS_ADMIN.) Windows: ReadDirectoryChangesW on the root with subtree
+// watching. Only paths are reported, what happened to them is read from the tree.
+// Not thread-safe, one thread waits on it.
+class ChangeWatcher {
+public:
+    // Start watching root. Throws fs::filesystem_error when it cannot be watched at all.
+    explicit ChangeWatcher(const fs::path& root);
+    ~ChangeWatcher();
+
+    ChangeWatcher(const ChangeWatcher&) = delete;
+    ChangeWatcher& operator=(const ChangeWatcher&) = delete;
+
+    // Wait up to timeout for notifications and append the relative paths they name to
+    // changed, a path may repeat. A directory that is new to the tree is reported once,
+    // its content may not be. Returns false when notifications were lost (the kernel
+    // queue overflowed, a directory could not be watched): rescan the tree to catch up.
+    bool Wait(std::chrono::milliseconds timeout, std::vector<PathString>& changed);
+
+private:
+    fs::path m_root;
+    bool m_lost = false;
+#ifdef _WIN32
+    struct Request; // OVERLAPPED and the notification buffer
+
+    bool Issue();
+
+    void* m_directory = nullptr; // HANDLE
+    std::unique_ptr<Request> m_request;
+    bool m_pending = false;
+#else
+    // Watch relativePath and every directory below it
+    void AddWatches(const PathString& relativePath);
+
+    int m_fd = -1;
+    std::unordered_map<int, PathString> m_watches; // watch descriptor and relative directory
+    std::unique_ptr<DirectoryEnumerator> m_enumerator;
+    std::vector<char> m_buffer;
+#endif
+};
+
+} // namespace zdm
+
+#endif // CHANGE_WATCHER_H
@@ -0,0 +1,321 @@
+#include "Checksum.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define ZDM_CRC32C_X64 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace zdm {
+
+namespace {
+
+const uint32_t kPolynomial = 0x82F63B78; // reflected Castagnoli
+
+// Slicing-by-8 lookup tables, built on first use
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (kPolynomial & (0u - (crc & 1)));
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int slice = 1; slice < 8; slice++) {
+                table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+const Crc32cTables& Tables() {
+    static const Crc32cTables tables;
+    return tables;
+}
+
+uint32_t Crc32cScalar(uint32_t crc, const unsigned char* data, size_t length) {
+    const auto& t = Tables().table;
+    while (length >= 8) {
+        uint32_t low;
+        uint32_t high;
+        std::memcpy(&low, data, 4);
+        std::memcpy(&high, data + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef ZDM_CRC32C_X64
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse4.2")))
+#endif
+uint32_t Crc32cSse42(uint32_t crc, const unsigned char* data, size_t length) {
+    uint64_t crc64 = crc;
+    while (length > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+        crc64 = _mm_crc32_u8(static_cast<uint32_t>(crc64), *data++);
+        length--;
+    }
+    // Four independent loads per iteration keep the load unit busy
+    while (length >= 32) {
+        uint64_t a, b, c, d;
+        std::memcpy(&a, data, 8);
+        std::memcpy(&b, data + 8, 8);
+        std::memcpy(&c, data + 16, 8);
+        std::memcpy(&d, data + 24, 8);
+        crc64 = _mm_crc32_u64(crc64, a);
+        crc64 = _mm_crc32_u64(crc64, b);
+        crc64 = _mm_crc32_u64(crc64, c);
+        crc64 = _mm_crc32_u64(crc64, d);
+        data += 32;
+        length -= 32;
+    }
+    while (length >= 8) {
+        uint64_t value;
+        std::memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        length -= 8;
+    }
+    uint32_t crc32 = static_cast<uint32_t>(crc64);
+    while (length-- > 0) {
+        crc32 = _mm_crc32_u8(crc32, *data++);
+    }
+    return crc32;
+}
+
+bool CpuHasSse42() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#endif // ZDM_CRC32C_X64
+
+using Crc32cKernel = uint32_t (*)(uint32_t, const unsigned char*, size_t);
+
+Crc32cKernel SelectKernel() {
+#ifdef ZDM_CRC32C_X64
+    if (CpuHasSse42()) {
+        return Crc32cSse42;
+    }
+#endif
+    return Crc32cScalar;
+}
+
+Crc32cKernel Kernel() {
+    static const Crc32cKernel kernel = SelectKernel();
+    return kernel;
+}
+
+} // namespace
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length) {
+    return ~Kernel()(~crc, static_cast<const unsigned char*>(data), length);
+}
+
+bool Crc32cIsHardware() {
+    return Kernel() != Crc32cScalar;
+}
+
+namespace {
+
+std::FILE* OpenForHashing(const fs::path& path) {
+#ifdef _WIN32
+    std::FILE* file = _wfopen(path.c_str(), L"rb");
+#else
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+#endif
+    if (!file) {
+        throw fs::filesystem_error("cannot read file", path, std::error_code(errno, std::generic_category()));
+    }
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    return file;
+}
+
+std::vector<char>& ReadBuffer() {
+    thread_local std::vector<char> buffer(1024 * 1024);
+    return buffer;
+}
+
+} // namespace
+
+uint32_t Crc32cFile(const fs::path& path) {
+    std::FILE* file = OpenForHashing(path);
+
+    std::vector<char>& buffer = ReadBuffer();
+    uint32_t crc = 0;
+    size_t count;
+    while ((count = std::fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+        crc = Crc32c(crc, buffer.data(), count);
+    }
+    bool failed = std::ferror(file) != 0;
+    std::fclose(file);
+
+    if (failed) {
+        throw fs::filesystem_error("cannot read file", path, std::error_code(EIO, std::generic_category()));
+    }
+    return crc;
+}
+
+namespace {
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little-endian loads, the byte order XXH64 is defined in on every supported target
+uint64_t Read64(const unsigned char* data) {
+    uint64_t value;
+    std::memcpy(&value, data, 8);
+    return value;
+}
+
+uint32_t Read32(const unsigned char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, 4);
+    return value;
+}
+
+uint64_t Round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * kPrime2;
+    return RotateLeft(accumulator, 31) * kPrime1;
+}
+
+uint64_t MergeRound(uint64_t hash, uint64_t accumulator) {
+    hash ^= Round(0, accumulator);
+    return hash * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+XxHash64::XxHash64(uint64_t seed)
+    : m_state{ seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1 }, m_seed(seed) {
+}
+
+void XxHash64::Update(const void* data, size_t length) {
+    const unsigned char* input = static_cast<const unsigned char*>(data);
+    m_totalLength += length;
+
+    if (m_buffered + length < sizeof(m_buffer)) {
+        std::memcpy(m_buffer + m_buffered, input, length);
+        m_buffered += length;
+        return;
+    }
+    if (m_buffered > 0) {
+        size_t fill = sizeof(m_buffer) - m_buffered;
+        std::memcpy(m_buffer + m_buffered, input, fill);
+        for (int lane = 0; lane < 4; lane++) {
+            m_state[lane] = Round(m_state[lane], Read64(m_buffer + lane * 8));
+        }
+        input += fill;
+        length -= fill;
+        m_buffered = 0;
+    }
+    // Four independent lanes per 32-byte stripe
+    while (length >= 32) {
+        m_state[0] = Round(m_state[0], Read64(input));
+        m_state[1] = Round(m_state[1], Read64(input + 8));
+        m_state[2] = Round(m_state[2], Read64(input + 16));
+        m_state[3] = Round(m_state[3], Read64(input + 24));
+        input += 32;
+        length -= 32;
+    }
+    std::memcpy(m_buffer, input, length);
+    m_buffered = length;
+}
+
+uint64_t XxHash64::Digest() const {
+    uint64_t hash;
+    if (m_totalLength >= 32) {
+        hash = RotateLeft(m_state[0], 1) + RotateLeft(m_state[1], 7) + RotateLeft(m_state[2], 12) +
+               RotateLeft(m_state[3], 18);
+        for (uint64_t lane : m_state) {
+            hash = MergeRound(hash, lane);
+        }
+    } else {
+        hash = m_seed + kPrime5;
+    }
+    hash += m_totalLength;
+
+    const unsigned char* tail = m_buffer;
+    size_t length = m_buffered;
+    while (length >= 8) {
+        hash ^= Round(0, Read64(tail));
+        hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+        tail += 8;
+        length -= 8;
+    }
+    if (length >= 4) {
+        hash ^= static_cast<uint64_t>(Read32(tail)) * kPrime1;
+        hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+        tail += 4;
+        length -= 4;
+    }
+    while (length-- > 0) {
+        hash ^= *tail++ * kPrime5;
+        hash = RotateLeft(hash, 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+FileFingerprint FingerprintFile(const fs::path& path, uint64_t limit) {
+    std::FILE* file = OpenForHashing(path);
+
+    std::vector<char>& buffer = ReadBuffer();
+    XxHash64 xxh;
+    FileFingerprint fingerprint;
+    size_t count;
+    while (limit > 0 &&
+           (count = std::fread(buffer.data(), 1, static_cast<size_t>(std::min<uint64_t>(buffer.size(), limit)), file)) > 0) {
+        xxh.Update(buffer.data(), count);
+        fingerprint.crc32c = Crc32c(fingerprint.crc32c, buffer.data(), count);
+        limit -= count;
+    }
+    bool failed = std::ferror(file) != 0;
+    std::fclose(file);
+
+    if (failed) {
+        throw fs::filesystem_error("cannot read file", path, std::error_code(EIO, std::generic_category()));
+    }
+    fingerprint.xxh64 = xxh.Digest();
+    return fingerprint;
+}
+
+} // namespace zdm
@@ -0,0 +1,59 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it,
+// otherwise a slicing-by-8 table implementation. Start with crc = 0 and feed
+// the previous result back in to hash data in pieces.
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length);
+
+// True when Crc32c runs on the hardware instruction
+bool Crc32cIsHardware();
+
+// CRC32C of a whole file. Throws fs::filesystem_error if it cannot be read.
+uint32_t Crc32cFile(const fs::path& path);
+
+// XXH64, fed in pieces like Crc32c. 64 bits keep accidental matches between
+// different files out of the picture where CRC32C alone would not.
+class XxHash64 {
+public:
+    explicit XxHash64(uint64_t seed = 0);
+
+    void Update(const void* data, size_t length);
+    uint64_t Digest() const;
+
+private:
+    uint64_t m_state[4];
+    uint64_t m_seed;
+    uint64_t m_totalLength = 0;
+    unsigned char m_buffer[32];
+    size_t m_buffered = 0;
+};
+
+// Content fingerprint for finding identical files: two independent hashes of the same bytes
+struct FileFingerprint {
+    uint64_t xxh64 = 0;
+    uint32_t crc32c = 0;
+
+    bool operator==(const FileFingerprint& other) const {
+        return xxh64 == other.xxh64 && crc32c == other.crc32c;
+    }
+    bool operator<(const FileFingerprint& other) const {
+        return xxh64 != other.xxh64 ? xxh64 < other.xxh64 : crc32c < other.crc32c;
+    }
+};
+
+// Fingerprint of the first limit bytes of a file, the whole file by default.
+// Throws fs::filesystem_error if it cannot be read.
+FileFingerprint FingerprintFile(const fs::path& path, uint64_t limit = UINT64_MAX);
+
+} // namespace zdm
+
+#endif // CHECKSUM_H
@@ -0,0 +1,668 @@
+#include "ColdArchive.h"
+#include "Checksum.h"
+#include "CopyEngine.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+
+#ifdef ZDM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+const char kMagic[8] = { 'Z', 'D', 'M', 'A', 'R', 'C', 'H', 'V' };
+const uint32_t kVersion = 1;
+
+// File data is cut into blocks of this size, the last block of a container may be shorter
+const uint32_t kBlockSize = 1024 * 1024;
+
+enum Codec : uint8_t {
+    kCodecStored = 0,
+    kCodecZstd = 1
+};
+
+// BlockRecord::rawSize flag: the block is kept as it was, compressing it did not pay
+const uint32_t kStoredBlock = 0x80000000u;
+
+struct ContainerHeader {
+    char magic[8];
+    uint32_t version;
+    uint16_t pathCharSize; // sizeof(PathChar) of the writer
+    uint8_t codec;
+    uint8_t reserved0;
+    uint32_t blockSize;
+    uint32_t reserved1;
+    uint64_t blockCount;
+    uint64_t fileCount;
+    uint64_t indexOffset; // block table, then file table, then path table
+    uint64_t pathChars;
+    uint64_t rawBytes;    // file data before compression
+};
+
+struct BlockRecord {
+    uint64_t offset; // in the container
+    uint32_t packedSize;
+    uint32_t rawSize; // | kStoredBlock
+};
+
+struct FileRecord {
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t dataOffset; // in the file data before compression, blocks are kBlockSize apart
+    uint32_t crc32c;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ContainerHeader) == 64, "archive header layout");
+static_assert(sizeof(BlockRecord) == 16, "archive block record layout");
+static_assert(sizeof(FileRecord) == 40, "archive file record layout");
+
+[[noreturn]] void ThrowArchiveError(const char* what, const fs::path& path, std::errc error) {
+    throw fs::filesystem_error(what, path, std::make_error_code(error));
+}
+
+Codec WriterCodec() {
+#ifdef ZDM_HAVE_ZSTD
+    return kCodecZstd;
+#else
+    return kCodecStored;
+#endif
+}
+
+// One block on its way from the reader through a compression worker to the container
+struct PendingBlock {
+    std::vector<char> raw;
+    std::vector<char> packed;
+    bool stored = true;
+};
+
+void CompressBlock(PendingBlock& block, int level) {
+#ifdef ZDM_HAVE_ZSTD
+    block.packed.resize(ZSTD_compressBound(block.raw.size()));
+    size_t packed = ZSTD_compress(block.packed.data(), block.packed.size(), block.raw.data(), block.raw.size(), level);
+    // Media is mostly compressed already, a block that shrinks by less than 3% is stored
+    if (!ZSTD_isError(packed) && packed < block.raw.size() - block.raw.size() / 32) {
+        block.packed.resize(packed);
+        block.stored = false;
+        return;
+    }
+#else
+    (void)level;
+#endif
+    block.packed.clear();
+    block.stored = true;
+}
+
+// Raw data of a block read back from a container
+void DecompressBlock(const BlockRecord& record, std::vector<char>& packed, std::vector<char>& raw,
+                     const fs::path& path) {
+    uint32_t rawSize = record.rawSize & ~kStoredBlock;
+    if (record.rawSize & kStoredBlock) {
+        raw.swap(packed);
+        if (raw.size() != rawSize) {
+            ThrowArchiveError("damaged archive block", path, std::errc::io_error);
+        }
+        return;
+    }
+#ifdef ZDM_HAVE_ZSTD
+    raw.resize(rawSize);
+    size_t size = ZSTD_decompress(raw.data(), raw.size(), packed.data(), packed.size());
+    if (ZSTD_isError(size) || size != rawSize) {
+        ThrowArchiveError("damaged archive block", path, std::errc::io_error);
+    }
+#else
+    ThrowArchiveError("archive is compressed with zstd, this build cannot read it", path,
+                      std::errc::function_not_supported);
+#endif
+}
+
+void ReadBlock(std::ifstream& in, const BlockRecord& record, std::vector<char>& packed, const fs::path& path) {
+    packed.resize(record.packedSize);
+    in.seekg(static_cast<std::streamoff>(record.offset));
+    in.read(packed.data(), static_cast<std::streamsize>(packed.size()));
+    if (!in) {
+        ThrowArchiveError("cannot read archive", path, std::errc::io_error);
+    }
+}
+
+// Restore a file's modification time from the ManifestEntry::mtime clock
+void SetModificationTime(const fs::path& path, int64_t mtime) {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    FILETIME writeTime;
+    writeTime.dwLowDateTime = static_cast<DWORD>(static_cast<uint64_t>(mtime));
+    writeTime.dwHighDateTime = static_cast<DWORD>(static_cast<uint64_t>(mtime) >> 32);
+    SetFileTime(file, NULL, NULL, &writeTime);
+    CloseHandle(file);
+#else
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = static_cast<time_t>(mtime / 1000000000);
+    times[1].tv_nsec = static_cast<long>(mtime % 1000000000);
+    utimensat(AT_FDCWD, path.c_str(), times, 0);
+#endif
+}
+
+// Writes one container: blocks as they come back from the workers, in order, then the index
+class ContainerWriter {
+public:
+    explicit ContainerWriter(const fs::path& path) : m_path(path), m_temporary(path) {
+        m_temporary += ".tmp";
+        m_out.open(m_temporary, std::ios_base::binary | std::ios_base::trunc);
+        if (!m_out.is_open()) {
+            ThrowArchiveError("cannot create archive", m_temporary, std::errc::io_error);
+        }
+        // Placeholder, the header is complete once the index is known
+        ContainerHeader header = {};
+        m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        m_offset = sizeof(header);
+    }
+
+    ~ContainerWriter() {
+        if (m_out.is_open()) {
+            m_out.close();
+            std::error_code ec;
+            fs::remove(m_temporary, ec);
+        }
+    }
+
+    // Bytes written so far
+    uint64_t Offset() const { return m_offset; }
+    uint64_t RawBytes() const { return m_rawBytes; }
+    bool Empty() const { return m_files.empty(); }
+
+    void AddFile(PathView relativePath, const ManifestEntry& entry, uint64_t dataOffset, uint32_t crc) {
+        FileRecord record = {};
+        record.pathOffset = static_cast<uint32_t>(m_pathPool.size());
+        record.pathLength = static_cast<uint32_t>(relativePath.size());
+        record.size = entry.size;
+        record.mtime = entry.mtime;
+        record.dataOffset = dataOffset;
+        record.crc32c = crc;
+        m_files.push_back(record);
+        m_pathPool.append(relativePath.data(), relativePath.size());
+    }
+
+    void WriteBlock(const PendingBlock& block) {
+        const std::vector<char>& data = block.stored ? block.raw : block.packed;
+        BlockRecord record = {};
+        record.offset = m_offset;
+        record.packedSize = static_cast<uint32_t>(data.size());
+        record.rawSize = static_cast<uint32_t>(block.raw.size()) | (block.stored ? kStoredBlock : 0);
+        m_out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        m_blocks.push_back(record);
+        m_offset += data.size();
+        m_rawBytes += block.raw.size();
+        if (!m_out) {
+            ThrowArchiveError("cannot write archive", m_temporary, std::errc::io_error);
+        }
+    }
+
+    // Write the index and the header and give the container its final name
+    void Finish(ArchiveStats& stats) {
+        ContainerHeader header = {};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.pathCharSize = sizeof(PathChar);
+        header.codec = WriterCodec();
+        header.blockSize = kBlockSize;
+        header.blockCount = m_blocks.size();
+        header.fileCount = m_files.size();
+        header.indexOffset = m_offset;
+        header.pathChars = m_pathPool.size();
+        header.rawBytes = m_rawBytes;
+
+        m_out.write(reinterpret_cast<const char*>(m_blocks.data()),
+                    static_cast<std::streamsize>(m_blocks.size() * sizeof(BlockRecord)));
+        m_out.write(reinterpret_cast<const char*>(m_files.data()),
+                    static_cast<std::streamsize>(m_files.size() * sizeof(FileRecord)));
+        m_out.write(reinterpret_cast<const char*>(m_pathPool.data()),
+                    static_cast<std::streamsize>(m_pathPool.size() * sizeof(PathChar)));
+        uint64_t end = static_cast<uint64_t>(m_out.tellp());
+        m_out.seekp(0);
+        m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        m_out.flush();
+        if (!m_out) {
+            ThrowArchiveError("cannot write archive", m_temporary, std::errc::io_error);
+        }
+        m_out.close();
+        fs::rename(m_temporary, m_path);
+
+        stats.containers++;
+        stats.storedBytes += end;
+        stats.blocks += m_blocks.size();
+        for (const BlockRecord& block : m_blocks) {
+            stats.blocksStored += (block.rawSize & kStoredBlock) ? 1 : 0;
+        }
+    }
+
+private:
+    fs::path m_path;
+    fs::path m_temporary;
+    std::ofstream m_out;
+    uint64_t m_offset = 0;
+    uint64_t m_rawBytes = 0;
+    std::vector<BlockRecord> m_blocks;
+    std::vector<FileRecord> m_files;
+    PathString m_pathPool;
+};
+
+// Keeps a bounded number of blocks compressing on the pool and hands them to the
+// container in the order they were filled
+class BlockPipeline {
+public:
+    BlockPipeline(WorkStealingPool& pool, int level)
+        : m_pool(pool), m_level(level), m_limit(pool.ThreadCount() * 2) {}
+
+    void Submit(std::shared_ptr<PendingBlock> block, ContainerWriter& writer) {
+        auto slot = std::make_shared<Slot>();
+        slot->block = std::move(block);
+        m_slots.push_back(slot);
+        m_pool.Submit([this, slot]() {
+            std::exception_ptr error;
+            try {
+                CompressBlock(*slot->block, m_level);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot->error = error;
+            slot->done = true;
+            m_blockDone.notify_all();
+        });
+        while (m_slots.size() > m_limit) {
+            WriteOldest(writer);
+        }
+    }
+
+    void Drain(ContainerWriter& writer) {
+        while (!m_slots.empty()) {
+            WriteOldest(writer);
+        }
+    }
+
+    // Wait for the workers without writing, before an exception leaves the pipeline
+    void Abandon() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (const auto& slot : m_slots) {
+            m_blockDone.wait(lock, [&slot] { return slot->done; });
+        }
+        m_slots.clear();
+    }
+
+private:
+    struct Slot {
+        std::shared_ptr<PendingBlock> block;
+        std::exception_ptr error;
+        bool done = false;
+    };
+
+    void WriteOldest(ContainerWriter& writer) {
+        std::shared_ptr<Slot> slot = m_slots.front();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_blockDone.wait(lock, [&slot] { return slot->done; });
+        }
+        m_slots.pop_front();
+        if (slot->error) {
+            std::rethrow_exception(slot->error);
+        }
+        writer.WriteBlock(*slot->block);
+    }
+
+    WorkStealingPool& m_pool;
+    int m_level;
+    size_t m_limit;
+    std::deque<std::shared_ptr<Slot>> m_slots;
+    std::mutex m_mutex;
+    std::condition_variable m_blockDone;
+};
+
+fs::path ContainerPath(const fs::path& directory, uint64_t number) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%05llu.zdma", static_cast<unsigned long long>(number));
+    return directory / name;
+}
+
+} // namespace
+
+// A container's index, loaded by ArchiveReader
+struct ArchiveReader::Container {
+    fs::path path;
+    ContainerHeader header = {};
+    std::vector<BlockRecord> blocks;
+    std::vector<FileRecord> files;
+    PathString pathPool;
+
+    PathView RelativePath(const FileRecord& file) const {
+        return PathView(pathPool.data() + file.pathOffset, file.pathLength);
+    }
+
+    const FileRecord* Find(PathView relativePath) const {
+        auto it = std::lower_bound(files.begin(), files.end(), relativePath,
+                                   [this](const FileRecord& file, PathView path) {
+                                       return ComparePathOrder(RelativePath(file), path) < 0;
+                                   });
+        return it != files.end() && RelativePath(*it) == relativePath ? &*it : nullptr;
+    }
+
+    // Pass the data of file to sink in pieces, decompressing only the blocks it spans.
+    // Returns the CRC32C of the data.
+    template <typename Sink>
+    uint32_t Read(const FileRecord& file, Sink&& sink) const {
+        std::ifstream in(path, std::ios_base::binary);
+        if (!in.is_open()) {
+            ThrowArchiveError("cannot open archive", path, std::errc::io_error);
+        }
+        std::vector<char> packed;
+        std::vector<char> raw;
+        uint32_t crc = 0;
+        uint64_t position = file.dataOffset;
+        uint64_t end = file.dataOffset + file.size;
+        while (position < end) {
+            uint64_t index = position / header.blockSize;
+            if (index >= blocks.size()) {
+                ThrowArchiveError("damaged archive index", path, std::errc::io_error);
+            }
+            ReadBlock(in, blocks[index], packed, path);
+            DecompressBlock(blocks[index], packed, raw, path);
+            uint64_t blockStart = index * header.blockSize;
+            size_t from = static_cast<size_t>(position - blockStart);
+            size_t to = static_cast<size_t>(std::min<uint64_t>(end - blockStart, raw.size()));
+            if (from >= to) {
+                ThrowArchiveError("damaged archive index", path, std::errc::io_error);
+            }
+            crc = Crc32c(crc, raw.data() + from, to - from);
+            sink(raw.data() + from, to - from);
+            position = blockStart + to;
+        }
+        return crc;
+    }
+};
+
+PlacementPolicy DefaultArchivePolicy(int64_t minAgeDays) {
+    std::istringstream rules(
+        "fast ext=.db,.db-wal,.db-shm,.db-journal,.sqlite,.sqlite-wal,.sqlite-shm,.ldb,.idx\n"
+        "bulk dir=picture,video,file,ZaloDownloads age>=" + std::to_string(minAgeDays) + "d\n"
+        "default fast\n");
+    return ParsePlacementPolicy(rules);
+}
+
+std::vector<size_t> SelectArchived(const Manifest& manifest, const PlacementPolicy& policy) {
+    std::vector<size_t> indexes;
+    int64_t now = MtimeNow();
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        const ManifestEntry& entry = manifest[i];
+        if (entry.type == EntryType::File && policy.Classify(manifest, entry, now) == Tier::Bulk) {
+            indexes.push_back(i);
+        }
+    }
+    return indexes;
+}
+
+fs::path ArchivePath(const fs::path& destination) {
+    fs::path folder = destination.has_filename() ? destination : destination.parent_path();
+    fs::path archive = folder;
+    archive += ".zdm-archive";
+    return archive;
+}
+
+bool ArchiveCompresses() {
+    return WriterCodec() != kCodecStored;
+}
+
+ArchiveStats WriteArchive(const fs::path& directory, const fs::path& root, const Manifest& manifest,
+                          const std::vector<size_t>& indexes, const ArchiveOptions& options) {
+    ArchiveStats stats;
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+
+    WorkStealingPool pool(options.threadCount);
+    BlockPipeline pipeline(pool, options.compressionLevel);
+    std::unique_ptr<ContainerWriter> writer;
+    uint64_t containerNumber = 0;
+    uint64_t containerBytes = 0; // file data put in the current container, blocks in flight included
+    auto block = std::make_shared<PendingBlock>();
+
+    // A full block goes to the workers while the next one is filled
+    auto submit = [&]() {
+        pipeline.Submit(std::move(block), *writer);
+        block = std::make_shared<PendingBlock>();
+    };
+    auto finish = [&]() {
+        if (!block->raw.empty()) {
+            submit();
+        }
+        pipeline.Drain(*writer);
+        writer->Finish(stats);
+        writer.reset();
+    };
+    auto checkCancel = [&]() {
+        if (options.cancel && options.cancel->load()) {
+            throw CopyCanceled();
+        }
+    };
+
+    try {
+        for (size_t index : indexes) {
+            checkCancel();
+            const ManifestEntry& entry = manifest[index];
+            PathView relativePath = manifest.RelativePath(entry);
+            if (writer && !writer->Empty() && containerBytes >= options.maxContainerBytes) {
+                finish();
+            }
+            if (!writer) {
+                writer = std::make_unique<ContainerWriter>(ContainerPath(directory, ++containerNumber));
+                containerBytes = 0;
+            }
+
+            fs::path source = root / PathString(relativePath);
+            std::ifstream in(source, std::ios_base::binary);
+            if (!in.is_open()) {
+                ThrowArchiveError("cannot read file to archive", source, std::errc::io_error);
+            }
+            uint64_t dataOffset = containerBytes;
+            uint64_t remaining = entry.size;
+            uint32_t crc = 0;
+            while (remaining > 0) {
+                size_t used = block->raw.size();
+                size_t chunk = static_cast<size_t>(std::min<uint64_t>(kBlockSize - used, remaining));
+                block->raw.resize(used + chunk);
+                in.read(block->raw.data() + used, static_cast<std::streamsize>(chunk));
+                if (static_cast<size_t>(in.gcount()) != chunk) {
+                    // Shorter than scanned: the file changed, the index would not match it
+                    ThrowArchiveError("file changed while archiving", source, std::errc::io_error);
+                }
+                crc = Crc32c(crc, block->raw.data() + used, chunk);
+                remaining -= chunk;
+                containerBytes += chunk;
+                if (block->raw.size() == kBlockSize) {
+                    submit();
+                    checkCancel();
+                }
+            }
+            if (in.peek() != std::ifstream::traits_type::eof()) {
+                // Longer than scanned: archiving the scanned size would silently cut it
+                ThrowArchiveError("file changed while archiving", source, std::errc::io_error);
+            }
+            writer->AddFile(relativePath, entry, dataOffset, crc);
+            stats.files++;
+            stats.bytes += entry.size;
+        }
+        if (writer) {
+            finish();
+        }
+    } catch (...) {
+        pipeline.Abandon();
+        throw;
+    }
+
+    if (options.verify && stats.files > 0) {
+        ArchiveReader(directory).Verify();
+    }
+    return stats;
+}
+
+ArchiveReader::ArchiveReader(const fs::path& directory) {
+    std::vector<fs::path> paths;
+    for (const fs::directory_entry& item : fs::directory_iterator(directory)) {
+        if (item.is_regular_file() && item.path().extension() == ".zdma") {
+            paths.push_back(item.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    for (const fs::path& path : paths) {
+        auto container = std::make_unique<Container>();
+        container->path = path;
+        uint64_t fileSize = fs::file_size(path);
+        std::ifstream in(path, std::ios_base::binary);
+        ContainerHeader& header = container->header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion) {
+            ThrowArchiveError("not an archive container", path, std::errc::invalid_argument);
+        }
+        if (header.pathCharSize != sizeof(PathChar) || header.blockSize == 0 ||
+            header.codec > kCodecZstd) {
+            ThrowArchiveError("archive written by an incompatible build", path, std::errc::invalid_argument);
+        }
+        uint64_t indexBytes = header.blockCount * sizeof(BlockRecord) + header.fileCount * sizeof(FileRecord) +
+                              header.pathChars * sizeof(PathChar);
+        if (header.indexOffset < sizeof(header) || header.indexOffset > fileSize ||
+            indexBytes > fileSize - header.indexOffset) {
+            ThrowArchiveError("damaged archive index", path, std::errc::io_error);
+        }
+
+        container->blocks.resize(static_cast<size_t>(header.blockCount));
+        container->files.resize(static_cast<size_t>(header.fileCount));
+        container->pathPool.resize(static_cast<size_t>(header.pathChars));
+        in.seekg(static_cast<std::streamoff>(header.indexOffset));
+        in.read(reinterpret_cast<char*>(container->blocks.data()),
+                static_cast<std::streamsize>(container->blocks.size() * sizeof(BlockRecord)));
+        in.read(reinterpret_cast<char*>(container->files.data()),
+                static_cast<std::streamsize>(container->files.size() * sizeof(FileRecord)));
+        in.read(reinterpret_cast<char*>(&container->pathPool[0]),
+                static_cast<std::streamsize>(container->pathPool.size() * sizeof(PathChar)));
+        if (!in) {
+            ThrowArchiveError("cannot read archive", path, std::errc::io_error);
+        }
+        for (const BlockRecord& block : container->blocks) {
+            if (block.offset < sizeof(header) || block.packedSize > header.indexOffset - block.offset) {
+                ThrowArchiveError("damaged archive index", path, std::errc::io_error);
+            }
+        }
+        for (const FileRecord& file : container->files) {
+            if (static_cast<uint64_t>(file.pathOffset) + file.pathLength > header.pathChars ||
+                file.dataOffset + file.size > header.rawBytes) {
+                ThrowArchiveError("damaged archive index", path, std::errc::io_error);
+            }
+        }
+        m_containers.push_back(std::move(container));
+    }
+}
+
+ArchiveReader::~ArchiveReader() = default;
+
+size_t ArchiveReader::Size() const {
+    size_t size = 0;
+    for (const auto& container : m_containers) {
+        size += container->files.size();
+    }
+    return size;
+}
+
+std::vector<ArchiveEntry> ArchiveReader::List() const {
+    std::vector<ArchiveEntry> entries;
+    entries.reserve(Size());
+    for (const auto& container : m_containers) {
+        for (const FileRecord& file : container->files) {
+            ArchiveEntry entry;
+            entry.relativePath = PathString(container->RelativePath(file));
+            entry.size = file.size;
+            entry.mtime = file.mtime;
+            entry.crc32c = file.crc32c;
+            entries.push_back(std::move(entry));
+        }
+    }
+    return entries;
+}
+
+bool ArchiveReader::Extract(const PathString& relativePath, const fs::path& output) const {
+    for (const auto& container : m_containers) {
+        const FileRecord* file = container->Find(relativePath);
+        if (!file) {
+            continue;
+        }
+        if (output.has_parent_path()) {
+            fs::create_directories(output.parent_path());
+        }
+        fs::path temporary = output;
+        temporary += ".tmp";
+        std::ofstream out(temporary, std::ios_base::binary | std::ios_base::trunc);
+        if (!out.is_open()) {
+            ThrowArchiveError("cannot create extracted file", temporary, std::errc::io_error);
+        }
+        uint32_t crc = 0;
+        try {
+            crc = container->Read(*file, [&out](const char* data, size_t size) {
+                out.write(data, static_cast<std::streamsize>(size));
+            });
+        } catch (...) {
+            out.close();
+            std::error_code ec;
+            fs::remove(temporary, ec);
+            throw;
+        }
+        out.close();
+        if (!out || crc != file->crc32c) {
+            std::error_code ec;
+            fs::remove(temporary, ec);
+            ThrowArchiveError(out ? "archived file does not match its checksum" : "cannot write extracted file",
+                              output, std::errc::io_error);
+        }
+        SetModificationTime(temporary, file->mtime);
+        fs::rename(temporary, output);
+        return true;
+    }
+    return false;
+}
+
+void ArchiveReader::Verify() const {
+    for (const auto& container : m_containers) {
+        for (const FileRecord& file : container->files) {
+            uint32_t crc = container->Read(file, [](const char*, size_t) {});
+            if (crc != file.crc32c) {
+                ThrowArchiveError("archived file does not match its checksum",
+                                  container->path / PathString(container->RelativePath(file)), std::errc::io_error);
+            }
+        }
+    }
+}
+
+} // namespace zdm
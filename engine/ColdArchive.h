@@ -0,0 +1,104 @@
+#ifndef COLD_ARCHIVE_H
+#define COLD_ARCHIVE_H
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Manifest.h"
+#include "PlacementPolicy.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Files that go into the cold archive instead of being copied as plain files
+struct ArchiveOptions {
+    // Files the policy puts in the bulk tier are archived, see DefaultArchivePolicy
+    PlacementPolicy policy;
+    unsigned threadCount = 0;   // compression workers, 0 = auto
+    int compressionLevel = 3;   // zstd level, ignored when blocks are stored
+    uint64_t maxContainerBytes = 4ull << 30; // a new container is started past this size
+    bool verify = false;        // decompress every block again and check each file's CRC32C
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+// Media (pictures, videos, files, downloads) not written for minAgeDays. Databases,
+// thumbnails and everything Zalo opens on its own stay plain files.
+PlacementPolicy DefaultArchivePolicy(int64_t minAgeDays);
+
+// Indexes of the regular files of manifest that policy puts in the bulk tier, ascending
+std::vector<size_t> SelectArchived(const Manifest& manifest, const PlacementPolicy& policy);
+
+struct ArchiveStats {
+    uint64_t files = 0;
+    uint64_t bytes = 0;        // of the archived files
+    uint64_t storedBytes = 0;  // written to the containers, index included
+    uint64_t containers = 0;
+    uint64_t blocks = 0;
+    uint64_t blocksStored = 0; // kept uncompressed because compression did not pay (JPEG, MP4)
+};
+
+// Container directory for the data folder at destination: "<folder>.zdm-archive" beside it
+fs::path ArchivePath(const fs::path& destination);
+
+// True when blocks are compressed (built with zstd), otherwise they are stored as they are
+bool ArchiveCompresses();
+
+// Pack the files of manifest at indexes (regular files, in manifest order) from root into
+// containers "00001.zdma", "00002.zdma"... in directory, which is emptied first.
+// A container is a run of blocks of 1 MiB of file data, each compressed on its own by the
+// worker threads while the files are read, followed by an index of the blocks and of the
+// files (path, size, mtime, CRC32C, offset in the data) sorted by path, so one file is read
+// back by decompressing only the blocks it spans. Containers are written under a temporary
+// name and renamed once complete.
+// Throws fs::filesystem_error (a file that cannot be read or no longer has its scanned size,
+// a full disk) or CopyCanceled.
+ArchiveStats WriteArchive(const fs::path& directory, const fs::path& root, const Manifest& manifest,
+                          const std::vector<size_t>& indexes, const ArchiveOptions& options);
+
+// One archived file
+struct ArchiveEntry {
+    PathString relativePath;
+    uint64_t size = 0;
+    int64_t mtime = 0; // on the ManifestEntry::mtime clock
+    uint32_t crc32c = 0;
+};
+
+// Read side of an archive directory: every container's index is loaded, the data is read
+// on demand. Safe for concurrent Extract calls.
+class ArchiveReader {
+public:
+    // Throws fs::filesystem_error when a container is missing its index or is damaged
+    explicit ArchiveReader(const fs::path& directory);
+    ~ArchiveReader();
+
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    size_t Size() const;
+
+    // Every archived file, in path order per container
+    std::vector<ArchiveEntry> List() const;
+
+    // Write the archived file relativePath to output with its mtime and check its CRC32C.
+    // Returns false when the archive does not hold it.
+    // Throws fs::filesystem_error when it cannot be read back or written.
+    bool Extract(const PathString& relativePath, const fs::path& output) const;
+
+    // Decompress every file and check its CRC32C.
+    // Throws fs::filesystem_error at the first one that does not match.
+    void Verify() const;
+
+private:
+    struct Container;
+
+    std::vector<std::unique_ptr<Container>> m_containers;
+};
+
+} // namespace zdm
+
+#endif // COLD_ARCHIVE_H
@@ -0,0 +1,695 @@
+#include "CopyEngine.h"
+#include "Checksum.h"
+#include "Dedup.h"
+#include "DirectoryEnumerator.h"
+#include "SmallFileBatch.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+namespace zdm {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The slowest files of a run. Offer only locks once a file beats the current
+// threshold, so the copy threads almost never contend on it.
+class SlowestFiles {
+public:
+    // Set before the copy threads start
+    void SetCapacity(size_t capacity) { m_capacity = capacity; }
+
+    void Offer(size_t index, double seconds) {
+        if (m_capacity == 0 || seconds <= m_threshold.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto position = std::find_if(m_files.begin(), m_files.end(),
+                                     [seconds](const FileTiming& file) { return file.seconds < seconds; });
+        m_files.insert(position, { index, seconds });
+        if (m_files.size() > m_capacity) {
+            m_files.pop_back();
+        }
+        if (m_files.size() == m_capacity) {
+            m_threshold.store(m_files.back().seconds, std::memory_order_relaxed);
+        }
+    }
+
+    std::vector<FileTiming> Take() { return std::move(m_files); }
+
+private:
+    size_t m_capacity = 0;
+    std::atomic<double> m_threshold{0};
+    std::mutex m_mutex;
+    std::vector<FileTiming> m_files;
+};
+
+// Whether the destination takes clones of the source files, learned from the first attempt
+enum CloneState : int {
+    kCloneUnknown,
+    kCloneWorks,
+    kCloneOff
+};
+
+// Shared state for one copy run
+struct CopyJob {
+    WorkStealingPool* pool = nullptr;
+    IoScheduler* scheduler = nullptr;
+    const Manifest* manifest = nullptr;
+    const CopyOptions* options = nullptr;
+    fs::path sourceRoot;
+    fs::path destinationRoot;
+    std::atomic<bool> failed{false};
+    std::atomic<uint64_t> filesCopied{0};
+    std::atomic<uint64_t> bytesCopied{0};
+    std::atomic<uint64_t> filesVerified{0};
+    std::atomic<uint64_t> filesSkipped{0};
+    std::atomic<uint64_t> bytesSkipped{0};
+    std::atomic<uint64_t> filesCloned{0};
+    std::atomic<uint64_t> bytesCloned{0};
+    std::atomic<int> cloneState{kCloneUnknown};
+    std::atomic<uint64_t> filesDeduplicated{0};
+    std::atomic<uint64_t> bytesDeduplicated{0};
+    std::mutex failedMutex;
+    std::vector<size_t> failedEntries;
+    std::vector<size_t> failedPrimaries; // failedEntries sorted, taken before duplicates are linked
+    std::vector<uint32_t> checksums;     // sized with verify, each task writes only its own entries
+    SlowestFiles slowestFiles;
+    std::atomic<Clock::rep> verifyBegin{std::numeric_limits<Clock::rep>::max()};
+    std::atomic<Clock::rep> verifyEnd{std::numeric_limits<Clock::rep>::min()};
+    std::atomic<Clock::rep> verifyTicks{0};
+};
+
+// Widen the verification span to cover one read-back pass
+void RecordVerify(CopyJob& job, Clock::time_point begin, Clock::time_point end) {
+    Clock::rep first = begin.time_since_epoch().count();
+    Clock::rep last = end.time_since_epoch().count();
+    Clock::rep seen = job.verifyBegin.load(std::memory_order_relaxed);
+    while (first < seen && !job.verifyBegin.compare_exchange_weak(seen, first, std::memory_order_relaxed)) {
+    }
+    seen = job.verifyEnd.load(std::memory_order_relaxed);
+    while (last > seen && !job.verifyEnd.compare_exchange_weak(seen, last, std::memory_order_relaxed)) {
+    }
+    job.verifyTicks.fetch_add(last - first, std::memory_order_relaxed);
+}
+
+// With continueOnError a failure is recorded and the run goes on, otherwise it stops the run.
+// Must be called from a catch block.
+void HandleFailure(CopyJob& job, size_t index) {
+    if (!job.options->continueOnError) {
+        job.failed = true;
+        throw;
+    }
+    std::lock_guard<std::mutex> lock(job.failedMutex);
+    job.failedEntries.push_back(index);
+}
+
+// True when the run should stop. Throws CopyCanceled the first time a cancel is seen.
+bool ShouldStop(CopyJob& job) {
+    if (job.failed.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    if (job.options->cancel && job.options->cancel->load(std::memory_order_relaxed)) {
+        if (!job.failed.exchange(true)) {
+            throw CopyCanceled();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ReportCopied(CopyJob& job, const ManifestEntry& entry) {
+    PathView relativePath = job.manifest->RelativePath(entry);
+    if (job.options->journal) {
+        job.options->journal->Record(relativePath, entry.size, entry.mtime);
+    }
+
+    job.filesCopied.fetch_add(1, std::memory_order_relaxed);
+    uint64_t bytesDone = job.bytesCopied.fetch_add(entry.size, std::memory_order_relaxed) + entry.size;
+    if (job.options->progress) {
+        job.options->progress->AddCopied(entry.size, relativePath);
+    }
+    if (job.options->onFileCopied) {
+        job.options->onFileCopied(fs::path(relativePath), bytesDone);
+    }
+}
+
+// Finished by an earlier, interrupted run: counted as done without being copied again
+void ReportSkipped(CopyJob& job, const ManifestEntry& entry) {
+    job.filesSkipped.fetch_add(1, std::memory_order_relaxed);
+    job.bytesSkipped.fetch_add(entry.size, std::memory_order_relaxed);
+    job.bytesCopied.fetch_add(entry.size, std::memory_order_relaxed);
+    if (job.options->progress) {
+        job.options->progress->AddSkipped(1, entry.size);
+    }
+}
+
+// root / relativePath built in a path object owned by the caller. Reusing the same
+// object for every entry keeps its storage, so building the path does not allocate.
+const fs::path& JoinPath(fs::path& buffer, const fs::path& root, PathView relativePath) {
+    buffer = root;
+    buffer /= relativePath;
+    return buffer;
+}
+
+// A copied file waiting for its destination to be checked
+struct PendingVerify {
+    size_t index;
+    uint32_t checksum;
+};
+
+// Re-read destinations and compare with the checksum taken while copying.
+// Runs as its own task so verification overlaps with the copies still in flight.
+void VerifyFiles(CopyJob& job, const std::vector<PendingVerify>& files) {
+    ScheduledStream stream(job.scheduler);
+    Clock::time_point begin = Clock::now();
+    for (const PendingVerify& file : files) {
+        if (ShouldStop(job)) {
+            return;
+        }
+
+        const ManifestEntry& entry = (*job.manifest)[file.index];
+        thread_local fs::path destinationBuffer;
+        const fs::path& destination = JoinPath(destinationBuffer, job.destinationRoot, job.manifest->RelativePath(entry));
+        try {
+            uint32_t checksum = Crc32cFile(destination);
+            job.scheduler->Throttle(entry.size);
+            stream.AddBytes(entry.size);
+            if (checksum != file.checksum) {
+                throw VerifyFailed(destination);
+            }
+        } catch (...) {
+            HandleFailure(job, file.index);
+            continue;
+        }
+
+        job.checksums[file.index] = file.checksum;
+        job.filesVerified.fetch_add(1, std::memory_order_relaxed);
+        ReportCopied(job, entry);
+    }
+    RecordVerify(job, begin, Clock::now());
+}
+
+// Clone instead of copying while the destination keeps accepting clones. A refusal
+// before any clone succeeded turns cloning off for the run (other file system, no
+// reflink support), a later one only sends that file down the copy path.
+bool TryClone(CopyJob& job, const fs::path& source, const fs::path& destination) {
+    if (job.cloneState.load(std::memory_order_relaxed) == kCloneOff) {
+        return false;
+    }
+    if (CloneFile(source, destination)) {
+        job.cloneState.store(kCloneWorks, std::memory_order_relaxed);
+        return true;
+    }
+    int expected = kCloneUnknown;
+    job.cloneState.compare_exchange_strong(expected, kCloneOff, std::memory_order_relaxed);
+    return false;
+}
+
+// Symlinks and files above the small-file threshold, one task each
+void CopyOneEntry(CopyJob& job, size_t index) {
+    if (ShouldStop(job)) {
+        return;
+    }
+
+    ScheduledStream stream(job.scheduler);
+    const ManifestEntry& entry = (*job.manifest)[index];
+    bool verify = job.options->verify && entry.type == EntryType::File;
+    uint32_t checksum = 0;
+
+    thread_local fs::path sourceBuffer;
+    thread_local fs::path destinationBuffer;
+    const fs::path& source = JoinPath(sourceBuffer, job.sourceRoot, job.manifest->RelativePath(entry));
+    const fs::path& destination = JoinPath(destinationBuffer, job.destinationRoot, job.manifest->RelativePath(entry));
+
+    bool cloned = false;
+    Clock::time_point begin = Clock::now();
+    try {
+        if (entry.type == EntryType::Symlink) {
+            // A resumed run may find the link already there
+            std::error_code ec;
+            fs::remove(destination, ec);
+            fs::copy_symlink(source, destination);
+        } else if (TryClone(job, source, destination)) {
+            cloned = true;
+        } else {
+            CopyFileData(source, destination, entry.size, job.options->tuning, verify ? &checksum : nullptr,
+                         job.scheduler);
+            stream.AddBytes(entry.size);
+        }
+    } catch (...) {
+        HandleFailure(job, index);
+        return;
+    }
+
+    job.slowestFiles.Offer(index, std::chrono::duration<double>(Clock::now() - begin).count());
+
+    // A clone shares the source blocks, no data was written that could be read back
+    if (cloned) {
+        job.filesCloned.fetch_add(1, std::memory_order_relaxed);
+        job.bytesCloned.fetch_add(entry.size, std::memory_order_relaxed);
+    } else if (verify) {
+        std::vector<PendingVerify> pending{ { index, checksum } };
+        job.pool->Submit([&job, pending = std::move(pending)] { VerifyFiles(job, pending); });
+        return;
+    }
+    ReportCopied(job, entry);
+}
+
+// Files an earlier run finished, read back on both sides when the run verifies.
+// One that no longer matches its source is copied again.
+void VerifyResumed(CopyJob& job, const std::vector<size_t>& indexes) {
+    ScheduledStream stream(job.scheduler);
+    thread_local fs::path sourceBuffer;
+    thread_local fs::path destinationBuffer;
+    Clock::time_point begin = Clock::now();
+    for (size_t index : indexes) {
+        if (ShouldStop(job)) {
+            return;
+        }
+
+        const ManifestEntry& entry = (*job.manifest)[index];
+        PathView relativePath = job.manifest->RelativePath(entry);
+        const fs::path& destination = JoinPath(destinationBuffer, job.destinationRoot, relativePath);
+        uint32_t checksum = 0;
+        bool same = false;
+        try {
+            checksum = Crc32cFile(JoinPath(sourceBuffer, job.sourceRoot, relativePath));
+            same = Crc32cFile(destination) == checksum;
+            job.scheduler->Throttle(2 * entry.size);
+            stream.AddBytes(2 * entry.size);
+        } catch (const fs::filesystem_error&) {
+        }
+
+        if (same) {
+            job.checksums[index] = checksum;
+            job.filesVerified.fetch_add(1, std::memory_order_relaxed);
+            ReportSkipped(job, entry);
+            continue;
+        }
+        // May be a hard link an earlier run made, copying into it would change the other names
+        std::error_code ec;
+        fs::remove(destination, ec);
+        CopyOneEntry(job, index);
+    }
+    RecordVerify(job, begin, Clock::now());
+}
+
+// Duplicates found before the copy, linked once every primary is written.
+// A duplicate whose primary failed, or that cannot be linked, is copied after all.
+void LinkDuplicates(CopyJob& job, const std::vector<DuplicateFile>& files) {
+    thread_local fs::path sourceBuffer;
+    thread_local fs::path existingBuffer;
+    thread_local fs::path destinationBuffer;
+    for (const DuplicateFile& file : files) {
+        if (ShouldStop(job)) {
+            return;
+        }
+        if (std::binary_search(job.failedPrimaries.begin(), job.failedPrimaries.end(), file.primary)) {
+            CopyOneEntry(job, file.index);
+            continue;
+        }
+
+        const ManifestEntry& entry = (*job.manifest)[file.index];
+        PathView relativePath = job.manifest->RelativePath(entry);
+        try {
+            LinkDuplicate(JoinPath(sourceBuffer, job.sourceRoot, relativePath),
+                          JoinPath(existingBuffer, job.destinationRoot,
+                                   job.manifest->RelativePath((*job.manifest)[file.primary])),
+                          JoinPath(destinationBuffer, job.destinationRoot, relativePath));
+        } catch (const fs::filesystem_error&) {
+            CopyOneEntry(job, file.index);
+            continue;
+        }
+
+        if (job.options->journal) {
+            job.options->journal->Record(relativePath, entry.size, entry.mtime);
+        }
+        if (!job.checksums.empty()) {
+            job.checksums[file.index] = job.checksums[file.primary];
+        }
+        job.filesDeduplicated.fetch_add(1, std::memory_order_relaxed);
+        job.bytesDeduplicated.fetch_add(entry.size, std::memory_order_relaxed);
+        if (job.options->progress) {
+            job.options->progress->AddCopied(entry.size, relativePath);
+        }
+        if (job.options->onFileCopied) {
+            job.options->onFileCopied(fs::path(relativePath), job.bytesCopied.load(std::memory_order_relaxed));
+        }
+    }
+}
+
+// The async backend of the calling worker thread, created on first use and kept
+// until the thread exits. Null when copies should use blocking calls.
+// Throws std::system_error when an explicitly requested backend is unavailable.
+AsyncIo* WorkerAsyncIo(const FileCopyTuning& tuning) {
+    struct WorkerIo {
+        bool created = false;
+        IoBackend backend = IoBackend::Auto;
+        unsigned queueDepth = 0;
+        std::unique_ptr<AsyncIo> io;
+    };
+    thread_local WorkerIo worker;
+
+    if (!worker.created || worker.backend != tuning.ioBackend || worker.queueDepth != tuning.queueDepth) {
+        worker.io.reset();
+        worker.created = true;
+        worker.backend = tuning.ioBackend;
+        worker.queueDepth = tuning.queueDepth;
+        worker.io = CreateAsyncIo(tuning.ioBackend, tuning.queueDepth);
+    }
+    return worker.io.get();
+}
+
+// Small files that share one parent directory
+void CopySmallFileBatch(CopyJob& job, const std::vector<size_t>& indexes) {
+    if (ShouldStop(job)) {
+        return;
+    }
+
+    ScheduledStream stream(job.scheduler);
+    PathView parent = PathParent(job.manifest->RelativePath((*job.manifest)[indexes.front()]));
+    thread_local fs::path sourceBuffer;
+    thread_local fs::path destinationBuffer;
+    std::unique_ptr<DirectoryBatchCopier> copier;
+    AsyncIo* io = nullptr;
+    try {
+        io = WorkerAsyncIo(job.options->tuning);
+        copier = std::make_unique<DirectoryBatchCopier>(JoinPath(sourceBuffer, job.sourceRoot, parent),
+                                                        JoinPath(destinationBuffer, job.destinationRoot, parent));
+    } catch (...) {
+        for (size_t index : indexes) {
+            HandleFailure(job, index);
+        }
+        return;
+    }
+
+    std::vector<PendingVerify> pending;
+    if (io) {
+        // Many files in flight from this one thread, results arrive in completion order
+        std::vector<BatchFile> files;
+        files.reserve(indexes.size());
+        for (size_t index : indexes) {
+            const ManifestEntry& entry = (*job.manifest)[index];
+            files.push_back({ PathName(job.manifest->RelativePath(entry)), entry.size });
+        }
+
+        bool stopped = false;
+        auto shouldStop = [&]() { return stopped = ShouldStop(job); };
+        auto onDone = [&](size_t position, std::exception_ptr error, uint32_t checksum) {
+            size_t index = indexes[position];
+            if (error) {
+                try {
+                    std::rethrow_exception(error);
+                } catch (...) {
+                    HandleFailure(job, index);
+                }
+                return;
+            }
+            job.scheduler->Throttle(files[position].size);
+            stream.AddBytes(files[position].size);
+            if (job.options->verify) {
+                pending.push_back({ index, checksum });
+            } else {
+                ReportCopied(job, (*job.manifest)[index]);
+            }
+        };
+        copier->CopyAsync(*io, files, job.options->verify, shouldStop, onDone);
+        if (stopped) {
+            return;
+        }
+    } else {
+        for (size_t index : indexes) {
+            if (ShouldStop(job)) {
+                return;
+            }
+            const ManifestEntry& entry = (*job.manifest)[index];
+            uint32_t checksum = 0;
+            Clock::time_point begin = Clock::now();
+            try {
+                copier->Copy(PathName(job.manifest->RelativePath(entry)), entry.size,
+                             job.options->verify ? &checksum : nullptr);
+            } catch (...) {
+                HandleFailure(job, index);
+                continue;
+            }
+            job.slowestFiles.Offer(index, std::chrono::duration<double>(Clock::now() - begin).count());
+
+            job.scheduler->Throttle(entry.size);
+            stream.AddBytes(entry.size);
+            if (job.options->verify) {
+                pending.push_back({ index, checksum });
+            } else {
+                ReportCopied(job, entry);
+            }
+        }
+    }
+
+    // Read the batch back through the open directory handle once it is all written
+    if (pending.empty()) {
+        return;
+    }
+    Clock::time_point begin = Clock::now();
+    for (const PendingVerify& file : pending) {
+        const ManifestEntry& entry = (*job.manifest)[file.index];
+        try {
+            PathView name = PathName(job.manifest->RelativePath(entry));
+            uint32_t checksum = copier->ChecksumDestination(name);
+            job.scheduler->Throttle(entry.size);
+            stream.AddBytes(entry.size);
+            if (checksum != file.checksum) {
+                throw VerifyFailed(job.destinationRoot / job.manifest->RelativePath(entry));
+            }
+        } catch (...) {
+            HandleFailure(job, file.index);
+            continue;
+        }
+
+        job.checksums[file.index] = file.checksum;
+        job.filesVerified.fetch_add(1, std::memory_order_relaxed);
+        ReportCopied(job, entry);
+    }
+    RecordVerify(job, begin, Clock::now());
+}
+
+// The journal only says an earlier run finished the file. Its destination must still be
+// there with the source size and mtime (CopyFileData, the batch copier and clones set it,
+// a hard-linked duplicate keeps its primary's and is linked again), or it was removed,
+// truncated or lost with the page cache since and is copied again. FAT and exFAT keep
+// mtimes to 2 seconds.
+bool FinishedEarlier(const CopyOptions& options, const Manifest& manifest, const ManifestEntry& entry,
+                     const fs::path& destinationRoot) {
+#ifdef _WIN32
+    const int64_t kMtimeTolerance = 20000000; // FILETIME ticks
+#else
+    const int64_t kMtimeTolerance = 2000000000; // nanoseconds
+#endif
+    PathView relativePath = manifest.RelativePath(entry);
+    if (!options.journal || !options.journal->IsComplete(relativePath, entry.size, entry.mtime)) {
+        return false;
+    }
+
+    thread_local fs::path destinationBuffer;
+    EntryType type;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    if (!StatEntry(JoinPath(destinationBuffer, destinationRoot, relativePath), type, size, mtime) ||
+        type != entry.type) {
+        return false;
+    }
+    return entry.type != EntryType::File ||
+           (size == entry.size && mtime - entry.mtime <= kMtimeTolerance && entry.mtime - mtime <= kMtimeTolerance);
+}
+
+} // namespace
+
+CopyEngine::CopyEngine(CopyOptions options)
+    : m_options(std::move(options)) {
+}
+
+CopyStats CopyEngine::CopyManifest(const Manifest& manifest, const fs::path& source, const fs::path& destination) {
+    CopyStats stats;
+
+    // Every destination directory is created exactly once, parents first
+    fs::create_directories(destination);
+    fs::path directory;
+    for (const ManifestEntry& entry : manifest.Entries()) {
+        if (entry.type == EntryType::Directory) {
+            fs::create_directory(JoinPath(directory, destination, manifest.RelativePath(entry)));
+            stats.directoriesCreated++;
+        }
+    }
+
+    // One stream per thread unless a device (or the caller) asks for fewer
+    unsigned threadCount = m_options.threadCount ? m_options.threadCount : WorkStealingPool::DefaultThreadCount();
+    stats.sourceDevice = ProbeDevice(source);
+    stats.destinationDevice = ProbeDevice(destination);
+    unsigned streams = m_options.io.maxStreams;
+    if (streams == 0) {
+        for (DeviceKind device : { stats.sourceDevice, stats.destinationDevice }) {
+            unsigned deviceLimit = DeviceStreamLimit(device);
+            if (deviceLimit != 0 && (streams == 0 || deviceLimit < streams)) {
+                streams = deviceLimit;
+            }
+        }
+    }
+    if (streams == 0 || streams > threadCount) {
+        streams = threadCount;
+    }
+    IoScheduler scheduler(m_options.io, streams, m_options.cancel);
+    WorkStealingPool pool(threadCount, m_options.io.lowPriority ? SetBackgroundPriority : nullptr);
+
+    CopyJob job;
+    job.pool = &pool;
+    job.scheduler = &scheduler;
+    job.manifest = &manifest;
+    job.options = &m_options;
+    job.sourceRoot = source;
+    job.destinationRoot = destination;
+    job.cloneState = m_options.tuning.reflink ? kCloneUnknown : kCloneOff;
+    job.slowestFiles.SetCapacity(m_options.slowestFiles);
+    if (m_options.verify) {
+        job.checksums.resize(manifest.Size());
+    }
+
+    const FileCopyTuning& tuning = m_options.tuning;
+    if (m_options.progress) {
+        m_options.progress->AddPlanned(manifest.Size() - manifest.DirectoryCount(), manifest.TotalBytes());
+    }
+
+    // Finished by an earlier, interrupted run
+    std::vector<char> resumed;
+    if (m_options.journal) {
+        resumed.resize(manifest.Size());
+        for (size_t i = 0; i < manifest.Size(); i++) {
+            const ManifestEntry& entry = manifest[i];
+            resumed[i] = entry.type != EntryType::Directory && FinishedEarlier(m_options, manifest, entry, destination);
+        }
+    }
+
+    // Hash the candidates up front, duplicates are left out of the copy and linked afterwards
+    DedupPlan dedup;
+    if (m_options.dedup) {
+        std::vector<size_t> candidates;
+        for (size_t i = 0; i < manifest.Size(); i++) {
+            const ManifestEntry& entry = manifest[i];
+            if (entry.type == EntryType::File && entry.size >= m_options.dedupMinSize &&
+                (resumed.empty() || !resumed[i])) {
+                candidates.push_back(i);
+            }
+        }
+        dedup = FindDuplicates(manifest, source, std::move(candidates), pool, m_options.cancel);
+        stats.dedupCandidates = dedup.filesHashed;
+    }
+    size_t nextDuplicate = 0;
+
+    // Entries of one directory are contiguous in the manifest, so small files
+    // are grouped by parent in a single pass
+    std::vector<size_t> smallFiles;
+    PathView smallParent;
+    auto flushSmallFiles = [&]() {
+        if (!smallFiles.empty()) {
+            pool.Submit([&job, indexes = std::move(smallFiles)] { CopySmallFileBatch(job, indexes); });
+            smallFiles.clear();
+        }
+    };
+
+    std::vector<size_t> resumedFiles;
+    auto flushResumedFiles = [&]() {
+        if (!resumedFiles.empty()) {
+            pool.Submit([&job, indexes = std::move(resumedFiles)] { VerifyResumed(job, indexes); });
+            resumedFiles.clear();
+        }
+    };
+
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        const ManifestEntry& entry = manifest[i];
+        if (entry.type == EntryType::Directory) {
+            continue;
+        }
+
+        if (!resumed.empty() && resumed[i]) {
+            if (m_options.verify && entry.type == EntryType::File) {
+                resumedFiles.push_back(i);
+                if (resumedFiles.size() >= tuning.smallBatchMaxFiles) {
+                    flushResumedFiles();
+                }
+            } else {
+                ReportSkipped(job, entry);
+            }
+            continue;
+        }
+
+        if (nextDuplicate < dedup.duplicates.size() && dedup.duplicates[nextDuplicate].index == i) {
+            nextDuplicate++;
+            continue;
+        }
+
+        if (entry.type == EntryType::File && entry.size <= tuning.smallFileThreshold) {
+            PathView parent = PathParent(manifest.RelativePath(entry));
+            if (parent != smallParent || smallFiles.size() >= tuning.smallBatchMaxFiles) {
+                flushSmallFiles();
+                smallParent = parent;
+            }
+            smallFiles.push_back(i);
+            continue;
+        }
+
+        pool.Submit([&job, i] { CopyOneEntry(job, i); });
+    }
+    flushSmallFiles();
+    flushResumedFiles();
+
+    try {
+        pool.Wait();
+
+        if (!dedup.duplicates.empty()) {
+            job.failedPrimaries = job.failedEntries;
+            std::sort(job.failedPrimaries.begin(), job.failedPrimaries.end());
+            for (size_t first = 0; first < dedup.duplicates.size(); first += tuning.smallBatchMaxFiles) {
+                size_t last = std::min(first + tuning.smallBatchMaxFiles, dedup.duplicates.size());
+                std::vector<DuplicateFile> batch(dedup.duplicates.begin() + first, dedup.duplicates.begin() + last);
+                pool.Submit([&job, batch = std::move(batch)] { LinkDuplicates(job, batch); });
+            }
+            pool.Wait();
+        }
+    } catch (...) {
+        if (m_options.journal) {
+            m_options.journal->Flush();
+        }
+        throw;
+    }
+    if (m_options.journal) {
+        m_options.journal->Flush();
+    }
+
+    stats.streamLimit = scheduler.StreamLimit();
+    stats.slowestFiles = job.slowestFiles.Take();
+    if (job.verifyBegin != std::numeric_limits<Clock::rep>::max()) {
+        stats.verifyBegin = Clock::time_point(Clock::duration(job.verifyBegin.load()));
+        stats.verifyEnd = Clock::time_point(Clock::duration(job.verifyEnd.load()));
+        stats.verifySeconds = std::chrono::duration<double>(Clock::duration(job.verifyTicks.load())).count();
+    }
+    stats.filesCopied = job.filesCopied;
+    stats.filesSkipped = job.filesSkipped;
+    stats.bytesSkipped = job.bytesSkipped;
+    stats.bytesCopied = job.bytesCopied - stats.bytesSkipped;
+    stats.filesVerified = job.filesVerified;
+    stats.filesCloned = job.filesCloned;
+    stats.bytesCloned = job.bytesCloned;
+    stats.filesDeduplicated = job.filesDeduplicated;
+    stats.bytesDeduplicated = job.bytesDeduplicated;
+    stats.failedEntries = std::move(job.failedEntries);
+    stats.checksums = std::move(job.checksums);
+    std::sort(stats.failedEntries.begin(), stats.failedEntries.end());
+    return stats;
+}
+
+CopyStats CopyEngine::CopyTree(const fs::path& source, const fs::path& destination) {
+    return CopyManifest(ScanTree(source, m_options.threadCount), source, destination);
+}
+
+} // namespace zdm
@@ -0,0 +1,144 @@
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "FileCopy.h"
+#include "IoScheduler.h"
+#include "Journal.h"
+#include "Manifest.h"
+#include "Progress.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Copy engine settings
+struct CopyOptions {
+    unsigned threadCount = 0; // 0 = pick from hardware concurrency
+
+    // Per-file copy settings, including the large-file threshold
+    FileCopyTuning tuning;
+
+    // Checkpoint journal: completed files are skipped and new ones recorded, may be null.
+    // A file is only skipped while its destination keeps the source size and mtime, and
+    // with verify it is read back on both sides first.
+    CopyJournal* journal = nullptr;
+
+    // Record files that fail (locked, vanished) in CopyStats::failedEntries and keep going,
+    // used for the live pre-copy while Zalo still has files open
+    bool continueOnError = false;
+
+    // Hash every file while it is copied (CRC32C, no second read of the source) and
+    // re-read the destination in a follow-up task to compare. A mismatch fails the run.
+    bool verify = false;
+
+    // Write files with identical content once: the other copies become clones of the
+    // first (copy-on-write, where the destination supports it) or hard links to it.
+    // Hard links share one set of attributes, and writing to one name changes all of them.
+    // Files smaller than dedupMinSize are copied as usual, they save little.
+    bool dedup = false;
+    uint64_t dedupMinSize = 64 * 1024;
+
+    // Streams in flight, bandwidth cap and thread priority (see IoScheduler). Without
+    // maxStreams the limit comes from the source and destination devices: a hard disk
+    // on either side gets DeviceStreamLimit instead of one stream per thread.
+    IoLimits io;
+
+    // Files kept in CopyStats::slowestFiles, 0 = do not time files
+    size_t slowestFiles = 10;
+
+    // Set to true from any thread to stop the copy, may be null
+    const std::atomic<bool>* cancel = nullptr;
+
+    // Lock-free counters and current path for a UI to sample on its own timer, may be null.
+    // Every copy pass adds its planned files and bytes, so live sync keeps one running total.
+    CopyProgress* progress = nullptr;
+
+    // Called from worker threads after every copied file with its relative path
+    // and the running total of bytes copied, may be empty. Runs on the copy path,
+    // a UI should sample progress instead.
+    std::function<void(const fs::path&, uint64_t)> onFileCopied;
+};
+
+// How long one file took to copy
+struct FileTiming {
+    size_t index; // in the manifest
+    double seconds;
+};
+
+// Totals reported after a copy
+struct CopyStats {
+    uint64_t filesCopied = 0;
+    uint64_t directoriesCreated = 0;
+    uint64_t bytesCopied = 0;
+    uint64_t filesSkipped = 0; // already complete according to the journal and the destination
+    uint64_t bytesSkipped = 0;
+    uint64_t filesVerified = 0; // skipped files included
+    uint64_t filesCloned = 0; // copy-on-write clones (FileCopyTuning::reflink), in filesCopied but never verified
+    uint64_t bytesCloned = 0;
+    uint64_t dedupCandidates = 0;   // files that shared their size with another one and were hashed
+    uint64_t filesDeduplicated = 0; // linked to an identical file instead of copied, not in filesCopied
+    uint64_t bytesDeduplicated = 0; // not written thanks to them, not in bytesCopied
+    DeviceKind sourceDevice = DeviceKind::Unknown; // as probed for the I/O scheduler
+    DeviceKind destinationDevice = DeviceKind::Unknown;
+    unsigned streamLimit = 0; // streams the scheduler allowed in flight when the copy ended
+
+    // Outliers among the files copied one at a time (large files, and small ones without
+    // an async backend), slowest first
+    std::vector<FileTiming> slowestFiles;
+
+    // Read-back verification overlaps the copy: from the first to the last file checked
+    // (equal when none was) and the time the threads spent on it
+    std::chrono::steady_clock::time_point verifyBegin;
+    std::chrono::steady_clock::time_point verifyEnd;
+    double verifySeconds = 0;
+    std::vector<size_t> failedEntries; // manifest indexes, only with continueOnError
+
+    // With verify: the CRC32C of every manifest entry whose copy was checked (a duplicate gets
+    // its primary's), 0 for the others (directories, symlinks, clones, failures)
+    std::vector<uint32_t> checksums;
+};
+
+// Thrown by CopyEngine when CopyOptions::cancel was set
+class CopyCanceled : public std::runtime_error {
+public:
+    CopyCanceled() : std::runtime_error("operation canceled") {}
+};
+
+// Thrown by CopyEngine when a copied file does not match its source checksum
+class VerifyFailed : public std::runtime_error {
+public:
+    explicit VerifyFailed(const fs::path& path)
+        : std::runtime_error("verification failed: " + path.u8string()) {}
+};
+
+// Copies a directory tree with a pool of work-stealing threads.
+// The tree is described by a Manifest so the source is only walked once,
+// the final layout at the destination is the same as a recursive fs::copy.
+class CopyEngine {
+public:
+    explicit CopyEngine(CopyOptions options = CopyOptions());
+
+    // Recreate every entry of manifest (scanned from source) under destination.
+    // Throws fs::filesystem_error for the first failure, remaining work is abandoned,
+    // and CopyCanceled when canceled. The journal is flushed either way.
+    CopyStats CopyManifest(const Manifest& manifest, const fs::path& source, const fs::path& destination);
+
+    // Scan source and copy it, for callers that do not need the manifest themselves
+    CopyStats CopyTree(const fs::path& source, const fs::path& destination);
+
+private:
+    CopyOptions m_options;
+};
+
+} // namespace zdm
+
+#endif // COPY_ENGINE_H
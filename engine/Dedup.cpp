@@ -0,0 +1,170 @@
+#include "Dedup.h"
+#include "Checksum.h"
+#include "FileCopy.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <system_error>
+
+namespace zdm {
+
+namespace {
+
+// Enough to tell apart most files of equal size, small enough to cost about one read
+const uint64_t kPrefixBytes = 16 * 1024;
+
+// Files fingerprinted by one task
+const size_t kHashBatch = 32;
+
+struct Candidate {
+    size_t index = 0;
+    uint64_t size = 0;
+    FileFingerprint fingerprint;
+    bool readable = true;
+};
+
+bool SameSize(const Candidate& left, const Candidate& right) {
+    return left.size == right.size;
+}
+
+bool SameContent(const Candidate& left, const Candidate& right) {
+    return left.size == right.size && left.fingerprint == right.fingerprint;
+}
+
+// Keep only readable candidates that have at least one equal neighbour under same,
+// candidates must be sorted so that equal ones are adjacent
+template <typename Same>
+void KeepGroups(std::vector<Candidate>& candidates, Same same) {
+    std::vector<Candidate> kept;
+    for (size_t first = 0; first < candidates.size();) {
+        size_t last = first + 1;
+        while (last < candidates.size() && same(candidates[first], candidates[last])) {
+            last++;
+        }
+        if (last - first > 1) {
+            kept.insert(kept.end(), candidates.begin() + first, candidates.begin() + last);
+        }
+        first = last;
+    }
+    candidates = std::move(kept);
+}
+
+void SortByContent(std::vector<Candidate>& candidates) {
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& left, const Candidate& right) {
+        if (left.size != right.size) {
+            return left.size < right.size;
+        }
+        if (!(left.fingerprint == right.fingerprint)) {
+            return left.fingerprint < right.fingerprint;
+        }
+        return left.index < right.index;
+    });
+}
+
+// Fingerprint up to limit bytes of every candidate larger than skipUpTo, in parallel.
+// Each task writes only to its own candidates. Unreadable files are dropped afterwards.
+void Fingerprint(std::vector<Candidate>& candidates, uint64_t skipUpTo, uint64_t limit, const Manifest& manifest,
+                 const fs::path& sourceRoot, WorkStealingPool& pool, const std::atomic<bool>* cancel,
+                 DedupPlan& plan) {
+    std::atomic<uint64_t> bytesRead{0};
+    std::vector<size_t> batch;
+    auto flush = [&]() {
+        if (batch.empty()) {
+            return;
+        }
+        pool.Submit([&, positions = std::move(batch)] {
+            fs::path path;
+            for (size_t position : positions) {
+                if (cancel && cancel->load(std::memory_order_relaxed)) {
+                    return;
+                }
+                Candidate& candidate = candidates[position];
+                path = sourceRoot;
+                path /= manifest.RelativePath(manifest[candidate.index]);
+                try {
+                    candidate.fingerprint = FingerprintFile(path, limit);
+                    bytesRead.fetch_add(std::min(candidate.size, limit), std::memory_order_relaxed);
+                } catch (const fs::filesystem_error&) {
+                    candidate.readable = false;
+                }
+            }
+        });
+        batch.clear();
+    };
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (candidates[i].size > skipUpTo) {
+            batch.push_back(i);
+            if (batch.size() >= kHashBatch) {
+                flush();
+            }
+        }
+    }
+    flush();
+    pool.Wait();
+
+    plan.bytesHashed += bytesRead;
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                    [](const Candidate& candidate) { return !candidate.readable; }),
+                     candidates.end());
+}
+
+} // namespace
+
+DedupPlan FindDuplicates(const Manifest& manifest, const fs::path& sourceRoot, std::vector<size_t> candidates,
+                         WorkStealingPool& pool, const std::atomic<bool>* cancel) {
+    DedupPlan plan;
+
+    // A size nothing else has cannot have a duplicate
+    std::vector<Candidate> files;
+    files.reserve(candidates.size());
+    for (size_t index : candidates) {
+        Candidate candidate;
+        candidate.index = index;
+        candidate.size = manifest[index].size;
+        files.push_back(candidate);
+    }
+    SortByContent(files);
+    KeepGroups(files, SameSize);
+    plan.filesHashed = files.size();
+
+    // Cheap first pass over the prefix, for files that fit in it this is already the whole content
+    Fingerprint(files, 0, kPrefixBytes, manifest, sourceRoot, pool, cancel, plan);
+    SortByContent(files);
+    KeepGroups(files, SameContent);
+
+    Fingerprint(files, kPrefixBytes, UINT64_MAX, manifest, sourceRoot, pool, cancel, plan);
+    SortByContent(files);
+    KeepGroups(files, SameContent);
+
+    if (cancel && cancel->load(std::memory_order_relaxed)) {
+        return DedupPlan();
+    }
+
+    // Groups are sorted by index, the first member is the copy the others share
+    for (size_t first = 0; first < files.size();) {
+        size_t last = first + 1;
+        while (last < files.size() && SameContent(files[first], files[last])) {
+            plan.duplicates.push_back({ files[last].index, files[first].index });
+            last++;
+        }
+        first = last;
+    }
+    std::sort(plan.duplicates.begin(), plan.duplicates.end(),
+              [](const DuplicateFile& left, const DuplicateFile& right) { return left.index < right.index; });
+    return plan;
+}
+
+DedupMethod LinkDuplicate(const fs::path& source, const fs::path& existing, const fs::path& destination) {
+    // Writing into an old hard link would change every other name of that file
+    std::error_code ec;
+    fs::remove(destination, ec);
+
+    if (CloneFile(existing, destination)) {
+        fs::last_write_time(destination, fs::last_write_time(source));
+        return DedupMethod::Clone;
+    }
+    fs::create_hard_link(existing, destination);
+    return DedupMethod::HardLink;
+}
+
+} // namespace zdm
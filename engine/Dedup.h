@@ -0,0 +1,53 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "Manifest.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+class WorkStealingPool;
+
+// A file whose content is identical to an earlier file of the same manifest
+struct DuplicateFile {
+    size_t index;   // manifest index of the duplicate
+    size_t primary; // manifest index of the copy it can share, the lowest of its group
+};
+
+struct DedupPlan {
+    std::vector<DuplicateFile> duplicates; // by ascending index
+    uint64_t filesHashed = 0; // candidates that shared their size with another one
+    uint64_t bytesHashed = 0; // read to fingerprint them
+};
+
+// Find files with the same content among candidates (manifest indexes of regular files
+// under sourceRoot). Only files of equal size are compared, first by a fingerprint of
+// their first 16 KiB, then by one of the whole file (XXH64 and CRC32C), so unique sizes
+// are never read and most near misses stop after one small read. Hashing runs on pool,
+// which must be idle. A file that cannot be read is left out. Returns an empty plan
+// when cancel is set.
+DedupPlan FindDuplicates(const Manifest& manifest, const fs::path& sourceRoot, std::vector<size_t> candidates,
+                         WorkStealingPool& pool, const std::atomic<bool>* cancel = nullptr);
+
+enum class DedupMethod {
+    Clone,   // own file sharing the blocks copy-on-write
+    HardLink // second name of the same file: also shares permissions and times
+};
+
+// Make destination hold the content of existing, a finished copy of an identical file on
+// the same volume, without writing the data again. A clone is preferred and gets the
+// modification time of source, the file destination stands for. Anything at destination
+// is removed first, so an older link is never written through.
+// Throws fs::filesystem_error when the volume supports neither (FAT, exFAT).
+DedupMethod LinkDuplicate(const fs::path& source, const fs::path& existing, const fs::path& destination);
+
+} // namespace zdm
+
+#endif // DEDUP_H
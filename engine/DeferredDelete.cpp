@@ -0,0 +1,354 @@
+#include "DeferredDelete.h"
+#include "IoScheduler.h"
+#include "Manifest.h"
+#include "WorkStealingPool.h"
+
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+const char kTrashSuffix[] = ".zdm-trash";
+
+// Shared state for one DeleteTree run
+struct DeleteJob {
+    const Manifest* manifest = nullptr;
+    const std::atomic<bool>* cancel = nullptr;
+    std::atomic<uint64_t> deleted{0};
+    std::atomic<uint64_t> failures{0};
+#ifdef _WIN32
+    PathString rootPrefix; // "<root>\"
+#else
+    int rootFd = -1;
+#endif
+};
+
+bool Canceled(const DeleteJob& job) {
+    return job.cancel && job.cancel->load(std::memory_order_relaxed);
+}
+
+#ifdef _WIN32
+
+// Read-only files and folders refuse to go until the attribute is cleared
+bool RemoveEntry(const PathString& path, bool directory) {
+    auto remove = [&]() { return directory ? RemoveDirectoryW(path.c_str()) : DeleteFileW(path.c_str()); };
+    if (remove()) {
+        return true;
+    }
+    DWORD error = GetLastError();
+    if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) {
+        return true;
+    }
+    if (error == ERROR_ACCESS_DENIED) {
+        SetFileAttributesW(path.c_str(), FILE_ATTRIBUTE_NORMAL);
+        return remove() != 0;
+    }
+    return false;
+}
+
+// Files and links of one directory
+void DeleteBatch(DeleteJob& job, const std::vector<size_t>& indexes) {
+    thread_local PathString path;
+    for (size_t index : indexes) {
+        if (Canceled(job)) {
+            return;
+        }
+        const ManifestEntry& entry = (*job.manifest)[index];
+        PathView relativePath = job.manifest->RelativePath(entry);
+        path.assign(job.rootPrefix);
+        path.append(relativePath.data(), relativePath.size());
+
+        // Directory links and junctions are directories to the file system, their targets stay untouched
+        bool removed = RemoveEntry(path, false) || (entry.type == EntryType::Symlink && RemoveEntry(path, true));
+        (removed ? job.deleted : job.failures).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Directories in reverse manifest order: children before their parents
+void DeleteDirectories(DeleteJob& job) {
+    PathString path;
+    for (size_t i = job.manifest->Size(); i-- > 0;) {
+        if (Canceled(job)) {
+            return;
+        }
+        const ManifestEntry& entry = (*job.manifest)[i];
+        if (entry.type != EntryType::Directory) {
+            continue;
+        }
+        PathView relativePath = job.manifest->RelativePath(entry);
+        path.assign(job.rootPrefix);
+        path.append(relativePath.data(), relativePath.size());
+        (RemoveEntry(path, true) ? job.deleted : job.failures).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool RemoveRoot(DeleteJob&, const fs::path& root) {
+    return RemoveEntry(root.native(), true);
+}
+
+#else
+
+void DeleteBatch(DeleteJob& job, const std::vector<size_t>& indexes) {
+    thread_local PathString name;
+    PathView parent = PathParent(job.manifest->RelativePath((*job.manifest)[indexes.front()]));
+
+    int directoryFd = job.rootFd;
+    if (!parent.empty()) {
+        name.assign(parent.data(), parent.size());
+        directoryFd = openat(job.rootFd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        if (directoryFd < 0) {
+            if (errno != ENOENT) {
+                job.failures.fetch_add(indexes.size(), std::memory_order_relaxed);
+            }
+            return;
+        }
+    }
+
+    for (size_t index : indexes) {
+        if (Canceled(job)) {
+            break;
+        }
+        PathView entryName = PathName(job.manifest->RelativePath((*job.manifest)[index]));
+        name.assign(entryName.data(), entryName.size());
+        bool removed = unlinkat(directoryFd, name.c_str(), 0) == 0 || errno == ENOENT;
+        (removed ? job.deleted : job.failures).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (directoryFd != job.rootFd) {
+        close(directoryFd);
+    }
+}
+
+void DeleteDirectories(DeleteJob& job) {
+    PathString path;
+    for (size_t i = job.manifest->Size(); i-- > 0;) {
+        if (Canceled(job)) {
+            return;
+        }
+        const ManifestEntry& entry = (*job.manifest)[i];
+        if (entry.type != EntryType::Directory) {
+            continue;
+        }
+        PathView relativePath = job.manifest->RelativePath(entry);
+        path.assign(relativePath.data(), relativePath.size());
+        bool removed = unlinkat(job.rootFd, path.c_str(), AT_REMOVEDIR) == 0 || errno == ENOENT;
+        (removed ? job.deleted : job.failures).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool RemoveRoot(DeleteJob& job, const fs::path& root) {
+    close(job.rootFd);
+    job.rootFd = -1;
+    return rmdir(root.c_str()) == 0 || errno == ENOENT;
+}
+
+#endif
+
+} // namespace
+
+fs::path MoveToTrash(const fs::path& directory, const fs::path& owner) {
+    fs::path source = directory.has_filename() ? directory : directory.parent_path();
+    fs::path name = owner.empty() ? source : (owner.has_filename() ? owner : owner.parent_path());
+
+    std::error_code ec;
+    for (int attempt = 0; attempt < 100; attempt++) {
+        fs::path trash = name;
+        trash += attempt == 0 ? std::string(kTrashSuffix) : kTrashSuffix + ("-" + std::to_string(attempt));
+
+        // rename() would replace an empty directory of that name, take only free names
+        if (fs::exists(fs::symlink_status(trash, ec))) {
+            continue;
+        }
+        fs::rename(source, trash, ec);
+        if (!ec) {
+            return trash;
+        }
+        if (ec != std::errc::file_exists && ec != std::errc::directory_not_empty) {
+            throw fs::filesystem_error("cannot move directory to trash", source, trash, ec);
+        }
+    }
+    throw fs::filesystem_error("cannot move directory to trash", source,
+                               std::make_error_code(std::errc::file_exists));
+}
+
+std::vector<fs::path> FindTrash(const fs::path& directory) {
+    fs::path source = directory.has_filename() ? directory : directory.parent_path();
+    PathString prefix = source.filename().native() + fs::path(kTrashSuffix).native();
+
+    std::vector<fs::path> trash;
+    std::error_code ec;
+    for (fs::directory_iterator it(source.parent_path(), ec), end; !ec && it != end; it.increment(ec)) {
+        PathString name = it->path().filename().native();
+        std::error_code statusError;
+        if (name.compare(0, prefix.size(), prefix) != 0 || it->is_symlink(statusError) ||
+            !it->is_directory(statusError)) {
+            continue;
+        }
+        // "<name>.zdm-trash" or "<name>.zdm-trash-<number>"
+        bool numbered = name.size() > prefix.size() + 1 && name[prefix.size()] == '-' &&
+                        name.find_first_not_of(fs::path("0123456789").native(), prefix.size() + 1) == PathString::npos;
+        if (name.size() == prefix.size() || numbered) {
+            trash.push_back(it->path());
+        }
+    }
+    return trash;
+}
+
+DeleteStats DeleteTree(const fs::path& root, const DeleteOptions& options) {
+    DeleteStats stats;
+
+    // Nothing to do, or a link: only the link goes
+    std::error_code ec;
+    fs::file_status status = fs::symlink_status(root, ec);
+    if (!fs::exists(status)) {
+        stats.completed = true;
+        return stats;
+    }
+    if (!fs::is_directory(status)) {
+        fs::remove(root, ec);
+        stats.completed = !ec;
+        stats.entriesDeleted = ec ? 0 : 1;
+        stats.failures = ec ? 1 : 0;
+        return stats;
+    }
+
+    WorkStealingPool pool(options.threadCount, options.lowPriority ? SetBackgroundPriority : nullptr);
+    Manifest manifest = ScanTree(root, pool);
+
+    DeleteJob job;
+    job.manifest = &manifest;
+    job.cancel = options.cancel;
+#ifdef _WIN32
+    job.rootPrefix = root.native() + L'\\';
+#else
+    job.rootFd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (job.rootFd < 0) {
+        throw fs::filesystem_error("cannot delete directory", root, std::error_code(errno, std::generic_category()));
+    }
+#endif
+
+    // Entries of one directory are contiguous in the manifest, batch them like the copy does
+    std::vector<size_t> batch;
+    PathView batchParent;
+    auto flush = [&]() {
+        if (!batch.empty()) {
+            pool.Submit([&job, indexes = std::move(batch)] { DeleteBatch(job, indexes); });
+            batch.clear();
+        }
+    };
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        if (manifest[i].type == EntryType::Directory) {
+            continue;
+        }
+        PathView parent = PathParent(manifest.RelativePath(manifest[i]));
+        if (parent != batchParent || batch.size() >= 256) {
+            flush();
+            batchParent = parent;
+        }
+        batch.push_back(i);
+    }
+    flush();
+    pool.Wait();
+
+    // Emptied directories go last, still on the background workers
+    pool.Submit([&job] { DeleteDirectories(job); });
+    pool.Wait();
+
+    if (!Canceled(job) && RemoveRoot(job, root)) {
+        job.deleted.fetch_add(1, std::memory_order_relaxed);
+        stats.completed = true;
+    }
+#ifndef _WIN32
+    if (job.rootFd >= 0) {
+        close(job.rootFd);
+    }
+#endif
+
+    stats.entriesDeleted = job.deleted;
+    stats.failures = job.failures;
+    return stats;
+}
+
+BackgroundDeleter::BackgroundDeleter(Finished onFinished)
+    : m_onFinished(std::move(onFinished)) {
+}
+
+BackgroundDeleter::~BackgroundDeleter() {
+    Stop();
+}
+
+void BackgroundDeleter::Add(const fs::path& trash) {
+    Add(std::vector<fs::path>{ trash });
+}
+
+void BackgroundDeleter::Add(const std::vector<fs::path>& trash) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping || trash.empty()) {
+        return;
+    }
+    m_queue.insert(m_queue.end(), trash.begin(), trash.end());
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&BackgroundDeleter::Run, this);
+    }
+    m_wake.notify_one();
+}
+
+bool BackgroundDeleter::Busy() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_deleting || !m_queue.empty();
+}
+
+void BackgroundDeleter::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_queue.clear();
+    }
+    m_cancel = true;
+    m_wake.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void BackgroundDeleter::Run() {
+    DeleteOptions options;
+    options.cancel = &m_cancel;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+        if (m_stopping) {
+            return;
+        }
+        fs::path trash = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_deleting = true;
+        lock.unlock();
+
+        DeleteStats stats;
+        try {
+            stats = DeleteTree(trash, options);
+        } catch (const std::exception&) {
+            stats.failures++;
+        }
+        if (m_onFinished) {
+            m_onFinished(trash, stats);
+        }
+
+        lock.lock();
+        m_deleting = false;
+    }
+}
+
+} // namespace zdm
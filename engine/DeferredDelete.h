@@ -0,0 +1,85 @@
+#ifndef DEFERRED_DELETE_H
+#define DEFERRED_DELETE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Rename directory to an unused sibling "<name>.zdm-trash[-N]" so its path is free
+// at once, the contents are deleted later by DeleteTree. The rename is atomic, an
+// interrupted delete leaves the trash directory behind for FindTrash.
+// With owner (a folder on the same volume holding directory) the trash is named and
+// placed after owner instead, so FindTrash(owner) also finds trash from its subfolders.
+// Throws fs::filesystem_error.
+fs::path MoveToTrash(const fs::path& directory, const fs::path& owner = fs::path());
+
+// Trash directories MoveToTrash left next to directory, e.g. after an interrupted delete
+std::vector<fs::path> FindTrash(const fs::path& directory);
+
+struct DeleteOptions {
+    unsigned threadCount = 0;   // 0 = auto
+    bool lowPriority = true;    // run the workers at background CPU and I/O priority
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+struct DeleteStats {
+    uint64_t entriesDeleted = 0;
+    uint64_t failures = 0;  // entries that could not be deleted, the root stays
+    bool completed = false; // root is gone
+};
+
+// Delete a directory tree: files and links of each directory in parallel, then the
+// directories bottom-up. Failures are counted rather than thrown so one locked file
+// does not stop the rest. Links are removed, never followed.
+// Throws fs::filesystem_error only when root cannot be read.
+DeleteStats DeleteTree(const fs::path& root, const DeleteOptions& options = DeleteOptions());
+
+// Deletes trash directories one after another on its own thread, so a front end can
+// hand them over and carry on. Stopping (or destroying it) cancels the current delete,
+// what is left is found again by FindTrash on the next launch.
+class BackgroundDeleter {
+public:
+    using Finished = std::function<void(const fs::path& trash, const DeleteStats& stats)>;
+
+    // onFinished runs on the deleter thread after each directory, it may be empty
+    explicit BackgroundDeleter(Finished onFinished = nullptr);
+    ~BackgroundDeleter();
+
+    BackgroundDeleter(const BackgroundDeleter&) = delete;
+    BackgroundDeleter& operator=(const BackgroundDeleter&) = delete;
+
+    void Add(const fs::path& trash);
+    void Add(const std::vector<fs::path>& trash);
+
+    // True while a directory is queued or being deleted
+    bool Busy() const;
+
+    // Cancel the current delete, drop the queue and wait for the thread
+    void Stop();
+
+private:
+    void Run();
+
+    Finished m_onFinished;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<fs::path> m_queue;
+    bool m_deleting = false;
+    bool m_stopping = false;
+    std::atomic<bool> m_cancel{false};
+    std::thread m_thread;
+};
+
+} // namespace zdm
+
+#endif // DEFERRED_DELETE_H
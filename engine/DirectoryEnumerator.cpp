@@ -0,0 +1,283 @@
+#include "DirectoryEnumerator.h"
+
+#include <algorithm>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+// Marks an entry that turned out to vanish or to be of a kind the tree does not keep
+constexpr size_t kDropped = static_cast<size_t>(-1);
+
+bool IsDotName(PathView name) {
+    return (name.size() == 1 && name[0] == '.') || (name.size() == 2 && name[0] == '.' && name[1] == '.');
+}
+
+#ifndef _WIN32
+
+// Record layout returned by getdents64
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+constexpr size_t kRecordBufferSize = 64 * 1024;
+
+#endif
+
+} // namespace
+
+void DirectoryEnumerator::AddEntry(PathView name, EntryType type, uint64_t size, int64_t mtime) {
+    m_nameRanges.emplace_back(m_names.size(), name.size());
+    m_names.append(name.data(), name.size());
+    m_names += PathChar(0); // statx takes NUL-terminated names
+    m_entries.push_back({ PathView(), type, size, mtime });
+}
+
+#ifdef _WIN32
+
+DirectoryEnumerator::DirectoryEnumerator(const fs::path& root)
+    : m_root(root),
+      m_pattern(root.native()) {
+    if (!m_pattern.empty() && m_pattern.back() != L'\\' && m_pattern.back() != L'/') {
+        m_pattern += L'\\';
+    }
+    m_rootLength = m_pattern.size();
+
+    DWORD attributes = GetFileAttributesW(root.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        ThrowError(PathString(), static_cast<int>(GetLastError()));
+    }
+    if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        ThrowError(PathString(), ERROR_DIRECTORY);
+    }
+}
+
+DirectoryEnumerator::~DirectoryEnumerator() {
+}
+
+const std::vector<DirectoryEntryInfo>& DirectoryEnumerator::Read(const PathString& relativePath) {
+    m_entries.clear();
+    m_nameRanges.clear();
+    m_names.clear();
+
+    m_pattern.resize(m_rootLength);
+    m_pattern += relativePath;
+    if (!relativePath.empty()) {
+        m_pattern += L'\\';
+    }
+    m_pattern += L'*';
+
+    // The large fetch asks the file system for big batches of entries per call
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileExW(m_pattern.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch,
+                                   NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE) {
+        ThrowError(relativePath, static_cast<int>(GetLastError()));
+    }
+
+    do {
+        PathView name(data.cFileName);
+        if (IsDotName(name)) {
+            continue;
+        }
+        // Junctions count as links: the data they point to is not part of this tree
+        EntryType type = EntryType::File;
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+            type = EntryType::Symlink;
+        } else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            type = EntryType::Directory;
+        }
+        uint64_t size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+        int64_t mtime = static_cast<int64_t>((static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+                                             data.ftLastWriteTime.dwLowDateTime);
+        AddEntry(name, type, type == EntryType::File ? size : 0, mtime);
+    } while (FindNextFileW(find, &data));
+
+    DWORD error = GetLastError();
+    FindClose(find);
+    if (error != ERROR_NO_MORE_FILES) {
+        ThrowError(relativePath, static_cast<int>(error));
+    }
+
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        m_entries[i].name = PathView(m_names.data() + m_nameRanges[i].first, m_nameRanges[i].second);
+    }
+    return m_entries;
+}
+
+#else
+
+DirectoryEnumerator::DirectoryEnumerator(const fs::path& root)
+    : m_root(root),
+      m_records(kRecordBufferSize) {
+    m_rootFd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_rootFd < 0) {
+        ThrowError(PathString(), errno);
+    }
+}
+
+DirectoryEnumerator::~DirectoryEnumerator() {
+    close(m_rootFd);
+}
+
+const std::vector<DirectoryEntryInfo>& DirectoryEnumerator::Read(const PathString& relativePath) {
+    m_entries.clear();
+    m_nameRanges.clear();
+    m_names.clear();
+    m_statOrder.clear();
+
+    int fd = openat(m_rootFd, relativePath.empty() ? "." : relativePath.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        ThrowError(relativePath, errno);
+    }
+
+    // The whole listing first: many entries per call, directories need nothing more
+    int error = 0;
+    for (;;) {
+        long count = syscall(SYS_getdents64, fd, m_records.data(), m_records.size());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = errno;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        for (long offset = 0; offset < count;) {
+            const LinuxDirent64* record = reinterpret_cast<const LinuxDirent64*>(m_records.data() + offset);
+            offset += record->d_reclen;
+
+            PathView name(record->d_name);
+            if (IsDotName(name)) {
+                continue;
+            }
+            if (record->d_type == DT_DIR) {
+                AddEntry(name, EntryType::Directory, 0, 0);
+            } else if (record->d_type == DT_REG || record->d_type == DT_LNK || record->d_type == DT_UNKNOWN) {
+                m_statOrder.emplace_back(record->d_ino, m_entries.size());
+                AddEntry(name, EntryType::File, 0, 0);
+            }
+        }
+    }
+
+    // Then size and mtime of everything else, in inode order so the lookups walk
+    // the inode table forward instead of jumping around it
+    std::sort(m_statOrder.begin(), m_statOrder.end());
+    for (const auto& pending : m_statOrder) {
+        if (error != 0) {
+            break;
+        }
+        size_t index = pending.second;
+        struct statx info;
+        if (statx(fd, m_names.data() + m_nameRanges[index].first, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                  STATX_TYPE | STATX_SIZE | STATX_MTIME, &info) != 0) {
+            if (errno == ENOENT) {
+                m_nameRanges[index].second = kDropped;
+            } else {
+                error = errno;
+            }
+            continue;
+        }
+
+        DirectoryEntryInfo& entry = m_entries[index];
+        if (S_ISREG(info.stx_mode)) {
+            entry.type = EntryType::File;
+            entry.size = info.stx_size;
+        } else if (S_ISDIR(info.stx_mode)) {
+            entry.type = EntryType::Directory;
+        } else if (S_ISLNK(info.stx_mode)) {
+            entry.type = EntryType::Symlink;
+        } else {
+            m_nameRanges[index].second = kDropped;
+            continue;
+        }
+        entry.mtime = static_cast<int64_t>(info.stx_mtime.tv_sec) * 1000000000 + info.stx_mtime.tv_nsec;
+    }
+
+    close(fd);
+    if (error != 0) {
+        ThrowError(relativePath, error);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        if (m_nameRanges[i].second == kDropped) {
+            continue;
+        }
+        m_entries[kept] = m_entries[i];
+        m_entries[kept].name = PathView(m_names.data() + m_nameRanges[i].first, m_nameRanges[i].second);
+        kept++;
+    }
+    m_entries.resize(kept);
+    return m_entries;
+}
+
+#endif
+
+void DirectoryEnumerator::ThrowError(const PathString& relativePath, int error) const {
+#ifdef _WIN32
+    std::error_code ec(error, std::system_category());
+#else
+    std::error_code ec(error, std::generic_category());
+#endif
+    throw fs::filesystem_error("cannot read directory", relativePath.empty() ? m_root : m_root / relativePath, ec);
+}
+
+bool StatEntry(const fs::path& path, EntryType& type, uint64_t& size, int64_t& mtime) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+        return false;
+    }
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+        type = EntryType::Symlink;
+    } else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        type = EntryType::Directory;
+    } else {
+        type = EntryType::File;
+    }
+    size = type == EntryType::File ? (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow : 0;
+    mtime = static_cast<int64_t>((static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+                                 data.ftLastWriteTime.dwLowDateTime);
+    return true;
+#else
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    if (S_ISREG(info.st_mode)) {
+        type = EntryType::File;
+    } else if (S_ISDIR(info.st_mode)) {
+        type = EntryType::Directory;
+    } else if (S_ISLNK(info.st_mode)) {
+        type = EntryType::Symlink;
+    } else {
+        return false;
+    }
+    size = type == EntryType::File ? static_cast<uint64_t>(info.st_size) : 0;
+    mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+#endif
+}
+
+} // namespace zdm
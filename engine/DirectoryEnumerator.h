@@ -0,0 +1,69 @@
+#ifndef DIRECTORY_ENUMERATOR_H
+#define DIRECTORY_ENUMERATOR_H
+
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#include "Manifest.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// One entry of a directory listing
+struct DirectoryEntryInfo {
+    PathView name;  // points into the enumerator, valid until its next Read
+    EntryType type;
+    uint64_t size;  // files only
+    int64_t mtime;  // same clock as ManifestEntry::mtime, 0 for directories on Linux
+};
+
+// Lists whole directories of one tree with as few system calls as possible: type,
+// size and mtime come with the listing instead of one stat per entry.
+// Linux: getdents64 into a large buffer, directory types from the listing itself and
+// one statx per other entry, issued in inode order once the listing is complete.
+// Windows: FindFirstFileExW with FIND_FIRST_EX_LARGE_FETCH.
+// Sockets, pipes, devices and entries removed while the directory is read are left out.
+// Not thread-safe, every thread uses its own.
+class DirectoryEnumerator {
+public:
+    // Directories are read relative to root. Throws fs::filesystem_error if it cannot be opened.
+    explicit DirectoryEnumerator(const fs::path& root);
+    ~DirectoryEnumerator();
+
+    DirectoryEnumerator(const DirectoryEnumerator&) = delete;
+    DirectoryEnumerator& operator=(const DirectoryEnumerator&) = delete;
+
+    // Entries of root/relativePath ("" for root itself) without "." and "..",
+    // in directory order. Throws fs::filesystem_error.
+    const std::vector<DirectoryEntryInfo>& Read(const PathString& relativePath);
+
+private:
+    [[noreturn]] void ThrowError(const PathString& relativePath, int error) const;
+
+    // Append an entry whose name is stored in m_names, the views are set once the listing is done
+    void AddEntry(PathView name, EntryType type, uint64_t size, int64_t mtime);
+
+    fs::path m_root;
+    std::vector<DirectoryEntryInfo> m_entries;
+    std::vector<std::pair<size_t, size_t>> m_nameRanges; // offset and length in m_names
+    PathString m_names;
+#ifdef _WIN32
+    PathString m_pattern; // "<root>\<relative>\*"
+    size_t m_rootLength = 0;
+#else
+    int m_rootFd = -1;
+    std::vector<char> m_records;              // getdents64 output
+    std::vector<std::pair<uint64_t, size_t>> m_statOrder; // inode and entry index
+#endif
+};
+
+// Type, size and mtime of one path, on the clock of a scan. False when it does not
+// exist or is something a scan leaves out (socket, device).
+bool StatEntry(const fs::path& path, EntryType& type, uint64_t& size, int64_t& mtime);
+
+} // namespace zdm
+
+#endif // DIRECTORY_ENUMERATOR_H
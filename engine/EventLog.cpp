@@ -0,0 +1,191 @@
+#include "EventLog.h"
+
+#include <cstdio>
+#include <ctime>
+#include <sstream>
+#include <system_error>
+
+namespace zdm {
+
+namespace {
+
+// Wake the writer early once this much is buffered
+const size_t kFlushBytes = 64 * 1024;
+
+// Current UTC time as 2026-01-31T08:15:02.125Z
+std::string UtcTimestamp() {
+    auto now = std::chrono::system_clock::now();
+    std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    int milliseconds = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+
+    std::tm utc = {};
+#ifdef _WIN32
+    gmtime_s(&utc, &seconds);
+#else
+    gmtime_r(&seconds, &utc);
+#endif
+    char buffer[32];
+    size_t length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(buffer + length, sizeof(buffer) - length, ".%03dZ", milliseconds);
+    return buffer;
+}
+
+std::string FormatSeconds(double seconds) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.3f", seconds);
+    return buffer;
+}
+
+} // namespace
+
+std::string JsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+EventLog::EventLog(const fs::path& path, std::chrono::milliseconds flushInterval)
+    : m_file(path, std::ios_base::app | std::ios_base::binary),
+      m_flushInterval(flushInterval),
+      m_opened(Clock::now()) {
+    if (!m_file.is_open()) {
+        throw fs::filesystem_error("cannot open log", path, std::make_error_code(std::errc::io_error));
+    }
+    m_thread = std::thread(&EventLog::Run, this);
+}
+
+EventLog::~EventLog() {
+    Close();
+}
+
+void EventLog::EnableTrace(const fs::path& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tracePath = path;
+}
+
+void EventLog::Write(const std::string& event, const std::string& fields) {
+    double elapsed = std::chrono::duration<double>(Clock::now() - m_opened).count();
+    std::string line = "{\"time\":\"" + UtcTimestamp() + "\",\"elapsed\":" + FormatSeconds(elapsed) +
+                       ",\"event\":" + JsonString(event) + (fields.empty() ? "" : "," + fields) + "}\n";
+
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_closed) {
+            return;
+        }
+        m_pending += line;
+        wake = m_pending.size() >= kFlushBytes;
+    }
+    if (wake) {
+        m_wake.notify_one();
+    }
+}
+
+void EventLog::Message(const std::string& text) {
+    Write("message", "\"message\":" + JsonString(text));
+}
+
+void EventLog::Span(const std::string& phase, Clock::time_point begin, Clock::time_point end,
+                    const SpanCounters& counters, const std::string& fields, unsigned thread) {
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    double rate = seconds > 0 ? counters.bytes / seconds : 0;
+    Write("span", "\"phase\":" + JsonString(phase) + ",\"seconds\":" + FormatSeconds(seconds) +
+                  ",\"files\":" + std::to_string(counters.files) + ",\"bytes\":" + std::to_string(counters.bytes) +
+                  ",\"bytes_per_second\":" + std::to_string(static_cast<uint64_t>(rate)) +
+                  (fields.empty() ? "" : "," + fields));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_tracePath.empty()) {
+        m_spans.push_back({ phase, std::chrono::duration<double>(begin - m_opened).count(), seconds, counters, thread });
+    }
+}
+
+void EventLog::Close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_closed) {
+            return;
+        }
+        m_closing = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    if (!m_tracePath.empty()) {
+        WriteTrace();
+    }
+}
+
+void EventLog::Run() {
+    std::string batch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait_for(lock, m_flushInterval, [this] { return m_closing || m_pending.size() >= kFlushBytes; });
+        batch.swap(m_pending);
+        bool closing = m_closing;
+
+        // The file is only touched here, callers keep appending meanwhile
+        lock.unlock();
+        if (!batch.empty()) {
+            m_file.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+            m_file.flush();
+            batch.clear();
+        }
+        lock.lock();
+
+        if (closing && m_pending.empty()) {
+            return;
+        }
+    }
+}
+
+// Complete ("X") events in microseconds, one row per thread
+void EventLog::WriteTrace() {
+    std::ostringstream trace;
+    trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < m_spans.size(); i++) {
+        const TraceSpan& span = m_spans[i];
+        trace << (i ? "," : "") << "\n{\"name\":" << JsonString(span.phase) << ",\"cat\":\"phase\",\"ph\":\"X\""
+              << ",\"ts\":" << static_cast<uint64_t>(span.begin * 1e6)
+              << ",\"dur\":" << static_cast<uint64_t>(span.seconds * 1e6)
+              << ",\"pid\":1,\"tid\":" << span.thread
+              << ",\"args\":{\"files\":" << span.counters.files << ",\"bytes\":" << span.counters.bytes << "}}";
+    }
+    trace << "\n]}\n";
+    std::ofstream(m_tracePath, std::ios_base::binary) << trace.str();
+}
+
+PhaseSpan::PhaseSpan(EventLog* log, std::string phase)
+    : m_log(log), m_phase(std::move(phase)), m_begin(EventLog::Clock::now()) {
+}
+
+PhaseSpan::~PhaseSpan() {
+    if (m_log) {
+        m_log->Span(m_phase, m_begin, EventLog::Clock::now(), SpanCounters(), "\"ok\":false");
+    }
+}
+
+void PhaseSpan::End(const SpanCounters& counters, const std::string& fields) {
+    if (m_log) {
+        m_log->Span(m_phase, m_begin, EventLog::Clock::now(), counters,
+                    "\"ok\":true" + (fields.empty() ? "" : "," + fields));
+        m_log = nullptr;
+    }
+}
+
+} // namespace zdm
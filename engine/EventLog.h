@@ -0,0 +1,109 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Work done during a span
+struct SpanCounters {
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+};
+
+// Structured log: one JSON object per line, e.g.
+//   {"time":"2026-01-31T08:15:02.125Z","elapsed":12.500,"event":"span","phase":"copy","seconds":9.8,...}
+// Callers only format the line and append it to a buffer, a background thread writes
+// the buffer out every flush interval, so logging never waits for the disk.
+// Spans can also be exported as Chrome trace events (chrome://tracing, ui.perfetto.dev).
+class EventLog {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Append to path, creating it. Throws fs::filesystem_error when it cannot be opened.
+    explicit EventLog(const fs::path& path, std::chrono::milliseconds flushInterval = std::chrono::milliseconds(500));
+    ~EventLog();
+
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+
+    // Keep every span and write them as trace events to path on Close
+    void EnableTrace(const fs::path& path);
+
+    // One line with event and fields, the members of a JSON object without its braces (may be empty)
+    void Write(const std::string& event, const std::string& fields = std::string());
+
+    // A free-text line, event "message"
+    void Message(const std::string& text);
+
+    // A finished phase: event "span" with its length, counters and extra fields.
+    // thread separates spans that overlap in the trace (e.g. verification during the copy).
+    void Span(const std::string& phase, Clock::time_point begin, Clock::time_point end,
+              const SpanCounters& counters, const std::string& fields = std::string(), unsigned thread = 0);
+
+    // Write what is buffered, the trace if enabled, and stop the writer thread. Called by the destructor.
+    void Close();
+
+private:
+    struct TraceSpan {
+        std::string phase;
+        double begin; // seconds since the log was opened
+        double seconds;
+        SpanCounters counters;
+        unsigned thread;
+    };
+
+    void Run();
+    void WriteTrace();
+
+    std::ofstream m_file;
+    std::chrono::milliseconds m_flushInterval;
+    Clock::time_point m_opened;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::string m_pending;
+    bool m_closing = false;
+    bool m_closed = false;
+
+    fs::path m_tracePath;
+    std::vector<TraceSpan> m_spans;
+
+    std::thread m_thread;
+};
+
+// Times one phase and logs it as a span when it ends. A span that is destroyed
+// without End (the phase threw) is logged with "ok":false.
+class PhaseSpan {
+public:
+    // log may be null, then nothing is recorded
+    PhaseSpan(EventLog* log, std::string phase);
+    ~PhaseSpan();
+
+    PhaseSpan(const PhaseSpan&) = delete;
+    PhaseSpan& operator=(const PhaseSpan&) = delete;
+
+    void End(const SpanCounters& counters = SpanCounters(), const std::string& fields = std::string());
+
+private:
+    EventLog* m_log;
+    std::string m_phase;
+    EventLog::Clock::time_point m_begin;
+};
+
+// text as a quoted JSON string
+std::string JsonString(const std::string& text);
+
+} // namespace zdm
+
+#endif // EVENT_LOG_H
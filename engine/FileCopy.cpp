@@ -0,0 +1,526 @@
+#include "FileCopy.h"
+#include "Checksum.h"
+
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+const size_t kAlignment = 4096;
+
+size_t AlignUp(size_t value) {
+    return (value + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+[[noreturn]] void ThrowCopyError(const fs::path& source, const fs::path& destination, int error) {
+#ifdef _WIN32
+    std::error_code ec(error, std::system_category());
+#else
+    std::error_code ec(error, std::generic_category());
+#endif
+    throw fs::filesystem_error("cannot copy file", source, destination, ec);
+}
+
+#ifndef _WIN32
+
+// Closes a descriptor on scope exit
+class UniqueFd {
+public:
+    explicit UniqueFd(int fd = -1) : m_fd(fd) {}
+    ~UniqueFd() { if (m_fd >= 0) close(m_fd); }
+    UniqueFd(const UniqueFd&) = delete;
+    UniqueFd& operator=(const UniqueFd&) = delete;
+
+    int Get() const { return m_fd; }
+    int Release() { int fd = m_fd; m_fd = -1; return fd; }
+    void Reset() { if (m_fd >= 0) close(m_fd); m_fd = -1; }
+
+private:
+    int m_fd;
+};
+
+// Page-aligned heap buffer, required by O_DIRECT
+class AlignedBuffer {
+public:
+    explicit AlignedBuffer(size_t size) : m_size(AlignUp(size)) {
+        if (posix_memalign(&m_data, kAlignment, m_size) != 0) {
+            throw std::bad_alloc();
+        }
+    }
+    ~AlignedBuffer() { free(m_data); }
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    char* Data() const { return static_cast<char*>(m_data); }
+    size_t Size() const { return m_size; }
+
+private:
+    void* m_data = nullptr;
+    size_t m_size;
+};
+
+// Open with O_DIRECT when asked, retrying without it on filesystems that refuse (tmpfs)
+int OpenMaybeDirect(const fs::path& path, int flags, mode_t mode, bool directIo) {
+    if (directIo) {
+        int fd = open(path.c_str(), flags | O_DIRECT | O_CLOEXEC, mode);
+        if (fd >= 0 || errno != EINVAL) {
+            return fd;
+        }
+    }
+    return open(path.c_str(), flags | O_CLOEXEC, mode);
+}
+
+// True for errors meaning "this offload method does not apply here"
+bool IsOffloadUnsupported(int error) {
+    return error == EXDEV || error == EINVAL || error == ENOSYS ||
+           error == EOPNOTSUPP || error == EBADF || error == EPERM;
+}
+
+// Kernel-side copy of the remaining data, returns false if offload is not available
+// for this pair of files. Both descriptors advance their file offsets. With a scheduler
+// the data moves in buffer-sized calls so it can be paced, otherwise in 1 GiB calls.
+bool OffloadCopy(int in, int out, const FileCopyTuning& tuning, IoScheduler* scheduler,
+                 const fs::path& source, const fs::path& destination) {
+    const size_t kChunk = scheduler ? AlignUp(tuning.bufferSize < kAlignment ? kAlignment : tuning.bufferSize)
+                                    : 1u << 30;
+    bool anyCopied = false;
+
+    for (;;) {
+        ssize_t copied = copy_file_range(in, nullptr, out, nullptr, kChunk, 0);
+        if (copied > 0) {
+            anyCopied = true;
+            if (scheduler) {
+                scheduler->Throttle(static_cast<uint64_t>(copied));
+            }
+            continue;
+        }
+        if (copied == 0) {
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (!anyCopied && IsOffloadUnsupported(errno)) {
+            break;
+        }
+        ThrowCopyError(source, destination, errno);
+    }
+
+    for (;;) {
+        ssize_t copied = sendfile(out, in, nullptr, kChunk);
+        if (copied > 0) {
+            anyCopied = true;
+            if (scheduler) {
+                scheduler->Throttle(static_cast<uint64_t>(copied));
+            }
+            continue;
+        }
+        if (copied == 0) {
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (!anyCopied && IsOffloadUnsupported(errno)) {
+            return false;
+        }
+        ThrowCopyError(source, destination, errno);
+    }
+}
+
+// Write all of data, dropping O_DIRECT if the filesystem rejects it mid-stream
+void WriteAll(int out, const char* data, size_t length, const fs::path& source, const fs::path& destination) {
+    while (length > 0) {
+        ssize_t written = write(out, data, length);
+        if (written < 0) {
+            int error = errno;
+            if (error == EINTR) {
+                continue;
+            }
+            int flags = fcntl(out, F_GETFL);
+            if (error == EINVAL && flags >= 0 && (flags & O_DIRECT)) {
+                fcntl(out, F_SETFL, flags & ~O_DIRECT);
+                continue;
+            }
+            ThrowCopyError(source, destination, error);
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+}
+
+// Read/write loop through one aligned buffer, hashing the data on the way when asked
+void BufferedCopy(int in, int out, const FileCopyTuning& tuning, uint32_t* checksum, IoScheduler* scheduler,
+                  const fs::path& source, const fs::path& destination) {
+    AlignedBuffer buffer(tuning.bufferSize < kAlignment ? kAlignment : tuning.bufferSize);
+    uint64_t total = 0;
+    bool padded = false;
+
+    for (;;) {
+        ssize_t count = read(in, buffer.Data(), buffer.Size());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowCopyError(source, destination, errno);
+        }
+        if (count == 0) {
+            break;
+        }
+
+        size_t length = static_cast<size_t>(count);
+        total += length;
+        if (checksum) {
+            *checksum = Crc32c(*checksum, buffer.Data(), length);
+        }
+
+        // O_DIRECT writes must be whole blocks, pad the tail and trim it afterwards
+        int flags = fcntl(out, F_GETFL);
+        if (flags >= 0 && (flags & O_DIRECT) && length % kAlignment != 0) {
+            size_t alignedLength = AlignUp(length);
+            memset(buffer.Data() + length, 0, alignedLength - length);
+            length = alignedLength;
+            padded = true;
+        }
+        WriteAll(out, buffer.Data(), length, source, destination);
+        if (scheduler) {
+            scheduler->Throttle(static_cast<uint64_t>(count));
+        }
+
+        // Keep the offset exact in case a short read was not the end of the file
+        if (padded && lseek(out, static_cast<off_t>(total), SEEK_SET) < 0) {
+            ThrowCopyError(source, destination, errno);
+        }
+    }
+
+    if (padded && ftruncate(out, static_cast<off_t>(total)) != 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+}
+
+#else
+
+// Closes a handle on scope exit
+class UniqueHandle {
+public:
+    explicit UniqueHandle(HANDLE handle) : m_handle(handle) {}
+    ~UniqueHandle() { Reset(); }
+    UniqueHandle(const UniqueHandle&) = delete;
+    UniqueHandle& operator=(const UniqueHandle&) = delete;
+
+    HANDLE Get() const { return m_handle; }
+    void Reset() { if (m_handle != INVALID_HANDLE_VALUE) CloseHandle(m_handle); m_handle = INVALID_HANDLE_VALUE; }
+
+private:
+    HANDLE m_handle;
+};
+
+// ReadFile/WriteFile loop, used instead of CopyFileEx when the data must be hashed
+void StreamCopy(const fs::path& source, const fs::path& destination, uint64_t size,
+                const FileCopyTuning& tuning, uint32_t* checksum, IoScheduler* scheduler) {
+    UniqueHandle in(CreateFileW(source.c_str(), GENERIC_READ,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (in.Get() == INVALID_HANDLE_VALUE) {
+        ThrowCopyError(source, destination, static_cast<int>(GetLastError()));
+    }
+    UniqueHandle out(CreateFileW(destination.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, NULL));
+    if (out.Get() == INVALID_HANDLE_VALUE) {
+        ThrowCopyError(source, destination, static_cast<int>(GetLastError()));
+    }
+
+    if (tuning.preallocate && size >= tuning.largeFileThreshold) {
+        FILE_ALLOCATION_INFO allocation;
+        allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+        SetFileInformationByHandle(out.Get(), FileAllocationInfo, &allocation, sizeof(allocation));
+    }
+
+    std::vector<char> buffer(AlignUp(tuning.bufferSize < kAlignment ? kAlignment : tuning.bufferSize));
+    for (;;) {
+        DWORD bytesRead = 0;
+        if (!ReadFile(in.Get(), buffer.data(), static_cast<DWORD>(buffer.size()), &bytesRead, NULL)) {
+            ThrowCopyError(source, destination, static_cast<int>(GetLastError()));
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        if (checksum) {
+            *checksum = Crc32c(*checksum, buffer.data(), bytesRead);
+        }
+        DWORD bytesWritten = 0;
+        if (!WriteFile(out.Get(), buffer.data(), bytesRead, &bytesWritten, NULL) || bytesWritten != bytesRead) {
+            ThrowCopyError(source, destination, static_cast<int>(GetLastError()));
+        }
+        if (scheduler) {
+            scheduler->Throttle(bytesWritten);
+        }
+    }
+
+    FILETIME creationTime, accessTime, writeTime;
+    if (GetFileTime(in.Get(), &creationTime, &accessTime, &writeTime)) {
+        SetFileTime(out.Get(), &creationTime, &accessTime, &writeTime);
+    }
+}
+
+// CopyFileEx progress routine: accounts each chunk with the scheduler, which may pause the copy
+struct CopyExProgress {
+    IoScheduler* scheduler;
+    uint64_t accounted;
+};
+
+DWORD CALLBACK OnCopyExProgress(LARGE_INTEGER, LARGE_INTEGER totalTransferred, LARGE_INTEGER, LARGE_INTEGER,
+                                DWORD, DWORD, HANDLE, HANDLE, LPVOID data) {
+    CopyExProgress* progress = static_cast<CopyExProgress*>(data);
+    uint64_t transferred = static_cast<uint64_t>(totalTransferred.QuadPart);
+    if (transferred > progress->accounted) {
+        progress->scheduler->Throttle(transferred - progress->accounted);
+        progress->accounted = transferred;
+    }
+    return PROGRESS_CONTINUE;
+}
+
+// FSCTL_DUPLICATE_EXTENTS_TO_FILE and its input, declared here for SDKs that predate them
+const DWORD kDuplicateExtentsToFile = CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 209, METHOD_BUFFERED, FILE_WRITE_ACCESS);
+
+struct DuplicateExtentsData {
+    HANDLE fileHandle;
+    LARGE_INTEGER sourceFileOffset;
+    LARGE_INTEGER targetFileOffset;
+    LARGE_INTEGER byteCount;
+};
+
+// Errors meaning the volume, or this pair of files, cannot be cloned
+bool IsCloneUnsupported(DWORD error) {
+    return error == ERROR_NOT_SUPPORTED || error == ERROR_INVALID_FUNCTION ||
+           error == ERROR_NOT_SAME_DEVICE || error == ERROR_INVALID_PARAMETER;
+}
+
+// Block cloning works in whole clusters of the destination volume
+DWORD ClusterSize(const fs::path& path) {
+    wchar_t volume[MAX_PATH];
+    DWORD sectorsPerCluster, bytesPerSector, freeClusters, totalClusters;
+    if (!GetVolumePathNameW(path.c_str(), volume, MAX_PATH) ||
+        !GetDiskFreeSpaceW(volume, &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters)) {
+        return 0;
+    }
+    return sectorsPerCluster * bytesPerSector;
+}
+
+// ReFS (and Dev Drive) block cloning: the destination references the source clusters
+bool BlockClone(const fs::path& source, const fs::path& destination) {
+    UniqueHandle in(CreateFileW(source.c_str(), GENERIC_READ,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                                OPEN_EXISTING, 0, NULL));
+    if (in.Get() == INVALID_HANDLE_VALUE) {
+        ThrowCopyError(source, destination, static_cast<int>(GetLastError()));
+    }
+    DWORD volumeFlags = 0;
+    if (!GetVolumeInformationByHandleW(in.Get(), NULL, 0, NULL, NULL, &volumeFlags, NULL, 0) ||
+        (volumeFlags & FILE_SUPPORTS_BLOCK_REFCOUNTING) == 0) {
+        return false;
+    }
+    DWORD clusterSize = ClusterSize(destination.parent_path());
+    if (clusterSize == 0) {
+        return false;
+    }
+
+    FILE_BASIC_INFO basic;
+    FILE_STANDARD_INFO standard;
+    if (!GetFileInformationByHandleEx(in.Get(), FileBasicInfo, &basic, sizeof(basic)) ||
+        !GetFileInformationByHandleEx(in.Get(), FileStandardInfo, &standard, sizeof(standard))) {
+        ThrowCopyError(source, destination, static_cast<int>(GetLastError()));
+    }
+
+    UniqueHandle out(CreateFileW(destination.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, NULL));
+    if (out.Get() == INVALID_HANDLE_VALUE) {
+        ThrowCopyError(source, destination, static_cast<int>(GetLastError()));
+    }
+    auto fail = [&](DWORD error) {
+        out.Reset();
+        DeleteFileW(destination.c_str());
+        if (!IsCloneUnsupported(error)) {
+            ThrowCopyError(source, destination, static_cast<int>(error));
+        }
+        return false;
+    };
+
+    // Source and destination must agree on sparseness, and the destination needs its final size first
+    DWORD returned = 0;
+    if ((basic.FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0 &&
+        !DeviceIoControl(out.Get(), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL)) {
+        return fail(GetLastError());
+    }
+    FILE_END_OF_FILE_INFO endOfFile;
+    endOfFile.EndOfFile = standard.EndOfFile;
+    if (!SetFileInformationByHandle(out.Get(), FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) {
+        return fail(GetLastError());
+    }
+
+    // Below 4 GiB per call, the last range is rounded up to a whole cluster past the end of file
+    const LONGLONG kChunk = 1ll << 31;
+    LONGLONG rounded = (standard.EndOfFile.QuadPart + clusterSize - 1) / clusterSize * clusterSize;
+    for (LONGLONG offset = 0; offset < rounded; offset += kChunk) {
+        DuplicateExtentsData extents;
+        extents.fileHandle = in.Get();
+        extents.sourceFileOffset.QuadPart = offset;
+        extents.targetFileOffset.QuadPart = offset;
+        extents.byteCount.QuadPart = rounded - offset < kChunk ? rounded - offset : kChunk;
+        if (!DeviceIoControl(out.Get(), kDuplicateExtentsToFile, &extents, sizeof(extents), NULL, 0, &returned, NULL)) {
+            return fail(GetLastError());
+        }
+    }
+
+    // Times and attributes, as CopyFileEx keeps them
+    SetFileInformationByHandle(out.Get(), FileBasicInfo, &basic, sizeof(basic));
+    return true;
+}
+
+#endif // !_WIN32
+
+} // namespace
+
+void CopyLargeFile(const fs::path& source, const fs::path& destination, uint64_t size,
+                   const FileCopyTuning& tuning, uint32_t* checksum, IoScheduler* scheduler) {
+    if (checksum) {
+        *checksum = 0;
+    }
+#ifdef _WIN32
+    // CopyFileEx never exposes the data, hashing needs the explicit loop
+    if (checksum) {
+        StreamCopy(source, destination, size, tuning, checksum, scheduler);
+        return;
+    }
+
+    // CopyFileEx already preallocates and offloads (ODX, SMB server-side copy)
+    DWORD flags = tuning.directIo ? COPY_FILE_NO_BUFFERING : 0;
+    CopyExProgress progress = { scheduler, 0 };
+    if (!CopyFileExW(source.c_str(), destination.c_str(), scheduler ? OnCopyExProgress : NULL,
+                     scheduler ? &progress : NULL, NULL, flags)) {
+        ThrowCopyError(source, destination, static_cast<int>(GetLastError()));
+    }
+#else
+    UniqueFd in(OpenMaybeDirect(source, O_RDONLY, 0, tuning.directIo));
+    if (in.Get() < 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+
+    struct stat sourceStat;
+    if (fstat(in.Get(), &sourceStat) != 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+
+    UniqueFd out(OpenMaybeDirect(destination, O_WRONLY | O_CREAT | O_TRUNC, 0600, tuning.directIo));
+    if (out.Get() < 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+
+    posix_fadvise(in.Get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Reserve blocks without changing the visible size, ignored where unsupported
+    if (tuning.preallocate && size > 0) {
+        fallocate(out.Get(), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size));
+    }
+
+    // copy_file_range goes through the page cache, so it is skipped for direct I/O,
+    // and the data never reaches user space, so it is skipped when hashing
+    bool copied = false;
+    if (tuning.kernelOffload && !tuning.directIo && !checksum) {
+        copied = OffloadCopy(in.Get(), out.Get(), tuning, scheduler, source, destination);
+    }
+    if (!copied) {
+        BufferedCopy(in.Get(), out.Get(), tuning, checksum, scheduler, source, destination);
+    }
+
+    // Same metadata fs::copy_file keeps, plus the modification time
+    fchmod(out.Get(), sourceStat.st_mode & 07777);
+    struct timespec times[2] = { sourceStat.st_atim, sourceStat.st_mtim };
+    futimens(out.Get(), times);
+
+    if (close(out.Release()) != 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+#endif
+}
+
+bool CloneFile(const fs::path& source, const fs::path& destination) {
+#ifdef _WIN32
+    return BlockClone(source, destination);
+#else
+    UniqueFd in(open(source.c_str(), O_RDONLY | O_CLOEXEC));
+    if (in.Get() < 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+
+    struct stat sourceStat;
+    if (fstat(in.Get(), &sourceStat) != 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+
+    UniqueFd out(open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+    if (out.Get() < 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+
+    // Shares the source extents copy-on-write (Btrfs, XFS with reflink, bcachefs).
+    // EXDEV: different file systems, EOPNOTSUPP/ENOTTY: no reflink support, EINVAL: e.g. a nodatacow file.
+    if (ioctl(out.Get(), FICLONE, in.Get()) != 0) {
+        int error = errno;
+        out.Reset();
+        unlink(destination.c_str());
+        if (IsOffloadUnsupported(error) || error == ENOTTY) {
+            return false;
+        }
+        ThrowCopyError(source, destination, error);
+    }
+
+    fchmod(out.Get(), sourceStat.st_mode & 07777);
+    struct timespec times[2] = { sourceStat.st_atim, sourceStat.st_mtim };
+    futimens(out.Get(), times);
+
+    if (close(out.Release()) != 0) {
+        ThrowCopyError(source, destination, errno);
+    }
+    return true;
+#endif
+}
+
+void CopyFileData(const fs::path& source, const fs::path& destination, uint64_t size,
+                  const FileCopyTuning& tuning, uint32_t* checksum, IoScheduler* scheduler) {
+    // fs::copy_file can neither hash nor pause, the streaming path handles every size
+    if (size >= tuning.largeFileThreshold || checksum || (scheduler && scheduler->HasCap())) {
+        CopyLargeFile(source, destination, size, tuning, checksum, scheduler);
+    } else {
+        fs::copy_file(source, destination, fs::copy_options::overwrite_existing);
+#ifndef _WIN32
+        // libstdc++ leaves the copy time, a resumed run compares the source mtime
+        struct stat sourceStat;
+        if (stat(source.c_str(), &sourceStat) == 0) {
+            struct timespec times[2] = { sourceStat.st_atim, sourceStat.st_mtim };
+            utimensat(AT_FDCWD, destination.c_str(), times, 0);
+        }
+#endif
+        if (scheduler) {
+            scheduler->Throttle(size);
+        }
+    }
+}
+
+} // namespace zdm
@@ -0,0 +1,72 @@
+#ifndef FILE_COPY_H
+#define FILE_COPY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include "AsyncIo.h"
+#include "IoScheduler.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Knobs for copying a single file
+struct FileCopyTuning {
+    // Files up to this size are copied in per-directory batches (see DirectoryBatchCopier)
+    uint64_t smallFileThreshold = 256 * 1024;
+
+    // Maximum number of small files handled by one batch task
+    size_t smallBatchMaxFiles = 256;
+
+    // Files at or above this size take the large-file streaming path
+    uint64_t largeFileThreshold = 64ull * 1024 * 1024;
+
+    // Streaming buffer, rounded up to a multiple of 4 KiB
+    size_t bufferSize = 4 * 1024 * 1024;
+
+    // Reserve the full destination size up front to avoid fragmentation
+    bool preallocate = true;
+
+    // Bypass the page cache (O_DIRECT / COPY_FILE_NO_BUFFERING). Disables kernel offload on Linux.
+    bool directIo = false;
+
+    // Let the kernel move the data (copy_file_range / sendfile) when possible
+    bool kernelOffload = true;
+
+    // Clone files above smallFileThreshold (see CloneFile) when the destination volume
+    // supports it, so no data is copied at all. Files that cannot be cloned are copied.
+    bool reflink = true;
+
+    // How small-file batches move their data, and how many requests each copy thread keeps in flight
+    IoBackend ioBackend = IoBackend::Auto;
+    unsigned queueDepth = 32;
+};
+
+// Copy one regular file, choosing the path from its size. When checksum is given
+// it receives the CRC32C of the data as it was read from the source. The data moved
+// is accounted with scheduler (may be null), chunk by chunk while it has a bandwidth cap.
+// Overwrites destination. Throws fs::filesystem_error on failure.
+void CopyFileData(const fs::path& source, const fs::path& destination, uint64_t size,
+                  const FileCopyTuning& tuning, uint32_t* checksum = nullptr,
+                  IoScheduler* scheduler = nullptr);
+
+// Streaming copy for large files: preallocation, large aligned buffers,
+// optional direct I/O and kernel copy offload (not used while hashing).
+// Every chunk is accounted with scheduler (may be null) as it is written.
+// Throws fs::filesystem_error on failure.
+void CopyLargeFile(const fs::path& source, const fs::path& destination, uint64_t size,
+                   const FileCopyTuning& tuning, uint32_t* checksum = nullptr,
+                   IoScheduler* scheduler = nullptr);
+
+// Make destination a copy of source that shares its blocks copy-on-write, with the
+// source's permissions and times: FICLONE on Linux (Btrfs, XFS), block cloning on ReFS.
+// Returns false, leaving no destination behind, when the file system cannot clone
+// (or source and destination are on different volumes).
+// Overwrites destination. Throws fs::filesystem_error on other failures.
+bool CloneFile(const fs::path& source, const fs::path& destination);
+
+} // namespace zdm
+
+#endif // FILE_COPY_H
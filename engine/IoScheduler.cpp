@@ -0,0 +1,239 @@
+#include "IoScheduler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+// Hill-climbing window, and the changes in throughput and latency that count as real
+const std::chrono::seconds kAdaptWindow(1);
+const double kRateTolerance = 0.05;
+const double kLatencyTolerance = 0.10;
+
+// Longest single sleep while waiting, so a cancel is seen quickly
+const std::chrono::milliseconds kWaitSlice(100);
+
+} // namespace
+
+DeviceKind ProbeDevice(const fs::path& path) {
+#ifdef _WIN32
+    wchar_t volume[MAX_PATH];
+    wchar_t volumeName[MAX_PATH];
+    if (!GetVolumePathNameW(path.c_str(), volume, MAX_PATH) ||
+        !GetVolumeNameForVolumeMountPointW(volume, volumeName, MAX_PATH)) {
+        return DeviceKind::Unknown;
+    }
+
+    // "\\?\Volume{...}\" names the volume's root directory, without the backslash the volume itself
+    std::wstring device = volumeName;
+    if (!device.empty() && device.back() == L'\\') {
+        device.pop_back();
+    }
+    HANDLE handle = CreateFileW(device.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return DeviceKind::Unknown;
+    }
+
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageDeviceSeekPenaltyProperty;
+    query.QueryType = PropertyStandardQuery;
+    DEVICE_SEEK_PENALTY_DESCRIPTOR seekPenalty = {};
+    DWORD returned = 0;
+    BOOL reported = DeviceIoControl(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+                                    &seekPenalty, sizeof(seekPenalty), &returned, NULL);
+    CloseHandle(handle);
+    if (!reported || returned < sizeof(seekPenalty)) {
+        return DeviceKind::Unknown;
+    }
+    return seekPenalty.IncursSeekPenalty ? DeviceKind::Rotational : DeviceKind::SolidState;
+#else
+    struct stat pathStat;
+    if (stat(path.c_str(), &pathStat) != 0) {
+        return DeviceKind::Unknown;
+    }
+
+    // /sys/dev/block/MAJ:MIN is the disk or one of its partitions, which has no queue of its own
+    std::error_code ec;
+    fs::path device = fs::canonical("/sys/dev/block/" + std::to_string(major(pathStat.st_dev)) + ":" +
+                                    std::to_string(minor(pathStat.st_dev)), ec);
+    if (ec) {
+        return DeviceKind::Unknown;
+    }
+    if (fs::exists(device / "partition", ec)) {
+        device = device.parent_path();
+    }
+
+    std::ifstream rotational(device / "queue" / "rotational");
+    int value = -1;
+    if (!(rotational >> value)) {
+        return DeviceKind::Unknown;
+    }
+    return value ? DeviceKind::Rotational : DeviceKind::SolidState;
+#endif
+}
+
+const char* DeviceKindName(DeviceKind kind) {
+    switch (kind) {
+    case DeviceKind::Rotational:
+        return "hdd";
+    case DeviceKind::SolidState:
+        return "ssd";
+    default:
+        return "unknown";
+    }
+}
+
+unsigned DeviceStreamLimit(DeviceKind kind) {
+    // One file being read while the previous one is written, more only adds seeks
+    return kind == DeviceKind::Rotational ? 2 : 0;
+}
+
+void SetBackgroundPriority() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__)
+    // ioprio_set(IOPRIO_WHO_PROCESS, 0 = this thread, IOPRIO_CLASS_IDLE): I/O only when the disk is otherwise idle
+    const int kWhoProcess = 1;
+    const int kClassIdle = 3;
+    const int kClassShift = 13;
+    syscall(SYS_ioprio_set, kWhoProcess, 0, kClassIdle << kClassShift);
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#else
+    setpriority(PRIO_PROCESS, 0, 10);
+#endif
+}
+
+IoScheduler::IoScheduler(const IoLimits& limits, unsigned limit, const std::atomic<bool>* cancel)
+    : m_cancel(cancel),
+      m_ceiling(std::max(limit, 1u)),
+      m_limit(m_ceiling),
+      m_adaptive(limits.adaptive && m_ceiling > 1),
+      m_windowStart(Clock::now()),
+      m_bytesPerSecond(limits.maxBytesPerSecond),
+      m_capClock(Clock::now()) {
+}
+
+bool IoScheduler::Canceled() const {
+    return m_cancel && m_cancel->load(std::memory_order_relaxed);
+}
+
+unsigned IoScheduler::StreamLimit() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_limit;
+}
+
+void IoScheduler::BeginStream() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_active >= m_limit && !Canceled()) {
+        m_streamFree.wait_for(lock, kWaitSlice);
+    }
+    m_active++;
+}
+
+void IoScheduler::EndStream(uint64_t bytes, double seconds) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active--;
+        m_windowStreamBytes += bytes;
+        m_windowStreamSeconds += seconds;
+        if (m_adaptive) {
+            Adapt(Clock::now());
+        }
+    }
+    m_streamFree.notify_all();
+}
+
+void IoScheduler::Throttle(uint64_t bytes) {
+    if (m_adaptive) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_windowBytes += bytes;
+        Adapt(Clock::now());
+    }
+    if (!HasCap()) {
+        return;
+    }
+
+    Clock::time_point due;
+    {
+        std::lock_guard<std::mutex> lock(m_capMutex);
+        Clock::time_point now = Clock::now();
+        if (m_capClock < now) {
+            m_capClock = now;
+        }
+        m_capClock += std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(bytes) / m_bytesPerSecond));
+        due = m_capClock;
+    }
+    for (Clock::time_point now = Clock::now(); now < due && !Canceled(); now = Clock::now()) {
+        std::this_thread::sleep_for(std::min<Clock::duration>(due - now, kWaitSlice));
+    }
+}
+
+void IoScheduler::Adapt(Clock::time_point now) {
+    double elapsed = std::chrono::duration<double>(now - m_windowStart).count();
+    if (now - m_windowStart < kAdaptWindow) {
+        return;
+    }
+
+    // Nothing finished or moved (one huge file, the dedup pass): no evidence either way
+    if (m_windowBytes == 0 || m_windowStreamBytes == 0) {
+        m_windowStart = now;
+        return;
+    }
+
+    double rate = static_cast<double>(m_windowBytes) / elapsed;
+    double latency = m_windowStreamSeconds / static_cast<double>(m_windowStreamBytes);
+    if (m_lastRate > 0) {
+        if (rate < m_lastRate * (1 - kRateTolerance)) {
+            m_direction = -m_direction;
+        } else if (rate <= m_lastRate * (1 + kRateTolerance) && latency > m_lastLatency * (1 + kLatencyTolerance)) {
+            m_direction = -1;
+        }
+        // Growing, or flat at the same latency: keep probing the same way
+
+        unsigned next = m_direction > 0 ? m_limit + 1 : m_limit - 1;
+        if (next < 1 || next > m_ceiling) {
+            m_direction = -m_direction;
+        } else {
+            m_limit = next;
+        }
+    }
+
+    m_lastRate = rate;
+    m_lastLatency = latency;
+    m_windowStart = now;
+    m_windowBytes = 0;
+    m_windowStreamBytes = 0;
+    m_windowStreamSeconds = 0;
+}
+
+ScheduledStream::ScheduledStream(IoScheduler* scheduler)
+    : m_scheduler(scheduler) {
+    if (m_scheduler) {
+        m_scheduler->BeginStream();
+        m_start = std::chrono::steady_clock::now();
+    }
+}
+
+ScheduledStream::~ScheduledStream() {
+    if (m_scheduler) {
+        m_scheduler->EndStream(m_bytes, std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count());
+    }
+}
+
+} // namespace zdm
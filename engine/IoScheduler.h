@@ -0,0 +1,120 @@
+#ifndef IO_SCHEDULER_H
+#define IO_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// How hard a copy may hit the disks
+struct IoLimits {
+    unsigned maxStreams = 0;      // files (or small-file batches) in flight at once, 0 = from the devices
+    double maxBytesPerSecond = 0; // cap on file data moved (copied or read back to verify), 0 = none
+    bool lowPriority = false;     // run the copy threads at background CPU and I/O priority
+    bool adaptive = true;         // tune the streams in flight to the observed throughput and latency
+};
+
+enum class DeviceKind {
+    Unknown,    // not a block device (tmpfs, network share) or not reported
+    Rotational, // hard disk: parallel streams turn into seeks
+    SolidState
+};
+
+// Kind of the physical device holding path, which must exist
+DeviceKind ProbeDevice(const fs::path& path);
+
+// Stable lower-case name of a device kind, for logs and machine-readable output
+const char* DeviceKindName(DeviceKind kind);
+
+// Streams a device kind handles well, 0 = no limit of its own
+unsigned DeviceStreamLimit(DeviceKind kind);
+
+// Lower the calling thread to background priority: idle I/O class and a higher nice
+// value on Linux, THREAD_MODE_BACKGROUND_BEGIN (very low I/O priority) on Windows
+void SetBackgroundPriority();
+
+// Shared by the tasks of one copy: limits the streams in flight and paces the bytes
+// against the bandwidth cap. With adaptive limits it hill-climbs the stream count
+// once per second: more streams while throughput grows, fewer when it drops or when
+// it stays flat while the time each stream needs per byte rises (the device is only
+// queueing deeper).
+class IoScheduler {
+public:
+    // limit: most streams in flight, at least 1. Waits give up when cancel is set.
+    IoScheduler(const IoLimits& limits, unsigned limit, const std::atomic<bool>* cancel = nullptr);
+
+    IoScheduler(const IoScheduler&) = delete;
+    IoScheduler& operator=(const IoScheduler&) = delete;
+
+    // Wait for a free stream before a task starts its I/O
+    void BeginStream();
+
+    // A stream that moved bytes in seconds is free again
+    void EndStream(uint64_t bytes, double seconds);
+
+    // Account bytes just moved, sleeping while the cap is exceeded
+    void Throttle(uint64_t bytes);
+
+    bool HasCap() const { return m_bytesPerSecond > 0; }
+
+    // Streams currently allowed in flight
+    unsigned StreamLimit() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Called with m_mutex held
+    void Adapt(Clock::time_point now);
+    bool Canceled() const;
+
+    const std::atomic<bool>* m_cancel;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_streamFree;
+    unsigned m_ceiling;
+    unsigned m_limit;
+    unsigned m_active = 0;
+    bool m_adaptive;
+
+    // Current measuring window and the rate and latency of the one before it
+    Clock::time_point m_windowStart;
+    uint64_t m_windowBytes = 0;
+    uint64_t m_windowStreamBytes = 0;
+    double m_windowStreamSeconds = 0;
+    double m_lastRate = 0;
+    double m_lastLatency = 0;
+    int m_direction = -1;
+
+    // Virtual clock of the bandwidth cap: when the bytes accounted so far are due
+    double m_bytesPerSecond;
+    std::mutex m_capMutex;
+    Clock::time_point m_capClock;
+};
+
+// Holds one stream of a scheduler (may be null) for the lifetime of a task
+class ScheduledStream {
+public:
+    explicit ScheduledStream(IoScheduler* scheduler);
+    ~ScheduledStream();
+
+    ScheduledStream(const ScheduledStream&) = delete;
+    ScheduledStream& operator=(const ScheduledStream&) = delete;
+
+    // Bytes the task moved, reported with its duration when the stream ends
+    void AddBytes(uint64_t bytes) { m_bytes += bytes; }
+
+private:
+    IoScheduler* m_scheduler;
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_bytes = 0;
+};
+
+} // namespace zdm
+
+#endif // IO_SCHEDULER_H
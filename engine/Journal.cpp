@@ -0,0 +1,301 @@
+#include "Journal.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <cwchar>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+const char kMagic[8] = { 'Z', 'D', 'M', 'J', 'R', 'N', 'L', '1' };
+// Every checkpoint syncs the destination volume, which on a hard disk also flushes its
+// write cache. Files finished since the last one are copied again after a crash.
+const std::chrono::seconds kCheckpointInterval(10);
+const size_t kCheckpointBytes = 16 * 1024 * 1024; // sooner when this many records pile up
+
+std::FILE* OpenFile(const fs::path& path, bool append) {
+#ifdef _WIN32
+    return _wfopen(path.c_str(), append ? L"ab" : L"rb");
+#else
+    return std::fopen(path.c_str(), append ? "ab" : "rb");
+#endif
+}
+
+[[noreturn]] void ThrowJournalError(const char* what, const fs::path& path) {
+    throw fs::filesystem_error(what, path, std::error_code(errno, std::generic_category()));
+}
+
+// Put the data of files written under root on disk, so a record naming them cannot
+// outlive them. Linux syncs the one file system, other systems everything.
+// Windows flushes the volume, which needs administrator rights (the application has
+// them), and returns false without them.
+bool SyncVolume(const fs::path& root) {
+#ifdef _WIN32
+    wchar_t mountPoint[MAX_PATH];
+    wchar_t volume[MAX_PATH];
+    if (!GetVolumePathNameW(root.c_str(), mountPoint, MAX_PATH) ||
+        !GetVolumeNameForVolumeMountPointW(mountPoint, volume, MAX_PATH)) {
+        return false;
+    }
+    // "\\?\Volume{...}\" names the root directory, without the backslash the volume itself
+    size_t length = std::wcslen(volume);
+    if (length > 0 && volume[length - 1] == L'\\') {
+        volume[length - 1] = L'\0';
+    }
+    HANDLE handle = CreateFileW(volume, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                OPEN_EXISTING, 0, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool synced = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return synced;
+#elif defined(__linux__)
+    int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = syncfs(fd) == 0;
+    close(fd);
+    return synced;
+#else
+    (void)root;
+    sync();
+    return true;
+#endif
+}
+
+#ifdef _WIN32
+// Without a volume handle each file is flushed instead
+bool SyncFile(const fs::path& path) {
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool synced = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return synced;
+}
+#endif
+
+// Sync the journal itself after its records were written
+void SyncJournal(std::FILE* file) {
+    std::fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#elif defined(__APPLE__)
+    fsync(fileno(file));
+#else
+    fdatasync(fileno(file));
+#endif
+}
+
+template <typename T>
+void AppendRaw(std::string& buffer, const T& value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+} // namespace
+
+CopyJournal::CopyJournal(const fs::path& destinationRoot)
+    : m_root(destinationRoot),
+      m_path(destinationRoot / FileName()) {
+}
+
+CopyJournal::~CopyJournal() {
+    StopThread();
+    Flush();
+    if (m_file) {
+        std::fclose(m_file);
+    }
+}
+
+const PathChar* CopyJournal::FileName() {
+#ifdef _WIN32
+    return L".zalo_data_mover.journal";
+#else
+    return ".zalo_data_mover.journal";
+#endif
+}
+
+bool CopyJournal::ExistsIn(const fs::path& destinationRoot) {
+    std::error_code ec;
+    return fs::is_regular_file(destinationRoot / FileName(), ec);
+}
+
+size_t CopyJournal::Load() {
+    m_completed.clear();
+    m_validBytes = -1;
+
+    // A torn record at the end is ignored
+    std::error_code sizeError;
+    uintmax_t fileSize = fs::file_size(m_path, sizeError);
+    if (std::FILE* in = OpenFile(m_path, false)) {
+        char magic[sizeof(kMagic)];
+        bool valid = std::fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+                     std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+
+        PathString path;
+        long validBytes = valid ? static_cast<long>(sizeof(kMagic)) : 0;
+        while (valid) {
+            CompletedFile record;
+            uint32_t length = 0;
+            if (std::fread(&record.size, sizeof(record.size), 1, in) != 1 ||
+                std::fread(&record.mtime, sizeof(record.mtime), 1, in) != 1 ||
+                std::fread(&length, sizeof(length), 1, in) != 1) {
+                break;
+            }
+            // A length past the end of the file is torn or garbage, not a path to allocate
+            long position = std::ftell(in);
+            if (sizeError || position < 0 ||
+                static_cast<uintmax_t>(length) * sizeof(PathChar) > fileSize - static_cast<uintmax_t>(position)) {
+                break;
+            }
+            path.resize(length);
+            if (length > 0 && std::fread(&path[0], sizeof(PathChar), length, in) != length) {
+                break;
+            }
+            m_completed[path] = record;
+            validBytes = std::ftell(in);
+        }
+        std::fclose(in);
+        m_validBytes = validBytes;
+    }
+    return m_completed.size();
+}
+
+size_t CopyJournal::Open() {
+    Load();
+    std::error_code ec;
+    if (m_validBytes == 0) {
+        fs::remove(m_path, ec);
+    } else if (m_validBytes > 0) {
+        // Drop a torn tail so new records stay aligned
+        fs::resize_file(m_path, static_cast<uintmax_t>(m_validBytes), ec);
+    }
+
+    m_file = OpenFile(m_path, true);
+    if (!m_file) {
+        ThrowJournalError("cannot open copy journal", m_path);
+    }
+    if (std::ftell(m_file) == 0) {
+        std::fwrite(kMagic, 1, sizeof(kMagic), m_file);
+        SyncJournal(m_file);
+    }
+    m_thread = std::thread(&CopyJournal::Run, this);
+    return m_completed.size();
+}
+
+bool CopyJournal::IsComplete(PathView relativePath, uint64_t size, int64_t mtime) const {
+    if (m_completed.empty()) {
+        return false;
+    }
+    // Called once per file on resume, the lookup key reuses one buffer
+    thread_local PathString key;
+    key.assign(relativePath.data(), relativePath.size());
+    auto it = m_completed.find(key);
+    return it != m_completed.end() && it->second.size == size && it->second.mtime == mtime;
+}
+
+void CopyJournal::Record(PathView relativePath, uint64_t size, int64_t mtime) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    AppendRaw(m_buffer, size);
+    AppendRaw(m_buffer, mtime);
+    AppendRaw(m_buffer, static_cast<uint32_t>(relativePath.size()));
+    m_buffer.append(reinterpret_cast<const char*>(relativePath.data()), relativePath.size() * sizeof(PathChar));
+#ifdef _WIN32
+    m_pending.emplace_back(relativePath.data(), relativePath.size());
+#endif
+    if (m_buffer.size() >= kCheckpointBytes) {
+        m_wake.notify_one();
+    }
+}
+
+void CopyJournal::Flush() {
+    std::lock_guard<std::mutex> writeLock(m_writeMutex);
+    std::string records;
+#ifdef _WIN32
+    std::vector<PathString> files;
+#endif
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        records.swap(m_buffer);
+#ifdef _WIN32
+        files.swap(m_pending);
+#endif
+    }
+    if (!m_file || records.empty()) {
+        return;
+    }
+
+    if (!SyncVolume(m_root)) {
+#ifdef _WIN32
+        for (const PathString& file : files) {
+            if (!SyncFile(m_root / file)) {
+                return;
+            }
+        }
+#else
+        return;
+#endif
+    }
+    std::fwrite(records.data(), 1, records.size(), m_file);
+    SyncJournal(m_file);
+}
+
+void CopyJournal::Run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_closing) {
+        m_wake.wait_for(lock, kCheckpointInterval, [this] { return m_closing || m_buffer.size() >= kCheckpointBytes; });
+        if (m_closing) {
+            return;
+        }
+        lock.unlock();
+        Flush();
+        lock.lock();
+    }
+}
+
+void CopyJournal::StopThread() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void CopyJournal::Remove() {
+    StopThread();
+    std::lock_guard<std::mutex> writeLock(m_writeMutex);
+    if (m_file) {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer.clear();
+#ifdef _WIN32
+    m_pending.clear();
+#endif
+    m_completed.clear();
+
+    std::error_code ec;
+    fs::remove(m_path, ec);
+}
+
+} // namespace zdm
@@ -0,0 +1,93 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Manifest.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Checkpoint journal kept in the destination root while a copy is in progress.
+// Every completed file is appended as (size, mtime, relative path) of its source,
+// so an interrupted migration can skip files that are already identical.
+// Records only reach the journal after the data of their files was synced to the
+// destination, so after a power loss the journal never names a file that was lost.
+// A thread of the journal does this at a checkpoint every few seconds, the copy
+// threads only append to a buffer.
+class CopyJournal {
+public:
+    explicit CopyJournal(const fs::path& destinationRoot);
+    ~CopyJournal();
+
+    CopyJournal(const CopyJournal&) = delete;
+    CopyJournal& operator=(const CopyJournal&) = delete;
+
+    static const PathChar* FileName();
+    static bool ExistsIn(const fs::path& destinationRoot);
+
+    // Read the records of a previous run without changing anything, for a look before
+    // the copy. Returns the number of completed files found.
+    size_t Load();
+
+    // Read records of a previous run, open the journal for appending and start the
+    // checkpoint thread. Returns the number of completed files found.
+    // Throws fs::filesystem_error.
+    size_t Open();
+
+    // True when a previous run finished this file with the same size and mtime
+    bool IsComplete(PathView relativePath, uint64_t size, int64_t mtime) const;
+
+    // Append a completed file. Thread-safe, written at the next checkpoint.
+    void Record(PathView relativePath, uint64_t size, int64_t mtime);
+
+    // Checkpoint now: sync the destination volume, then write the buffered records and
+    // sync the journal. When the data cannot be synced the records are dropped and
+    // their files are copied again.
+    void Flush();
+
+    // Stop the checkpoint thread, close and delete the journal after a successful migration
+    void Remove();
+
+    const fs::path& Path() const { return m_path; }
+
+private:
+    struct CompletedFile {
+        uint64_t size;
+        int64_t mtime;
+    };
+
+    void Run();
+    void StopThread();
+
+    fs::path m_root;
+    fs::path m_path;
+    std::unordered_map<PathString, CompletedFile> m_completed;
+    long m_validBytes = -1; // of the file Load read, 0 when it is no journal, -1 when there was none
+
+    // Appending to the buffer never waits for a sync in progress
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::string m_buffer;
+#ifdef _WIN32
+    std::vector<PathString> m_pending; // files of the buffered records, flushed one by one without a volume handle
+#endif
+    bool m_closing = false;
+
+    std::mutex m_writeMutex; // held while syncing and writing
+    std::FILE* m_file = nullptr;
+    std::thread m_thread;
+};
+
+} // namespace zdm
+
+#endif // JOURNAL_H
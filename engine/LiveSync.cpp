@@ -0,0 +1,116 @@
+#include "LiveSync.h"
+
+#include <chrono>
+
+namespace zdm {
+
+namespace {
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+LiveSyncStats RunLiveSync(const Manifest& before, const fs::path& source, const fs::path& destination,
+                          const CopyOptions& options,
+                          const std::function<void()>& quiesce,
+                          const std::function<void(LiveSyncPhase)>& onPhase,
+                          const std::function<Manifest(const Manifest&)>& select,
+                          Manifest* synced) {
+    LiveSyncStats stats;
+    auto report = [&](LiveSyncPhase phase) {
+        if (onPhase) {
+            onPhase(phase);
+        }
+    };
+
+    // 1. Bulk copy while the source is live, files in use are retried later
+    report(LiveSyncPhase::PreCopy);
+    auto preCopyStart = std::chrono::steady_clock::now();
+
+    CopyOptions preCopyOptions = options;
+    preCopyOptions.continueOnError = true;
+    stats.preCopy = CopyEngine(preCopyOptions).CopyManifest(before, source, destination);
+    stats.preCopySeconds = SecondsSince(preCopyStart);
+
+    // What actually reached the destination: failed entries count as missing
+    std::vector<size_t> copied;
+    copied.reserve(before.Size());
+    size_t nextFailed = 0;
+    for (size_t i = 0; i < before.Size(); i++) {
+        if (nextFailed < stats.preCopy.failedEntries.size() && stats.preCopy.failedEntries[nextFailed] == i) {
+            nextFailed++;
+            continue;
+        }
+        copied.push_back(i);
+    }
+    Manifest copiedManifest = before.Subset(copied);
+
+    // 2. Stop the application, downtime starts here
+    report(LiveSyncPhase::Quiesce);
+    auto downtimeStart = std::chrono::steady_clock::now();
+    if (quiesce) {
+        quiesce();
+    }
+
+    // 3. Rescan and compare on type, size and mtime
+    report(LiveSyncPhase::Rescan);
+    Manifest after = ScanTree(source, options.threadCount);
+    if (select) {
+        after = select(after);
+    }
+    ManifestDiff diff = DiffManifests(copiedManifest, after);
+
+    // Deepest first so directories are empty before they go
+    for (auto it = diff.removed.rbegin(); it != diff.removed.rend(); ++it) {
+        std::error_code ec;
+        fs::remove_all(destination / copiedManifest.RelativePath(copiedManifest[*it]), ec);
+        stats.entriesRemoved++;
+    }
+
+    // 4. Copy only the changes, failures are fatal now that nothing holds the files
+    report(LiveSyncPhase::Delta);
+    Manifest delta = after.Subset(diff.changed);
+    if (options.dedup) {
+        // A changed file may be linked to an unchanged one, rewriting it in place would change both
+        for (const ManifestEntry& entry : delta.Entries()) {
+            if (entry.type == EntryType::File) {
+                std::error_code ec;
+                fs::remove(destination / delta.RelativePath(entry), ec);
+            }
+        }
+    }
+    CopyOptions deltaOptions = options;
+    deltaOptions.continueOnError = false;
+    stats.delta = CopyEngine(deltaOptions).CopyManifest(delta, source, destination);
+    stats.downtimeSeconds = SecondsSince(downtimeStart);
+
+    if (synced) {
+        if (options.verify) {
+            // Unchanged entries of after are in copiedManifest, both are sorted by path
+            stats.checksums.resize(after.Size());
+            size_t nextChanged = 0;
+            size_t k = 0;
+            for (size_t j = 0; j < after.Size(); j++) {
+                if (nextChanged < diff.changed.size() && diff.changed[nextChanged] == j) {
+                    stats.checksums[j] = stats.delta.checksums[nextChanged++];
+                    continue;
+                }
+                PathView path = after.RelativePath(after[j]);
+                while (k < copiedManifest.Size() &&
+                       ComparePathOrder(copiedManifest.RelativePath(copiedManifest[k]), path) < 0) {
+                    k++;
+                }
+                if (k < copiedManifest.Size()) {
+                    stats.checksums[j] = stats.preCopy.checksums[copied[k]];
+                }
+            }
+        }
+        *synced = std::move(after);
+    }
+
+    return stats;
+}
+
+} // namespace zdm
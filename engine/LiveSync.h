@@ -0,0 +1,48 @@
+#ifndef LIVE_SYNC_H
+#define LIVE_SYNC_H
+
+#include <filesystem>
+#include <functional>
+
+#include "CopyEngine.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+enum class LiveSyncPhase {
+    PreCopy,  // bulk copy while the application keeps running
+    Quiesce,  // stopping the application
+    Rescan,   // scanning the source again
+    Delta     // copying what changed since the pre-copy
+};
+
+struct LiveSyncStats {
+    CopyStats preCopy;
+    CopyStats delta;
+    uint64_t entriesRemoved = 0; // deleted at the destination because they vanished
+    double preCopySeconds = 0;
+    double downtimeSeconds = 0; // from quiesce to the end of the delta pass
+
+    // With verify and synced: CRC32C per entry of synced (see CopyStats::checksums), from
+    // the delta pass for what it copied and from the pre-copy for the rest
+    std::vector<uint32_t> checksums;
+};
+
+// Two-phase copy: a bulk pass over before (a scan of the live source), then
+// quiesce() (close Zalo), a rescan and a delta pass over only the entries whose
+// type, size or mtime changed, plus files that could not be read the first time.
+// Downtime scales with the change set instead of the profile size.
+// When before covers only part of the source, select cuts the rescan down to the same part.
+// synced, if given, receives that rescan: what the destination holds once the delta pass is done.
+// Throws like CopyEngine::CopyManifest.
+LiveSyncStats RunLiveSync(const Manifest& before, const fs::path& source, const fs::path& destination,
+                          const CopyOptions& options,
+                          const std::function<void()>& quiesce,
+                          const std::function<void(LiveSyncPhase)>& onPhase = nullptr,
+                          const std::function<Manifest(const Manifest&)>& select = nullptr,
+                          Manifest* synced = nullptr);
+
+} // namespace zdm
+
+#endif // LIVE_SYNC_H
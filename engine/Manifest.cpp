@@ -0,0 +1,166 @@
+#include "Manifest.h"
+#include "DirectoryEnumerator.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace zdm {
+
+void Manifest::Add(EntryType type, PathView relativePath, uint64_t size, int64_t mtime) {
+    ManifestEntry entry;
+    entry.pathOffset = static_cast<uint32_t>(m_pathPool.size());
+    entry.pathLength = static_cast<uint32_t>(relativePath.size());
+    entry.type = type;
+    entry.size = type == EntryType::File ? size : 0;
+    entry.mtime = mtime;
+
+    m_pathPool.append(relativePath.data(), relativePath.size());
+    m_entries.push_back(entry);
+
+    if (type == EntryType::File) {
+        m_fileCount++;
+        m_totalBytes += size;
+    } else if (type == EntryType::Directory) {
+        m_directoryCount++;
+    }
+}
+
+void Manifest::Append(Manifest&& other) {
+    uint32_t base = static_cast<uint32_t>(m_pathPool.size());
+    m_pathPool += other.m_pathPool;
+
+    m_entries.reserve(m_entries.size() + other.m_entries.size());
+    for (ManifestEntry entry : other.m_entries) {
+        entry.pathOffset += base;
+        m_entries.push_back(entry);
+    }
+
+    m_totalBytes += other.m_totalBytes;
+    m_fileCount += other.m_fileCount;
+    m_directoryCount += other.m_directoryCount;
+    other = Manifest();
+}
+
+namespace {
+
+// Component-wise compare: the separator sorts before every other character,
+// so "a/b" comes right after "a" and before "a.txt"
+int ComparePaths(PathView a, PathView b) {
+    size_t count = std::min(a.size(), b.size());
+    for (size_t i = 0; i < count; i++) {
+        PathChar ca = a[i] == fs::path::preferred_separator ? PathChar(0) : a[i];
+        PathChar cb = b[i] == fs::path::preferred_separator ? PathChar(0) : b[i];
+        if (ca != cb) {
+            return ca < cb ? -1 : 1;
+        }
+    }
+    if (a.size() == b.size()) {
+        return 0;
+    }
+    return a.size() < b.size() ? -1 : 1;
+}
+
+} // namespace
+
+bool PathLess(PathView left, PathView right) {
+    return ComparePathOrder(left, right) < 0;
+}
+
+int ComparePathOrder(PathView left, PathView right) {
+    int parentOrder = ComparePaths(PathParent(left), PathParent(right));
+    if (parentOrder != 0) {
+        return parentOrder;
+    }
+    return ComparePaths(PathName(left), PathName(right));
+}
+
+Manifest Manifest::Subset(const std::vector<size_t>& indexes) const {
+    Manifest subset;
+    subset.m_entries.reserve(indexes.size());
+    for (size_t index : indexes) {
+        const ManifestEntry& entry = m_entries[index];
+        subset.Add(entry.type, RelativePath(entry), entry.size, entry.mtime);
+    }
+    return subset;
+}
+
+void Manifest::SortByPath() {
+    std::sort(m_entries.begin(), m_entries.end(), [this](const ManifestEntry& left, const ManifestEntry& right) {
+        return PathLess(RelativePath(left), RelativePath(right));
+    });
+}
+
+ManifestDiff DiffManifests(const Manifest& before, const Manifest& after) {
+    return DiffSortedListings(before, after);
+}
+
+namespace {
+
+// Per-run scan state, each worker writes only to its own shard and reads through its own enumerator
+struct ScanJob {
+    WorkStealingPool* pool = nullptr;
+    std::vector<Manifest> shards;
+    std::vector<std::unique_ptr<DirectoryEnumerator>> enumerators;
+    std::atomic<bool> failed{false};
+};
+
+void ScanDirectory(ScanJob& job, const PathString& relativePath) {
+    if (job.failed.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    int worker = job.pool->CurrentWorkerIndex();
+    Manifest& shard = job.shards[worker];
+
+    // Reused by every directory this worker scans: each entry only rewrites the name after the prefix
+    thread_local PathString childPath;
+    childPath.assign(relativePath);
+    if (!childPath.empty()) {
+        childPath += fs::path::preferred_separator;
+    }
+    size_t prefix = childPath.size();
+
+    try {
+        for (const DirectoryEntryInfo& entry : job.enumerators[worker]->Read(relativePath)) {
+            childPath.resize(prefix);
+            childPath.append(entry.name.data(), entry.name.size());
+            shard.Add(entry.type, childPath, entry.size, entry.mtime);
+            if (entry.type == EntryType::Directory) {
+                job.pool->Submit([&job, child = childPath] { ScanDirectory(job, child); });
+            }
+        }
+    } catch (...) {
+        job.failed = true;
+        throw;
+    }
+}
+
+} // namespace
+
+Manifest ScanTree(const fs::path& root, unsigned threadCount) {
+    WorkStealingPool pool(threadCount);
+    return ScanTree(root, pool);
+}
+
+Manifest ScanTree(const fs::path& root, WorkStealingPool& pool) {
+    ScanJob job;
+    job.pool = &pool;
+    job.shards.resize(pool.ThreadCount());
+    for (unsigned i = 0; i < pool.ThreadCount(); i++) {
+        job.enumerators.push_back(std::make_unique<DirectoryEnumerator>(root));
+    }
+
+    pool.Submit([&job] { ScanDirectory(job, PathString()); });
+    pool.Wait();
+
+    Manifest manifest;
+    for (Manifest& shard : job.shards) {
+        manifest.Append(std::move(shard));
+    }
+    manifest.SortByPath();
+    return manifest;
+}
+
+} // namespace zdm
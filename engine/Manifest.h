@@ -0,0 +1,158 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+using PathChar = fs::path::value_type;
+using PathString = fs::path::string_type;
+using PathView = std::basic_string_view<PathChar>;
+
+enum class EntryType : uint8_t {
+    File,
+    Directory,
+    Symlink
+};
+
+// One scanned entry. The relative path lives in the manifest's string pool.
+struct ManifestEntry {
+    uint32_t pathOffset = 0;
+    uint32_t pathLength = 0;
+    EntryType type = EntryType::File;
+    uint64_t size = 0;
+    int64_t mtime = 0; // nanoseconds since 1970 (POSIX), FILETIME ticks (Windows)
+};
+
+// Compact in-memory listing of a tree: relative path, type, size and mtime.
+// Built once by ScanTree and used by every later phase instead of walking the tree again.
+class Manifest {
+public:
+    void Add(EntryType type, PathView relativePath, uint64_t size, int64_t mtime);
+
+    // Move all entries of other into this manifest
+    void Append(Manifest&& other);
+
+    // Copy of the entries at indexes (ascending), keeping their order
+    Manifest Subset(const std::vector<size_t>& indexes) const;
+
+    // Order entries by parent directory, then by name. Parents come before their
+    // children and all entries of one directory are contiguous.
+    void SortByPath();
+
+    size_t Size() const { return m_entries.size(); }
+    bool Empty() const { return m_entries.empty(); }
+    const ManifestEntry& operator[](size_t index) const { return m_entries[index]; }
+    const std::vector<ManifestEntry>& Entries() const { return m_entries; }
+
+    PathView RelativePath(const ManifestEntry& entry) const {
+        return PathView(m_pathPool.data() + entry.pathOffset, entry.pathLength);
+    }
+
+    uint64_t TotalBytes() const { return m_totalBytes; }
+    uint64_t FileCount() const { return m_fileCount; }
+    uint64_t DirectoryCount() const { return m_directoryCount; }
+
+private:
+    std::vector<ManifestEntry> m_entries;
+    PathString m_pathPool;
+    uint64_t m_totalBytes = 0;
+    uint64_t m_fileCount = 0;
+    uint64_t m_directoryCount = 0;
+};
+
+// Parent directory part of a relative path ("" for top-level entries)
+inline PathView PathParent(PathView relativePath) {
+    size_t separator = relativePath.rfind(fs::path::preferred_separator);
+    return separator == PathView::npos ? PathView() : relativePath.substr(0, separator);
+}
+
+// Last component of a relative path
+inline PathView PathName(PathView relativePath) {
+    size_t separator = relativePath.rfind(fs::path::preferred_separator);
+    return separator == PathView::npos ? relativePath : relativePath.substr(separator + 1);
+}
+
+// Total order used by SortByPath and by manifest comparisons
+bool PathLess(PathView left, PathView right);
+
+// Same order as a three-way compare: negative, zero or positive
+int ComparePathOrder(PathView left, PathView right);
+
+// Result of comparing two manifests of the same tree
+struct ManifestDiff {
+    std::vector<size_t> changed; // indexes into "after": new entries or different type, size, mtime or hash
+    std::vector<size_t> removed; // indexes into "before": entries that no longer exist
+};
+
+// A scan reads no file content, see ManifestRecord for listings that carry a hash
+inline uint64_t ContentHash(const ManifestEntry&) {
+    return 0;
+}
+
+// Linear merge of two path-sorted listings (Manifest, ManifestFile) comparing type, size
+// and mtime, and the content hash where both sides have one. A listing has Size(),
+// operator[] and RelativePath() like Manifest.
+template <typename Before, typename After>
+ManifestDiff DiffSortedListings(const Before& before, const After& after) {
+    ManifestDiff diff;
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < before.Size() && j < after.Size()) {
+        const auto& oldEntry = before[i];
+        const auto& newEntry = after[j];
+        int order = ComparePathOrder(before.RelativePath(oldEntry), after.RelativePath(newEntry));
+
+        if (order < 0) {
+            diff.removed.push_back(i++);
+        } else if (order > 0) {
+            diff.changed.push_back(j++);
+        } else {
+            // Directory mtimes change whenever a child does, the children carry the delta
+            uint64_t oldHash = ContentHash(oldEntry);
+            uint64_t newHash = ContentHash(newEntry);
+            bool same = oldEntry.type == newEntry.type &&
+                        (newEntry.type == EntryType::Directory ||
+                         (oldEntry.size == newEntry.size && oldEntry.mtime == newEntry.mtime &&
+                          (oldHash == 0 || newHash == 0 || oldHash == newHash)));
+            if (!same) {
+                if (oldEntry.type != newEntry.type) {
+                    diff.removed.push_back(i);
+                }
+                diff.changed.push_back(j);
+            }
+            i++;
+            j++;
+        }
+    }
+    while (i < before.Size()) {
+        diff.removed.push_back(i++);
+    }
+    while (j < after.Size()) {
+        diff.changed.push_back(j++);
+    }
+    return diff;
+}
+
+// Linear merge of two path-sorted manifests, comparing type, size and mtime
+ManifestDiff DiffManifests(const Manifest& before, const Manifest& after);
+
+class WorkStealingPool;
+
+// Walk root once with threadCount workers (0 = auto) and return its manifest, sorted by path.
+// The root itself is not included. Throws fs::filesystem_error on failure.
+Manifest ScanTree(const fs::path& root, unsigned threadCount = 0);
+
+// Same, on the workers of an existing idle pool
+Manifest ScanTree(const fs::path& root, WorkStealingPool& pool);
+
+} // namespace zdm
+
+#endif // MANIFEST_H
@@ -0,0 +1,248 @@
+#include "ManifestFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+const char kMagic[8] = { 'Z', 'D', 'M', 'M', 'N', 'F', 'S', 'T' };
+const uint32_t kVersion = 1;
+const uint32_t kHasHashes = 1;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pathCharSize; // sizeof(PathChar) of the writer
+    uint32_t recordSize;   // sizeof(ManifestRecord) of the writer
+    uint32_t flags;
+    uint64_t entryCount;
+    uint64_t pathChars; // length of the path table
+    uint64_t totalBytes;
+    uint64_t fileCount;
+    uint64_t directoryCount;
+};
+
+static_assert(sizeof(FileHeader) == 64, "manifest file header layout");
+static_assert(sizeof(ManifestRecord) == 40, "manifest record layout");
+
+[[noreturn]] void ThrowManifestError(const char* what, const fs::path& path, std::error_code ec) {
+    throw fs::filesystem_error(what, path, ec);
+}
+
+std::error_code LastError() {
+#ifdef _WIN32
+    return std::error_code(static_cast<int>(GetLastError()), std::system_category());
+#else
+    return std::error_code(errno, std::generic_category());
+#endif
+}
+
+} // namespace
+
+fs::path SnapshotPath(const fs::path& destination) {
+    fs::path folder = destination.has_filename() ? destination : destination.parent_path();
+    fs::path snapshot = folder;
+    snapshot += ".zdm-manifest";
+    return snapshot;
+}
+
+void WriteManifestFile(const fs::path& path, const Manifest& manifest, const std::vector<uint64_t>& hashes) {
+    FileHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.pathCharSize = sizeof(PathChar);
+    header.recordSize = sizeof(ManifestRecord);
+    header.flags = hashes.empty() ? 0 : kHasHashes;
+    header.entryCount = manifest.Size();
+    header.totalBytes = manifest.TotalBytes();
+    header.fileCount = manifest.FileCount();
+    header.directoryCount = manifest.DirectoryCount();
+    for (const ManifestEntry& entry : manifest.Entries()) {
+        header.pathChars += entry.pathLength;
+    }
+
+    fs::path temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios_base::binary | std::ios_base::trunc);
+        if (!out.is_open()) {
+            ThrowManifestError("cannot create manifest file", temporary, std::make_error_code(std::errc::io_error));
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        // The manifest's pool may hold entries in scan order, the table follows the sorted order
+        uint32_t offset = 0;
+        for (size_t i = 0; i < manifest.Size(); i++) {
+            const ManifestEntry& entry = manifest[i];
+            ManifestRecord record = {};
+            record.pathOffset = offset;
+            record.pathLength = entry.pathLength;
+            record.type = entry.type;
+            record.size = entry.size;
+            record.mtime = entry.mtime;
+            record.hash = hashes.empty() ? 0 : hashes[i];
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            offset += entry.pathLength;
+        }
+        for (const ManifestEntry& entry : manifest.Entries()) {
+            PathView relativePath = manifest.RelativePath(entry);
+            out.write(reinterpret_cast<const char*>(relativePath.data()),
+                      static_cast<std::streamsize>(relativePath.size() * sizeof(PathChar)));
+        }
+
+        out.flush();
+        if (!out) {
+            std::error_code ec;
+            fs::remove(temporary, ec);
+            ThrowManifestError("cannot write manifest file", temporary, std::make_error_code(std::errc::io_error));
+        }
+    }
+    fs::rename(temporary, path);
+}
+
+ManifestFile::ManifestFile(const fs::path& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        ThrowManifestError("cannot open manifest file", path, LastError());
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        std::error_code ec = LastError();
+        CloseHandle(file);
+        ThrowManifestError("cannot open manifest file", path, ec);
+    }
+    m_bytes = static_cast<size_t>(size.QuadPart);
+    if (m_bytes >= sizeof(FileHeader)) {
+        m_mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m_mapping) {
+            m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+    }
+    std::error_code ec = LastError();
+    CloseHandle(file);
+    if (m_bytes >= sizeof(FileHeader) && !m_data) {
+        Unmap();
+        ThrowManifestError("cannot map manifest file", path, ec);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ThrowManifestError("cannot open manifest file", path, LastError());
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        std::error_code ec = LastError();
+        close(fd);
+        ThrowManifestError("cannot open manifest file", path, ec);
+    }
+    m_bytes = static_cast<size_t>(fileStat.st_size);
+    if (m_bytes >= sizeof(FileHeader)) {
+        void* data = mmap(nullptr, m_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            std::error_code ec = LastError();
+            close(fd);
+            ThrowManifestError("cannot map manifest file", path, ec);
+        }
+        // Diffs walk the records front to back
+        madvise(data, m_bytes, MADV_SEQUENTIAL);
+        m_data = static_cast<const unsigned char*>(data);
+    }
+    close(fd);
+#endif
+
+    // Everything below reads straight from the mapping, so nothing in it is trusted
+    FileHeader header = {};
+    bool valid = m_data != nullptr;
+    if (valid) {
+        std::memcpy(&header, m_data, sizeof(header));
+        valid = std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.version == kVersion &&
+                header.pathCharSize == sizeof(PathChar) && header.recordSize == sizeof(ManifestRecord);
+    }
+    size_t available = valid ? m_bytes - sizeof(FileHeader) : 0;
+    if (valid) {
+        valid = header.entryCount <= available / sizeof(ManifestRecord) &&
+                header.pathChars == (available - header.entryCount * sizeof(ManifestRecord)) / sizeof(PathChar) &&
+                (available - header.entryCount * sizeof(ManifestRecord)) % sizeof(PathChar) == 0;
+    }
+    if (valid) {
+        m_records = reinterpret_cast<const ManifestRecord*>(m_data + sizeof(FileHeader));
+        m_paths = reinterpret_cast<const PathChar*>(m_data + sizeof(FileHeader) +
+                                                    header.entryCount * sizeof(ManifestRecord));
+        m_count = static_cast<size_t>(header.entryCount);
+        for (size_t i = 0; i < m_count && valid; i++) {
+            valid = static_cast<uint64_t>(m_records[i].pathOffset) + m_records[i].pathLength <= header.pathChars;
+        }
+    }
+    if (!valid) {
+        Unmap();
+        ThrowManifestError("not a manifest file of this platform", path,
+                           std::make_error_code(std::errc::invalid_argument));
+    }
+
+    m_hasHashes = (header.flags & kHasHashes) != 0;
+    m_totalBytes = header.totalBytes;
+    m_fileCount = header.fileCount;
+    m_directoryCount = header.directoryCount;
+}
+
+ManifestFile::~ManifestFile() {
+    Unmap();
+}
+
+void ManifestFile::Unmap() {
+#ifdef _WIN32
+    if (m_data) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+    }
+    m_mapping = nullptr;
+#else
+    if (m_data) {
+        munmap(const_cast<unsigned char*>(m_data), m_bytes);
+    }
+#endif
+    m_data = nullptr;
+    m_records = nullptr;
+    m_paths = nullptr;
+    m_count = 0;
+}
+
+const ManifestRecord* ManifestFile::Find(PathView relativePath) const {
+    const ManifestRecord* end = m_records + m_count;
+    const ManifestRecord* found = std::lower_bound(m_records, end, relativePath,
+                                                   [this](const ManifestRecord& record, PathView path) {
+                                                       return PathLess(RelativePath(record), path);
+                                                   });
+    if (found == end || RelativePath(*found) != relativePath) {
+        return nullptr;
+    }
+    return found;
+}
+
+ManifestDiff DiffManifests(const ManifestFile& before, const Manifest& after) {
+    return DiffSortedListings(before, after);
+}
+
+ManifestDiff DiffManifests(const ManifestFile& before, const ManifestFile& after) {
+    return DiffSortedListings(before, after);
+}
+
+} // namespace zdm
@@ -0,0 +1,92 @@
+#ifndef MANIFEST_FILE_H
+#define MANIFEST_FILE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "Manifest.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// One entry as stored in a manifest file. Fixed size, so the records are used in place.
+struct ManifestRecord {
+    uint32_t pathOffset; // into the path table, in PathChars
+    uint32_t pathLength;
+    EntryType type;
+    uint8_t reserved[7];
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash; // content hash (CRC32C from the copy's verification), 0 = not recorded
+};
+
+inline uint64_t ContentHash(const ManifestRecord& record) {
+    return record.hash;
+}
+
+// Snapshot left next to a migrated data folder: D:\ZaloData\ZaloPC -> D:\ZaloData\ZaloPC.zdm-manifest.
+// Outside the folder itself, so it is neither part of the data nor of the next scan.
+fs::path SnapshotPath(const fs::path& destination);
+
+// Write manifest (sorted by path) as a manifest file: a header, one ManifestRecord per
+// entry in the same order, then the path table. hashes is empty or holds one content
+// hash per entry. The file is written under a temporary name and renamed, a reader
+// never sees half of it. Throws fs::filesystem_error.
+void WriteManifestFile(const fs::path& path, const Manifest& manifest, const std::vector<uint64_t>& hashes = {});
+
+// Read-only manifest file mapped into memory. Records and paths are read in place,
+// opening costs one pass to validate the records whatever the size of the tree.
+// The layout is native (byte order, PathChar width, mtime units): a file is read on
+// the platform that wrote it.
+class ManifestFile {
+public:
+    // Throws fs::filesystem_error when path cannot be mapped or is not a manifest file of this platform
+    explicit ManifestFile(const fs::path& path);
+    ~ManifestFile();
+
+    ManifestFile(const ManifestFile&) = delete;
+    ManifestFile& operator=(const ManifestFile&) = delete;
+
+    size_t Size() const { return m_count; }
+    bool Empty() const { return m_count == 0; }
+    const ManifestRecord& operator[](size_t index) const { return m_records[index]; }
+
+    PathView RelativePath(const ManifestRecord& record) const {
+        return PathView(m_paths + record.pathOffset, record.pathLength);
+    }
+
+    bool HasHashes() const { return m_hasHashes; }
+    uint64_t TotalBytes() const { return m_totalBytes; }
+    uint64_t FileCount() const { return m_fileCount; }
+    uint64_t DirectoryCount() const { return m_directoryCount; }
+
+    // Record of relativePath by binary search, null when it is not listed
+    const ManifestRecord* Find(PathView relativePath) const;
+
+private:
+    void Unmap();
+
+    const unsigned char* m_data = nullptr;
+    size_t m_bytes = 0;
+#ifdef _WIN32
+    void* m_mapping = nullptr;
+#endif
+
+    const ManifestRecord* m_records = nullptr;
+    const PathChar* m_paths = nullptr;
+    size_t m_count = 0;
+    bool m_hasHashes = false;
+    uint64_t m_totalBytes = 0;
+    uint64_t m_fileCount = 0;
+    uint64_t m_directoryCount = 0;
+};
+
+// Changes since a snapshot: against a live scan, or against a later snapshot
+ManifestDiff DiffManifests(const ManifestFile& before, const Manifest& after);
+ManifestDiff DiffManifests(const ManifestFile& before, const ManifestFile& after);
+
+} // namespace zdm
+
+#endif // MANIFEST_FILE_H
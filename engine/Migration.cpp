@@ -0,0 +1,639 @@
+#include "Migration.h"
+#include "ColdArchive.h"
+#include "DeferredDelete.h"
+#include "Journal.h"
+#include "LiveSync.h"
+#include "Manifest.h"
+#include "ManifestFile.h"
+#include "PlacementPolicy.h"
+
+#include <system_error>
+
+#ifdef _WIN32
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <windows.h>
+#include <winioctl.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+// Calls the optional hooks, so the pipeline below reads like the steps it runs
+class Reporter {
+public:
+    Reporter(const MigrationCallbacks& callbacks, EventLog* eventLog)
+        : m_callbacks(callbacks), m_eventLog(eventLog) {}
+
+    EventLog* Events() const { return m_eventLog; }
+
+    void Status(MigrationStep step, const std::string& message) const {
+        if (m_callbacks.onStatus) {
+            m_callbacks.onStatus(step, message);
+        }
+    }
+
+    void Log(const std::string& line) const {
+        if (m_callbacks.log) {
+            m_callbacks.log(line);
+        }
+    }
+
+    bool Decide(MigrationQuestion question, const std::string& prompt) const {
+        return m_callbacks.decide && m_callbacks.decide(question, prompt);
+    }
+
+    void CloseApplication() const {
+        if (m_callbacks.closeApplication) {
+            PhaseSpan span(m_eventLog, "close");
+            m_callbacks.closeApplication();
+            span.End();
+        }
+    }
+
+private:
+    const MigrationCallbacks& m_callbacks;
+    EventLog* m_eventLog;
+};
+
+SpanCounters ManifestCounters(const Manifest& manifest) {
+    return { manifest.Size() - manifest.DirectoryCount(), manifest.TotalBytes() };
+}
+
+// The span of one copy pass, with the verification that overlapped it on a row of its own
+// and, given the manifest that was copied, the slowest files
+void LogCopyPass(EventLog* log, const std::string& phase, EventLog::Clock::time_point begin,
+                 EventLog::Clock::time_point end, const CopyStats& stats, const Manifest* manifest) {
+    if (!log) {
+        return;
+    }
+    log->Span(phase, begin, end, { stats.filesCopied, stats.bytesCopied },
+              "\"ok\":true,\"files_skipped\":" + std::to_string(stats.filesSkipped) +
+              ",\"bytes_skipped\":" + std::to_string(stats.bytesSkipped) +
+              ",\"files_cloned\":" + std::to_string(stats.filesCloned) +
+              ",\"files_deduplicated\":" + std::to_string(stats.filesDeduplicated) +
+              ",\"files_failed\":" + std::to_string(stats.failedEntries.size()) +
+              ",\"streams\":" + std::to_string(stats.streamLimit));
+    if (stats.verifyEnd > stats.verifyBegin) {
+        log->Span("verify", stats.verifyBegin, stats.verifyEnd, { stats.filesVerified, 0 },
+                  "\"ok\":true,\"thread_seconds\":" + std::to_string(stats.verifySeconds), 1);
+    }
+    for (size_t i = 0; manifest && i < stats.slowestFiles.size(); i++) {
+        const FileTiming& file = stats.slowestFiles[i];
+        const ManifestEntry& entry = (*manifest)[file.index];
+        log->Write("slow_file", "\"phase\":" + JsonString(phase) +
+                                ",\"path\":" + JsonString(fs::path(manifest->RelativePath(entry)).u8string()) +
+                                ",\"bytes\":" + std::to_string(entry.size) +
+                                ",\"seconds\":" + std::to_string(file.seconds));
+    }
+}
+
+Manifest ScanSource(const MigrationOptions& options, const Reporter& reporter) {
+    reporter.Status(MigrationStep::Scan, "Scanning data...");
+    PhaseSpan span(reporter.Events(), "scan");
+    Manifest manifest = ScanTree(options.source, options.threadCount);
+    span.End(ManifestCounters(manifest));
+    return manifest;
+}
+
+// Record what the destination now holds next to it, for audits and later runs to diff against.
+// Best effort: the data is complete without it.
+// checksums holds the CRC32C of each entry when the copy was verified, see CopyStats::checksums.
+void WriteSnapshot(const MigrationOptions& options, const Reporter& reporter, const Manifest& manifest,
+                   const std::vector<uint32_t>& checksums, MigrationResult& result) {
+    PhaseSpan span(reporter.Events(), "snapshot");
+    fs::path path = SnapshotPath(options.destination);
+    try {
+        WriteManifestFile(path, manifest, std::vector<uint64_t>(checksums.begin(), checksums.end()));
+        result.snapshot = path;
+        span.End(ManifestCounters(manifest));
+    } catch (const fs::filesystem_error& e) {
+        reporter.Log(std::string("Cannot write the manifest snapshot (") + e.what() + ")");
+    }
+}
+
+// A rename leaves no scan to record, a snapshot of an earlier run would describe other data
+void RemoveSnapshot(const MigrationOptions& options) {
+    std::error_code ec;
+    fs::remove(SnapshotPath(options.destination), ec);
+}
+
+// Copy manifest with the engine, resume from and then remove the destination journal,
+// and snapshot the result into result.copy and result.snapshot.
+// select narrows the live rescan down to what manifest covers, it may be empty.
+void CopyData(const MigrationOptions& options, const Reporter& reporter, const Manifest& manifest,
+              MigrationResult& result, const std::function<Manifest(const Manifest&)>& select = nullptr) {
+    fs::create_directories(options.destination);
+    CopyJournal journal(options.destination);
+    if (journal.Open() > 0) {
+        reporter.Status(MigrationStep::Scan, "Resuming interrupted migration...");
+    }
+
+    CopyOptions copyOptions;
+    copyOptions.threadCount = options.threadCount;
+    copyOptions.journal = &journal;
+    copyOptions.cancel = options.cancel;
+    copyOptions.verify = options.verify;
+    copyOptions.dedup = options.dedup;
+    copyOptions.progress = options.progress;
+    copyOptions.tuning = options.tuning;
+    copyOptions.io = options.io;
+
+    CopyStats stats;
+    Manifest synced; // live copy: the rescan the delta pass brought the destination up to
+    std::vector<uint32_t> checksums; // of the entries of the snapshot, with verify
+    EventLog* log = reporter.Events();
+    if (options.liveCopy) {
+        // Spans are logged once the counters are known, from the time each phase started
+        EventLog::Clock::time_point phaseStart[4];
+        LiveSyncPhase current = LiveSyncPhase::PreCopy;
+        auto onPhase = [&](LiveSyncPhase phase) {
+            current = phase;
+            phaseStart[static_cast<int>(phase)] = EventLog::Clock::now();
+            if (phase == LiveSyncPhase::PreCopy) {
+                reporter.Status(MigrationStep::Copy, "Copying data while the application is running...");
+            } else if (phase == LiveSyncPhase::Rescan) {
+                reporter.Status(MigrationStep::Rescan, "Looking for files changed during the copy...");
+            } else if (phase == LiveSyncPhase::Delta) {
+                reporter.Status(MigrationStep::SyncChanges, "Syncing changes...");
+            }
+        };
+        auto quiesce = [&]() { reporter.CloseApplication(); };
+        LiveSyncStats liveStats;
+        try {
+            liveStats = RunLiveSync(manifest, options.source, options.destination, copyOptions, quiesce, onPhase, select,
+                                    &synced);
+        } catch (...) {
+            const char* phases[] = { "copy", "close", "rescan", "sync" };
+            if (log && current != LiveSyncPhase::Quiesce) {
+                log->Span(phases[static_cast<int>(current)], phaseStart[static_cast<int>(current)],
+                          EventLog::Clock::now(), SpanCounters(), "\"ok\":false");
+            }
+            throw;
+        }
+        auto end = EventLog::Clock::now();
+        LogCopyPass(log, "copy", phaseStart[static_cast<int>(LiveSyncPhase::PreCopy)],
+                    phaseStart[static_cast<int>(LiveSyncPhase::Quiesce)], liveStats.preCopy, &manifest);
+        if (log) {
+            log->Span("rescan", phaseStart[static_cast<int>(LiveSyncPhase::Rescan)],
+                      phaseStart[static_cast<int>(LiveSyncPhase::Delta)], SpanCounters(),
+                      "\"ok\":true,\"entries_removed\":" + std::to_string(liveStats.entriesRemoved));
+        }
+        // The delta pass copies from a rescan the slowest files cannot be looked up in
+        LogCopyPass(log, "sync", phaseStart[static_cast<int>(LiveSyncPhase::Delta)], end, liveStats.delta, nullptr);
+
+        reporter.Log("Live pre-copy: " + std::to_string(liveStats.preCopy.filesCopied) + " files in " +
+                     std::to_string(static_cast<int>(liveStats.preCopySeconds)) + " s, delta: " +
+                     std::to_string(liveStats.delta.filesCopied) + " files, downtime " +
+                     std::to_string(static_cast<int>(liveStats.downtimeSeconds)) + " s");
+
+        stats = liveStats.preCopy;
+        stats.checksums.clear(); // indexes of the pre-copy manifest, the snapshot is of synced
+        checksums = std::move(liveStats.checksums);
+        stats.filesCopied += liveStats.delta.filesCopied;
+        stats.bytesCopied += liveStats.delta.bytesCopied;
+        stats.filesVerified += liveStats.delta.filesVerified;
+        stats.filesCloned += liveStats.delta.filesCloned;
+        stats.bytesCloned += liveStats.delta.bytesCloned;
+        stats.dedupCandidates += liveStats.delta.dedupCandidates;
+        stats.filesDeduplicated += liveStats.delta.filesDeduplicated;
+        stats.bytesDeduplicated += liveStats.delta.bytesDeduplicated;
+    } else {
+        reporter.Status(MigrationStep::Copy, "Copying data to the new location...");
+        auto begin = EventLog::Clock::now();
+        try {
+            stats = CopyEngine(copyOptions).CopyManifest(manifest, options.source, options.destination);
+        } catch (...) {
+            if (log) {
+                log->Span("copy", begin, EventLog::Clock::now(), SpanCounters(), "\"ok\":false");
+            }
+            throw;
+        }
+        LogCopyPass(log, "copy", begin, EventLog::Clock::now(), stats, &manifest);
+        checksums = std::move(stats.checksums);
+    }
+
+    reporter.Log("Copied " + std::to_string(stats.filesCopied) + " files (" +
+                 std::to_string(stats.filesCloned) + " cloned), " +
+                 std::to_string(stats.filesSkipped) + " already copied by an earlier run, " +
+                 std::to_string(stats.filesVerified) + " verified");
+    reporter.Log(std::string("I/O: source ") + DeviceKindName(stats.sourceDevice) + ", destination " +
+                 DeviceKindName(stats.destinationDevice) + ", " + std::to_string(stats.streamLimit) +
+                 " streams in flight at the end" + (options.io.lowPriority ? ", low priority" : ""));
+    if (options.dedup) {
+        reporter.Log("Deduplicated " + std::to_string(stats.filesDeduplicated) + " of " +
+                     std::to_string(stats.dedupCandidates) + " candidate files, " +
+                     std::to_string(stats.bytesDeduplicated / (1024 * 1024)) + " MB not written");
+    }
+
+    // Everything is in place, the checkpoint is no longer needed
+    journal.Remove();
+    result.copy = stats;
+    WriteSnapshot(options, reporter, options.liveCopy ? synced : manifest, checksums, result);
+}
+
+// Pack the files the archive policy marks cold into ArchivePath(destination) and return
+// what is left for the copy. Zalo is closed by then, RunMigration refuses a live copy.
+Manifest ArchiveCold(const MigrationOptions& options, const Reporter& reporter, const Manifest& manifest,
+                     MigrationResult& result) {
+    std::vector<size_t> archived = SelectArchived(manifest, options.archive->policy);
+    if (archived.empty()) {
+        reporter.Log("No files old enough for the cold archive");
+        return manifest;
+    }
+
+    reporter.Status(MigrationStep::Archive, "Packing old media into the archive...");
+    ArchiveOptions archiveOptions = *options.archive;
+    if (archiveOptions.threadCount == 0) {
+        archiveOptions.threadCount = options.threadCount;
+    }
+    if (!archiveOptions.cancel) {
+        archiveOptions.cancel = options.cancel;
+    }
+    fs::path directory = ArchivePath(options.destination);
+    PhaseSpan span(reporter.Events(), "archive");
+    result.archive = WriteArchive(directory, options.source, manifest, archived, archiveOptions);
+    result.archiveDirectory = directory;
+    const ArchiveStats& stats = result.archive;
+    span.End({ stats.files, stats.bytes }, "\"stored_bytes\":" + std::to_string(stats.storedBytes) +
+                                           ",\"containers\":" + std::to_string(stats.containers) +
+                                           ",\"blocks\":" + std::to_string(stats.blocks) +
+                                           ",\"blocks_stored\":" + std::to_string(stats.blocksStored));
+    reporter.Log("Archived " + std::to_string(stats.files) + " files, " + std::to_string(stats.bytes / (1024 * 1024)) +
+                 " MB into " + std::to_string(stats.storedBytes / (1024 * 1024)) + " MB at " + directory.u8string() +
+                 (ArchiveCompresses() ? "" : " (stored, built without zstd)"));
+
+    std::vector<size_t> rest;
+    for (size_t i = 0, next = 0; i < manifest.Size(); i++) {
+        if (next < archived.size() && archived[next] == i) {
+            next++;
+        } else {
+            rest.push_back(i);
+        }
+    }
+    return manifest.Subset(rest);
+}
+
+void ReportRemoveSource(const MigrationOptions& options, const Reporter& reporter) {
+    reporter.Status(MigrationStep::RemoveSource, options.deferDelete ? "Moving old data directory aside..."
+                                                                     : "Removing old data directory...");
+}
+
+// Delete a copied source directory, or with deferDelete only rename it aside into trash
+// named after owner. Falls back to deleting in place when the rename fails.
+void RemoveSourceDirectory(const MigrationOptions& options, const Reporter& reporter, const fs::path& directory,
+                           const fs::path& owner, MigrationResult& result) {
+    PhaseSpan span(reporter.Events(), "delete");
+    if (options.deferDelete) {
+        // A rename frees the path at once, so the link and the application do not wait for the delete
+        try {
+            fs::path trash = MoveToTrash(directory, owner);
+            reporter.Log("Old data moved to " + trash.u8string() + ", deleting it in the background");
+            result.trash.push_back(trash);
+            span.End(SpanCounters(), "\"deferred\":true");
+            return;
+        } catch (const fs::filesystem_error& e) {
+            reporter.Log(std::string("Cannot move old data aside (") + e.what() + "), deleting it now");
+            reporter.Status(MigrationStep::RemoveSource, "Removing old data directory...");
+        }
+    }
+    uintmax_t removed = fs::remove_all(directory);
+    span.End({ removed, 0 }, "\"deferred\":false");
+}
+
+// Placement: the data folder stays, every bulk subtree is renamed or copied to the same
+// relative path under destination and linked from its old path
+MigrationResult MoveSubtrees(const MigrationOptions& options, const Reporter& reporter, const Manifest& manifest,
+                             MigrationResult result) {
+    result.partial = true;
+    if (options.archive) {
+        reporter.Log("The cold archive applies to whole-folder copies, moved subtrees stay plain files");
+    }
+    const std::vector<PlacementSubtree>& subtrees = result.placement.subtrees;
+    if (subtrees.empty()) {
+        reporter.Log("The placement policy keeps every file in place, nothing to move");
+        reporter.Status(MigrationStep::CheckDirectories, "Nothing to move under the placement policy.");
+        return result;
+    }
+
+    // The destination may hold subtrees of an earlier placement run, only the ones moving now must be free
+    result.resumed = CopyJournal::ExistsIn(options.destination);
+    if (result.resumed) {
+        reporter.Status(MigrationStep::CheckDirectories, "Found an interrupted migration, resuming...");
+        reporter.Log("Resuming interrupted migration");
+    }
+    for (size_t i = 0; i < subtrees.size() && !result.resumed; i++) {
+        fs::path target = options.destination / subtrees[i].relativePath;
+        if (!fs::exists(target)) {
+            continue;
+        }
+        if (!reporter.Decide(MigrationQuestion::DeleteExistingDestination,
+                             "Destination folder " + target.u8string() + " already exists. Do you want to delete it?")) {
+            throw MigrationDeclined("destination folder already exists: " + target.u8string());
+        }
+        fs::remove_all(target);
+    }
+
+    MigrationPlan plan = PlanMigration(options.source, options.destination);
+    if (result.resumed) {
+        plan.strategy = MigrationStrategy::Copy;
+        plan.reason = "resuming an interrupted copy";
+    }
+    std::string strategyMsg = std::string("Migration strategy: ") + StrategyName(plan.strategy) + " (" + plan.reason +
+                              "), " + std::to_string(subtrees.size()) + " folders";
+    reporter.Log(strategyMsg);
+    reporter.Status(MigrationStep::CheckDirectories, strategyMsg);
+
+    // Same volume: one rename per subtree, whatever refuses to rename is copied
+    std::vector<PlacementSubtree> renamed;
+    std::vector<PlacementSubtree> pending;
+    if (plan.strategy == MigrationStrategy::Rename) {
+        if (options.liveCopy) {
+            reporter.CloseApplication();
+        }
+        reporter.Status(MigrationStep::Rename, "Moving data by renaming folders...");
+        PhaseSpan span(reporter.Events(), "rename");
+        for (const PlacementSubtree& subtree : subtrees) {
+            fs::path target = options.destination / subtree.relativePath;
+            std::error_code ec;
+            fs::create_directories(target.parent_path(), ec);
+            fs::rename(options.source / subtree.relativePath, target, ec);
+            if (ec) {
+                reporter.Log("Rename of " + fs::path(subtree.relativePath).u8string() + " failed (" + ec.message() +
+                             "), falling back to copy");
+                pending.push_back(subtree);
+            } else {
+                renamed.push_back(subtree);
+            }
+        }
+        SpanCounters counters;
+        for (const PlacementSubtree& subtree : renamed) {
+            counters.files += subtree.totals.files;
+            counters.bytes += subtree.totals.bytes;
+        }
+        span.End(counters, "\"folders\":" + std::to_string(renamed.size()) +
+                           ",\"failed\":" + std::to_string(pending.size()));
+    } else {
+        pending = subtrees;
+    }
+
+    result.strategy = pending.empty() ? MigrationStrategy::Rename : MigrationStrategy::Copy;
+    if (pending.empty()) {
+        RemoveSnapshot(options);
+    } else {
+        auto select = [&pending](const Manifest& scanned) { return SelectSubtrees(scanned, pending); };
+        try {
+            CopyData(options, reporter, select(manifest), result, select);
+        } catch (...) {
+            // Put renamed folders back, unlinked they would be missing from the application
+            for (const PlacementSubtree& subtree : renamed) {
+                std::error_code ec;
+                fs::rename(options.destination / subtree.relativePath, options.source / subtree.relativePath, ec);
+            }
+            throw;
+        }
+        ReportRemoveSource(options, reporter);
+        for (const PlacementSubtree& subtree : pending) {
+            RemoveSourceDirectory(options, reporter, options.source / subtree.relativePath, options.source, result);
+        }
+    }
+
+    if (options.createLink) {
+        reporter.Status(MigrationStep::CreateLink, "Creating directory links...");
+        PhaseSpan span(reporter.Events(), "link");
+        for (const PlacementSubtree& subtree : subtrees) {
+            CreateDirectoryLink(options.source / subtree.relativePath, options.destination / subtree.relativePath);
+        }
+        span.End({ subtrees.size(), 0 });
+    }
+    return result;
+}
+
+} // namespace
+
+MigrationResult RunMigration(const MigrationOptions& options, const MigrationCallbacks& callbacks) {
+    Reporter reporter(callbacks, options.eventLog);
+    MigrationResult result;
+
+    reporter.Status(MigrationStep::CheckDirectories, "Checking directories...");
+    PhaseSpan check(reporter.Events(), "check");
+    if (!fs::exists(options.source)) {
+        throw fs::filesystem_error("data directory not found", options.source,
+                                   std::make_error_code(std::errc::no_such_file_or_directory));
+    }
+
+    // Through a link the destination may already be the data itself, deleting it would lose everything
+    std::error_code ec;
+    if (fs::equivalent(options.source, options.destination, ec)) {
+        throw fs::filesystem_error("data is already at the destination", options.source, options.destination,
+                                   std::make_error_code(std::errc::file_exists));
+    }
+    // Archived files are packed once, before the live window: changes to them during it
+    // would never reach the archive, and the source is deleted afterwards
+    if (options.archive && options.liveCopy) {
+        throw fs::filesystem_error("the cold archive cannot be combined with a live copy", options.source,
+                                   std::make_error_code(std::errc::invalid_argument));
+    }
+    check.End();
+
+    // The policy splits the data by file, which needs a scan before anything moves.
+    // A folder that is already a link moves as a whole, its subtrees live elsewhere.
+    Manifest manifest;
+    bool scanned = false;
+    if (options.placement) {
+        if (PlanMigration(options.source, options.destination).dataDirectory != options.source) {
+            reporter.Log("Data folder is already a link, the placement policy does not apply");
+        } else {
+            manifest = ScanSource(options, reporter);
+            scanned = true;
+            result.placement = PlanPlacement(manifest, *options.placement);
+            reporter.Log("Placement plan:\n" + DescribePlacement(result.placement));
+            if (!result.placement.wholeTree) {
+                return MoveSubtrees(options, reporter, manifest, std::move(result));
+            }
+        }
+    }
+
+    // An interrupted copy left its journal behind: resume instead of starting over
+    result.resumed = CopyJournal::ExistsIn(options.destination);
+    if (result.resumed) {
+        reporter.Status(MigrationStep::CheckDirectories, "Found an interrupted migration, resuming...");
+        reporter.Log("Resuming interrupted migration");
+    } else if (fs::exists(options.destination)) {
+        if (!reporter.Decide(MigrationQuestion::DeleteExistingDestination,
+                             "Destination folder already exists. Do you want to delete it?")) {
+            throw MigrationDeclined("destination folder already exists: " + options.destination.u8string());
+        }
+        reporter.Status(MigrationStep::CheckDirectories, "Deleting old destination folder...");
+        PhaseSpan span(reporter.Events(), "clear_destination");
+        uintmax_t removed = fs::remove_all(options.destination);
+        span.End({ removed, 0 });
+    }
+
+    // Same volume: a directory rename, otherwise the copy engine.
+    // A resumed copy keeps copying, the destination already holds part of the data.
+    MigrationPlan plan = PlanMigration(options.source, options.destination);
+    if (result.resumed) {
+        plan.strategy = MigrationStrategy::Copy;
+        plan.reason = "resuming an interrupted copy";
+    }
+    std::string strategyMsg = std::string("Migration strategy: ") + StrategyName(plan.strategy) + " (" + plan.reason + ")";
+    reporter.Log(strategyMsg);
+    reporter.Status(MigrationStep::CheckDirectories, strategyMsg);
+
+    // The source is a link to an earlier location: its target holds the data,
+    // only the link itself is removed once the data has moved
+    bool sourceIsLink = plan.dataDirectory != options.source;
+    bool moved = false;
+    fs::create_directories(options.destination.parent_path());
+
+    if (plan.strategy == MigrationStrategy::Rename) {
+        // A rename is instant, but the application must not hold files open while it happens
+        if (options.liveCopy) {
+            reporter.CloseApplication();
+        }
+
+        reporter.Status(MigrationStep::Rename, "Moving data by renaming the directory...");
+        PhaseSpan span(reporter.Events(), "rename");
+        fs::rename(plan.dataDirectory, options.destination, ec);
+        span.End(SpanCounters(), "\"renamed\":" + std::string(ec ? "false" : "true"));
+        if (!ec) {
+            result.strategy = MigrationStrategy::Rename;
+            moved = true;
+            RemoveSnapshot(options);
+            if (options.archive) {
+                reporter.Log("Data renamed in place, the cold archive applies to copies only");
+            }
+        } else {
+            reporter.Log("Rename failed (" + ec.message() + "), falling back to copy");
+            reporter.Status(MigrationStep::Rename, "Rename failed, falling back to copy...");
+        }
+    }
+
+    if (!moved) {
+        result.strategy = MigrationStrategy::Copy;
+        if (!scanned) {
+            manifest = ScanSource(options, reporter);
+        }
+        if (options.archive) {
+            manifest = ArchiveCold(options, reporter, manifest, result);
+        }
+        CopyData(options, reporter, manifest, result);
+    }
+
+    if (sourceIsLink) {
+        reporter.Status(MigrationStep::RemoveSource, "Removing old symbolic link...");
+        PhaseSpan span(reporter.Events(), "delete");
+        fs::remove(options.source);
+        span.End({ 1, 0 });
+    } else if (!moved) {
+        ReportRemoveSource(options, reporter);
+        RemoveSourceDirectory(options, reporter, options.source, fs::path(), result);
+    }
+
+    if (options.createLink) {
+        reporter.Status(MigrationStep::CreateLink, "Creating directory link...");
+        PhaseSpan span(reporter.Events(), "link");
+        CreateDirectoryLink(options.source, options.destination);
+        span.End({ 1, 0 });
+    }
+
+    return result;
+}
+
+const char* StepName(MigrationStep step) {
+    switch (step) {
+        case MigrationStep::CheckDirectories:
+            return "check";
+        case MigrationStep::Rename:
+            return "rename";
+        case MigrationStep::Scan:
+            return "scan";
+        case MigrationStep::Archive:
+            return "archive";
+        case MigrationStep::Copy:
+            return "copy";
+        case MigrationStep::Rescan:
+            return "rescan";
+        case MigrationStep::SyncChanges:
+            return "sync";
+        case MigrationStep::RemoveSource:
+            return "delete";
+        case MigrationStep::CreateLink:
+            return "link";
+    }
+    return "unknown";
+}
+
+#ifdef _WIN32
+
+namespace {
+
+// REPARSE_DATA_BUFFER of a mount point, which only the driver kit headers declare
+struct MountPointReparseBuffer {
+    DWORD reparseTag;
+    WORD reparseDataLength;
+    WORD reserved;
+    WORD substituteNameOffset;
+    WORD substituteNameLength;
+    WORD printNameOffset;
+    WORD printNameLength;
+    WCHAR pathBuffer[1];
+};
+
+const size_t kMountPointHeaderBytes = offsetof(MountPointReparseBuffer, pathBuffer);
+
+} // namespace
+
+#endif
+
+void CreateDirectoryLink(const fs::path& link, const fs::path& target) {
+#ifdef _WIN32
+    // Junctions need no privilege and work across local volumes. The link is an empty
+    // directory that gets a mount point reparse point: the NT path ("\\??\\C:\\...") to
+    // follow and the plain path for display, both NUL-terminated.
+    std::wstring printName = fs::absolute(target).wstring();
+    if (printName.compare(0, 4, L"\\\\?\\") == 0) {
+        printName.erase(0, 4);
+    }
+    std::wstring substituteName = L"\\??\\" + printName;
+
+    size_t pathBytes = (substituteName.size() + 1 + printName.size() + 1) * sizeof(WCHAR);
+    if (kMountPointHeaderBytes + pathBytes > MAXIMUM_REPARSE_DATA_BUFFER_SIZE) {
+        throw fs::filesystem_error("cannot create junction", link, target,
+                                   std::make_error_code(std::errc::filename_too_long));
+    }
+    std::vector<unsigned char> buffer(kMountPointHeaderBytes + pathBytes);
+    MountPointReparseBuffer* reparse = reinterpret_cast<MountPointReparseBuffer*>(buffer.data());
+    reparse->reparseTag = IO_REPARSE_TAG_MOUNT_POINT;
+    reparse->reparseDataLength = static_cast<WORD>(buffer.size() - offsetof(MountPointReparseBuffer, substituteNameOffset));
+    reparse->substituteNameOffset = 0;
+    reparse->substituteNameLength = static_cast<WORD>(substituteName.size() * sizeof(WCHAR));
+    reparse->printNameOffset = static_cast<WORD>((substituteName.size() + 1) * sizeof(WCHAR));
+    reparse->printNameLength = static_cast<WORD>(printName.size() * sizeof(WCHAR));
+    std::memcpy(reparse->pathBuffer, substituteName.c_str(), (substituteName.size() + 1) * sizeof(WCHAR));
+    std::memcpy(reparse->pathBuffer + substituteName.size() + 1, printName.c_str(), (printName.size() + 1) * sizeof(WCHAR));
+
+    fs::create_directory(link);
+    HANDLE directory = CreateFileW(link.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                                   FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, NULL);
+    DWORD returned = 0;
+    BOOL linked = directory != INVALID_HANDLE_VALUE &&
+                  DeviceIoControl(directory, FSCTL_SET_REPARSE_POINT, buffer.data(), static_cast<DWORD>(buffer.size()),
+                                  NULL, 0, &returned, NULL);
+    std::error_code ec(static_cast<int>(GetLastError()), std::system_category());
+    if (directory != INVALID_HANDLE_VALUE) {
+        CloseHandle(directory);
+    }
+    if (!linked) {
+        RemoveDirectoryW(link.c_str());
+        throw fs::filesystem_error("cannot create junction", link, target, ec);
+    }
+#else
+    fs::create_directory_symlink(fs::absolute(target), link);
+#endif
+}
+
+} // namespace zdm
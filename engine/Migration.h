@@ -0,0 +1,118 @@
+#ifndef MIGRATION_H
+#define MIGRATION_H
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ColdArchive.h"
+#include "CopyEngine.h"
+#include "EventLog.h"
+#include "IoScheduler.h"
+#include "MigrationPlanner.h"
+#include "PlacementPolicy.h"
+#include "Progress.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Stages reported through MigrationCallbacks::onStatus, in the order they run
+enum class MigrationStep {
+    CheckDirectories,
+    Rename,      // same-volume move
+    Scan,
+    Archive,     // cold files packed into the archive next to the destination
+    Copy,        // bulk copy, progress is live in MigrationOptions::progress
+    Rescan,      // live copy only: looking for changes after closing the application
+    SyncChanges, // live copy only: delta pass, progress is live again
+    RemoveSource,
+    CreateLink
+};
+
+// Yes/no questions the pipeline cannot answer by itself
+enum class MigrationQuestion {
+    DeleteExistingDestination // the destination exists and is not an interrupted migration
+};
+
+// Hooks for a front end. Everything is called from the migration thread, every member may be empty.
+struct MigrationCallbacks {
+    // Short status line for the current step
+    std::function<void(MigrationStep, const std::string& message)> onStatus;
+
+    // Answer a question, an empty callback answers no
+    std::function<bool(MigrationQuestion, const std::string& prompt)> decide;
+
+    // Stop the application that owns the data. Called before a rename and before the
+    // delta pass of a live copy, the front end closes it up front otherwise.
+    std::function<void()> closeApplication;
+
+    // One line for the persistent log
+    std::function<void(const std::string& line)> log;
+};
+
+struct MigrationOptions {
+    fs::path source;      // data folder, may already be a link to an earlier location
+    fs::path destination; // new path of the data folder itself
+    unsigned threadCount = 0;
+    bool verify = false;
+    bool liveCopy = false;  // bulk copy while the application runs, see RunLiveSync
+    bool createLink = true; // leave a directory link at source pointing to destination
+    bool dedup = false;     // write identical files once, see CopyOptions::dedup
+    bool deferDelete = false; // rename the old data aside instead of deleting it, see MigrationResult::trash
+    const PlacementPolicy* placement = nullptr; // move only the bulk subtrees, each behind its own link
+    const ArchiveOptions* archive = nullptr;    // pack the files its policy marks bulk instead of copying them, not with liveCopy
+    FileCopyTuning tuning;  // passed to the copy engine
+    IoLimits io;            // streams, bandwidth cap and priority of the copy, see CopyOptions::io
+    CopyProgress* progress = nullptr;
+    const std::atomic<bool>* cancel = nullptr;
+
+    // Timing spans with counters for every phase (check, scan, rename, copy, verify,
+    // archive, rescan, sync, close, delete, link) and the slowest files of the copy, may be null
+    EventLog* eventLog = nullptr;
+};
+
+struct MigrationResult {
+    MigrationStrategy strategy = MigrationStrategy::Copy;
+    bool resumed = false; // continued from the journal of an interrupted run
+    CopyStats copy;       // empty after a rename
+    std::vector<fs::path> trash; // deferDelete: old data still to be deleted with DeleteTree
+    PlacementPlan placement;     // with a policy: how the files were split between the tiers
+    bool partial = false;        // the data folder stayed, only placement.subtrees (if any) moved
+    fs::path snapshot;           // manifest file of what was copied (see SnapshotPath), empty after a rename
+    ArchiveStats archive;        // with archive options: what went into the cold archive instead of the copy
+    fs::path archiveDirectory;   // ArchivePath(destination) when anything was archived
+};
+
+// Thrown when a MigrationCallbacks::decide answer stops the migration
+class MigrationDeclined : public std::runtime_error {
+public:
+    explicit MigrationDeclined(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Move the data folder to destination: rename on the same volume, otherwise
+// scan, copy (resuming from a journal, optionally verified or live), record what was
+// copied in a manifest file next to the destination, remove the source (or only rename
+// it aside with deferDelete), then link the old path to the new one. Nothing is deleted
+// at the source before the copy has fully succeeded.
+// With a placement policy the data folder stays and only its bulk subtrees move the
+// same way, each linked from source/<subtree> to destination/<subtree>; a folder that
+// holds no fast files at all (or is already a link) still moves as a whole.
+// With archive options a whole-folder copy first packs the cold files into containers at
+// ArchivePath(destination) and copies only the rest; they are read back with ArchiveReader.
+// Throws fs::filesystem_error, CopyCanceled, VerifyFailed or MigrationDeclined.
+MigrationResult RunMigration(const MigrationOptions& options, const MigrationCallbacks& callbacks);
+
+// Stable lower-case name of a step, for logs and machine-readable output
+const char* StepName(MigrationStep step);
+
+// Directory link from link to target: a junction on Windows, a symlink elsewhere.
+// Throws fs::filesystem_error.
+void CreateDirectoryLink(const fs::path& link, const fs::path& target);
+
+} // namespace zdm
+
+#endif // MIGRATION_H
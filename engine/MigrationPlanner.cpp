@@ -0,0 +1,102 @@
+#include "MigrationPlanner.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace zdm {
+
+fs::path NearestExisting(const fs::path& path) {
+    std::error_code ec;
+    fs::path current = fs::absolute(path, ec);
+    if (ec) {
+        current = path;
+    }
+    while (!current.empty() && !fs::exists(current, ec)) {
+        fs::path parent = current.parent_path();
+        if (parent == current) {
+            break;
+        }
+        current = parent;
+    }
+    return current;
+}
+
+namespace {
+
+#ifdef _WIN32
+// Volume GUID path (\\?\Volume{...}\) so mounted folders and drive letters compare correctly
+std::wstring VolumeId(const fs::path& path) {
+    wchar_t mountPoint[MAX_PATH];
+    if (!GetVolumePathNameW(path.c_str(), mountPoint, MAX_PATH)) {
+        return std::wstring();
+    }
+    wchar_t volumeName[MAX_PATH];
+    if (!GetVolumeNameForVolumeMountPointW(mountPoint, volumeName, MAX_PATH)) {
+        // Network shares have no volume GUID, fall back to the mount point itself
+        return mountPoint;
+    }
+    return volumeName;
+}
+#endif
+
+} // namespace
+
+bool IsSameVolume(const fs::path& first, const fs::path& second) {
+    fs::path a = NearestExisting(first);
+    fs::path b = NearestExisting(second);
+    if (a.empty() || b.empty()) {
+        return false;
+    }
+
+#ifdef _WIN32
+    std::wstring volumeA = VolumeId(a);
+    std::wstring volumeB = VolumeId(b);
+    return !volumeA.empty() && _wcsicmp(volumeA.c_str(), volumeB.c_str()) == 0;
+#else
+    struct stat statA;
+    struct stat statB;
+    if (stat(a.c_str(), &statA) != 0 || stat(b.c_str(), &statB) != 0) {
+        return false;
+    }
+    return statA.st_dev == statB.st_dev;
+#endif
+}
+
+MigrationPlan PlanMigration(const fs::path& source, const fs::path& destination) {
+    MigrationPlan plan;
+    plan.dataDirectory = source;
+
+    // When the source is already a link (symlink or junction), the data to move is its target
+    std::error_code ec;
+    fs::file_status linkStatus = fs::symlink_status(source, ec);
+    if (!ec && linkStatus.type() != fs::file_type::directory && fs::is_directory(source, ec)) {
+        fs::path target = fs::canonical(source, ec);
+        if (!ec) {
+            plan.dataDirectory = target;
+        }
+    }
+
+    if (IsSameVolume(plan.dataDirectory, destination)) {
+        plan.strategy = MigrationStrategy::Rename;
+        plan.reason = "source and destination are on the same volume";
+    } else {
+        plan.strategy = MigrationStrategy::Copy;
+        plan.reason = "source and destination are on different volumes";
+    }
+    return plan;
+}
+
+const char* StrategyName(MigrationStrategy strategy) {
+    switch (strategy) {
+        case MigrationStrategy::Rename:
+            return "rename";
+        case MigrationStrategy::Copy:
+            return "copy";
+    }
+    return "unknown";
+}
+
+} // namespace zdm
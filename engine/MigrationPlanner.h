@@ -0,0 +1,38 @@
+#ifndef MIGRATION_PLANNER_H
+#define MIGRATION_PLANNER_H
+
+#include <filesystem>
+#include <string>
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// How the data directory gets to its new location
+enum class MigrationStrategy {
+    Rename, // same volume: a single directory rename
+    Copy    // different volumes: copy engine, then delete the source
+};
+
+struct MigrationPlan {
+    MigrationStrategy strategy = MigrationStrategy::Copy;
+    fs::path dataDirectory;   // real directory holding the data (link target if source is a link)
+    std::string reason;       // short explanation for status and log
+};
+
+// path itself or its nearest existing parent (a destination folder may not exist yet),
+// made absolute. Empty when nothing along the way exists.
+fs::path NearestExisting(const fs::path& path);
+
+// True when both paths live on the same volume (Windows) or device (POSIX).
+// A path that does not exist yet is resolved through its nearest existing parent.
+bool IsSameVolume(const fs::path& first, const fs::path& second);
+
+// Decide how to move source to destination. Does not touch the disk beyond queries.
+MigrationPlan PlanMigration(const fs::path& source, const fs::path& destination);
+
+const char* StrategyName(MigrationStrategy strategy);
+
+} // namespace zdm
+
+#endif // MIGRATION_PLANNER_H
@@ -0,0 +1,279 @@
+#include "Mirror.h"
+#include "ChangeWatcher.h"
+#include "DirectoryEnumerator.h"
+#include "Manifest.h"
+
+#include <algorithm>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+namespace zdm {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Longest wait for notifications, so a cancel is seen within a second even when idle
+const std::chrono::milliseconds kMaxWait(1000);
+
+// Paths due this soon after the first ride along in its batch, a burst of writes is one copy pass
+const std::chrono::milliseconds kBatchWindow(250);
+
+// Reconciliations in a row that may fail before the error is taken for real. A folder
+// deleted while it is scanned fails one, an unusable mirror fails every one.
+const unsigned kReconcileAttempts = 3;
+
+struct PendingChange {
+    Clock::time_point first;
+    Clock::time_point last;
+};
+
+bool Canceled(const MirrorOptions& options) {
+    return options.cancel && options.cancel->load(std::memory_order_relaxed);
+}
+
+CopyOptions MirrorCopyOptions(const MirrorOptions& options) {
+    CopyOptions copyOptions;
+    copyOptions.threadCount = options.threadCount;
+    copyOptions.tuning = options.tuning;
+    copyOptions.io = options.io;
+    copyOptions.cancel = options.cancel;
+    copyOptions.slowestFiles = 0;
+    // The source is in use, a locked or vanished file is retried instead of stopping the mirror
+    copyOptions.continueOnError = true;
+    return copyOptions;
+}
+
+bool IsInside(PathView path, const PathString& directory) {
+    return path.size() > directory.size() && path[directory.size()] == fs::path::preferred_separator &&
+           path.substr(0, directory.size()) == PathView(directory);
+}
+
+// Copy manifest into the mirror, returning the paths that failed so they are tried again
+std::vector<PathString> CopyEntries(const MirrorOptions& options, const Manifest& manifest, MirrorPass& pass) {
+    std::vector<PathString> failed;
+    if (manifest.Empty()) {
+        return failed;
+    }
+    CopyStats stats = CopyEngine(MirrorCopyOptions(options)).CopyManifest(manifest, options.source, options.mirror);
+    pass.filesCopied += stats.filesCopied;
+    pass.bytesCopied += stats.bytesCopied;
+    pass.failures += stats.failedEntries.size();
+    for (size_t index : stats.failedEntries) {
+        PathView relativePath = manifest.RelativePath(manifest[index]);
+        failed.emplace_back(relativePath.data(), relativePath.size());
+    }
+    return failed;
+}
+
+// Full comparison of both trees, for the start and for changes the notifications missed
+std::vector<PathString> Reconcile(const MirrorOptions& options, MirrorPass& pass) {
+    Manifest source = ScanTree(options.source, options.threadCount);
+    Manifest mirror;
+    std::error_code ec;
+    if (fs::exists(options.mirror, ec)) {
+        mirror = ScanTree(options.mirror, options.threadCount);
+    } else {
+        fs::create_directories(options.mirror);
+    }
+
+    // Copies keep the source mtime, so the mirror diffs like a rescan of the source
+    ManifestDiff diff = DiffManifests(mirror, source);
+    for (auto it = diff.removed.rbegin(); it != diff.removed.rend(); ++it) {
+        fs::remove_all(options.mirror / mirror.RelativePath(mirror[*it]), ec);
+        pass.entriesRemoved++;
+    }
+    pass.paths = source.Size();
+    return CopyEntries(options, source.Subset(diff.changed), pass);
+}
+
+// Bring the notified paths up to date: copy what exists, delete what is gone
+std::vector<PathString> SyncPaths(const MirrorOptions& options, std::vector<PathString>& paths, MirrorPass& pass) {
+    std::sort(paths.begin(), paths.end(),
+              [](const PathString& left, const PathString& right) { return PathLess(left, right); });
+    pass.paths = paths.size();
+
+    Manifest batch;
+    std::vector<PathString> failed;
+    std::vector<PathString> subtrees; // new directories, taken whole with everything below them
+    std::error_code ec;
+    for (const PathString& path : paths) {
+        if (std::any_of(subtrees.begin(), subtrees.end(),
+                        [&path](const PathString& subtree) { return IsInside(path, subtree); })) {
+            continue;
+        }
+
+        fs::path target = options.mirror / path;
+        EntryType type;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        if (!StatEntry(options.source / path, type, size, mtime)) {
+            if (fs::remove_all(target, ec) > 0) {
+                pass.entriesRemoved++;
+            }
+            continue;
+        }
+
+        // A name that changed type (a file replaced by a folder) is replaced as a whole
+        fs::file_status status = fs::symlink_status(target, ec);
+        bool existing = fs::exists(status);
+        bool sameType = (type == EntryType::Directory && fs::is_directory(status)) ||
+                        (type == EntryType::File && fs::is_regular_file(status)) ||
+                        (type == EntryType::Symlink && fs::is_symlink(status));
+        if (existing && !sameType) {
+            fs::remove_all(target, ec);
+            existing = false;
+        }
+        fs::create_directories(target.parent_path());
+
+        if (type != EntryType::Directory) {
+            batch.Add(type, path, size, mtime);
+        } else if (!existing) {
+            // Files written before the directory was watched were never notified
+            Manifest subtree;
+            try {
+                subtree = ScanTree(options.source / path, options.threadCount);
+            } catch (const fs::filesystem_error&) {
+                // Changing under the scan, try again once it has settled
+                failed.push_back(path);
+                pass.failures++;
+                continue;
+            }
+            batch.Add(type, path, 0, mtime);
+            PathString childPath;
+            for (const ManifestEntry& entry : subtree.Entries()) {
+                PathView relativePath = subtree.RelativePath(entry);
+                childPath.assign(path);
+                childPath += fs::path::preferred_separator;
+                childPath.append(relativePath.data(), relativePath.size());
+                batch.Add(entry.type, childPath, entry.size, entry.mtime);
+            }
+            subtrees.push_back(path);
+        }
+        // An existing directory has nothing to copy, its children report their own changes
+    }
+
+    batch.SortByPath();
+    std::vector<PathString> failedCopies = CopyEntries(options, batch, pass);
+    failed.insert(failed.end(), std::make_move_iterator(failedCopies.begin()),
+                  std::make_move_iterator(failedCopies.end()));
+    return failed;
+}
+
+} // namespace
+
+MirrorStats RunMirror(const MirrorOptions& options, const std::function<void(const MirrorPass&)>& onPass) {
+    MirrorStats stats;
+
+    // Watching starts before the first scan, so nothing changes unseen between the two
+    ChangeWatcher watcher(options.source);
+
+    std::unordered_map<PathString, PendingChange> pending;
+    bool reconcile = true; // due at nextReconcile even without a periodic interval
+    Clock::time_point nextReconcile = Clock::now();
+    unsigned failedReconciles = 0;
+    std::vector<PathString> changed;
+    std::vector<PathString> ready;
+
+    auto runPass = [&](bool full) {
+        MirrorPass pass;
+        pass.reconcile = full;
+        auto start = Clock::now();
+        PhaseSpan span(options.eventLog, full ? "reconcile" : "mirror_batch");
+        std::vector<PathString> failed = full ? Reconcile(options, pass) : SyncPaths(options, ready, pass);
+        span.End({ pass.filesCopied, pass.bytesCopied }, "\"paths\":" + std::to_string(pass.paths) +
+                                                         ",\"removed\":" + std::to_string(pass.entriesRemoved) +
+                                                         ",\"failures\":" + std::to_string(pass.failures));
+        pass.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        // Failed files wait for another quiet period, the application may still hold them
+        Clock::time_point now = Clock::now();
+        for (PathString& path : failed) {
+            pending.emplace(std::move(path), PendingChange{ now, now });
+        }
+
+        (full ? stats.reconciles : stats.batches)++;
+        stats.filesCopied += pass.filesCopied;
+        stats.bytesCopied += pass.bytesCopied;
+        stats.entriesRemoved += pass.entriesRemoved;
+        if (onPass) {
+            onPass(pass);
+        }
+    };
+
+    try {
+        while (!Canceled(options)) {
+            Clock::time_point now = Clock::now();
+            bool scheduled = reconcile || options.reconcileInterval.count() > 0;
+            if (scheduled && now >= nextReconcile) {
+                try {
+                    runPass(true);
+                    failedReconciles = 0;
+                    reconcile = false;
+                    nextReconcile = Clock::now() + options.reconcileInterval;
+                } catch (const fs::filesystem_error& e) {
+                    if (++failedReconciles >= kReconcileAttempts) {
+                        throw;
+                    }
+                    if (options.eventLog) {
+                        options.eventLog->Message(std::string("Reconciliation failed (") + e.what() +
+                                                  "), trying again");
+                    }
+                    reconcile = true;
+                    nextReconcile = Clock::now() + options.settle;
+                }
+                continue;
+            }
+
+            // Sleep until the next path is due, the next reconciliation or the next look at the cancel flag
+            auto due = [&](const PendingChange& change) {
+                return std::min(change.last + options.settle, change.first + options.maxDelay);
+            };
+            Clock::time_point wakeUp = now + kMaxWait;
+            for (const auto& change : pending) {
+                wakeUp = std::min(wakeUp, due(change.second));
+            }
+            if (scheduled) {
+                wakeUp = std::min(wakeUp, nextReconcile);
+            }
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wakeUp - now);
+
+            changed.clear();
+            if (!watcher.Wait(std::max(timeout, std::chrono::milliseconds(0)), changed)) {
+                stats.notificationsLost++;
+                reconcile = true;
+                nextReconcile = Clock::now();
+                if (options.eventLog) {
+                    options.eventLog->Message("Change notifications were lost, reconciling the mirror");
+                }
+            }
+
+            // Coalesce: a file written in many small pieces is one pending path
+            now = Clock::now();
+            for (PathString& path : changed) {
+                auto inserted = pending.emplace(std::move(path), PendingChange{ now, now });
+                inserted.first->second.last = now;
+            }
+
+            ready.clear();
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (due(it->second) <= now + kBatchWindow) {
+                    ready.push_back(it->first);
+                    it = pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (!ready.empty()) {
+                runPass(false);
+            }
+        }
+    } catch (const CopyCanceled&) {
+        // Canceled during a pass, the next run reconciles what it left
+    }
+    return stats;
+}
+
+} // namespace zdm
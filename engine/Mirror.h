@@ -0,0 +1,72 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+
+#include "CopyEngine.h"
+#include "EventLog.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+struct MirrorOptions {
+    fs::path source; // data folder to follow
+    fs::path mirror; // warm copy of it, created if missing
+    unsigned threadCount = 0;
+
+    // A changed path is copied once it has been quiet for settle, or maxDelay after its
+    // first change when it never is (a database the application keeps writing)
+    std::chrono::milliseconds settle{2000};
+    std::chrono::milliseconds maxDelay{60000};
+
+    // Rescan both trees this often to catch changes the notifications missed, 0 = only
+    // at the start and after notifications were lost
+    std::chrono::seconds reconcileInterval{15 * 60};
+
+    FileCopyTuning tuning;
+    IoLimits io;
+
+    // Stops RunMirror, which otherwise never returns
+    const std::atomic<bool>* cancel = nullptr;
+
+    // "reconcile" and "mirror_batch" spans, may be null
+    EventLog* eventLog = nullptr;
+};
+
+// One pass that brought the mirror up to date
+struct MirrorPass {
+    bool reconcile = false; // a rescan of both trees rather than a batch of notified paths
+    uint64_t paths = 0;     // batch: notified paths looked at
+    uint64_t filesCopied = 0;
+    uint64_t bytesCopied = 0;
+    uint64_t entriesRemoved = 0;
+    uint64_t failures = 0; // files that could not be read (locked, vanished), tried again later
+    double seconds = 0;
+};
+
+struct MirrorStats {
+    uint64_t batches = 0;
+    uint64_t reconciles = 0;
+    uint64_t filesCopied = 0;
+    uint64_t bytesCopied = 0;
+    uint64_t entriesRemoved = 0;
+    uint64_t notificationsLost = 0; // times the watcher fell behind and a rescan caught up
+};
+
+// Keep mirror a copy of source until options.cancel is set. Starts with a reconciliation
+// (scan both trees, diff, copy and delete what differs), then follows change notifications
+// (see ChangeWatcher): notified paths are coalesced, copied in batches once they settle,
+// and deleted from the mirror when they are gone at the source. Idle, it only waits for
+// notifications. onPass is called after every pass from the calling thread.
+// Throws fs::filesystem_error when the source cannot be watched or scanned or the mirror
+// cannot be written.
+MirrorStats RunMirror(const MirrorOptions& options, const std::function<void(const MirrorPass&)>& onPass = nullptr);
+
+} // namespace zdm
+
+#endif // MIRROR_H
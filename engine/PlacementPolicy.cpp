@@ -0,0 +1,417 @@
+#include "PlacementPolicy.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace zdm {
+
+namespace {
+
+#ifdef _WIN32
+const int64_t kTicksPerDay = 864000000000LL;      // 100 ns FILETIME ticks
+const int64_t kFileTimeEpochOffset = 116444736000000000LL; // 1601 to 1970
+#else
+const int64_t kTicksPerDay = 86400000000000LL;    // nanoseconds
+#endif
+
+} // namespace
+
+int64_t MtimeNow() {
+    auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+#ifdef _WIN32
+    using Ticks = std::chrono::duration<int64_t, std::ratio<1, 10000000>>;
+    return std::chrono::duration_cast<Ticks>(sinceEpoch).count() + kFileTimeEpochOffset;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch).count();
+#endif
+}
+
+namespace {
+
+PathChar LowerAscii(PathChar c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<PathChar>(c - 'A' + 'a') : c;
+}
+
+bool EqualNoCase(PathView a, PathView b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (LowerAscii(a[i]) != LowerAscii(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HasExtension(PathView name, const std::vector<PathString>& extensions) {
+    for (const PathString& extension : extensions) {
+        if (name.size() > extension.size() &&
+            EqualNoCase(name.substr(name.size() - extension.size()), extension)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Any component of a relative directory path named like one of names
+bool InDirectory(PathView directory, const std::vector<PathString>& names) {
+    while (!directory.empty()) {
+        PathView component = PathName(directory);
+        for (const PathString& name : names) {
+            if (EqualNoCase(component, name)) {
+                return true;
+            }
+        }
+        directory = PathParent(directory);
+    }
+    return false;
+}
+
+std::vector<PathString> SplitList(const std::string& list, bool extensions) {
+    std::vector<PathString> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        if (extensions && item[0] != '.') {
+            item.insert(item.begin(), '.');
+        }
+        items.push_back(fs::u8path(item).native());
+    }
+    return items;
+}
+
+// "64K", "100M", "2G" or plain bytes
+bool ParseSize(const std::string& text, uint64_t& size) {
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    std::string suffix(end);
+    uint64_t unit = 1;
+    if (suffix == "K" || suffix == "k") {
+        unit = 1024;
+    } else if (suffix == "M" || suffix == "m") {
+        unit = 1024 * 1024;
+    } else if (suffix == "G" || suffix == "g") {
+        unit = 1024ull * 1024 * 1024;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    size = value * unit;
+    return true;
+}
+
+// "30d" or "30"
+bool ParseDays(const std::string& text, int64_t& days) {
+    char* end = nullptr;
+    long long value = std::strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str() || value < 0 || !(*end == '\0' || (end[0] == 'd' && end[1] == '\0'))) {
+        return false;
+    }
+    days = value;
+    return true;
+}
+
+bool ParseTier(const std::string& text, Tier& tier) {
+    if (text == "fast") {
+        tier = Tier::Fast;
+    } else if (text == "bulk") {
+        tier = Tier::Bulk;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ParseCondition(const std::string& condition, PlacementRule& rule) {
+    if (condition.compare(0, 4, "dir=") == 0) {
+        rule.directories = SplitList(condition.substr(4), false);
+        return !rule.directories.empty();
+    }
+    if (condition.compare(0, 4, "ext=") == 0) {
+        rule.extensions = SplitList(condition.substr(4), true);
+        return !rule.extensions.empty();
+    }
+    if (condition.compare(0, 6, "size>=") == 0) {
+        return ParseSize(condition.substr(6), rule.minSize);
+    }
+    if (condition.compare(0, 5, "size<") == 0) {
+        return ParseSize(condition.substr(5), rule.maxSize);
+    }
+    if (condition.compare(0, 5, "age>=") == 0) {
+        return ParseDays(condition.substr(5), rule.minAgeDays);
+    }
+    if (condition.compare(0, 4, "age<") == 0) {
+        return ParseDays(condition.substr(4), rule.maxAgeDays);
+    }
+    return false;
+}
+
+std::string FormatSize(uint64_t bytes) {
+    char buffer[32];
+    if (bytes >= 1024ull * 1024 * 1024) {
+        std::snprintf(buffer, sizeof(buffer), "%.2f GB", bytes / (1024.0 * 1024 * 1024));
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%.1f MB", bytes / (1024.0 * 1024));
+    }
+    return buffer;
+}
+
+std::string FormatTotals(const TierTotals& totals) {
+    return std::to_string(totals.files) + " files, " + FormatSize(totals.bytes);
+}
+
+void AddFile(TierTotals& totals, const ManifestEntry& file) {
+    totals.files++;
+    totals.bytes += file.size;
+}
+
+} // namespace
+
+Tier PlacementPolicy::Classify(const Manifest& manifest, const ManifestEntry& file, int64_t now) const {
+    PathView path = manifest.RelativePath(file);
+    int64_t ageDays = file.mtime < now ? (now - file.mtime) / kTicksPerDay : 0;
+
+    for (const PlacementRule& rule : rules) {
+        if (file.size < rule.minSize || file.size >= rule.maxSize ||
+            ageDays < rule.minAgeDays || ageDays >= rule.maxAgeDays) {
+            continue;
+        }
+        if (!rule.extensions.empty() && !HasExtension(PathName(path), rule.extensions)) {
+            continue;
+        }
+        if (!rule.directories.empty() && !InDirectory(PathParent(path), rule.directories)) {
+            continue;
+        }
+        return rule.tier;
+    }
+    return defaultTier;
+}
+
+PlacementPolicy DefaultPlacementPolicy() {
+    // Written like a policy file so it doubles as an example of one
+    std::istringstream rules(
+        "fast ext=.db,.db-wal,.db-shm,.db-journal,.sqlite,.sqlite-wal,.sqlite-shm,.ldb,.idx\n"
+        "fast size<64K age<30d\n"
+        "bulk dir=picture,video,file,thumb,ZaloDownloads\n"
+        "default fast\n");
+    return ParsePlacementPolicy(rules);
+}
+
+PlacementPolicy ParsePlacementPolicy(std::istream& input) {
+    PlacementPolicy policy;
+    std::string line;
+    for (int lineNumber = 1; std::getline(input, line); lineNumber++) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream words(line);
+        std::string first;
+        if (!(words >> first)) {
+            continue;
+        }
+
+        auto fail = [&](const std::string& what) {
+            throw std::invalid_argument("placement policy line " + std::to_string(lineNumber) + ": " + what);
+        };
+
+        std::string word;
+        if (first == "default") {
+            if (!(words >> word) || !ParseTier(word, policy.defaultTier) || (words >> word)) {
+                fail("expected \"default fast\" or \"default bulk\"");
+            }
+            continue;
+        }
+
+        PlacementRule rule;
+        if (!ParseTier(first, rule.tier)) {
+            fail("unknown tier \"" + first + "\"");
+        }
+        while (words >> word) {
+            if (!ParseCondition(word, rule)) {
+                fail("bad condition \"" + word + "\"");
+            }
+        }
+        policy.rules.push_back(std::move(rule));
+    }
+    return policy;
+}
+
+PlacementPolicy LoadPlacementPolicy(const fs::path& path) {
+    std::ifstream input(path);
+    if (!input) {
+        throw fs::filesystem_error("cannot open placement policy", path,
+                                   std::make_error_code(std::errc::no_such_file_or_directory));
+    }
+    return ParsePlacementPolicy(input);
+}
+
+PlacementPlan PlanPlacement(const Manifest& manifest, const PlacementPolicy& policy) {
+    enum : uint8_t {
+        kHasFast = 1, // directories: some file below is fast, files: the file is
+        kHasBulk = 2,
+        kMoved = 4
+    };
+
+    PlacementPlan plan;
+    std::vector<uint8_t> flags(manifest.Size(), 0);
+    std::unordered_map<PathView, size_t> directories;
+    directories.reserve(manifest.DirectoryCount());
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        if (manifest[i].type == EntryType::Directory) {
+            directories.emplace(manifest.RelativePath(manifest[i]), i);
+        }
+    }
+
+    // Classify the files and mark every directory above them. A directory that already
+    // carries the mark has marked its own parents too, so the walk stops there.
+    // Links (such as subtrees moved by an earlier run) stay, like fast files.
+    int64_t now = MtimeNow();
+    uint8_t rootFlags = 0;
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        const ManifestEntry& entry = manifest[i];
+        if (entry.type == EntryType::Directory) {
+            continue;
+        }
+        uint8_t mark = kHasFast;
+        if (entry.type == EntryType::File && policy.Classify(manifest, entry, now) == Tier::Bulk) {
+            mark = kHasBulk;
+        }
+        flags[i] = mark;
+        rootFlags |= mark;
+        for (PathView parent = PathParent(manifest.RelativePath(entry)); !parent.empty(); parent = PathParent(parent)) {
+            auto it = directories.find(parent);
+            if (it == directories.end() || (flags[it->second] & mark)) {
+                break;
+            }
+            flags[it->second] |= mark;
+        }
+    }
+
+    // Nothing has to stay: the whole folder moves like it always did
+    if (!(rootFlags & kHasFast)) {
+        plan.wholeTree = (rootFlags & kHasBulk) != 0;
+        for (size_t i = 0; i < manifest.Size(); i++) {
+            if (manifest[i].type == EntryType::File) {
+                AddFile(plan.moved, manifest[i]);
+            }
+        }
+        return plan;
+    }
+
+    // Top-most directories holding bulk files only. Parents come first in the manifest,
+    // and a directory below a moved one is never moved itself.
+    std::unordered_map<size_t, size_t> subtreeOf;
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        if (manifest[i].type != EntryType::Directory || flags[i] != kHasBulk) {
+            continue;
+        }
+        PathView path = manifest.RelativePath(manifest[i]);
+        PathView parent = PathParent(path);
+        if (!parent.empty()) {
+            auto it = directories.find(parent);
+            if (it != directories.end() && !(flags[it->second] & kHasFast)) {
+                continue;
+            }
+        }
+        flags[i] |= kMoved;
+        subtreeOf.emplace(i, plan.subtrees.size());
+        plan.subtrees.push_back({ PathString(path), TierTotals() });
+    }
+
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        const ManifestEntry& entry = manifest[i];
+        if (entry.type != EntryType::File) {
+            continue;
+        }
+        if (flags[i] == kHasFast) {
+            AddFile(plan.fast, entry);
+            continue;
+        }
+        bool moved = false;
+        for (PathView parent = PathParent(manifest.RelativePath(entry)); !parent.empty(); parent = PathParent(parent)) {
+            auto it = directories.find(parent);
+            if (it != directories.end() && (flags[it->second] & kMoved)) {
+                AddFile(plan.subtrees[subtreeOf[it->second]].totals, entry);
+                moved = true;
+                break;
+            }
+        }
+        AddFile(moved ? plan.moved : plan.pinned, entry);
+    }
+    return plan;
+}
+
+Manifest SelectSubtrees(const Manifest& manifest, const std::vector<PlacementSubtree>& subtrees) {
+    std::unordered_set<PathView> roots;
+    std::unordered_set<PathView> ancestors;
+    for (const PlacementSubtree& subtree : subtrees) {
+        roots.insert(subtree.relativePath);
+        for (PathView parent = PathParent(subtree.relativePath); !parent.empty(); parent = PathParent(parent)) {
+            ancestors.insert(parent);
+        }
+    }
+
+    std::vector<size_t> selected;
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        PathView path = manifest.RelativePath(manifest[i]);
+        bool keep = manifest[i].type == EntryType::Directory && ancestors.count(path) != 0;
+        for (PathView current = path; !keep && !current.empty(); current = PathParent(current)) {
+            keep = roots.count(current) != 0;
+        }
+        if (keep) {
+            selected.push_back(i);
+        }
+    }
+    return manifest.Subset(selected);
+}
+
+std::string DescribePlacement(const PlacementPlan& plan) {
+    const size_t kListed = 20;
+
+    std::string text = "Fast tier, stays: " + FormatTotals(plan.fast) + "\n";
+    text += "Bulk tier, moves: " + FormatTotals(plan.moved);
+    if (plan.wholeTree) {
+        text += " (the whole folder)";
+    } else {
+        text += " in " + std::to_string(plan.subtrees.size()) + " folders";
+    }
+    text += "\n";
+    if (plan.pinned.files > 0) {
+        text += "Bulk files kept next to fast ones: " + FormatTotals(plan.pinned) + "\n";
+    }
+    for (size_t i = 0; i < plan.subtrees.size() && i < kListed; i++) {
+        text += "  " + fs::path(plan.subtrees[i].relativePath).u8string() + ": " +
+                FormatTotals(plan.subtrees[i].totals) + "\n";
+    }
+    if (plan.subtrees.size() > kListed) {
+        text += "  ... and " + std::to_string(plan.subtrees.size() - kListed) + " more folders\n";
+    }
+    text.pop_back();
+    return text;
+}
+
+const char* TierName(Tier tier) {
+    switch (tier) {
+        case Tier::Fast:
+            return "fast";
+        case Tier::Bulk:
+            return "bulk";
+    }
+    return "unknown";
+}
+
+} // namespace zdm
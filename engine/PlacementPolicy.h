@@ -0,0 +1,96 @@
+#ifndef PLACEMENT_POLICY_H
+#define PLACEMENT_POLICY_H
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "Manifest.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// Where a file belongs
+enum class Tier : uint8_t {
+    Fast, // stays on the original disk: databases, indexes, small files in use
+    Bulk  // moves to the destination: media archives
+};
+
+// One policy rule. Every condition that is set must hold, an empty list matches anything.
+struct PlacementRule {
+    Tier tier = Tier::Bulk;
+    std::vector<PathString> directories; // any folder on the path has one of these names
+    std::vector<PathString> extensions;  // name ends with one of these, with the dot (".db-wal")
+    uint64_t minSize = 0;
+    uint64_t maxSize = UINT64_MAX;       // exclusive
+    int64_t minAgeDays = 0;              // since the last write
+    int64_t maxAgeDays = INT64_MAX;      // exclusive
+};
+
+// Ordered rules deciding the tier of each file: the first rule that matches wins.
+// Names and extensions compare without regard to ASCII case.
+struct PlacementPolicy {
+    std::vector<PlacementRule> rules;
+    Tier defaultTier = Tier::Fast;
+
+    Tier Classify(const Manifest& manifest, const ManifestEntry& file, int64_t now) const;
+};
+
+// Current time on the ManifestEntry::mtime clock, for Classify
+int64_t MtimeNow();
+
+// Keeps the SQLite stores and recently written small files on the fast disk and moves
+// the media folders (pictures, videos, files, thumbnails, downloads)
+PlacementPolicy DefaultPlacementPolicy();
+
+// Read rules from text, one per line, "#" starts a comment:
+//   fast ext=.db,.db-wal            bulk dir=picture,video
+//   fast size<64K age<30d           bulk size>=100M
+//   default fast
+// Sizes take K, M or G, ages are in days. Throws std::invalid_argument naming the line.
+PlacementPolicy ParsePlacementPolicy(std::istream& input);
+
+// ParsePlacementPolicy on a file. Throws fs::filesystem_error or std::invalid_argument.
+PlacementPolicy LoadPlacementPolicy(const fs::path& path);
+
+// Files and bytes of one group
+struct TierTotals {
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+};
+
+// Directory moved as a whole and linked from its old path
+struct PlacementSubtree {
+    PathString relativePath;
+    TierTotals totals;
+};
+
+// What a policy does to one tree. Only whole directories move, each behind one link,
+// so a bulk file that shares its directory tree with a fast file stays where it is.
+// Links already in the tree, e.g. from an earlier run, stay in place like fast files.
+struct PlacementPlan {
+    std::vector<PlacementSubtree> subtrees; // top-most directories without fast files, in path order
+    TierTotals fast;   // kept by the policy
+    TierTotals moved;  // bulk files inside the subtrees
+    TierTotals pinned; // bulk files that stay next to fast ones
+    bool wholeTree = false; // no fast file at all: the tree itself moves behind one link
+};
+
+// Classify every file of manifest (sorted by path) and pick the subtrees to move
+PlacementPlan PlanPlacement(const Manifest& manifest, const PlacementPolicy& policy);
+
+// The subtrees with everything inside them and the directories leading to them,
+// in manifest order: what a copy of the plan has to create at the destination
+Manifest SelectSubtrees(const Manifest& manifest, const std::vector<PlacementSubtree>& subtrees);
+
+// Short multi-line summary of a plan for logs and dry runs, without a final newline
+std::string DescribePlacement(const PlacementPlan& plan);
+
+const char* TierName(Tier tier);
+
+} // namespace zdm
+
+#endif // PLACEMENT_POLICY_H
@@ -0,0 +1,516 @@
+#include "Preflight.h"
+#include "DirectoryEnumerator.h"
+#include "Journal.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <new>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Probe I/O goes in chunks of this size, a multiple of every sector size
+const size_t kProbeChunk = 1024 * 1024;
+
+// Files at or above this size measure sequential throughput, below kSmallFile the cost per file
+const uint64_t kLargeFile = 1024 * 1024;
+const uint64_t kSmallFile = 64 * 1024;
+const uint64_t kProbeSmallFiles = 128;
+
+// Space a file takes on disk, in whole clusters
+const uint64_t kClusterSize = 4096;
+
+// Cold archive index: a record per file besides its path, and one per MiB block of data
+const uint64_t kArchiveFileRecord = 64;
+const uint64_t kArchiveBlockRecord = 16;
+const uint64_t kArchiveBlockSize = 1024 * 1024;
+
+std::string FormatSize(uint64_t bytes) {
+    char buffer[32];
+    if (bytes >= 1024ull * 1024 * 1024) {
+        std::snprintf(buffer, sizeof(buffer), "%.2f GB", bytes / (1024.0 * 1024 * 1024));
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%.1f MB", bytes / (1024.0 * 1024));
+    }
+    return buffer;
+}
+
+std::string FormatDuration(double seconds) {
+    long long total = static_cast<long long>(seconds + 0.5);
+    char buffer[32];
+    if (total >= 3600) {
+        std::snprintf(buffer, sizeof(buffer), "%lld:%02lld:%02lld", total / 3600, total / 60 % 60, total % 60);
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%lld:%02lld", total / 60, total % 60);
+    }
+    return buffer;
+}
+
+bool Canceled(const PreflightOptions& options) {
+    return options.cancel && options.cancel->load();
+}
+
+// Sector-aligned buffer filled with data no disk can compress or deduplicate,
+// as unbuffered I/O requires
+class ProbeBuffer {
+public:
+    ProbeBuffer() {
+#ifdef _WIN32
+        m_data = VirtualAlloc(NULL, kProbeChunk, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!m_data) {
+            throw std::bad_alloc();
+        }
+#else
+        if (posix_memalign(&m_data, 4096, kProbeChunk) != 0) {
+            throw std::bad_alloc();
+        }
+#endif
+        uint64_t state = 0x9E3779B97F4A7C15ull;
+        uint64_t* words = static_cast<uint64_t*>(m_data);
+        for (size_t i = 0; i < kProbeChunk / sizeof(uint64_t); i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            words[i] = state;
+        }
+    }
+    ~ProbeBuffer() {
+#ifdef _WIN32
+        VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+        free(m_data);
+#endif
+    }
+    ProbeBuffer(const ProbeBuffer&) = delete;
+    ProbeBuffer& operator=(const ProbeBuffer&) = delete;
+
+    void* Data() const { return m_data; }
+
+private:
+    void* m_data = nullptr;
+};
+
+// Read a file up to maxBytes or deadline past the page cache: unbuffered on Windows, with
+// the cached pages dropped first on Linux. Returns the bytes read, 0 when it cannot be
+// opened (Zalo may hold it locked).
+uint64_t ReadUncached(const fs::path& path, ProbeBuffer& buffer, uint64_t maxBytes, Clock::time_point deadline) {
+    uint64_t total = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    DWORD read = 0;
+    while (total < maxBytes && ReadFile(file, buffer.Data(), static_cast<DWORD>(kProbeChunk), &read, NULL) && read > 0) {
+        total += read;
+        if (Clock::now() >= deadline) {
+            break;
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (total < maxBytes) {
+        ssize_t read = ::read(fd, buffer.Data(), kProbeChunk);
+        if (read <= 0) {
+            break;
+        }
+        total += static_cast<uint64_t>(read);
+        if (Clock::now() >= deadline) {
+            break;
+        }
+    }
+    close(fd);
+#endif
+    return total;
+}
+
+// Write chunks of chunkSize (whole sectors, at most kProbeChunk) to a new file until maxBytes
+// or deadline and flush them to the disk: write-through and unbuffered on Windows, synced at
+// the end elsewhere. Returns the bytes written, 0 when the file cannot be created or written.
+uint64_t WriteThrough(const fs::path& path, ProbeBuffer& buffer, size_t chunkSize, uint64_t maxBytes,
+                      Clock::time_point deadline) {
+    uint64_t total = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    DWORD written = 0;
+    bool ok = true;
+    do {
+        ok = WriteFile(file, buffer.Data(), static_cast<DWORD>(chunkSize), &written, NULL) && written == chunkSize;
+        total += written;
+    } while (ok && total < maxBytes && Clock::now() < deadline);
+    ok = FlushFileBuffers(file) && ok;
+    CloseHandle(file);
+#else
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return 0;
+    }
+    bool ok = true;
+    do {
+        ssize_t written = ::write(fd, buffer.Data(), chunkSize);
+        ok = written == static_cast<ssize_t>(chunkSize);
+        total += written > 0 ? static_cast<uint64_t>(written) : 0;
+    } while (ok && total < maxBytes && Clock::now() < deadline);
+    ok = fdatasync(fd) == 0 && ok;
+    close(fd);
+#endif
+    return ok ? total : 0;
+}
+
+// Read sampled source files: large ones spread over the whole tree for the sequential
+// rate, then small ones for the cost per file
+VolumeProbe ProbeSource(const fs::path& root, const Manifest& manifest, const PreflightOptions& options) {
+    VolumeProbe probe;
+    probe.device = ProbeDevice(root);
+
+    std::vector<size_t> large;
+    std::vector<size_t> small;
+    for (size_t i = 0; i < manifest.Size(); i++) {
+        const ManifestEntry& entry = manifest[i];
+        if (entry.type != EntryType::File) {
+            continue;
+        }
+        if (entry.size >= kLargeFile) {
+            large.push_back(i);
+        } else if (entry.size < kSmallFile) {
+            small.push_back(i);
+        }
+    }
+
+    ProbeBuffer buffer;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + options.probeTime * 3 / 4;
+    uint64_t largeBytes = 0;
+    size_t step = std::max<size_t>(1, large.size() / 64);
+    for (size_t i = 0; i < large.size() && largeBytes < options.probeBytes; i += step) {
+        if (Clock::now() >= deadline || Canceled(options)) {
+            break;
+        }
+        const ManifestEntry& entry = manifest[large[i]];
+        largeBytes += ReadUncached(root / PathString(manifest.RelativePath(entry)), buffer,
+                                   options.probeBytes - largeBytes, deadline);
+    }
+    double largeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (largeBytes >= kLargeFile && largeSeconds > 0) {
+        probe.bytesPerSecond = largeBytes / largeSeconds;
+    }
+
+    start = Clock::now();
+    deadline = start + options.probeTime / 4;
+    uint64_t smallFiles = 0;
+    uint64_t smallBytes = 0;
+    step = std::max<size_t>(1, small.size() / kProbeSmallFiles);
+    for (size_t i = 0; i < small.size() && Clock::now() < deadline && !Canceled(options); i += step) {
+        const ManifestEntry& entry = manifest[small[i]];
+        smallBytes += ReadUncached(root / PathString(manifest.RelativePath(entry)), buffer, kSmallFile, deadline);
+        smallFiles++;
+    }
+    if (smallFiles > 0) {
+        probe.secondsPerFile = std::chrono::duration<double>(Clock::now() - start).count() / smallFiles;
+    }
+
+    probe.bytes = largeBytes + smallBytes;
+    probe.files = smallFiles;
+    return probe;
+}
+
+// Write a probe file of up to maxBytes and a few small files in a scratch folder next to
+// the destination, then remove them. writable turns false when nothing could be written there.
+VolumeProbe ProbeDestination(const fs::path& folder, uint64_t maxBytes, const PreflightOptions& options,
+                             bool& writable) {
+    VolumeProbe probe;
+    probe.device = ProbeDevice(folder);
+
+    std::error_code ec;
+    fs::path scratch = folder / ".zdm-preflight";
+    fs::create_directory(scratch, ec);
+    if (ec) {
+        writable = false;
+        return probe;
+    }
+
+    ProbeBuffer buffer;
+    Clock::time_point start = Clock::now();
+    uint64_t written = WriteThrough(scratch / "sequential", buffer, kProbeChunk, maxBytes,
+                                    start + options.probeTime * 3 / 4);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    writable = written > 0;
+    if (written > 0 && seconds > 0) {
+        probe.bytesPerSecond = written / seconds;
+    }
+
+    start = Clock::now();
+    Clock::time_point deadline = start + options.probeTime / 4;
+    uint64_t files = 0;
+    while (writable && files < kProbeSmallFiles && Clock::now() < deadline && !Canceled(options)) {
+        if (WriteThrough(scratch / std::to_string(files), buffer, kClusterSize, kClusterSize, deadline) == 0) {
+            break;
+        }
+        files++;
+    }
+    if (files > 0) {
+        probe.secondsPerFile = std::chrono::duration<double>(Clock::now() - start).count() / files;
+    }
+
+    probe.bytes = written + files * kClusterSize;
+    probe.files = files;
+    fs::remove_all(scratch, ec);
+    return probe;
+}
+
+// Copy time from the measured rates: the data at the slower sequential rate (and read
+// once more to verify), plus the per-file cost of both sides shared by the streams
+double EstimateSeconds(const PreflightReport& report, const PreflightOptions& options) {
+    double rate = 0;
+    for (double measured : { report.source.bytesPerSecond, report.destination.bytesPerSecond }) {
+        if (measured > 0 && (rate == 0 || measured < rate)) {
+            rate = measured;
+        }
+    }
+    if (options.io.maxBytesPerSecond > 0 && (rate == 0 || options.io.maxBytesPerSecond < rate)) {
+        rate = options.io.maxBytesPerSecond;
+    }
+
+    double seconds = 0;
+    if (rate > 0) {
+        seconds += report.bytesToMove / rate;
+        if (options.verify) {
+            seconds += report.bytesToMove / rate;
+        }
+    }
+    seconds += report.filesToMove * (report.source.secondsPerFile + report.destination.secondsPerFile) /
+               report.streams;
+    return seconds;
+}
+
+} // namespace
+
+PreflightReport RunPreflight(const PreflightOptions& options) {
+    Clock::time_point start = Clock::now();
+    PhaseSpan span(options.eventLog, "preflight");
+
+    PreflightReport report;
+    report.plan = PlanMigration(options.source, options.destination);
+    bool copy = report.plan.strategy == MigrationStrategy::Copy;
+    fs::path destinationFolder = NearestExisting(options.destination.parent_path());
+
+    if (copy) {
+        std::error_code ec;
+        fs::space_info space = fs::space(destinationFolder, ec);
+        if (!ec) {
+            report.availableBytes = space.available;
+        }
+    }
+
+    // The destination volume is measured while the source is scanned, they are different disks.
+    // The probe file takes at most a small share of the free space.
+    std::thread writeProbe;
+    if (copy) {
+        uint64_t probeBytes = std::min(options.probeBytes, report.availableBytes / 8);
+        writeProbe = std::thread([&, probeBytes]() {
+            try {
+                report.destination = ProbeDestination(destinationFolder, probeBytes, options, report.writable);
+            } catch (const std::exception&) {
+                report.writable = false;
+            }
+        });
+    }
+
+    Manifest manifest;
+    try {
+        manifest = ScanTree(report.plan.dataDirectory, options.threadCount);
+    } catch (...) {
+        if (writeProbe.joinable()) {
+            writeProbe.join();
+        }
+        throw;
+    }
+    report.files = manifest.FileCount();
+    report.directories = manifest.DirectoryCount();
+    report.bytes = manifest.TotalBytes();
+
+    // Per top-level folder; the manifest keeps a folder's entries together only per directory
+    std::map<PathString, PreflightFolder> folders;
+    uint64_t allocated = 0;
+    for (const ManifestEntry& entry : manifest.Entries()) {
+        if (entry.type != EntryType::File) {
+            continue;
+        }
+        PathView path = manifest.RelativePath(entry);
+        size_t separator = path.find(fs::path::preferred_separator);
+        PathView name = separator == PathView::npos ? PathView() : path.substr(0, separator);
+        PreflightFolder& folder = folders[PathString(name)];
+        folder.files++;
+        folder.bytes += entry.size;
+        allocated += (entry.size + kClusterSize - 1) / kClusterSize * kClusterSize;
+    }
+    for (auto& folder : folders) {
+        folder.second.name = folder.first;
+        report.folders.push_back(folder.second);
+    }
+    std::sort(report.folders.begin(), report.folders.end(), [](const PreflightFolder& a, const PreflightFolder& b) {
+        return a.bytes > b.bytes;
+    });
+
+    // An interrupted copy already put these files at the destination, the resumed run skips them
+    uint64_t resumedFiles = 0;
+    uint64_t resumedAllocated = 0;
+    if (copy && CopyJournal::ExistsIn(options.destination)) {
+        CopyJournal journal(options.destination);
+        if (journal.Load() > 0) {
+            fs::path destination;
+            for (const ManifestEntry& entry : manifest.Entries()) {
+                PathView path = manifest.RelativePath(entry);
+                if (entry.type != EntryType::File || !journal.IsComplete(path, entry.size, entry.mtime)) {
+                    continue;
+                }
+                EntryType type;
+                uint64_t size = 0;
+                int64_t mtime = 0;
+                destination = options.destination;
+                destination /= path;
+                if (StatEntry(destination, type, size, mtime) && type == EntryType::File && size == entry.size) {
+                    resumedFiles++;
+                    report.bytesResumed += entry.size;
+                    resumedAllocated += (entry.size + kClusterSize - 1) / kClusterSize * kClusterSize;
+                }
+            }
+        }
+    }
+
+    report.filesToMove = report.files;
+    report.bytesToMove = report.bytes;
+    bool partial = false;
+    if (options.placement) {
+        PlacementPlan placement = PlanPlacement(manifest, *options.placement);
+        if (!placement.wholeTree) {
+            partial = true;
+            report.filesToMove = placement.moved.files;
+            report.bytesToMove = placement.moved.bytes;
+            // Half a cluster of slack per file on average
+            allocated = report.bytesToMove + report.filesToMove * kClusterSize / 2;
+        }
+    }
+    // Archived files are packed back to back: blocks never larger than the data (those that
+    // do not compress, like most media, are stored) and an index record, not whole clusters.
+    // Moved subtrees stay plain files.
+    if (copy && options.archive && !partial) {
+        for (size_t index : SelectArchived(manifest, options.archive->policy)) {
+            const ManifestEntry& entry = manifest[index];
+            report.filesArchived++;
+            report.bytesArchived += entry.size;
+            allocated -= std::min(allocated, (entry.size + kClusterSize - 1) / kClusterSize * kClusterSize);
+            allocated += entry.size + kArchiveFileRecord + manifest.RelativePath(entry).size() * sizeof(PathChar) +
+                         (entry.size / kArchiveBlockSize + 1) * kArchiveBlockRecord;
+        }
+    }
+    report.filesToMove -= std::min(report.filesToMove, resumedFiles);
+    report.bytesToMove -= std::min(report.bytesToMove, report.bytesResumed);
+    allocated -= std::min(allocated, resumedAllocated);
+
+    if (copy) {
+        // Every file, directory and path also goes into the manifest file written after the copy
+        uint64_t headroom = std::max(static_cast<uint64_t>(allocated * options.headroomFraction), options.minimumHeadroom);
+        report.requiredBytes = allocated + headroom + manifest.Size() * 64;
+        report.enoughSpace = report.availableBytes >= report.requiredBytes;
+
+        if (!Canceled(options)) {
+            report.source = ProbeSource(report.plan.dataDirectory, manifest, options);
+        }
+        writeProbe.join();
+
+        unsigned threadCount = options.threadCount ? options.threadCount : WorkStealingPool::DefaultThreadCount();
+        unsigned streams = options.io.maxStreams;
+        if (streams == 0) {
+            for (DeviceKind device : { report.source.device, report.destination.device }) {
+                unsigned deviceLimit = DeviceStreamLimit(device);
+                if (deviceLimit != 0 && (streams == 0 || deviceLimit < streams)) {
+                    streams = deviceLimit;
+                }
+            }
+        }
+        report.streams = streams == 0 || streams > threadCount ? threadCount : streams;
+        report.estimatedSeconds = EstimateSeconds(report, options);
+    }
+
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    span.End({ report.files, report.bytes },
+             "\"strategy\":" + JsonString(StrategyName(report.plan.strategy)) +
+             ",\"required_bytes\":" + std::to_string(report.requiredBytes) +
+             ",\"available_bytes\":" + std::to_string(report.availableBytes) +
+             ",\"read_bytes_per_second\":" + std::to_string(static_cast<uint64_t>(report.source.bytesPerSecond)) +
+             ",\"write_bytes_per_second\":" + std::to_string(static_cast<uint64_t>(report.destination.bytesPerSecond)) +
+             ",\"estimated_seconds\":" + std::to_string(report.estimatedSeconds) +
+             ",\"ready\":" + (report.Ok() ? "true" : "false"));
+    return report;
+}
+
+std::string DescribePreflight(const PreflightReport& report) {
+    const size_t kListed = 10;
+
+    std::string text = "Data: " + std::to_string(report.files) + " files, " + FormatSize(report.bytes) + "\n";
+    for (size_t i = 0; i < report.folders.size() && i < kListed; i++) {
+        const PreflightFolder& folder = report.folders[i];
+        std::string name = folder.name.empty() ? std::string("(files in the folder itself)") : fs::path(folder.name).u8string();
+        text += "  " + name + ": " + std::to_string(folder.files) + " files, " + FormatSize(folder.bytes) + "\n";
+    }
+    if (report.folders.size() > kListed) {
+        text += "  ... and " + std::to_string(report.folders.size() - kListed) + " more folders\n";
+    }
+
+    if (report.plan.strategy == MigrationStrategy::Rename) {
+        text += "Same volume: the folder is renamed, no space or copy time needed\n";
+    } else {
+        text += "To copy: " + std::to_string(report.filesToMove) + " files, " + FormatSize(report.bytesToMove);
+        if (report.bytesResumed > 0) {
+            text += " (" + FormatSize(report.bytesResumed) + " already copied by an interrupted run)";
+        }
+        text += "\n";
+        if (report.filesArchived > 0) {
+            text += "Cold archive: " + std::to_string(report.filesArchived) + " files, " +
+                    FormatSize(report.bytesArchived) + " packed into containers\n";
+        }
+        text += "Destination: " + FormatSize(report.availableBytes) + " free, " + FormatSize(report.requiredBytes) +
+                " needed with headroom" + (report.enoughSpace ? "" : " - NOT ENOUGH SPACE") + "\n";
+        if (!report.writable) {
+            text += "Destination: cannot write next to the destination folder\n";
+        }
+        char rates[128];
+        std::snprintf(rates, sizeof(rates), "Measured: read %.0f MB/s (%s), write %.0f MB/s (%s), %u streams\n",
+                      report.source.bytesPerSecond / (1024 * 1024), DeviceKindName(report.source.device),
+                      report.destination.bytesPerSecond / (1024 * 1024), DeviceKindName(report.destination.device),
+                      report.streams);
+        text += rates;
+        text += "Estimated copy time: " + FormatDuration(report.estimatedSeconds) + "\n";
+    }
+    text.pop_back();
+    return text;
+}
+
+} // namespace zdm
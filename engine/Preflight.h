@@ -0,0 +1,102 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "ColdArchive.h"
+#include "EventLog.h"
+#include "IoScheduler.h"
+#include "Manifest.h"
+#include "MigrationPlanner.h"
+#include "PlacementPolicy.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+struct PreflightOptions {
+    fs::path source;      // data folder, may already be a link to an earlier location
+    fs::path destination; // new path of the data folder itself, like MigrationOptions
+    unsigned threadCount = 0;
+    bool verify = false;  // the estimate includes reading the copy back
+    const PlacementPolicy* placement = nullptr; // only the bulk subtrees will move
+    const ArchiveOptions* archive = nullptr;    // files its policy selects go into the cold archive
+    IoLimits io;          // streams and bandwidth cap the copy will run with
+
+    // Free space the destination must keep beyond the data: the larger of a share of
+    // the data and a fixed floor, for the journal, the manifest file and other writers
+    double headroomFraction = 0.05;
+    uint64_t minimumHeadroom = 256ull * 1024 * 1024;
+
+    // Each throughput probe stops after this many bytes (the write probe also at an eighth
+    // of the free space) or this long, whichever comes first
+    uint64_t probeBytes = 256ull * 1024 * 1024;
+    std::chrono::milliseconds probeTime{1000};
+
+    const std::atomic<bool>* cancel = nullptr;
+    EventLog* eventLog = nullptr; // "preflight" span, may be null
+};
+
+// Files below one top-level folder of the data (name empty: files directly in it)
+struct PreflightFolder {
+    PathString name;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+};
+
+// Throughput measured on one volume, all zero when it was not measured
+struct VolumeProbe {
+    DeviceKind device = DeviceKind::Unknown;
+    double bytesPerSecond = 0; // sequential, one stream, past the page cache where possible
+    double secondsPerFile = 0; // open, read or write and close of a small file
+    uint64_t bytes = 0;        // moved by the probe
+    uint64_t files = 0;
+};
+
+struct PreflightReport {
+    MigrationPlan plan;
+    uint64_t files = 0;       // whole data folder
+    uint64_t directories = 0;
+    uint64_t bytes = 0;
+    std::vector<PreflightFolder> folders; // largest first
+
+    uint64_t filesToMove = 0;    // what the copy writes: everything, the bulk tier, or nothing for a rename
+    uint64_t bytesToMove = 0;
+    uint64_t bytesResumed = 0;   // at the destination already according to its journal, not in bytesToMove
+    uint64_t filesArchived = 0;  // of those to move, packed into the cold archive
+    uint64_t bytesArchived = 0;
+    uint64_t requiredBytes = 0;  // space the destination needs: allocated size of the files plus headroom
+    uint64_t availableBytes = 0; // free for this user at the destination
+    bool enoughSpace = true;
+    bool writable = true;        // a probe file could be created next to the destination
+
+    VolumeProbe source;      // read
+    VolumeProbe destination; // write
+    unsigned streams = 1;    // files the copy will move at once
+    double estimatedSeconds = 0; // 0 for a rename
+    double seconds = 0;          // the preflight itself
+
+    // Nothing found that stops the migration before it starts
+    bool Ok() const { return enoughSpace && writable; }
+};
+
+// Look at a migration before anything is closed or copied: scan the source in parallel
+// and total it per top-level folder, check the destination's free space and measure
+// both volumes while the scan runs (sampled source files are read, a probe file and a
+// few small ones are written and removed next to the destination), then estimate how
+// long the copy will take. Takes a few seconds whatever the size of the data: the scan
+// reads only directories and each probe is capped by probeBytes and probeTime.
+// Throws fs::filesystem_error when the source cannot be scanned.
+PreflightReport RunPreflight(const PreflightOptions& options);
+
+// Short multi-line summary of a report for the window and text output, without a final newline
+std::string DescribePreflight(const PreflightReport& report);
+
+} // namespace zdm
+
+#endif // PREFLIGHT_H
@@ -0,0 +1,216 @@
+#include "ProcessControl.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <tlhelp32.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <poll.h>
+#include <string>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int RemainingMilliseconds(Clock::time_point deadline) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+    return static_cast<int>(std::max<long long>(remaining, 0));
+}
+
+} // namespace
+
+#ifdef _WIN32
+
+std::vector<ProcessId> FindProcesses(const PathString& name) {
+    std::vector<ProcessId> ids;
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        return ids;
+    }
+    PROCESSENTRY32W entry = {};
+    entry.dwSize = sizeof(entry);
+    DWORD self = GetCurrentProcessId();
+    for (BOOL more = Process32FirstW(snapshot, &entry); more; more = Process32NextW(snapshot, &entry)) {
+        if (entry.th32ProcessID != self && _wcsicmp(entry.szExeFile, name.c_str()) == 0) {
+            ids.push_back(entry.th32ProcessID);
+        }
+    }
+    CloseHandle(snapshot);
+    return ids;
+}
+
+TerminateResult TerminateProcesses(const std::vector<ProcessId>& ids, std::chrono::milliseconds timeout) {
+    TerminateResult result;
+    result.found = ids.size();
+    Clock::time_point deadline = Clock::now() + timeout;
+
+    // Every process is told to end before the first wait, they shut down in parallel
+    std::vector<HANDLE> processes;
+    for (ProcessId id : ids) {
+        HANDLE process = OpenProcess(PROCESS_TERMINATE | SYNCHRONIZE, FALSE, id);
+        if (!process) {
+            // Exited since it was found, or not ours to end (access denied)
+            if (GetLastError() == ERROR_INVALID_PARAMETER) {
+                result.exited++;
+            }
+            continue;
+        }
+        TerminateProcess(process, 1);
+        processes.push_back(process);
+    }
+    for (HANDLE process : processes) {
+        if (WaitForSingleObject(process, static_cast<DWORD>(RemainingMilliseconds(deadline))) == WAIT_OBJECT_0) {
+            result.exited++;
+        }
+        CloseHandle(process);
+    }
+    return result;
+}
+
+#else
+
+namespace {
+
+// A zombie has exited, it only waits for its parent to collect the status
+bool ProcessGone(ProcessId id) {
+    std::ifstream stat("/proc/" + std::to_string(id) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) {
+        return true;
+    }
+    size_t end = line.rfind(')');
+    return end == std::string::npos || end + 2 >= line.size() || line[end + 2] == 'Z' || line[end + 2] == 'X';
+}
+
+int OpenPidfd(ProcessId id) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, static_cast<pid_t>(id), 0));
+#else
+    (void)id;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+bool SignalPidfd(int pidfd, int signal) {
+#ifdef SYS_pidfd_send_signal
+    return syscall(SYS_pidfd_send_signal, pidfd, signal, nullptr, 0) == 0;
+#else
+    (void)pidfd;
+    (void)signal;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+} // namespace
+
+std::vector<ProcessId> FindProcesses(const PathString& name) {
+    // TASK_COMM_LEN is 16 with the terminator
+    const size_t kCommLength = 15;
+    PathString wanted = name.substr(0, kCommLength);
+
+    std::vector<ProcessId> ids;
+    DIR* proc = opendir("/proc");
+    if (!proc) {
+        return ids;
+    }
+    ProcessId self = static_cast<ProcessId>(getpid());
+    while (dirent* entry = readdir(proc)) {
+        char* end = nullptr;
+        unsigned long id = std::strtoul(entry->d_name, &end, 10);
+        if (*end != '\0' || id == 0 || id == self) {
+            continue;
+        }
+        std::ifstream comm(std::string("/proc/") + entry->d_name + "/comm");
+        std::string command;
+        if (std::getline(comm, command) && command == wanted) {
+            ids.push_back(static_cast<ProcessId>(id));
+        }
+    }
+    closedir(proc);
+    return ids;
+}
+
+TerminateResult TerminateProcesses(const std::vector<ProcessId>& ids, std::chrono::milliseconds timeout) {
+    TerminateResult result;
+    result.found = ids.size();
+    Clock::time_point deadline = Clock::now() + timeout;
+
+    // A pidfd pins the process: the signal cannot reach a new process that reused the id,
+    // and it turns readable when the process exits. Kernels before 5.3 fall back to kill().
+    std::vector<pollfd> pidfds;
+    std::vector<ProcessId> polled;
+    for (ProcessId id : ids) {
+        int pidfd = OpenPidfd(id);
+        if (pidfd >= 0) {
+            if (SignalPidfd(pidfd, SIGKILL) || errno != ESRCH) {
+                pidfds.push_back({ pidfd, POLLIN, 0 });
+                continue;
+            }
+            close(pidfd);
+            result.exited++;
+        } else if (errno == ESRCH) {
+            result.exited++;
+        } else if (kill(static_cast<pid_t>(id), SIGKILL) == 0 || errno != ESRCH) {
+            polled.push_back(id);
+        } else {
+            result.exited++;
+        }
+    }
+
+    while (!pidfds.empty()) {
+        int ready = poll(pidfds.data(), pidfds.size(), RemainingMilliseconds(deadline));
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            break;
+        }
+        for (auto it = pidfds.begin(); it != pidfds.end();) {
+            if (it->revents) {
+                close(it->fd);
+                result.exited++;
+                it = pidfds.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (const pollfd& pidfd : pidfds) {
+        close(pidfd.fd);
+    }
+
+    // Without pidfds there is nothing to wait on, look again every few milliseconds
+    const std::chrono::milliseconds kPollInterval(10);
+    size_t signaled = polled.size();
+    for (;;) {
+        polled.erase(std::remove_if(polled.begin(), polled.end(), ProcessGone), polled.end());
+        if (polled.empty() || Clock::now() >= deadline) {
+            break;
+        }
+        std::this_thread::sleep_for(kPollInterval);
+    }
+    result.exited += signaled - polled.size();
+    return result;
+}
+
+#endif
+
+TerminateResult TerminateProcesses(const PathString& name, std::chrono::milliseconds timeout) {
+    return TerminateProcesses(FindProcesses(name), timeout);
+}
+
+} // namespace zdm
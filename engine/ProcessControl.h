@@ -0,0 +1,36 @@
+#ifndef PROCESS_CONTROL_H
+#define PROCESS_CONTROL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Manifest.h"
+
+namespace zdm {
+
+using ProcessId = uint32_t;
+
+// Running processes named name, this process excluded. Windows: the executable file
+// name ("Zalo.exe"), compared without case. Linux: the command name, which the kernel
+// cuts to 15 characters, so only that much of name is compared.
+std::vector<ProcessId> FindProcesses(const PathString& name);
+
+struct TerminateResult {
+    size_t found = 0;  // processes asked to end
+    size_t exited = 0; // of those, gone when the call returned
+    bool Complete() const { return exited == found; }
+};
+
+// Force processes to end (TerminateProcess, SIGKILL) and wait on them until all have
+// exited or timeout runs out. The waits are on process handles (pidfds on Linux) so
+// they return the moment the last one is gone, and a reused id is never signaled.
+TerminateResult TerminateProcesses(const std::vector<ProcessId>& ids, std::chrono::milliseconds timeout);
+
+// Same for every process named name, see FindProcesses
+TerminateResult TerminateProcesses(const PathString& name, std::chrono::milliseconds timeout);
+
+} // namespace zdm
+
+#endif // PROCESS_CONTROL_H
@@ -0,0 +1,126 @@
+#include "Progress.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace zdm {
+
+void CopyProgress::AddPlanned(uint64_t files, uint64_t bytes) {
+    m_filesPlanned.fetch_add(files, std::memory_order_relaxed);
+    m_bytesPlanned.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void CopyProgress::AddSkipped(uint64_t files, uint64_t bytes) {
+    m_filesSkipped.fetch_add(files, std::memory_order_relaxed);
+    m_bytesSkipped.fetch_add(bytes, std::memory_order_relaxed);
+    m_filesDone.fetch_add(files, std::memory_order_relaxed);
+    m_bytesDone.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void CopyProgress::AddCopied(uint64_t bytes, PathView relativePath) {
+    m_filesDone.fetch_add(1, std::memory_order_relaxed);
+    m_bytesDone.fetch_add(bytes, std::memory_order_relaxed);
+
+    // Only one writer at a time, the others skip: the UI only needs a recent path
+    uint32_t sequence = m_pathSequence.load(std::memory_order_relaxed);
+    if ((sequence & 1) != 0 ||
+        !m_pathSequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t length = std::min(relativePath.size(), kPathCapacity);
+    for (size_t i = 0; i < length; i++) {
+        m_path[i].store(relativePath[i], std::memory_order_relaxed);
+    }
+    m_pathLength.store(static_cast<uint32_t>(length), std::memory_order_relaxed);
+
+    m_pathSequence.store(sequence + 2, std::memory_order_release);
+}
+
+ProgressSnapshot CopyProgress::Snapshot() const {
+    ProgressSnapshot snapshot;
+
+    // A writer holds the slot for a few hundred stores at most, a couple of retries is plenty
+    PathChar path[kPathCapacity];
+    for (int attempt = 0; attempt < 8; attempt++) {
+        uint32_t before = m_pathSequence.load(std::memory_order_acquire);
+        if ((before & 1) != 0) {
+            continue;
+        }
+        size_t length = std::min<size_t>(m_pathLength.load(std::memory_order_relaxed), kPathCapacity);
+        for (size_t i = 0; i < length; i++) {
+            path[i] = m_path[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_pathSequence.load(std::memory_order_relaxed) == before) {
+            snapshot.currentPath.assign(path, length);
+            break;
+        }
+    }
+
+    snapshot.filesPlanned = m_filesPlanned.load(std::memory_order_relaxed);
+    snapshot.bytesPlanned = m_bytesPlanned.load(std::memory_order_relaxed);
+    snapshot.filesSkipped = m_filesSkipped.load(std::memory_order_relaxed);
+    snapshot.bytesSkipped = m_bytesSkipped.load(std::memory_order_relaxed);
+    snapshot.filesDone = m_filesDone.load(std::memory_order_relaxed);
+    snapshot.bytesDone = m_bytesDone.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void CopyProgress::Reset() {
+    m_filesPlanned = 0;
+    m_bytesPlanned = 0;
+    m_filesDone = 0;
+    m_bytesDone = 0;
+    m_filesSkipped = 0;
+    m_bytesSkipped = 0;
+    m_pathLength = 0;
+}
+
+void ProgressRate::Update(const ProgressSnapshot& snapshot, double seconds) {
+    // The counters are read one by one, clamp rather than trust done >= skipped
+    uint64_t bytes = snapshot.bytesDone > snapshot.bytesSkipped ? snapshot.bytesDone - snapshot.bytesSkipped : 0;
+    uint64_t files = snapshot.filesDone > snapshot.filesSkipped ? snapshot.filesDone - snapshot.filesSkipped : 0;
+    m_bytesRemaining = snapshot.bytesPlanned > snapshot.bytesDone ? snapshot.bytesPlanned - snapshot.bytesDone : 0;
+
+    if (!m_started) {
+        m_started = true;
+        m_lastSeconds = seconds;
+        m_lastBytes = bytes;
+        m_lastFiles = files;
+        return;
+    }
+
+    double elapsed = seconds - m_lastSeconds;
+    if (elapsed <= 0) {
+        return;
+    }
+
+    // Exponential average over roughly the last three seconds, smooth but still
+    // quick to follow a switch from small files to large ones
+    const double kTimeConstant = 3.0;
+    double weight = 1.0 - std::exp(-elapsed / kTimeConstant);
+    double bytesRate = bytes > m_lastBytes ? (bytes - m_lastBytes) / elapsed : 0.0;
+    double filesRate = files > m_lastFiles ? (files - m_lastFiles) / elapsed : 0.0;
+    if (m_bytesPerSecond == 0 && m_filesPerSecond == 0) {
+        m_bytesPerSecond = bytesRate;
+        m_filesPerSecond = filesRate;
+    } else {
+        m_bytesPerSecond += weight * (bytesRate - m_bytesPerSecond);
+        m_filesPerSecond += weight * (filesRate - m_filesPerSecond);
+    }
+
+    m_lastSeconds = seconds;
+    m_lastBytes = bytes;
+    m_lastFiles = files;
+}
+
+double ProgressRate::EtaSeconds() const {
+    if (m_bytesPerSecond < 1.0) {
+        return -1.0;
+    }
+    return m_bytesRemaining / m_bytesPerSecond;
+}
+
+} // namespace zdm
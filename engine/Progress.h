@@ -0,0 +1,90 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "Manifest.h"
+
+namespace zdm {
+
+// Copy progress as seen by one Snapshot call
+struct ProgressSnapshot {
+    uint64_t filesPlanned = 0;
+    uint64_t bytesPlanned = 0;
+    uint64_t filesDone = 0;    // includes files skipped through the journal
+    uint64_t bytesDone = 0;
+    uint64_t filesSkipped = 0;
+    uint64_t bytesSkipped = 0;
+    PathString currentPath;    // last published file, empty if none was readable
+};
+
+// Lock-free progress channel between copy workers and a UI.
+// Workers bump counters and publish the file they just finished, the UI samples
+// the whole state on its own timer. Neither side ever waits for the other:
+// a worker that finds the path slot busy simply skips publishing its path.
+class CopyProgress {
+public:
+    CopyProgress() = default;
+    CopyProgress(const CopyProgress&) = delete;
+    CopyProgress& operator=(const CopyProgress&) = delete;
+
+    // Add work about to be copied. Called once per copy pass.
+    void AddPlanned(uint64_t files, uint64_t bytes);
+
+    // Count files that an earlier run already finished
+    void AddSkipped(uint64_t files, uint64_t bytes);
+
+    // Count one finished file and publish its path
+    void AddCopied(uint64_t bytes, PathView relativePath);
+
+    // Consistent read of the counters and the current path, from any thread
+    ProgressSnapshot Snapshot() const;
+
+    // Clear everything, only while no copy is using this object
+    void Reset();
+
+private:
+    static constexpr size_t kPathCapacity = 260;
+
+    std::atomic<uint64_t> m_filesPlanned{0};
+    std::atomic<uint64_t> m_bytesPlanned{0};
+    std::atomic<uint64_t> m_filesDone{0};
+    std::atomic<uint64_t> m_bytesDone{0};
+    std::atomic<uint64_t> m_filesSkipped{0};
+    std::atomic<uint64_t> m_bytesSkipped{0};
+
+    // Seqlock around the path: odd while a worker is writing it.
+    // Kept on its own cache line, away from the counters every worker bumps.
+    alignas(64) std::atomic<uint32_t> m_pathSequence{0};
+    std::atomic<uint32_t> m_pathLength{0};
+    std::atomic<PathChar> m_path[kPathCapacity];
+};
+
+// Smoothed throughput and time left, fed with successive snapshots by a single
+// (UI) thread. Files skipped through the journal do not count as throughput.
+class ProgressRate {
+public:
+    // seconds is any monotonic clock reading
+    void Update(const ProgressSnapshot& snapshot, double seconds);
+
+    double BytesPerSecond() const { return m_bytesPerSecond; }
+    double FilesPerSecond() const { return m_filesPerSecond; }
+    uint64_t BytesRemaining() const { return m_bytesRemaining; }
+
+    // Estimated seconds left, negative until there is a rate to go by
+    double EtaSeconds() const;
+
+private:
+    bool m_started = false;
+    double m_lastSeconds = 0;
+    uint64_t m_lastBytes = 0;
+    uint64_t m_lastFiles = 0;
+    double m_bytesPerSecond = 0;
+    double m_filesPerSecond = 0;
+    uint64_t m_bytesRemaining = 0;
+};
+
+} // namespace zdm
+
+#endif // PROGRESS_H
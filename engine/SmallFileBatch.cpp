@@ -0,0 +1,532 @@
+#include "SmallFileBatch.h"
+#include "Checksum.h"
+
+#include <algorithm>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zdm {
+
+namespace {
+
+// One read buffer per worker thread, grown on demand and never freed mid-run
+std::vector<char>& ThreadBuffer(uint64_t size) {
+    thread_local std::vector<char> buffer;
+    size_t wanted = static_cast<size_t>(size) + 1;
+    if (buffer.size() < wanted) {
+        buffer.resize(wanted < 64 * 1024 ? 64 * 1024 : wanted);
+    }
+    return buffer;
+}
+
+fs::filesystem_error BatchError(const fs::path& source, const fs::path& destination, int error) {
+#ifdef _WIN32
+    std::error_code ec(error, std::system_category());
+#else
+    std::error_code ec(error, std::generic_category());
+#endif
+    return fs::filesystem_error("cannot copy file", source, destination, ec);
+}
+
+[[noreturn]] void ThrowBatchError(const fs::path& source, const fs::path& destination, int error) {
+    throw BatchError(source, destination, error);
+}
+
+} // namespace
+
+// One file of CopyAsync: read whole into the buffer, then written whole
+struct DirectoryBatchCopier::AsyncSlot {
+    size_t position = 0;
+    IoHandle in;
+    IoHandle out;
+    uint64_t size = 0; // as seen when the source was opened
+    uint64_t done = 0; // bytes read, then bytes written
+    bool writing = false;
+    uint32_t checksum = 0;
+    std::vector<char> buffer;
+#ifdef _WIN32
+    FILETIME creationTime;
+    FILETIME accessTime;
+    FILETIME writeTime;
+#else
+    struct timespec times[2];
+#endif
+};
+
+#ifdef _WIN32
+
+DirectoryBatchCopier::DirectoryBatchCopier(const fs::path& sourceDirectory, const fs::path& destinationDirectory)
+    : m_sourceDirectory(sourceDirectory),
+      m_destinationDirectory(destinationDirectory),
+      m_sourcePath(sourceDirectory.native()),
+      m_destinationPath(destinationDirectory.native()) {
+    m_sourcePath += L'\\';
+    m_destinationPath += L'\\';
+    m_sourcePrefix = m_sourcePath.size();
+    m_destinationPrefix = m_destinationPath.size();
+}
+
+DirectoryBatchCopier::~DirectoryBatchCopier() {
+}
+
+void DirectoryBatchCopier::Copy(PathView name, uint64_t size, uint32_t* checksum) {
+    if (checksum) {
+        *checksum = 0;
+    }
+
+    m_sourcePath.resize(m_sourcePrefix);
+    m_sourcePath.append(name.data(), name.size());
+    m_destinationPath.resize(m_destinationPrefix);
+    m_destinationPath.append(name.data(), name.size());
+
+    HANDLE in = CreateFileW(m_sourcePath.c_str(), GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (in == INVALID_HANDLE_VALUE) {
+        ThrowBatchError(m_sourcePath, m_destinationPath, static_cast<int>(GetLastError()));
+    }
+
+    std::vector<char>& buffer = ThreadBuffer(size);
+    BY_HANDLE_FILE_INFORMATION info = {};
+    GetFileInformationByHandle(in, &info);
+    DWORD attributes = info.dwFileAttributes &
+        (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED);
+
+    HANDLE out = CreateFileW(m_destinationPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                             attributes ? attributes : FILE_ATTRIBUTE_NORMAL, NULL);
+    if (out == INVALID_HANDLE_VALUE) {
+        DWORD error = GetLastError();
+        CloseHandle(in);
+        ThrowBatchError(m_sourcePath, m_destinationPath, static_cast<int>(error));
+    }
+
+    // Files can grow after the scan, keep reading until end of file
+    DWORD error = ERROR_SUCCESS;
+    for (;;) {
+        DWORD bytesRead = 0;
+        if (!ReadFile(in, buffer.data(), static_cast<DWORD>(buffer.size()), &bytesRead, NULL)) {
+            error = GetLastError();
+            break;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        if (checksum) {
+            *checksum = Crc32c(*checksum, buffer.data(), bytesRead);
+        }
+        DWORD bytesWritten = 0;
+        if (!WriteFile(out, buffer.data(), bytesRead, &bytesWritten, NULL) || bytesWritten != bytesRead) {
+            error = GetLastError();
+            break;
+        }
+    }
+
+    SetFileTime(out, &info.ftCreationTime, &info.ftLastAccessTime, &info.ftLastWriteTime);
+    CloseHandle(out);
+    CloseHandle(in);
+    if (error != ERROR_SUCCESS) {
+        ThrowBatchError(m_sourcePath, m_destinationPath, static_cast<int>(error));
+    }
+}
+
+uint32_t DirectoryBatchCopier::ChecksumDestination(PathView name) {
+    m_destinationPath.resize(m_destinationPrefix);
+    m_destinationPath.append(name.data(), name.size());
+
+    return Crc32cFile(m_destinationPath);
+}
+
+void DirectoryBatchCopier::OpenAsync(AsyncIo& io, PathView name, AsyncSlot& slot) {
+    m_sourcePath.resize(m_sourcePrefix);
+    m_sourcePath.append(name.data(), name.size());
+    m_destinationPath.resize(m_destinationPrefix);
+    m_destinationPath.append(name.data(), name.size());
+
+    slot.in = CreateFileW(m_sourcePath.c_str(), GENERIC_READ,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED, NULL);
+    if (slot.in == INVALID_HANDLE_VALUE) {
+        ThrowBatchError(m_sourcePath, m_destinationPath, static_cast<int>(GetLastError()));
+    }
+
+    BY_HANDLE_FILE_INFORMATION info = {};
+    GetFileInformationByHandle(slot.in, &info);
+    DWORD attributes = info.dwFileAttributes &
+        (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED);
+    slot.size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    slot.creationTime = info.ftCreationTime;
+    slot.accessTime = info.ftLastAccessTime;
+    slot.writeTime = info.ftLastWriteTime;
+
+    slot.out = CreateFileW(m_destinationPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                           (attributes ? attributes : FILE_ATTRIBUTE_NORMAL) | FILE_FLAG_OVERLAPPED, NULL);
+    if (slot.out == INVALID_HANDLE_VALUE) {
+        DWORD error = GetLastError();
+        CloseHandle(slot.in);
+        ThrowBatchError(m_sourcePath, m_destinationPath, static_cast<int>(error));
+    }
+
+    try {
+        io.Attach(slot.in);
+        io.Attach(slot.out);
+    } catch (const std::system_error& e) {
+        CloseAsync(slot);
+        ThrowBatchError(m_sourcePath, m_destinationPath, e.code().value());
+    }
+}
+
+void DirectoryBatchCopier::FinishAsync(AsyncSlot& slot, PathView) {
+    SetFileTime(slot.out, &slot.creationTime, &slot.accessTime, &slot.writeTime);
+    CloseAsync(slot);
+}
+
+void DirectoryBatchCopier::CloseAsync(AsyncSlot& slot) {
+    CloseHandle(slot.out);
+    CloseHandle(slot.in);
+}
+
+#else
+
+DirectoryBatchCopier::DirectoryBatchCopier(const fs::path& sourceDirectory, const fs::path& destinationDirectory)
+    : m_sourceDirectory(sourceDirectory),
+      m_destinationDirectory(destinationDirectory) {
+    m_sourceFd = open(sourceDirectory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_sourceFd < 0) {
+        ThrowBatchError(sourceDirectory, destinationDirectory, errno);
+    }
+    m_destinationFd = open(destinationDirectory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_destinationFd < 0) {
+        int error = errno;
+        close(m_sourceFd);
+        ThrowBatchError(sourceDirectory, destinationDirectory, error);
+    }
+}
+
+DirectoryBatchCopier::~DirectoryBatchCopier() {
+    close(m_destinationFd);
+    close(m_sourceFd);
+}
+
+void DirectoryBatchCopier::Copy(PathView name, uint64_t size, uint32_t* checksum) {
+    if (checksum) {
+        *checksum = 0;
+    }
+
+    m_name.assign(name.data(), name.size());
+
+    int in = openat(m_sourceFd, m_name.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (in < 0) {
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, errno);
+    }
+
+    struct stat sourceStat;
+    if (fstat(in, &sourceStat) != 0) {
+        int error = errno;
+        close(in);
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, error);
+    }
+
+    int out = openat(m_destinationFd, m_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     sourceStat.st_mode & 07777);
+    if (out < 0) {
+        int error = errno;
+        close(in);
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, error);
+    }
+
+    std::vector<char>& buffer = ThreadBuffer(size);
+    uint64_t copied = 0;
+    uint64_t expected = static_cast<uint64_t>(sourceStat.st_size);
+    int error = 0;
+
+    // Stop as soon as the size seen by fstat is reached, saving the read that returns 0
+    while (expected == 0 || copied < expected) {
+        ssize_t count = read(in, buffer.data(), buffer.size());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = errno;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        copied += static_cast<uint64_t>(count);
+        if (checksum) {
+            *checksum = Crc32c(*checksum, buffer.data(), static_cast<size_t>(count));
+        }
+        const char* data = buffer.data();
+        size_t remaining = static_cast<size_t>(count);
+        while (remaining > 0) {
+            ssize_t written = write(out, data, remaining);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error = errno;
+                break;
+            }
+            data += written;
+            remaining -= static_cast<size_t>(written);
+        }
+        if (error != 0) {
+            break;
+        }
+    }
+
+    if (error == 0) {
+        struct timespec times[2] = { sourceStat.st_atim, sourceStat.st_mtim };
+        futimens(out, times);
+    }
+    close(in);
+    if (close(out) != 0 && error == 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, error);
+    }
+}
+
+uint32_t DirectoryBatchCopier::ChecksumDestination(PathView name) {
+    m_name.assign(name.data(), name.size());
+
+    int fd = openat(m_destinationFd, m_name.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        ThrowBatchError(m_destinationDirectory / m_name, m_destinationDirectory / m_name, errno);
+    }
+
+    std::vector<char>& buffer = ThreadBuffer(0);
+    uint32_t crc = 0;
+    int error = 0;
+    for (;;) {
+        ssize_t count = read(fd, buffer.data(), buffer.size());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = errno;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+        crc = Crc32c(crc, buffer.data(), static_cast<size_t>(count));
+    }
+    close(fd);
+
+    if (error != 0) {
+        ThrowBatchError(m_destinationDirectory / m_name, m_destinationDirectory / m_name, error);
+    }
+    return crc;
+}
+
+void DirectoryBatchCopier::OpenAsync(AsyncIo& io, PathView name, AsyncSlot& slot) {
+    m_name.assign(name.data(), name.size());
+
+    slot.in = openat(m_sourceFd, m_name.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (slot.in < 0) {
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, errno);
+    }
+
+    struct stat sourceStat;
+    if (fstat(slot.in, &sourceStat) != 0) {
+        int error = errno;
+        close(slot.in);
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, error);
+    }
+    slot.size = static_cast<uint64_t>(sourceStat.st_size);
+    slot.times[0] = sourceStat.st_atim;
+    slot.times[1] = sourceStat.st_mtim;
+
+    slot.out = openat(m_destinationFd, m_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      sourceStat.st_mode & 07777);
+    if (slot.out < 0) {
+        int error = errno;
+        close(slot.in);
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, error);
+    }
+
+    try {
+        io.Attach(slot.in);
+        io.Attach(slot.out);
+    } catch (const std::system_error& e) {
+        CloseAsync(slot);
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, e.code().value());
+    }
+}
+
+void DirectoryBatchCopier::FinishAsync(AsyncSlot& slot, PathView name) {
+    futimens(slot.out, slot.times);
+    close(slot.in);
+    if (close(slot.out) != 0) {
+        m_name.assign(name.data(), name.size());
+        ThrowBatchError(m_sourceDirectory / m_name, m_destinationDirectory / m_name, errno);
+    }
+}
+
+void DirectoryBatchCopier::CloseAsync(AsyncSlot& slot) {
+    close(slot.out);
+    close(slot.in);
+}
+
+#endif
+
+void DirectoryBatchCopier::CopyAsync(AsyncIo& io, const std::vector<BatchFile>& files, bool checksum,
+                                     const std::function<bool()>& shouldStop, const BatchFileDone& onDone) {
+    // Slots and their buffers outlive the batch, the next batch on this thread reuses them
+    thread_local std::vector<AsyncSlot> slots;
+    thread_local std::vector<size_t> idle;
+    thread_local std::vector<IoCompletion> completions;
+    size_t depth = std::min<size_t>(io.QueueDepth(), files.size());
+    if (slots.size() < depth) {
+        slots.resize(depth);
+        completions.resize(depth);
+    }
+    idle.clear();
+    for (size_t i = depth; i > 0; i--) {
+        idle.push_back(i - 1);
+    }
+
+    // After a callback throws, files still in flight are closed without reporting
+    std::exception_ptr stopError;
+    auto report = [&](size_t position, std::exception_ptr error, uint32_t crc) {
+        if (stopError) {
+            return;
+        }
+        try {
+            onDone(position, error, crc);
+        } catch (...) {
+            stopError = std::current_exception();
+        }
+    };
+    auto fail = [&](size_t index, int error) {
+        AsyncSlot& slot = slots[index];
+        PathView name = files[slot.position].name;
+        CloseAsync(slot);
+        idle.push_back(index);
+        report(slot.position, std::make_exception_ptr(BatchError(m_sourceDirectory / fs::path(name),
+                                                                 m_destinationDirectory / fs::path(name), error)), 0);
+    };
+    auto finish = [&](size_t index) {
+        AsyncSlot& slot = slots[index];
+        idle.push_back(index);
+        try {
+            FinishAsync(slot, files[slot.position].name);
+        } catch (...) {
+            report(slot.position, std::current_exception(), 0);
+            return;
+        }
+        report(slot.position, nullptr, slot.checksum);
+    };
+    // The source has been read: checksum the data and write it out in one request
+    auto startWrite = [&](size_t index) {
+        AsyncSlot& slot = slots[index];
+        slot.checksum = checksum ? Crc32c(0, slot.buffer.data(), static_cast<size_t>(slot.size)) : 0;
+        slot.writing = true;
+        slot.done = 0;
+        if (slot.size == 0) {
+            finish(index);
+        } else {
+            io.Write(slot.out, slot.buffer.data(), static_cast<size_t>(slot.size), 0, index);
+        }
+    };
+
+    size_t next = 0;
+    bool stopping = false;
+    for (;;) {
+        while (!stopError && !stopping && next < files.size() && !idle.empty()) {
+            try {
+                stopping = shouldStop && shouldStop();
+            } catch (...) {
+                stopError = std::current_exception();
+            }
+            if (stopping || stopError) {
+                break;
+            }
+
+            size_t index = idle.back();
+            idle.pop_back();
+            AsyncSlot& slot = slots[index];
+            slot.position = next++;
+            try {
+                OpenAsync(io, files[slot.position].name, slot);
+            } catch (...) {
+                idle.push_back(index);
+                report(slot.position, std::current_exception(), 0);
+                continue;
+            }
+
+            slot.writing = false;
+            slot.done = 0;
+            if (slot.buffer.size() < slot.size) {
+                slot.buffer.resize(static_cast<size_t>(slot.size));
+            }
+            if (slot.size == 0) {
+                startWrite(index);
+            } else {
+                io.Read(slot.in, slot.buffer.data(), static_cast<size_t>(slot.size), 0, index);
+            }
+        }
+
+        if (io.InFlight() == 0) {
+            break;
+        }
+
+        size_t count = io.Wait(completions.data(), depth);
+        for (size_t i = 0; i < count; i++) {
+            size_t index = static_cast<size_t>(completions[i].tag);
+            int64_t result = completions[i].result;
+            AsyncSlot& slot = slots[index];
+
+            if (stopError) {
+                CloseAsync(slot);
+                idle.push_back(index);
+            } else if (result < 0) {
+                fail(index, static_cast<int>(-result));
+            } else if (!slot.writing) {
+                // A read returning 0 means the file shrank since it was opened, copy what is there
+                slot.done += static_cast<uint64_t>(result);
+                if (result == 0) {
+                    slot.size = slot.done;
+                }
+                if (slot.done < slot.size) {
+                    io.Read(slot.in, slot.buffer.data() + slot.done, static_cast<size_t>(slot.size - slot.done),
+                            slot.done, index);
+                } else {
+                    startWrite(index);
+                }
+            } else if (result == 0) {
+#ifdef _WIN32
+                fail(index, ERROR_WRITE_FAULT);
+#else
+                fail(index, EIO);
+#endif
+            } else {
+                slot.done += static_cast<uint64_t>(result);
+                if (slot.done < slot.size) {
+                    io.Write(slot.out, slot.buffer.data() + slot.done, static_cast<size_t>(slot.size - slot.done),
+                             slot.done, index);
+                } else {
+                    finish(index);
+                }
+            }
+        }
+    }
+
+    if (stopError) {
+        std::rethrow_exception(stopError);
+    }
+}
+
+} // namespace zdm
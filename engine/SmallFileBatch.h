@@ -0,0 +1,82 @@
+#ifndef SMALL_FILE_BATCH_H
+#define SMALL_FILE_BATCH_H
+
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+#include "AsyncIo.h"
+#include "Manifest.h"
+
+namespace zdm {
+
+namespace fs = std::filesystem;
+
+// One file of an asynchronous batch
+struct BatchFile {
+    PathView name;
+    uint64_t size;
+};
+
+// Outcome of one file of CopyAsync: its position in the batch, the failure (null on
+// success) and the CRC32C of its data when checksums were asked for
+using BatchFileDone = std::function<void(size_t position, std::exception_ptr error, uint32_t checksum)>;
+
+// Copies many small files from one source directory into one destination directory.
+// Both directories are opened once and files are opened relative to them, every
+// file is read and written in one go through a buffer reused by the calling thread.
+class DirectoryBatchCopier {
+public:
+    // Throws fs::filesystem_error if either directory cannot be opened
+    DirectoryBatchCopier(const fs::path& sourceDirectory, const fs::path& destinationDirectory);
+    ~DirectoryBatchCopier();
+
+    DirectoryBatchCopier(const DirectoryBatchCopier&) = delete;
+    DirectoryBatchCopier& operator=(const DirectoryBatchCopier&) = delete;
+
+    // Copy one file by name (no separators), size is a hint for the buffer.
+    // Overwrites the destination and keeps mode and mtime. When checksum is given it
+    // receives the CRC32C of the data read. Throws fs::filesystem_error.
+    void Copy(PathView name, uint64_t size, uint32_t* checksum = nullptr);
+
+    // Copy files with up to io.QueueDepth() of them in flight. Opening, metadata and
+    // closing stay synchronous, the data moves through io, so one thread keeps the
+    // device busy with many files at once. onDone runs on this thread as files finish,
+    // in completion order. No new file is started once shouldStop returns true.
+    // An exception from a callback stops the batch and is rethrown once the requests
+    // in flight have drained.
+    void CopyAsync(AsyncIo& io, const std::vector<BatchFile>& files, bool checksum,
+                   const std::function<bool()>& shouldStop, const BatchFileDone& onDone);
+
+    // CRC32C of a file in the destination directory, read back through the same
+    // directory handle. Throws fs::filesystem_error.
+    uint32_t ChecksumDestination(PathView name);
+
+private:
+    struct AsyncSlot;
+
+    // Platform parts of CopyAsync. OpenAsync opens both files and reads the source
+    // metadata, FinishAsync sets the times and closes, both throw fs::filesystem_error.
+    void OpenAsync(AsyncIo& io, PathView name, AsyncSlot& slot);
+    void FinishAsync(AsyncSlot& slot, PathView name);
+    void CloseAsync(AsyncSlot& slot);
+
+    fs::path m_sourceDirectory;
+    fs::path m_destinationDirectory;
+#ifdef _WIN32
+    PathString m_sourcePath;      // reused "<dir>\<name>" buffers
+    PathString m_destinationPath;
+    size_t m_sourcePrefix = 0;
+    size_t m_destinationPrefix = 0;
+#else
+    int m_sourceFd = -1;
+    int m_destinationFd = -1;
+    PathString m_name;            // reused NUL-terminated name buffer
+#endif
+};
+
+} // namespace zdm
+
+#endif // SMALL_FILE_BATCH_H
@@ -0,0 +1,156 @@
+#include "WorkStealingPool.h"
+
+namespace zdm {
+
+namespace {
+    // Identifies the pool and slot of the current worker thread
+    thread_local const WorkStealingPool* t_pool = nullptr;
+    thread_local int t_workerIndex = -1;
+}
+
+unsigned WorkStealingPool::DefaultThreadCount() {
+    unsigned count = std::thread::hardware_concurrency();
+    if (count == 0) {
+        count = 4;
+    }
+    // Copying is I/O bound, a few extra threads keep the device queue full
+    return count < 4 ? 4 : count;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned threadCount, Task onWorkerStart)
+    : m_onWorkerStart(std::move(onWorkerStart)) {
+    if (threadCount == 0) {
+        threadCount = DefaultThreadCount();
+    }
+
+    m_queues.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; i++) {
+        m_queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    m_threads.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; i++) {
+        m_threads.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+int WorkStealingPool::CurrentWorkerIndex() const {
+    return t_pool == this ? t_workerIndex : -1;
+}
+
+void WorkStealingPool::Submit(Task task) {
+    int self = CurrentWorkerIndex();
+    unsigned target = self >= 0
+        ? static_cast<unsigned>(self)
+        : m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(m_queues[target]->mutex);
+        m_queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_queued++;
+    }
+    m_workAvailable.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+    {
+        std::unique_lock<std::mutex> lock(m_stateMutex);
+        m_allDone.wait(lock, [this] { return m_pending.load() == 0; });
+    }
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        error = m_firstError;
+        m_firstError = nullptr;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+bool WorkStealingPool::TryPop(unsigned index, Task& task) {
+    WorkQueue& queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::TrySteal(unsigned index, Task& task) {
+    size_t count = m_queues.size();
+    for (size_t offset = 1; offset < count; offset++) {
+        WorkQueue& victim = *m_queues[(index + offset) % count];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || victim.tasks.empty()) {
+            continue;
+        }
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::WorkerLoop(unsigned index) {
+    t_pool = this;
+    t_workerIndex = static_cast<int>(index);
+    if (m_onWorkerStart) {
+        m_onWorkerStart();
+    }
+
+    for (;;) {
+        Task task;
+        if (!TryPop(index, task) && !TrySteal(index, task)) {
+            std::unique_lock<std::mutex> lock(m_stateMutex);
+            if (m_stopping) {
+                return;
+            }
+            // Tasks may be queued behind a contended try_lock, check the count before sleeping
+            if (m_queued == 0) {
+                m_workAvailable.wait(lock, [this] { return m_queued > 0 || m_stopping; });
+            }
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_stateMutex);
+            m_queued--;
+        }
+
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_errorMutex);
+            if (!m_firstError) {
+                m_firstError = std::current_exception();
+            }
+        }
+
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(m_stateMutex);
+            m_allDone.notify_all();
+        }
+    }
+}
+
+} // namespace zdm
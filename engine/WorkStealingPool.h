@@ -0,0 +1,74 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zdm {
+
+// Fixed-size thread pool where every worker owns a task deque.
+// Workers pop their own tasks LIFO (depth-first, cache friendly) and steal
+// from the front of other workers' deques when they run dry, so a single
+// huge directory spreads across all threads.
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    // threadCount == 0 selects DefaultThreadCount(). onWorkerStart runs once on every
+    // worker thread before its first task, e.g. to lower the thread's priority.
+    explicit WorkStealingPool(unsigned threadCount = 0, Task onWorkerStart = nullptr);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Queue a task. Called from a worker, the task goes to that worker's own deque.
+    void Submit(Task task);
+
+    // Block until every submitted task (including tasks spawned by tasks) has run.
+    // Rethrows the first exception thrown by a task, if any.
+    void Wait();
+
+    // Index of the calling worker thread in this pool, or -1 for outside threads
+    int CurrentWorkerIndex() const;
+
+    unsigned ThreadCount() const { return static_cast<unsigned>(m_threads.size()); }
+
+    static unsigned DefaultThreadCount();
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void WorkerLoop(unsigned index);
+    bool TryPop(unsigned index, Task& task);
+    bool TrySteal(unsigned index, Task& task);
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    Task m_onWorkerStart;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_stateMutex;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_allDone;
+    size_t m_queued = 0;          // tasks sitting in a deque, guarded by m_stateMutex
+    std::atomic<size_t> m_pending{0}; // queued + running
+    std::atomic<unsigned> m_nextQueue{0};
+    bool m_stopping = false;
+
+    std::mutex m_errorMutex;
+    std::exception_ptr m_firstError;
+};
+
+} // namespace zdm
+
+#endif // WORK_STEALING_POOL_H
@@ -11,6 +11,15 @@
 #define IDC_STATUS_TEXT                 204
 #define IDC_TARGET_PATH                 205
 #define IDC_CHECKBOX_START_ZALO         206
+#define IDC_CHECKBOX_LIVE_COPY          207
+#define IDC_CHECKBOX_VERIFY             208
+#define IDC_CHECKBOX_PLACEMENT          209
+#define IDC_CHECKBOX_DEDUP              210
+#define IDC_CHECKBOX_LOW_PRIORITY       211
+#define IDC_CHECKBOX_ARCHIVE            212
+
+// Timer IDs
+#define IDT_COPY_PROGRESS               301
 
 // Custom messages
 #define WM_UPDATE_PROGRESS              (WM_USER + 1)